@@ -0,0 +1,86 @@
+#!/bin/bash
+#
+# Runs the bridged path of the tag service inside this host: two network namespaces joined by a veth pair stand
+# for two hosts, a tag_bridge in the first one forwards the level 0 of the source key to a tag_bridge in the second
+# one, which republishes it on the destination key. The tags are shared by the whole host, so tag_bridge_bench
+# sends on the source key and receives on the destination key from the root namespace with the same clock, and
+# measures the latency of the full path: tag_send -> bridge -> veth -> bridge -> tag_send -> tag_receive.
+# The tag_service module must be loaded (install.sh); run as root.
+#
+# usage: ./bridge_netns.sh [-t] [-b batch] [-w flush_us] [-- tag_bridge_bench options]
+#   -t           bridges over TCP instead of UDP
+#   -b batch     frame size limit of the bridges
+#   -w flush_us  flush interval of the bridges
+#
+# Example: ./bridge_netns.sh -w 100 -- -m 64,1024 -r 10000,50000 -d 10
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+PARAMS=/sys/module/tag_service/parameters
+SRC_KEY=100
+DST_KEY=200
+PORT=7411
+BRIDGE_OPTS=""
+
+while getopts "tb:w:h" opt; do
+    case $opt in
+        t) BRIDGE_OPTS="$BRIDGE_OPTS -t" ;;
+        b) BRIDGE_OPTS="$BRIDGE_OPTS -b $OPTARG" ;;
+        w) BRIDGE_OPTS="$BRIDGE_OPTS -w $OPTARG" ;;
+        *) sed -n '2,15p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ "$1" = "--" ] && shift
+
+if [ ! -d $PARAMS ]; then
+    echo "tag_service module not loaded"
+    exit 1
+fi
+
+nr_flags="-DGET_NR=$(cat $PARAMS/tag_get_nr) -DSND_NR=$(cat $PARAMS/tag_send_nr) -DRCV_NR=$(cat $PARAMS/tag_receive_nr)"
+nr_flags="$nr_flags -DCTL_NR=$(cat $PARAMS/tag_ctl_nr) -DINFO_NR=$(cat $PARAMS/tag_receive_info_nr)"
+# shellcheck disable=SC2086
+gcc -O2 -pthread $nr_flags "$ROOT/user/tag_bridge.c" -o /tmp/tag_bridge || exit 1
+# shellcheck disable=SC2086
+gcc -O2 -pthread $nr_flags "$ROOT/user/tag_bridge_bench.c" -o /tmp/tag_bridge_bench || exit 1
+
+cleanup() {
+    [ -n "$PID_A" ] && kill -INT "$PID_A" 2> /dev/null
+    [ -n "$PID_B" ] && kill -INT "$PID_B" 2> /dev/null
+    wait 2> /dev/null
+    ip netns del tag_bridge_a 2> /dev/null
+    ip netns del tag_bridge_b 2> /dev/null
+}
+trap cleanup EXIT
+
+ip netns add tag_bridge_a || exit 1
+ip netns add tag_bridge_b || exit 1
+ip link add veth_tag_a netns tag_bridge_a type veth peer name veth_tag_b netns tag_bridge_b || exit 1
+ip -n tag_bridge_a addr add 10.211.0.1/24 dev veth_tag_a
+ip -n tag_bridge_b addr add 10.211.0.2/24 dev veth_tag_b
+ip -n tag_bridge_a link set lo up
+ip -n tag_bridge_b link set lo up
+ip -n tag_bridge_a link set veth_tag_a up
+ip -n tag_bridge_b link set veth_tag_b up
+
+# shellcheck disable=SC2086
+ip netns exec tag_bridge_b /tmp/tag_bridge $BRIDGE_OPTS -l 10.211.0.2:$PORT -p 10.211.0.1:$PORT -a $DST_KEY:0x1 \
+    > /tmp/tag_bridge_b.log &
+PID_B=$!
+sleep 0.5
+# shellcheck disable=SC2086
+ip netns exec tag_bridge_a /tmp/tag_bridge $BRIDGE_OPTS -p 10.211.0.2:$PORT -f $SRC_KEY:0x1@$DST_KEY \
+    > /tmp/tag_bridge_a.log &
+PID_A=$!
+sleep 0.5
+
+/tmp/tag_bridge_bench -k $SRC_KEY -K $DST_KEY "$@"
+status=$?
+
+kill -INT "$PID_A" "$PID_B"
+wait "$PID_A" "$PID_B"
+PID_A=""
+PID_B=""
+echo "bridge A: $(cat /tmp/tag_bridge_a.log)"
+echo "bridge B: $(cat /tmp/tag_bridge_b.log)"
+exit $status
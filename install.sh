@@ -1,11 +1,35 @@
 #!/bin/bash
 
+# reuse the syscall table address cached by uninstall.sh during this boot, the module validates it anyway
+CACHE=/var/tmp/systbl_hack.cache
+PARAMS=""
+if [ -f $CACHE ] && [ "$(cut -d' ' -f1 $CACHE)" = "$(cat /proc/sys/kernel/random/boot_id)" ]; then
+  PARAMS="sys_call_table=$(cut -d' ' -f2 $CACHE)"
+fi
+
 cd ./tag_service/systbl_hack && make
-make load
+make load PARAMS="$PARAMS"
 cd ../ && make
 make load
 dmesg | grep 'SYSCALL TABLE HACKING SYSTEM\|TAG-SERVICE\|tag-device-driver'
-# shellcheck disable=SC2046
-mknod /dev/mydev c $(cat /sys/module/tag_service/parameters/major_number) 0
+# the major number changes at every load
+MAJOR=$(cat /sys/module/tag_service/parameters/major_number)
+rm -f /dev/mydev /dev/mydev_ns
+mknod /dev/mydev c "$MAJOR" 0
+mknod /dev/mydev_ns c "$MAJOR" 1
+# restore the tag namespace saved by uninstall.sh before the clients reconnect
+NS=/var/tmp/tag_service.ns
+STATUS=0
+if [ -s $NS ]; then
+  # the write fails with EEXIST if some tags could not be restored, the snapshot is kept for inspection
+  if cat $NS > /dev/mydev_ns; then
+    rm -f $NS
+  else
+    echo "tag namespace partially restored, snapshot kept in $NS" >&2
+    STATUS=1
+  fi
+  dmesg | grep 'namespace import' | tail -1
+fi
 # shellcheck disable=SC2028
-echo "setup done succesfully\n"
\ No newline at end of file
+echo "setup done succesfully\n"
+exit $STATUS
\ No newline at end of file
@@ -8,21 +8,47 @@
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
+#include "tag_service/tag.h"
 #define SOA_PROJECT_TM_TAG_LIB_H
 
-#endif //SOA_PROJECT_TM_TAG_LIB_H
-
-/*change those values by check dmsg after module insert */
+/*change those values by check dmsg after module insert (or pass them with -DGET_NR=... at compile time, they are
+ * published in /sys/module/tag_service/parameters/tag_*_nr) */
+#ifndef GET_NR
 #define GET_NR 134
+#endif
+#ifndef SND_NR
 #define SND_NR 156
+#endif
+#ifndef RCV_NR
 #define RCV_NR 174
+#endif
+#ifndef CTL_NR
 #define CTL_NR 177
+#endif
+#ifndef BLK_NR
+#define BLK_NR 183
+#endif
+#ifndef SET_NR
+#define SET_NR 184
+#endif
+#ifndef INFO_NR
+#define INFO_NR 185
+#endif
+#ifndef BATCH_NR
+#define BATCH_NR 214
+#endif
 
 static inline int tag_get(int key, int command, int permission) {
     errno  = 0;
     return syscall(GET_NR, key, command, permission);
 }
 
+/* opens or creates nr tags at once, see struct tag_get_req */
+static inline int tag_get_bulk(struct tag_get_req *reqs, unsigned int nr) {
+    errno  = 0;
+    return syscall(BLK_NR, reqs, nr);
+}
+
 static inline int tag_send(int tag, int level, char *buffer, size_t size) {
     errno  = 0;
     return syscall(SND_NR, tag, level, buffer, size);
@@ -33,7 +59,35 @@ static inline int tag_receive(int tag, int level, char *buffer, size_t size) {
     return syscall(RCV_NR, tag, level, buffer, size);
 }
 
+/* receives the first message of the subscriptions subs, see struct tag_sub and struct tag_origin */
+static inline int tag_receive_set(struct tag_sub *subs, unsigned int nr, char *buffer, size_t size,
+                                  struct tag_origin *origin) {
+    errno  = 0;
+    return syscall(SET_NR, subs, nr, buffer, size, origin);
+}
+
+/* tag_receive that also returns the sequence number, sender and send time of the message, see struct tag_msg_info */
+static inline int tag_receive_info(int tag, int level, char *buffer, size_t size, struct tag_msg_info *info) {
+    errno  = 0;
+    return syscall(INFO_NR, tag, level, buffer, size, info);
+}
+
+/* receives up to nr messages of the levels of the bit mask at once, see struct tag_mmsg; returns how many */
+static inline int tag_receive_batch(int tag, unsigned int levels, struct tag_mmsg *msgs, unsigned int nr,
+                                    unsigned int window_us, unsigned int window_msgs) {
+    errno  = 0;
+    return syscall(BATCH_NR, tag, levels, msgs, nr, window_us, window_msgs);
+}
+
 static inline int tag_ctl(int tag, int command) {
     errno  = 0;
-    return syscall(CTL_NR, tag, command);
+    return syscall(CTL_NR, tag, command, 0UL);
 }
+
+/* tag_ctl for the commands with an argument (TAG_BUSY_POLL, TAG_POLL_STATS) */
+static inline int tag_ctl_arg(int tag, int command, unsigned long arg) {
+    errno  = 0;
+    return syscall(CTL_NR, tag, command, arg);
+}
+
+#endif //SOA_PROJECT_TM_TAG_LIB_H
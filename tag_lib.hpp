@@ -0,0 +1,467 @@
+/*
+ * Header-only C++20 client of the tag service.
+ *
+ * The syscall numbers are discovered once from the read-only parameters of the module
+ * (/sys/module/tag_service/parameters/tag_*_nr), no rebuild is needed after a reload. A tag::handle owns a tag
+ * descriptor and closes it; send and receive work on std::span views of caller buffers, so the hot path makes no
+ * allocation. Every operation has a throwing form (typed tag::error subclasses) and a noexcept form that reports the
+ * failure in a std::error_code, meant for loops where ECANCELED or ETIMEDOUT are expected.
+ *
+ * Build with -std=c++20, see user/tag_lib_bench.cpp.
+ */
+
+#ifndef SOA_PROJECT_TM_TAG_LIB_HPP
+#define SOA_PROJECT_TM_TAG_LIB_HPP
+
+#include <sys/ipc.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <span>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tag_service/tag.h"
+
+/* hooks to run the library on another transport, e.g. the user space build of the tag core */
+#ifndef TAG_LIB_SYSCALL
+#define TAG_LIB_SYSCALL(...) ::syscall(__VA_ARGS__)
+#endif
+#ifndef TAG_LIB_CLOSE
+#define TAG_LIB_CLOSE(fd) ::close(fd)
+#endif
+#ifndef TAG_LIB_PARAMETERS
+#define TAG_LIB_PARAMETERS "/sys/module/tag_service/parameters/"
+#endif
+
+namespace tag {
+
+/* failure of an operation of the tag service, code() holds the errno */
+class error : public std::system_error {
+public:
+    error(int err, const char *what) : std::system_error(err, std::generic_category(), what) {}
+};
+
+/* AWAKE_ALL/AWAKE_LEVELS notification or mode change of the level (ECANCELED) */
+class canceled : public error {
+public:
+    using error::error;
+};
+
+/* the tag has been removed (ENOENT) or is being removed with TAG_DRAIN (EIDRM) */
+class removed : public error {
+public:
+    using error::error;
+};
+
+/* no message within the timeout (ETIMEDOUT) */
+class timed_out : public error {
+public:
+    using error::error;
+};
+
+/* receive buffer smaller than the message (ENOBUFS) */
+class no_buffer : public error {
+public:
+    using error::error;
+};
+
+/* the descriptor was opened by a user without access to the tag (EPERM) */
+class denied : public error {
+public:
+    using error::error;
+};
+
+[[noreturn]] inline void raise(int err, const char *what) {
+    switch (err) {
+        case ECANCELED:
+            throw canceled(err, what);
+        case ENOENT:
+        case EIDRM:
+            throw removed(err, what);
+        case ETIMEDOUT:
+            throw timed_out(err, what);
+        case ENOBUFS:
+            throw no_buffer(err, what);
+        case EPERM:
+            throw denied(err, what);
+        default:
+            throw error(err, what);
+    }
+}
+
+/* syscall numbers and limits published by the module */
+struct service {
+    long get_nr;
+    long send_nr;
+    long receive_nr;
+    long ctl_nr;
+    long get_bulk_nr;
+    long receive_set_nr;
+    long receive_info_nr;
+    long receive_batch_nr;
+    std::size_t msg_size;
+};
+
+namespace detail {
+
+inline long read_parameter(const char *name) {
+    char path[256];
+    long value = -1;
+    std::FILE *file;
+    std::snprintf(path, sizeof(path), "%s%s", TAG_LIB_PARAMETERS, name);
+    file = std::fopen(path, "r");
+    if (file == nullptr) return -1;
+    if (std::fscanf(file, "%ld", &value) != 1) value = -1;
+    std::fclose(file);
+    return value;
+}
+
+inline service read_service() {
+    service s{read_parameter("tag_get_nr"), read_parameter("tag_send_nr"), read_parameter("tag_receive_nr"),
+              read_parameter("tag_ctl_nr"), read_parameter("tag_get_bulk_nr"), read_parameter("tag_receive_set_nr"),
+              read_parameter("tag_receive_info_nr"), read_parameter("tag_receive_batch_nr"), 0};
+    long msg_size = read_parameter("msg_size");
+    if (s.get_nr < 0 || s.send_nr < 0 || s.receive_nr < 0 || s.ctl_nr < 0 || s.get_bulk_nr < 0 ||
+        s.receive_set_nr < 0 || s.receive_info_nr < 0 || s.receive_batch_nr < 0 || msg_size <= 0) {
+        throw error(ENOSYS, "tag_service module not loaded");
+    }
+    s.msg_size = static_cast<std::size_t>(msg_size);
+    return s;
+}
+
+inline bool fail(std::error_code &ec) noexcept {
+    ec.assign(errno, std::generic_category());
+    return false;
+}
+
+} // namespace detail
+
+/* the parameters of the module, read on first use: call it at startup to fail early if the module is not loaded */
+inline const service &discover() {
+    static const service s = detail::read_service();
+    return s;
+}
+
+/* a message of a batch */
+struct message {
+    int level;
+    std::span<const std::byte> data;
+};
+
+/* owner of a tag descriptor */
+class handle {
+public:
+    handle() noexcept = default;
+
+    /* takes the ownership of a descriptor returned by tag_get */
+    explicit handle(int td) noexcept : td_(td) {}
+
+    handle(const handle &) = delete;
+    handle &operator=(const handle &) = delete;
+
+    handle(handle &&other) noexcept : td_(std::exchange(other.td_, -1)), timeout_(other.timeout_) {}
+
+    handle &operator=(handle &&other) noexcept {
+        if (this != &other) {
+            reset();
+            td_ = std::exchange(other.td_, -1);
+            timeout_ = other.timeout_;
+        }
+        return *this;
+    }
+
+    ~handle() { reset(); }
+
+    /* tag_get: opens the tag of key (IPC_CREAT creates it, TAG_OPEN never does, IPC_PRIVATE creates a private one) */
+    static handle open(int key, int command = IPC_CREAT, int permissions = 0) {
+        long td = TAG_LIB_SYSCALL(discover().get_nr, key, command, permissions);
+        if (td < 0) raise(errno, "tag_get");
+        return handle(static_cast<int>(td));
+    }
+
+    /*
+     * tag_get_bulk: opens or creates the tags of reqs with one system call. out[i] owns the descriptor of reqs[i]
+     * if reqs[i].ret is not negative. out must be at least as long as reqs.
+     * @return the number of descriptors opened
+     */
+    static std::size_t open_bulk(std::span<tag_get_req> reqs, std::span<handle> out) {
+        long opened;
+        std::size_t i;
+        if (out.size() < reqs.size()) throw error(EINVAL, "tag_get_bulk");
+        opened = TAG_LIB_SYSCALL(discover().get_bulk_nr, reqs.data(), static_cast<unsigned int>(reqs.size()));
+        if (opened < 0) raise(errno, "tag_get_bulk");
+        for (i = 0; i < reqs.size(); i++) {
+            if (reqs[i].ret >= 0) out[i] = handle(reqs[i].ret);
+        }
+        return static_cast<std::size_t>(opened);
+    }
+
+    [[nodiscard]] int fd() const noexcept { return td_; }
+
+    [[nodiscard]] bool valid() const noexcept { return td_ >= 0; }
+
+    /* gives up the ownership of the descriptor */
+    int release() noexcept { return std::exchange(td_, -1); }
+
+    void reset() noexcept {
+        if (td_ >= 0) TAG_LIB_CLOSE(td_);
+        td_ = -1;
+        timeout_ = 0;
+    }
+
+    bool send(int level, std::span<const std::byte> msg, std::error_code &ec) const noexcept {
+        if (TAG_LIB_SYSCALL(discover().send_nr, td_, level, msg.data(), msg.size()) < 0) return detail::fail(ec);
+        ec.clear();
+        return true;
+    }
+
+    void send(int level, std::span<const std::byte> msg) const {
+        std::error_code ec;
+        if (!send(level, msg, ec)) raise(ec.value(), "tag_send");
+    }
+
+    template<class T> requires std::is_trivially_copyable_v<T>
+    void send_value(int level, const T &value) const {
+        send(level, std::as_bytes(std::span<const T, 1>(&value, 1)));
+    }
+
+    /*
+     * Sends the messages in order, one tag_send each, and stops at the first failure.
+     * @return the number of messages sent
+     */
+    std::size_t send_batch(std::span<const message> msgs, std::error_code &ec) const noexcept {
+        std::size_t sent = 0;
+        for (const message &msg : msgs) {
+            if (!send(msg.level, msg.data, ec)) break;
+            sent++;
+        }
+        return sent;
+    }
+
+    std::size_t send_batch(std::span<const message> msgs) const {
+        std::error_code ec;
+        std::size_t sent = send_batch(msgs, ec);
+        if (ec) raise(ec.value(), "tag_send");
+        return sent;
+    }
+
+    /*
+     * tag_receive in buffer, flags are the level flags TAG_POLL and TAG_LATEST.
+     * @return the size of the message, 0 and ec set on failure
+     */
+    std::size_t receive(int level, std::span<std::byte> buffer, std::error_code &ec, int flags = 0) noexcept {
+        if (timeout_ != 0 && !set_timeout(std::chrono::microseconds::zero(), ec)) return 0;
+        return receive_call(level, buffer, ec, flags);
+    }
+
+    std::size_t receive(int level, std::span<std::byte> buffer, int flags = 0) {
+        std::error_code ec;
+        std::size_t size = receive(level, buffer, ec, flags);
+        if (ec) raise(ec.value(), "tag_receive");
+        return size;
+    }
+
+    /*
+     * tag_receive_info in buffer: info gets the sequence number, sender and send time of the message.
+     * @return the size of the message, 0 and ec set on failure
+     */
+    std::size_t receive(int level, std::span<std::byte> buffer, tag_msg_info &info, std::error_code &ec,
+                        int flags = 0) noexcept {
+        if (timeout_ != 0 && !set_timeout(std::chrono::microseconds::zero(), ec)) return 0;
+        return receive_call(level, buffer, ec, flags, &info);
+    }
+
+    std::size_t receive(int level, std::span<std::byte> buffer, tag_msg_info &info, int flags = 0) {
+        std::error_code ec;
+        std::size_t size = receive(level, buffer, info, ec, flags);
+        if (ec) raise(ec.value(), "tag_receive_info");
+        return size;
+    }
+
+    /*
+     * tag_receive_batch: up to msgs.size() messages of the levels of the bit mask, each one in the buffer of its slot.
+     * After the first message the call keeps collecting for window, or until window_msgs slots are filled (0 for all).
+     * @return the number of slots filled, 0 and ec set on failure
+     */
+    std::size_t receive_batch(unsigned int levels, std::span<tag_mmsg> msgs, std::chrono::microseconds window,
+                              std::error_code &ec, unsigned int window_msgs = 0) noexcept {
+        long got;
+        if (timeout_ != 0 && !set_timeout(std::chrono::microseconds::zero(), ec)) return 0;
+        got = TAG_LIB_SYSCALL(discover().receive_batch_nr, td_, levels, msgs.data(),
+                              static_cast<unsigned int>(msgs.size()), static_cast<unsigned int>(window.count()),
+                              window_msgs);
+        if (got < 0) {
+            detail::fail(ec);
+            return 0;
+        }
+        ec.clear();
+        return static_cast<std::size_t>(got);
+    }
+
+    std::size_t receive_batch(unsigned int levels, std::span<tag_mmsg> msgs, std::chrono::microseconds window,
+                              unsigned int window_msgs = 0) {
+        std::error_code ec;
+        std::size_t got = receive_batch(levels, msgs, window, ec, window_msgs);
+        if (ec) raise(ec.value(), "tag_receive_batch");
+        return got;
+    }
+
+    /*
+     * tag_receive that fails with ETIMEDOUT if no message comes within timeout. The timeout is set on the descriptor
+     * with TAG_TIMEOUT only when it changes, so loops with the same timeout cost one system call per receive.
+     */
+    std::size_t receive_for(int level, std::span<std::byte> buffer, std::chrono::microseconds timeout,
+                            std::error_code &ec, int flags = 0) noexcept {
+        if (timeout.count() <= 0) {
+            ec.assign(EINVAL, std::generic_category());
+            return 0;
+        }
+        if (timeout.count() != timeout_ && !set_timeout(timeout, ec)) return 0;
+        return receive_call(level, buffer, ec, flags);
+    }
+
+    std::size_t receive_for(int level, std::span<std::byte> buffer, std::chrono::microseconds timeout,
+                            int flags = 0) {
+        std::error_code ec;
+        std::size_t size = receive_for(level, buffer, timeout, ec, flags);
+        if (ec) raise(ec.value(), "tag_receive");
+        return size;
+    }
+
+    template<class T> requires std::is_trivially_copyable_v<T>
+    T receive_value(int level, int flags = 0) {
+        T value;
+        if (receive(level, std::as_writable_bytes(std::span<T, 1>(&value, 1)), flags) != sizeof(T)) {
+            throw error(EMSGSIZE, "tag_receive");
+        }
+        return value;
+    }
+
+    /* tag_ctl with the commands of tag.h */
+    int ctl(int command, unsigned long arg, std::error_code &ec) const noexcept {
+        long ret = TAG_LIB_SYSCALL(discover().ctl_nr, td_, command, arg);
+        if (ret < 0) {
+            detail::fail(ec);
+            return -1;
+        }
+        ec.clear();
+        return static_cast<int>(ret);
+    }
+
+    int ctl(int command, unsigned long arg = 0) const {
+        std::error_code ec;
+        int ret = ctl(command, arg, ec);
+        if (ec) raise(ec.value(), "tag_ctl");
+        return ret;
+    }
+
+    void awake_all() const { ctl(AWAKE_ALL); }
+
+    void awake_levels(unsigned long levels) const { ctl(AWAKE_LEVELS, levels); }
+
+    void busy_poll(std::chrono::microseconds poll) const { ctl(TAG_BUSY_POLL, static_cast<unsigned long>(poll.count())); }
+
+    void conflate(unsigned long levels) const { ctl(TAG_CONFLATE, levels); }
+
+    /* TAG_DEADLINE: the senders of the tag wait at most deadline for the readers, 0 waits for all of them */
+    void deadline(std::chrono::microseconds deadline) const {
+        ctl(TAG_DEADLINE, static_cast<unsigned long>(deadline.count()));
+    }
+
+    /* TAG_FILTER: receives through this descriptor on filter.level only get the matching messages, len 0 removes it */
+    void filter(const tag_filter &filter) const { ctl(TAG_FILTER, reinterpret_cast<unsigned long>(&filter)); }
+
+    /* IPC_RMID, with IPC_NOWAIT and/or TAG_DRAIN in flags; the descriptor stays open */
+    void remove(int flags = 0) const { ctl(IPC_RMID | flags); }
+
+private:
+    bool set_timeout(std::chrono::microseconds timeout, std::error_code &ec) noexcept {
+        if (ctl(TAG_TIMEOUT, static_cast<unsigned long>(timeout.count()), ec) < 0) return false;
+        timeout_ = timeout.count();
+        return true;
+    }
+
+    std::size_t receive_call(int level, std::span<std::byte> buffer, std::error_code &ec, int flags,
+                             tag_msg_info *info = nullptr) noexcept {
+        long size = info == nullptr
+                    ? TAG_LIB_SYSCALL(discover().receive_nr, td_, level | flags, buffer.data(), buffer.size())
+                    : TAG_LIB_SYSCALL(discover().receive_info_nr, td_, level | flags, buffer.data(), buffer.size(),
+                                      info);
+        if (size < 0) {
+            detail::fail(ec);
+            return 0;
+        }
+        ec.clear();
+        return static_cast<std::size_t>(size);
+    }
+
+    int td_ = -1;
+    long long timeout_ = 0; // TAG_TIMEOUT of the descriptor in microseconds, 0 waits forever
+};
+
+/*
+ * Subscriptions of tag_receive_set: (descriptor, level mask) pairs followed by a single receiving thread. The
+ * descriptors are not owned and must outlive the set; the receive timeout is the TAG_TIMEOUT of the first one.
+ * Only add and remove allocate.
+ */
+class subscription_set {
+public:
+    /* subscribes the levels of the bit mask on td, in addition to the ones already subscribed */
+    void add(const handle &td, unsigned long levels) {
+        auto it = find(td.fd());
+        if (it != subs_.end()) it->levels |= static_cast<unsigned int>(levels);
+        else subs_.push_back(tag_sub{td.fd(), static_cast<unsigned int>(levels)});
+    }
+
+    void remove(const handle &td) noexcept {
+        auto it = find(td.fd());
+        if (it != subs_.end()) subs_.erase(it);
+    }
+
+    void clear() noexcept { subs_.clear(); }
+
+    [[nodiscard]] std::size_t size() const noexcept { return subs_.size(); }
+
+    [[nodiscard]] bool empty() const noexcept { return subs_.empty(); }
+
+    /*
+     * tag_receive_set in buffer: origin tells the subscription, descriptor and level of the message, or of the
+     * failure of a single subscription.
+     * @return the size of the message, 0 and ec set on failure
+     */
+    std::size_t receive(std::span<std::byte> buffer, tag_origin &origin, std::error_code &ec) noexcept {
+        long size = TAG_LIB_SYSCALL(discover().receive_set_nr, subs_.data(), static_cast<unsigned int>(subs_.size()),
+                                    buffer.data(), buffer.size(), &origin);
+        if (size < 0) {
+            detail::fail(ec);
+            return 0;
+        }
+        ec.clear();
+        return static_cast<std::size_t>(size);
+    }
+
+    std::size_t receive(std::span<std::byte> buffer, tag_origin &origin) {
+        std::error_code ec;
+        std::size_t size = receive(buffer, origin, ec);
+        if (ec) raise(ec.value(), "tag_receive_set");
+        return size;
+    }
+
+private:
+    std::vector<tag_sub>::iterator find(int td) {
+        return std::find_if(subs_.begin(), subs_.end(), [td](const tag_sub &sub) { return sub.tag == td; });
+    }
+
+    std::vector<tag_sub> subs_;
+};
+
+} // namespace tag
+
+#endif //SOA_PROJECT_TM_TAG_LIB_HPP
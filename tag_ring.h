@@ -0,0 +1,175 @@
+/*
+ * User space side of the shared-memory rings of the tag service (TAG_RING).
+ *
+ * A ring is a broadcast ring of the messages of a level: senders claim a sequence number n incrementing head and
+ * write the slot n % slots, every receiver follows the ring with its own cursor and reads all the messages, the
+ * ones overwritten before being read are counted in lost. A slot is a seqlock: seq is 2 * n + 1 while the message n
+ * is written and 2 * n + 2 once it is complete, the sender of n waits for the sender of n - slots to complete it.
+ * The kernel is entered only to sleep on an empty ring (TAG_RING_WAIT) and by the senders that see sleeping
+ * receivers in the header (TAG_RING_WAKE); AWAKE_ALL/AWAKE_LEVELS and the removal of the tag reach the receivers
+ * of the ring like the ones of tag_receive.
+ */
+
+#ifndef SOA_PROJECT_TM_TAG_RING_H
+#define SOA_PROJECT_TM_TAG_RING_H
+
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "tag_lib.h"
+#include "tag_service/tag.h"
+
+#ifndef TAG_RING_MMAP
+#define TAG_RING_MMAP(td, size, level) \
+    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, td, (off_t) (level) * sysconf(_SC_PAGESIZE))
+#define TAG_RING_MUNMAP(addr, size) munmap(addr, size)
+#endif
+
+#define TAG_RING_SPIN 2000 // polls of an empty ring before sleeping in the kernel
+
+struct tag_ring {
+    int td; // tag descriptor
+    int level;
+    struct tag_ring_hdr *hdr;
+    char *slots;
+    size_t size; // bytes mapped
+    size_t stride;
+    unsigned long long mask;
+    unsigned long long pos; // next sequence number to read
+    unsigned long long lost; // messages overwritten before being read
+};
+
+static inline struct tag_ring_slot *tag_ring_slot(struct tag_ring *ring, unsigned long long n) {
+    return (struct tag_ring_slot *) (ring->slots + (n & ring->mask) * ring->stride);
+}
+
+/**
+ * @description Sets up the ring of a level with slots messages of at most slot_size bytes, or attaches to the
+ * existing one (slots 0 attaches whatever its geometry), and maps it. Receivers start from the next message sent.
+ * @return 0 on success, -1 on failure and errno is set (see TAG_RING in tag_ctl)
+ */
+static inline int tag_ring_open(struct tag_ring *ring, int td, int level, unsigned int slots, unsigned int slot_size) {
+    struct tag_ring_req req = {level, slots, slot_size};
+    void *addr;
+    int size = tag_ctl_arg(td, TAG_RING, (unsigned long) &req);
+    if (size < 0) return -1;
+    addr = TAG_RING_MMAP(td, (size_t) size, level);
+    if (addr == MAP_FAILED) return -1;
+    ring->td = td;
+    ring->level = level;
+    ring->hdr = addr;
+    ring->slots = (char *) addr + sizeof(struct tag_ring_hdr);
+    ring->size = (size_t) size;
+    ring->stride = TAG_RING_STRIDE(ring->hdr->slot_size);
+    ring->mask = ring->hdr->slots - 1;
+    ring->pos = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+    ring->lost = 0;
+    return 0;
+}
+
+static inline void tag_ring_close(struct tag_ring *ring) {
+    TAG_RING_MUNMAP(ring->hdr, ring->size);
+    ring->hdr = NULL;
+}
+
+/**
+ * @description Publishes a message on the ring, the oldest message is overwritten. Never sleeps: the only wait is
+ * for a sender still writing the same slot one lap behind.
+ * @return 0 on success, -1 on failure and errno is set (EINVAL if size exceeds the slot size)
+ */
+static inline int tag_ring_send(struct tag_ring *ring, const void *buffer, size_t size) {
+    struct tag_ring_slot *slot;
+    unsigned long long n, expected;
+
+    if (size > ring->hdr->slot_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    n = __atomic_fetch_add(&ring->hdr->head, 1, __ATOMIC_SEQ_CST);
+    slot = tag_ring_slot(ring, n);
+    for (;;) {
+        expected = n > ring->mask ? 2 * (n - ring->mask - 1) + 2 : 0;
+        if (__atomic_compare_exchange_n(&slot->seq, &expected, 2 * n + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        sched_yield();
+    }
+    /* the odd seq is visible before the payload changes */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->len = (unsigned int) size;
+    memcpy(slot->data, buffer, size);
+    __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+
+    /* pairs with the increment of waiters in tag_ring_receive */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->hdr->waiters, __ATOMIC_RELAXED) != 0) {
+        return tag_ctl_arg(ring->td, TAG_RING_WAKE, ring->level) < 0 ? -1 : 0;
+    }
+    return 0;
+}
+
+/**
+ * @description Receives the next message of the ring, sleeping in the kernel if the ring stays empty.
+ * If the receiver was lapped it skips to the oldest message still in the ring and adds the skipped ones to lost.
+ * @return bytes copied on success, -1 on failure and errno is set: ECANCELED (AWAKE notification), EIDRM (tag being
+ * removed), EINTR, ENOBUFS (message larger than size, it is consumed)
+ */
+static inline int tag_ring_receive(struct tag_ring *ring, void *buffer, size_t size) {
+    struct tag_ring_slot *slot;
+    struct tag_ring_wait wait;
+    unsigned long long seq, head;
+    unsigned int awake_gen = __atomic_load_n(&ring->hdr->awake_gen, __ATOMIC_ACQUIRE);
+    unsigned int len;
+    int spin = 0, ret;
+
+    for (;;) {
+        slot = tag_ring_slot(ring, ring->pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 2 * ring->pos + 2) {
+            len = slot->len;
+            if (len <= size) memcpy(buffer, slot->data, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+                ring->pos++;
+                if (len > size) {
+                    errno = ENOBUFS;
+                    return -1;
+                }
+                return (int) len;
+            }
+            /* overwritten while copying */
+            continue;
+        }
+        if (seq > 2 * ring->pos + 2) {
+            /* lapped: the oldest message that can still be complete is head - slots */
+            head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+            if (head > ring->pos + ring->mask + 1) {
+                ring->lost += head - ring->mask - 1 - ring->pos;
+                ring->pos = head - ring->mask - 1;
+            } else {
+                ring->lost++;
+                ring->pos++;
+            }
+            continue;
+        }
+        if (__atomic_load_n(&ring->hdr->awake_gen, __ATOMIC_ACQUIRE) != awake_gen) {
+            errno = ECANCELED;
+            return -1;
+        }
+        /* empty, or a sender is writing the message */
+        if (seq == 2 * ring->pos + 1 || ++spin < TAG_RING_SPIN) {
+            sched_yield();
+            continue;
+        }
+        spin = 0;
+        wait.level = ring->level;
+        wait.awake_gen = awake_gen;
+        wait.seq = ring->pos;
+        __atomic_fetch_add(&ring->hdr->waiters, 1, __ATOMIC_SEQ_CST);
+        ret = tag_ctl_arg(ring->td, TAG_RING_WAIT, (unsigned long) &wait);
+        __atomic_fetch_sub(&ring->hdr->waiters, 1, __ATOMIC_SEQ_CST);
+        if (ret < 0) return -1;
+    }
+}
+
+#endif //SOA_PROJECT_TM_TAG_RING_H
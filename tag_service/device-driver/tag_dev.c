@@ -6,12 +6,14 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/rwsem.h>
+#include <linux/rcupdate.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/string.h>
 #include <linux/types.h>
 #include <linux/compiler.h>
+#include <linux/capability.h>
 #include "tag_dev.h"
 
 extern tag_node_ptr tag_list;
@@ -20,6 +22,7 @@ extern unsigned int max_tg;
 static DEFINE_MUTEX(device_state);
 tag_status_ptr_t status_list;
 dev_object_t info;
+ns_import_t import;
 
 struct file_operations fops = {
         .owner = THIS_MODULE,
@@ -33,6 +36,8 @@ struct file_operations fops = {
  * @description This function opens a new session for the device file and build the information needed.
  * Be carefull, this device driver cannot be accessed in time sharing (single istance)
  * if someone else try to open a new session without closing the current one this will cause an error condition.
+ * On minor TAG_NS_MINOR a read-only session reads the namespace snapshot (struct tag_ns_hdr and records), a
+ * write-only session of CAP_SYS_ADMIN imports one.
  *
  * @param inode file inode
  * @param file file struct
@@ -42,46 +47,69 @@ int open_tag_status(struct inode *inode, struct file *file) {
     int i, j, res;
     unsigned int minor;
     tag_ptr_t my_tag;
+    rcu_util_ptr rcu_util;
     if (inode == NULL || file == NULL) {
         /*invalid argument*/
         return -EINVAL;
     }
-    minor = file->f_inode->i_rdev;
+    minor = iminor(inode);
+    if (minor != 0 && minor != TAG_NS_MINOR) return -ENXIO;
+    if (minor == TAG_NS_MINOR && (file->f_mode & FMODE_WRITE)) {
+        /* a snapshot is either read or imported */
+        if (file->f_mode & FMODE_READ) return -EINVAL;
+        if (!capable(CAP_SYS_ADMIN)) return -EPERM;
+    }
     if (!mutex_trylock(&device_state)) {
         /*this device file is single instance*/
         return -EBUSY;
     }
 
+    if (minor == TAG_NS_MINOR) {
+        if (file->f_mode & FMODE_WRITE) {
+            memset(&import, 0, sizeof(ns_import_t));
+            import.active = true;
+            res = 0;
+        } else {
+            res = build_ns_content();
+        }
+        if (res < 0) {
+            mutex_unlock(&device_state);
+            return res;
+        }
+        printk("%s : %s namespace succesfully opened with major=%d\n", MODNAME, DEVICE_NAME, major_number);
+        return 0;
+    }
+
     status_list = kzalloc(sizeof(tag_status_t) * max_tg, GFP_KERNEL);
     if (status_list == NULL) {
         printk(KERN_INFO "Tag-Driver unable to allocate memory\n");
+        mutex_unlock(&device_state);
         return -ENOMEM;
     }
 
     /*let's retrieve status informations*/
     for (i = 0; i < max_tg; i++) {
-        /* take read lock to avoid that someone deletes the tag entry during my job*/
-        if (!down_read_trylock(&tag_list[i].tag_node_rwsem)) {
-            //contention! this means that a remover or a creator is here, the go on
-            status_list[i].present = false;
-            continue;
-        }
+        /* a removed tag is released only after a grace period, so it can be read during my job*/
+        rcu_read_lock();
         // this is a snapshot and I don't care about concurrency
-        my_tag = tag_list[i].tag_ptr;
+        my_tag = rcu_dereference(tag_list[i].tag_ptr);
         if (my_tag != NULL) {
             status_list[i].present = true;
             status_list[i].key = my_tag->key;
             status_list[i].uid_owner = my_tag->uid;
+            status_list[i].node = my_tag->node;
             for (j = 0; j < LEVELS; j++) {
+                /* the level state of an idle tag can be released by the shrinker: no readers */
+                rcu_util = READ_ONCE(my_tag->msg_rcu_util_list[j]);
+                if (rcu_util == NULL) continue;
                 //consider both current_epoch and next_epoch
-                status_list[i].standing_readers[j] =
-                        my_tag->msg_rcu_util_list[j]->standings[0] + my_tag->msg_rcu_util_list[j]->standings[1];
+                status_list[i].standing_readers[j] = rcu_util->standings[0] + rcu_util->standings[1];
             }
         } else {
             status_list[i].present = false;
         }
 
-        up_read(&tag_list[i].tag_node_rwsem);
+        rcu_read_unlock();
     }
     /*Here we have collected all the infrmation needed to build the text*/
     res = build_content();
@@ -96,32 +124,38 @@ int open_tag_status(struct inode *inode, struct file *file) {
 }
 
 /**
- * @description Builds a text with the information collected from the tag_list of the tag_service.
+ * @description Builds a text with the information collected from the tag_list of the tag_service, after a first
+ * line with the activity of the shrinker of the level state of idle tags.
  * @return integer corresponding to the number of bytes that have been written
  */
 int build_content(void) {
-    int i, j, written;
+    int i, j, written, len;
     char *temp_text, *text;
+    struct tag_reclaim_stats stats;
     /*alloc a potentially big amount of memory*/
-    text = vzalloc(max_tg * LEVELS * LINE_LEN);
+    text = vzalloc(max_tg * LEVELS * LINE_LEN + RECLAIM_LINE_LEN);
     if (text == NULL) {
         printk(KERN_INFO "%s : unable to allocate memory\n", DEVICE_NAME);
         return -ENOMEM;
     }
 
-    temp_text = text;
-    written = 0;
+    tag_reclaim_stats(&stats);
+    written = sprintf(text, "reclaimed_bytes=%lu\treleased_bytes=%lu\treclaims=%lu\trebuilds=%lu\n",
+                      stats.reclaimed_bytes, stats.released_bytes, stats.reclaims, stats.rebuilds);
+    temp_text = text + written;
     for (i = 0; i < max_tg; i++) {
         if (status_list[i].present) {
             for (j = 0; j < LEVELS; j++) {
                 /*consider only the levels for wich there are standing readers*/
                 if (status_list[i].standing_readers[j] != 0) {
-                    written += sprintf(temp_text, "key=%d\towner=%d\tlevel=%d\treaders=%ld\n",
-                                       status_list[i].key,
-                                       status_list[i].uid_owner.val,
-                                       j,
-                                       status_list[i].standing_readers[j]);
-                    temp_text += written;
+                    len = sprintf(temp_text, "key=%d\towner=%d\tlevel=%d\treaders=%ld\tnode=%d\n",
+                                  status_list[i].key,
+                                  status_list[i].uid_owner.val,
+                                  j,
+                                  status_list[i].standing_readers[j],
+                                  status_list[i].node);
+                    temp_text += len;
+                    written += len;
                 }
             }
         }
@@ -132,6 +166,35 @@ int build_content(void) {
     return written;
 }
 
+/**
+ * @description Builds the namespace snapshot of the tags with a key.
+ * @return integer corresponding to the number of bytes that have been written
+ */
+int build_ns_content(void) {
+    struct tag_ns_hdr *hdr;
+    char *text;
+    int count;
+    text = vzalloc(sizeof(struct tag_ns_hdr) + sizeof(struct tag_ns_record) * max_tg);
+    if (text == NULL) {
+        printk(KERN_INFO "%s : unable to allocate memory\n", DEVICE_NAME);
+        return -ENOMEM;
+    }
+    count = tag_ns_export((struct tag_ns_record *) (text + sizeof(struct tag_ns_hdr)));
+    if (count < 0) {
+        vfree(text);
+        return count;
+    }
+    hdr = (struct tag_ns_hdr *) text;
+    hdr->magic = TAG_NS_MAGIC;
+    hdr->version = TAG_NS_VERSION;
+    hdr->count = count;
+    hdr->record_size = sizeof(struct tag_ns_record);
+
+    info.content = text;
+    info.content_size = (int) (sizeof(struct tag_ns_hdr) + sizeof(struct tag_ns_record) * count);
+    return info.content_size;
+}
+
 /**
  * @description Allows reading informations about the tag-service collected during the open operation.
  * @param filp file struct
@@ -170,8 +233,15 @@ ssize_t read_tag_status(struct file *filp, char *buff, size_t len, loff_t *off)
  * @return 0 on success
  */
 int release_tag_status(struct inode *inode, struct file *file) {
+    if (import.active) {
+        printk("%s : namespace import restored %d tags, skipped %d%s\n", MODNAME, import.imported, import.skipped,
+               !import.started || import.left != 0 || import.len != 0 ? " (truncated snapshot)" : "");
+        import.active = false;
+    }
     if (status_list != NULL) kfree(status_list);
     if (info.content != NULL) vfree(info.content);
+    status_list = NULL;
+    info.content = NULL;
     info.content_size = 0;
     mutex_unlock(&device_state);
     printk("%s : %s succesfully closed.\n", MODNAME, DEVICE_NAME);
@@ -179,9 +249,54 @@ int release_tag_status(struct inode *inode, struct file *file) {
 }
 
 /**
- * @description Not implemented yet
+ * @description Imports the namespace snapshot written on minor TAG_NS_MINOR, in any number of writes: every complete
+ * record is restored by tag_ns_import, the records that cannot be restored (key or entry in use) are skipped
+ * and logged. The write completing a snapshot with skipped records fails, so that the writer sees a partial restore.
+ * The status device is read only.
+ * @return number of bytes consumed, -EEXIST if the last record has been consumed and some records were skipped,
+ * -EINVAL on a malformed snapshot, -ENOSYS on the status device
  */
 ssize_t write_tag_status(struct file *filp, const char *buff, size_t len, loff_t *off) {
-    /*Not implemented yet*/
-    return -ENOSYS;
+    struct tag_ns_hdr *hdr = (struct tag_ns_hdr *) import.pending;
+    struct tag_ns_record *rec = (struct tag_ns_record *) import.pending;
+    size_t unit, chunk, done = 0;
+    int ret;
+
+    if (!import.active) return -ENOSYS;
+    while (done < len) {
+        if (import.started && import.left == 0) {
+            /* more bytes than the records of the header */
+            return -EINVAL;
+        }
+        unit = import.started ? sizeof(struct tag_ns_record) : sizeof(struct tag_ns_hdr);
+        chunk = min(len - done, unit - import.len);
+        if (copy_from_user(import.pending + import.len, buff + done, chunk) != 0) return -EFAULT;
+        import.len += chunk;
+        done += chunk;
+        if (import.len < unit) break;
+        import.len = 0;
+
+        if (!import.started) {
+            if (hdr->magic != TAG_NS_MAGIC || hdr->version != TAG_NS_VERSION ||
+                hdr->record_size != sizeof(struct tag_ns_record) || hdr->count > max_tg) {
+                return -EINVAL;
+            }
+            import.started = true;
+            import.left = hdr->count;
+            continue;
+        }
+        import.left--;
+        ret = tag_ns_import(rec);
+        if (ret == 0) {
+            import.imported++;
+        } else {
+            /* e.g. a client recreated the key before the import */
+            import.skipped++;
+            printk(KERN_INFO "%s : key %d not restored on tag %d (error %d)\n", MODNAME, rec->key, rec->tag, ret);
+        }
+    }
+    *off += done;
+    /* every record has been tried: report the partial import, the count is logged at release */
+    if (import.started && import.left == 0 && import.skipped != 0) return -EEXIST;
+    return (ssize_t) done;
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #define SOA_PROJECT_TM_TAG_DEV_H
 
 #define LINE_LEN 64 // max allowed size for a line of information
+#define RECLAIM_LINE_LEN 128 // first line, activity of the shrinker
 #define DEVICE_NAME "tag-device-driver"
 
 #endif //SOA_PROJECT_TM_TAG_DEV_H
@@ -19,10 +20,22 @@ typedef struct object_state {
 } dev_object_t;
 
 
+/* namespace snapshot being written on the namespace device (minor TAG_NS_MINOR) */
+typedef struct ns_import {
+    bool active; // the session writes a snapshot
+    bool started; // header accepted
+    char pending[sizeof(struct tag_ns_record)]; // header or record still incomplete
+    size_t len;
+    unsigned int left; // records still expected
+    int imported;
+    int skipped;
+} ns_import_t;
+
 typedef struct tag_stastus {
     int key;
     kuid_t uid_owner;
     unsigned long standing_readers[LEVELS];
+    int node; // NUMA node holding the tag state
     bool present;
 } tag_status_t;
 typedef tag_status_t *tag_status_ptr_t;
@@ -31,6 +44,8 @@ typedef tag_status_t *tag_status_ptr_t;
  * @description This function opens a new session for the device file and build the information needed.
  * Be carefull, this device driver cannot be accessed in time sharing (single istance)
  * if someone else try to open a new session without closing the current one this will cause an error condition.
+ * On minor TAG_NS_MINOR a read-only session reads the namespace snapshot (struct tag_ns_hdr and records), a
+ * write-only session of CAP_SYS_ADMIN imports one.
  *
  * @param inode dev file inode
  * @param file file struct
@@ -57,12 +72,22 @@ ssize_t read_tag_status(struct file *filp, char *buff, size_t len, loff_t *off);
 int release_tag_status(struct inode *inode, struct file *file);
 
 /**
- * @description Not implemented yet
+ * @description Imports the namespace snapshot written on minor TAG_NS_MINOR, in any number of writes: every complete
+ * record is restored by tag_ns_import, the records that cannot be restored (key or entry in use) are skipped
+ * and logged. The status device is read only.
+ * @return number of bytes consumed, -EINVAL on a malformed snapshot, -ENOSYS on the status device
  */
 ssize_t write_tag_status(struct file *filp, const char *buff, size_t len, loff_t *off);
 
 /**
- * @description Builds a text with the information collected from the tag_list of the tag_service.
+ * @description Builds a text with the information collected from the tag_list of the tag_service, after a first
+ * line with the activity of the shrinker of the level state of idle tags.
+ * @return integer corresponding to the number of bytes that have been written
+ */
+int build_content(void);
+
+/**
+ * @description Builds the namespace snapshot of the tags with a key.
  * @return integer corresponding to the number of bytes that have been written
  */
-int build_content(void);
\ No newline at end of file
+int build_ns_content(void);
\ No newline at end of file
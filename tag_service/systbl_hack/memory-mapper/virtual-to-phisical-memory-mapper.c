@@ -49,8 +49,27 @@ static inline unsigned long read_content_cr3(void) {
 #define PDE(vaddr)  ((unsigned long long)(vaddr >> 21) & 0x1ffULL)
 #define PTE(vaddr)  ((unsigned long long)(vaddr >> 12) & 0x1ffULL)
 
+/* size of the virtual region covered by an entry of every level */
+#define PML4_SPAN (1UL << 39)
+#define PDP_SPAN  (1UL << 30)
+#define PDE_SPAN  (1UL << 21)
+#define PTE_SPAN  (1UL << 12)
+
 
 long page_table_walk(unsigned long vaddr) {
+    unsigned long span;
+    return page_table_walk_span(vaddr, &span);
+}
+
+/**
+ * @description Page table walk that also reports the size of the region the answer holds for:
+ * the size of the mapping (4 KB, 2 MB or 1 GB) if vaddr is mapped, the size of the region covered by the
+ * first missing entry (4 KB, 2 MB, 1 GB or 512 GB) otherwise. A linear scan can use it to skip unmapped regions.
+ * @param vaddr virtual address to translate
+ * @param span output, size of the (un)mapped region containing vaddr
+ * @return frame number or NO_MAP
+ */
+long page_table_walk_span(unsigned long vaddr, unsigned long *span) {
 
     pgd_t * pml4;
     pud_t *pdp;
@@ -63,15 +82,18 @@ long page_table_walk(unsigned long vaddr) {
     pml4 = __va(read_content_cr3() & ADDR_MASK);
     if (!((pml4[PML4(vaddr)].pgd) & VALID)) {
         PAGE_WALK_AUDIT printk(KERN_INFO "%s: PML4 entry not mapped to physical memory.\n", LIB_NAME);
+        *span = PML4_SPAN;
         return NO_MAP;
     }
 
     pdp = __va((pml4[PML4(vaddr)].pgd) & PT_ADDR_MASK);
     if (!((pdp[PDP(vaddr)].pud) & VALID)) {
         PAGE_WALK_AUDIT printk(KERN_INFO "%s: PDP entry not not mapped to physical memory.\n", LIB_NAME);
+        *span = PDP_SPAN;
         return NO_MAP;
     } else if (unlikely((pdp[PDP(vaddr)].pud) & LARGE_PAGE)) {
         //1 GB page case
+        *span = PDP_SPAN;
         frame = ((pdp[PDP(vaddr)].pud) & PT_ADDR_MASK) >> 30;
         return frame;
     }
@@ -80,11 +102,13 @@ long page_table_walk(unsigned long vaddr) {
     pde = __va((pdp[PDP(vaddr)].pud) & PT_ADDR_MASK);
     if (!((pde[PDE(vaddr)].pmd) & VALID)) {
         PAGE_WALK_AUDIT printk(KERN_INFO "%s: PDE entry not not mapped to physical memory.\n", LIB_NAME);
+        *span = PDE_SPAN;
         return NO_MAP;
     }
 
     if (unlikely((pde[PDE(vaddr)].pmd) & LARGE_PAGE)) {
         PAGE_WALK_AUDIT printk(KERN_INFO "%s: PDE region maps large page 2 MB.\n", LIB_NAME);
+        *span = PDE_SPAN;
         frame = ((pde[PDE(vaddr)].pmd) & PT_ADDR_MASK) >> 21;
         //stop walking and return large page physical address
         return frame;
@@ -92,6 +116,7 @@ long page_table_walk(unsigned long vaddr) {
 
 
     pte = __va((pde[PDE(vaddr)].pmd) & PT_ADDR_MASK);
+    *span = PTE_SPAN;
     if (!((pte[PTE(vaddr)].pte) & VALID)) {
         PAGE_WALK_AUDIT printk(KERN_DEBUG "%s: PTE page not mapped to physical memory.\n", LIB_NAME);
         return NO_MAP;
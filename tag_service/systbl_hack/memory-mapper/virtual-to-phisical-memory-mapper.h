@@ -7,6 +7,7 @@
 #define SOA_PROJECT_TM_VIRTUAL_TO_PHISICAL_MEMORY_MAPPER_H
 
 long page_table_walk(unsigned long vaddr);
+long page_table_walk_span(unsigned long vaddr, unsigned long *span);
 #define NO_MAP (-1)
 
 #endif //SOA_PROJECT_TM_VIRTUAL_TO_PHISICAL_MEMORY_MAPPER_H
@@ -14,6 +14,11 @@
 // end point
 #define KERNEL_END   ((void *)0xfffffffffff00000ULL)
 
+// kernel image mapping (__START_KERNEL_map + KERNEL_IMAGE_SIZE): text and rodata live here even with KASLR
+#define KERNEL_IMAGE_START ((void *)0xffffffff80000000ULL)
+#define KERNEL_IMAGE_END   ((void *)0xffffffffc0000000ULL)
+#define _LARGE_PAGE_SIZE (1UL << 21)
+
 
 #define TABLE_ENTRIES       256
 #define MAX_FREE_ENTRIES    15
@@ -43,7 +48,20 @@
 
 int compatible(void **addr);
 
-int match_pattern(void *page);
+/**
+ * @description Looks for the system call table inside a page.
+ * @param page page address
+ * @param next_mapped 0 if the following page is not mapped, so the table cannot cross the page boundary
+ * @return 1 if the table was found, 0 otherwise
+ */
+int match_pattern(void *page, int next_mapped);
+
+/**
+ * @description Checks that a candidate address (e.g. the sys_call_table parameter) really is the system call table.
+ * @param addr candidate address
+ * @return 1 if valid, 0 otherwise
+ */
+int systbl_validate(void **addr);
 
 /**
  * @description Linear esearch of free entries in the system call table, setup of the state-map.
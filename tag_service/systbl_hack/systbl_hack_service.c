@@ -17,6 +17,8 @@
 #include <linux/mutex.h>
 #include <linux/compiler.h>
 #include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
 #include "systbl_hack.h"
 #include "memory-mapper/virtual-to-phisical-memory-mapper.h"
 
@@ -51,6 +53,17 @@ module_param(free_entry_founded, int, S_IRUGO);
 MODULE_PARM_DESC(nr_sysnis,
                  "Number of hackable entries in the syscall table.");
 
+/* load-time instrumentation of the research */
+unsigned long search_time_ns = 0;
+
+module_param(search_time_ns, ulong, S_IRUGO);
+MODULE_PARM_DESC(search_time_ns, "Time spent looking for the syscall table (ns).");
+
+unsigned long pages_scanned = 0;
+
+module_param(pages_scanned, ulong, S_IRUGO);
+MODULE_PARM_DESC(pages_scanned, "Mapped pages inspected looking for the syscall table.");
+
 inline void safe_write_cr0(unsigned long cr0) {
     unsigned long __force_order;
     asm volatile(
@@ -68,31 +81,132 @@ inline void disable_write_protection(void) {
     safe_write_cr0(cr0 & ~X86_CR0_WP);
 }
 
+static void systbl_found(void **addr) {
+    sys_call_table_address = addr;
+    sys_call_table = (unsigned long) addr;
+    sys_ni_syscall_address = addr[FIRST_NI_SYSCALL];
+    sys_ni_syscall = (unsigned long) sys_ni_syscall_address;
+}
+
+/**
+ * @description Linear scan of [from, to) looking for the system call table.
+ * Unmapped regions are skipped at the granularity of the missing page table entry and the pages of a mapping
+ * are inspected without walking the page table again.
+ * @return 1 if the table was found, 0 otherwise
+ */
+static int systbl_scan(unsigned long from, unsigned long to) {
+    unsigned long addr = from, next, span, region_end;
+    while (addr < to) {
+        if (page_table_walk_span(addr, &span) == NO_MAP) {
+            next = (addr & ~(span - 1)) + span;
+            if (next <= addr) break; // end of the address space
+            addr = next;
+            continue;
+        }
+        region_end = (addr & ~(span - 1)) + span;
+        if (region_end <= addr) region_end = to;
+        for (; addr < region_end && addr < to; addr += _PAGE_SIZE) {
+            pages_scanned++;
+            if (match_pattern((void *) addr, addr + _PAGE_SIZE < region_end ||
+                                             page_table_walk(addr + _PAGE_SIZE) != NO_MAP)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
 /**
  * @description Research of the system call table address and of the free entries.
+ * The fast paths are tried in order: knowledge already acquired, sys_call_table parameter (e.g. cached by
+ * uninstall.sh at the previous unload), scan of the kernel image from the text onwards; the scan of the whole
+ * original range is kept as last resort.
  * @return total number of the free entries founded, -1 on failure.
  */
 int systbl_search(void) {
-    void *current_page;
-    for (current_page = KERNEL_START; current_page < KERNEL_END; current_page += _PAGE_SIZE) {
-        if (page_table_walk((unsigned long) current_page) != NO_MAP &&
-            match_pattern(current_page)) {
-            AUDIT {
-                printk(KERN_DEBUG "%s : found syscall table at %px\n", MODNAME, sys_call_table_address);
-                printk(KERN_DEBUG "%s : found ni syscall at %px\n", MODNAME, sys_ni_syscall_address);
-            }
-            find_free_entries();
-            return free_entry_founded;
+    unsigned long text;
+    const char *method;
+    u64 start;
+
+    if (sys_call_table_address != NULL) {
+        /* research already done, keep the current state of the entries */
+        return free_entry_founded;
+    }
+
+    start = ktime_get_ns();
+    pages_scanned = 0;
+
+    if (sys_call_table != 0x0ULL) {
+        if (systbl_validate((void **) sys_call_table)) {
+            systbl_found((void **) sys_call_table);
+            method = "parameter";
+            goto found;
         }
+        AUDIT printk(KERN_DEBUG "%s : sys_call_table parameter %lx is not valid, scanning\n", MODNAME,
+                     sys_call_table);
+        sys_call_table = 0x0ULL;
+    }
+
+    /* the table is in rodata, which follows the kernel text: start from the large page of a text symbol */
+    text = (unsigned long) &kfree;
+    if (text < (unsigned long) KERNEL_IMAGE_START || text >= (unsigned long) KERNEL_IMAGE_END) {
+        text = (unsigned long) KERNEL_IMAGE_START;
+    }
+    if (systbl_scan(text & ~(_LARGE_PAGE_SIZE - 1), (unsigned long) KERNEL_IMAGE_END)) {
+        method = "kernel image scan";
+        goto found;
     }
 
-    AUDIT printk(KERN_DEBUG "%s : research failed!\n", MODNAME);
+    if (systbl_scan((unsigned long) KERNEL_START, (unsigned long) KERNEL_END)) {
+        method = "full scan";
+        goto found;
+    }
+
+    search_time_ns = ktime_get_ns() - start;
+    AUDIT printk(KERN_DEBUG "%s : research failed! (%lu pages in %lu us)\n", MODNAME, pages_scanned,
+                 search_time_ns / 1000);
     return -1;
+
+    found:
+    search_time_ns = ktime_get_ns() - start;
+    printk(KERN_INFO "%s : syscall table found by %s in %lu us, %lu pages inspected\n", MODNAME, method,
+           search_time_ns / 1000, pages_scanned);
+    AUDIT {
+        printk(KERN_DEBUG "%s : found syscall table at %px\n", MODNAME, sys_call_table_address);
+        printk(KERN_DEBUG "%s : found ni syscall at %px\n", MODNAME, sys_ni_syscall_address);
+    }
+    find_free_entries();
+    return free_entry_founded;
 }
 
 EXPORT_SYMBOL(systbl_search);
 
-int match_pattern(void *page) {
+/**
+ * @description Checks that a candidate address (e.g. the sys_call_table parameter) really is the system call table.
+ * @param addr candidate address
+ * @return 1 if valid, 0 otherwise
+ */
+int systbl_validate(void **addr) {
+    if (((unsigned long) addr & (sizeof(void *) - 1)) != 0 || (void *) addr < KERNEL_START) return 0;
+    /* the table can span two pages */
+    if (page_table_walk((unsigned long) addr) == NO_MAP ||
+        page_table_walk((unsigned long) &addr[TABLE_ENTRIES - 1]) == NO_MAP) {
+        return 0;
+    }
+    return (addr[FIRST_NI_SYSCALL] != 0x0)
+           && (((unsigned long) addr[FIRST_NI_SYSCALL] & 0x3) == 0)
+           && (addr[FIRST_NI_SYSCALL] > KERNEL_START)
+           && PATTERN(addr)
+           && compatible(addr);
+}
+
+/**
+ * @description Looks for the system call table inside a page.
+ * @param page page address
+ * @param next_mapped 0 if the following page is not mapped, so the table cannot cross the page boundary
+ * @return 1 if the table was found, 0 otherwise
+ */
+int match_pattern(void *page, int next_mapped) {
     void *next_page;
     void **test;
     unsigned long i = 0;
@@ -102,8 +216,8 @@ int match_pattern(void *page) {
 
         // If the table occupies 2 pages ;  the second one could be materialized in a frame
         if (
-                ((unsigned long) (page + _PAGE_SIZE) == ((unsigned long) next_page & _ADDRESS_MASK))
-                && page_table_walk((unsigned long) next_page) == NO_MAP
+                !next_mapped
+                && ((unsigned long) (page + _PAGE_SIZE) == ((unsigned long) next_page & _ADDRESS_MASK))
                 )
             break;
         //check patter matching
@@ -116,10 +230,7 @@ int match_pattern(void *page) {
                 && (compatible(test))
                 ) {
 
-            sys_call_table_address = test;
-            sys_call_table = (unsigned long) test;
-            sys_ni_syscall_address = test[FIRST_NI_SYSCALL];
-            sys_ni_syscall = (unsigned long) sys_ni_syscall_address;
+            systbl_found(test);
             return 1;
         }
     }
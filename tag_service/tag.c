@@ -23,8 +23,29 @@
 #include <linux/rwsem.h>
 #include <linux/types.h>
 #include <linux/wait.h>
+#include <linux/wait_bit.h>
 #include <linux/sched.h>
 #include <linux/mutex.h>
+#include <linux/numa.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/jiffies.h>
+#include <linux/sched/signal.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
 
 #include "tag_flags.h"
 #include "tag.h"
@@ -34,7 +55,772 @@ extern int max_tg;
 extern int *key_list;
 extern int max_key;
 extern unsigned msg_size;
+extern unsigned int numa_replica_size;
+extern unsigned int busy_poll_usecs;
+extern unsigned int reclaim_idle_ms;
+extern unsigned int fanout_threshold;
 static DEFINE_MUTEX(key_list_mtx);
+static struct tag_reclaim_stats reclaim_stats;
+static unsigned long resident_tags; // tags with the level state allocated
+static unsigned long reclaim_cursor; // next tag_list entry examined by tag_shrink_scan
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0)
+/* pin_user_pages appeared in 5.6: use plain page references (write access is 1 with both the old and new flags) */
+#define pin_user_pages_fast(start, nr_pages, gup_flags, pages) get_user_pages_fast(start, nr_pages, 1, pages)
+
+static inline void unpin_user_pages(struct page **pages, unsigned long npages) {
+    unsigned long i;
+    for (i = 0; i < npages; i++) put_page(pages[i]);
+}
+
+static inline void unpin_user_pages_dirty_lock(struct page **pages, unsigned long npages, bool make_dirty) {
+    unsigned long i;
+    for (i = 0; i < npages; i++) {
+        if (make_dirty) set_page_dirty_lock(pages[i]);
+        put_page(pages[i]);
+    }
+}
+#endif
+
+static void tag_free_rcu(struct rcu_head *head) {
+    tag_cleanup_mem(container_of(head, struct tag_t, rcu));
+}
+
+/* release a memory reference; the memory is freed after a grace period because lock-free lookups could still see it */
+static void tag_release(tag_ptr_t my_tag) {
+    if (refcount_dec_and_test(&my_tag->refs)) call_rcu(&my_tag->rcu, tag_free_rcu);
+}
+
+/* release a reference obtained with tag_pin; the last reference is always dropped by remove_tag */
+static inline void tag_put(tag_ptr_t my_tag) {
+    refcount_dec(&my_tag->users);
+}
+
+/* memory of the state of all the levels of a tag, released by the shrinker */
+static void tag_msg_free_rcu(struct rcu_head *head) {
+    struct tag_msg *msg = container_of(head, struct tag_msg, rcu);
+    int node;
+    if (msg->replicas != NULL) {
+        for (node = 0; node < nr_node_ids; node++) kfree(msg->replicas[node]);
+        kfree(msg->replicas);
+    }
+    kfree(msg);
+}
+
+/* the last reference of a message of a combined batch releases the one it holds on the next message */
+static inline void tag_msg_put(struct tag_msg *msg) {
+    struct tag_msg *next;
+    while (msg != NULL && refcount_dec_and_test(&msg->refs)) {
+        next = msg->batch;
+        call_rcu(&msg->rcu, tag_msg_free_rcu);
+        msg = next;
+    }
+}
+
+/* bytes allocated for the state of a level, the per-CPU wait queues included once the level has them */
+static inline unsigned long level_state_size(rcu_util_ptr rcu_util) {
+    unsigned long size = sizeof(struct msg_t) + sizeof(struct rcu_util) + sizeof(unsigned long) * nr_node_ids;
+    if (READ_ONCE(rcu_util->fanout) != NULL) size += sizeof(struct fanout_shard) * nr_cpu_ids;
+    return size;
+}
+
+static void level_free(msg_ptr_t msg_str, rcu_util_ptr rcu_util) {
+    kfree(msg_str);
+    if (rcu_util != NULL) {
+        kfree(rcu_util->node_standings);
+        kfree(rcu_util->fanout);
+    }
+    kfree(rcu_util);
+}
+
+static void level_free_rcu(struct rcu_head *head) {
+    level_free(NULL, container_of(head, struct rcu_util, rcu));
+}
+
+/**
+ * @description Allocates and initializes the state of every level on the NUMA node.
+ * @return 0 on success, -ENOMEM if out of memory: then nothing is left allocated
+ */
+static int alloc_levels(msg_ptr_t *msg_store, rcu_util_ptr *rcu_util_list, int node) {
+    int j;
+
+    for (j = 0; j < LEVELS; j++) {
+        msg_store[j] = kzalloc_node(sizeof(struct msg_t), GFP_KERNEL, node);
+        rcu_util_list[j] = kzalloc_node(sizeof(struct rcu_util), GFP_KERNEL, node);
+        if (msg_store[j] == NULL || rcu_util_list[j] == NULL) goto out_of_memory;
+        //message buffer initialization
+        RCU_INIT_POINTER(msg_store[j]->msg[0], NULL);
+        RCU_INIT_POINTER(msg_store[j]->msg[1], NULL);
+        //rcu util initialization
+        init_rcu_util(rcu_util_list[j], node);
+        rcu_util_list[j]->node_standings = kzalloc_node(sizeof(unsigned long) * nr_node_ids, GFP_KERNEL, node);
+        if (rcu_util_list[j]->node_standings == NULL) goto out_of_memory;
+    }
+    return 0;
+
+    out_of_memory:
+    for (; j >= 0; j--) level_free(msg_store[j], rcu_util_list[j]);
+    return -ENOMEM;
+}
+
+/**
+ * @description Allocates again the level state released by the shrinker (see tag_reclaim), the sequence numbers of
+ * the levels go on from where they were. Called by the first operation pinning the tag.
+ * @return 0 on success, -ENOMEM if out of memory
+ */
+static int tag_rebuild(tag_ptr_t my_tag) {
+    msg_ptr_t msg_store[LEVELS];
+    rcu_util_ptr rcu_util_list[LEVELS];
+    int level, ret = 0;
+
+    mutex_lock(&my_tag->rebuild_mtx);
+    if (READ_ONCE(my_tag->reclaimed)) {
+        ret = alloc_levels(msg_store, rcu_util_list, my_tag->node);
+        if (ret == 0) {
+            for (level = 0; level < LEVELS; level++) {
+                rcu_util_list[level]->seq = my_tag->idle_seq[level];
+                my_tag->msg_store[level] = msg_store[level];
+                WRITE_ONCE(my_tag->msg_rcu_util_list[level], rcu_util_list[level]);
+            }
+            /* the threads seeing the tag rebuilt see the whole state */
+            asm volatile ("mfence":: : "memory");
+            WRITE_ONCE(my_tag->reclaimed, false);
+            __sync_fetch_and_add(&resident_tags, 1);
+            __sync_fetch_and_sub(&reclaim_stats.released_bytes, my_tag->released);
+            my_tag->released = 0;
+            __sync_fetch_and_add(&reclaim_stats.rebuilds, 1);
+        }
+    }
+    mutex_unlock(&my_tag->rebuild_mtx);
+    return ret;
+}
+
+/**
+ * @description Pins the pages of a user buffer and maps them in the kernel, so that senders of any process can copy
+ * a message straight into it.
+ * @return 0 on success, an error code on failure.
+ */
+static int direct_map(char *ubuf, size_t size, struct direct_buf **out) {
+    struct direct_buf *reg;
+    int pinned;
+
+    reg = kzalloc(sizeof(struct direct_buf), GFP_KERNEL);
+    if (reg == NULL) return -ENOMEM;
+    reg->nr_pages = DIV_ROUND_UP(offset_in_page(ubuf) + size, PAGE_SIZE);
+    reg->pages = kzalloc(sizeof(struct page *) * reg->nr_pages, GFP_KERNEL);
+    if (reg->pages == NULL) {
+        kfree(reg);
+        return -ENOMEM;
+    }
+
+    pinned = pin_user_pages_fast((unsigned long) ubuf & PAGE_MASK, reg->nr_pages, FOLL_WRITE | FOLL_LONGTERM,
+                                 reg->pages);
+    if (pinned != reg->nr_pages) {
+        if (pinned > 0) unpin_user_pages(reg->pages, pinned);
+        kfree(reg->pages);
+        kfree(reg);
+        return -EFAULT;
+    }
+    reg->kaddr = vmap(reg->pages, reg->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (reg->kaddr == NULL) {
+        unpin_user_pages(reg->pages, reg->nr_pages);
+        kfree(reg->pages);
+        kfree(reg);
+        return -ENOMEM;
+    }
+    reg->kaddr += offset_in_page(ubuf);
+    reg->ubuf = ubuf;
+    reg->size = size;
+    reg->state = DIRECT_IDLE;
+    *out = reg;
+    return 0;
+}
+
+static void direct_unmap(struct direct_buf *reg) {
+    vunmap((void *) ((unsigned long) reg->kaddr & PAGE_MASK));
+    unpin_user_pages_dirty_lock(reg->pages, reg->nr_pages, true);
+    kfree(reg->pages);
+    kfree(reg);
+}
+
+/**
+ * @description Registers (buffer != NULL) or unregisters the receive buffer of a descriptor on a level.
+ * Registrations of a level are changed under the level mutex, so that no sender is walking the list.
+ * A buffer in use by a receiver cannot be unregistered (-EBUSY).
+ */
+static int direct_register(tag_ptr_t my_tag, tag_handle_ptr handle, struct tag_direct *req) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[req->level];
+    struct direct_buf *reg = NULL;
+    int ret;
+
+    if (req->buffer != NULL) {
+        ret = direct_map(req->buffer, req->size, &reg);
+        if (ret < 0) return ret;
+    }
+    if (mutex_lock_interruptible(&rcu_util->mtx) == -EINTR) {
+        if (reg != NULL) direct_unmap(reg);
+        return -EINTR;
+    }
+
+    if (reg != NULL) {
+        if (rcu_access_pointer(handle->direct[req->level]) != NULL) {
+            mutex_unlock(&rcu_util->mtx);
+            direct_unmap(reg);
+            return -EBUSY;
+        }
+        list_add(&reg->node, &rcu_util->direct);
+        rcu_assign_pointer(handle->direct[req->level], reg);
+        mutex_unlock(&rcu_util->mtx);
+        return 0;
+    }
+
+    reg = rcu_dereference_protected(handle->direct[req->level], 1);
+    if (reg == NULL || !__sync_bool_compare_and_swap(&reg->state, DIRECT_IDLE, DIRECT_DEAD)) {
+        mutex_unlock(&rcu_util->mtx);
+        return reg == NULL ? -ENOENT : -EBUSY;
+    }
+    list_del(&reg->node);
+    RCU_INIT_POINTER(handle->direct[req->level], NULL);
+    mutex_unlock(&rcu_util->mtx);
+    /* receivers of other threads could be looking at it */
+    synchronize_rcu();
+    direct_unmap(reg);
+    return 0;
+}
+
+/* on close nobody can receive through the descriptor anymore */
+static void direct_release(tag_handle_ptr handle) {
+    struct direct_buf *reg;
+    int level;
+    for (level = 0; level < LEVELS; level++) {
+        reg = rcu_dereference_protected(handle->direct[level], 1);
+        if (reg == NULL) continue;
+        mutex_lock(&handle->tag->msg_rcu_util_list[level]->mtx);
+        list_del(&reg->node);
+        mutex_unlock(&handle->tag->msg_rcu_util_list[level]->mtx);
+        direct_unmap(reg);
+    }
+}
+
+/**
+ * @description Copies the message in the registered buffers whose owner is waiting, with the level mutex held.
+ * buffer is a kernel address if kernel is set: a message queued by a combined sender (see combine).
+ * @return 0, or -EFAULT if the message cannot be read from the sender buffer
+ */
+static int direct_deliver(rcu_util_ptr rcu_util, char *buffer, size_t size, struct tag_msg_info *info, bool kernel) {
+    struct direct_buf *reg;
+    int delivered = 0, ret = 0;
+    list_for_each_entry(reg, &rcu_util->direct, node) {
+        if (!__sync_bool_compare_and_swap(&reg->state, DIRECT_ARMED, DIRECT_FILLING)) continue;
+        reg->info = *info;
+        if (size > reg->size) {
+            reg->len = -ENOBUFS;
+        } else if (kernel) {
+            memcpy(reg->kaddr, buffer, size);
+            reg->len = (long) size;
+        } else if (copy_from_user(reg->kaddr, buffer, size) != 0) {
+            reg->len = ret = -EFAULT;
+        } else {
+            reg->len = (long) size;
+        }
+        asm volatile ("mfence":: : "memory");
+        WRITE_ONCE(reg->state, DIRECT_FULL);
+        delivered++;
+    }
+    /* direct readers wait on the queue of epoch 0 */
+    if (delivered != 0) wake_up_all(&rcu_util->the_queue_head[0]);
+    return ret;
+}
+
+/* remove a reader from the presence counters; after this the sender can release the message */
+/**
+ * @description Counts a reader in the current epoch of the level. The epoch is read again after the presence counter:
+ * a sender flipping it in between could have found no reader and left, then the reader moves to the new epoch, so
+ * that the sender of the epoch joined always waits for the reader (up to the deadline of the tag).
+ * @return the epoch joined, its round is stored in round
+ */
+static int reader_join(rcu_util_ptr rcu_util, unsigned long *round) {
+    int epoch;
+    for (;;) {
+        epoch = READ_ONCE(rcu_util->current_epoch);
+        __sync_fetch_and_add(&rcu_util->standings[epoch], 1);
+        if (READ_ONCE(rcu_util->current_epoch) == epoch) break;
+        __sync_fetch_and_add(&rcu_util->standings[epoch], -1);
+    }
+    /* the message of this round is mine: the epoch could be reused while I'm late */
+    *round = READ_ONCE(rcu_util->round[epoch]);
+    return epoch;
+}
+
+static inline void reader_leave(rcu_util_ptr rcu_util, int epoch, int node) {
+    __sync_fetch_and_add(&rcu_util->node_standings[node], -1);
+    __sync_fetch_and_add(&rcu_util->standings[epoch], -1);
+}
+
+static void fanout_work(struct work_struct *work) {
+    struct fanout_shard *shard = container_of(work, struct fanout_shard, work);
+    wake_up_all(&shard->wq[shard->epoch]);
+    /* the last access: the sender waits for it before leaving the level */
+    __sync_fetch_and_sub(&shard->owner->fanout_pending, 1);
+}
+
+/**
+ * @description Allocates the per-CPU wait queues of a level, called by the reader that finds fanout_threshold
+ * readers standing on it. They are kept until the level state is released.
+ * @return the shards of the level, NULL if out of memory: the readers keep using the_queue_head
+ */
+static struct fanout_shard *fanout_alloc(rcu_util_ptr rcu_util) {
+    struct fanout_shard *fanout, *old;
+    unsigned int cpu;
+
+    fanout = kzalloc_node(sizeof(struct fanout_shard) * nr_cpu_ids, GFP_KERNEL, rcu_util->node);
+    if (fanout == NULL) return NULL;
+    for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+        init_waitqueue_head(&fanout[cpu].wq[0]);
+        init_waitqueue_head(&fanout[cpu].wq[1]);
+        INIT_WORK(&fanout[cpu].work, fanout_work);
+        fanout[cpu].owner = rcu_util;
+    }
+    old = __sync_val_compare_and_swap(&rcu_util->fanout, NULL, fanout);
+    if (old == NULL) return fanout;
+    kfree(fanout);
+    return old;
+}
+
+/* wait queue of a standing reader of the epoch: the one of its CPU once the level has many readers */
+static wait_queue_head_t *reader_queue(rcu_util_ptr rcu_util, int epoch) {
+    struct fanout_shard *fanout = READ_ONCE(rcu_util->fanout);
+    unsigned int threshold = READ_ONCE(fanout_threshold);
+
+    if (fanout == NULL && threshold != 0 && READ_ONCE(rcu_util->standings[epoch]) >= threshold) {
+        fanout = fanout_alloc(rcu_util);
+    }
+    if (fanout == NULL) return &rcu_util->the_queue_head[epoch];
+    return &fanout[raw_smp_processor_id()].wq[epoch];
+}
+
+/* wake up every reader of the epoch on the caller CPU: AWAKE notifications, removal, mode changes */
+static void wake_epoch(rcu_util_ptr rcu_util, int epoch) {
+    struct fanout_shard *fanout;
+    unsigned int cpu;
+
+    wake_up_all(&rcu_util->the_queue_head[epoch]);
+    /* the wake up condition is set before looking for the shards, a reader sets them before checking it */
+    asm volatile ("mfence":: : "memory");
+    fanout = READ_ONCE(rcu_util->fanout);
+    if (fanout == NULL) return;
+    for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+        if (waitqueue_active(&fanout[cpu].wq[epoch])) wake_up_all(&fanout[cpu].wq[epoch]);
+    }
+}
+
+/**
+ * @description Wakes up the readers of the epoch of a message, with the level mutex held. With fanout_threshold or
+ * more standing readers the wait queues of the other CPUs are woken by work items queued on those CPUs, so that
+ * the wait lists are walked in parallel near the readers instead of one after the other by the sender, which only
+ * wakes the queue of its own CPU. The sender must wait for the work items (fanout_pending) before leaving the level.
+ */
+static void fanout_wake(rcu_util_ptr rcu_util, int epoch) {
+    struct fanout_shard *fanout;
+    unsigned int cpu, self, threshold;
+    bool offload;
+
+    wake_up_all(&rcu_util->the_queue_head[epoch]);
+    fanout = READ_ONCE(rcu_util->fanout);
+    if (fanout == NULL) return;
+    threshold = READ_ONCE(fanout_threshold);
+    offload = threshold != 0 && READ_ONCE(rcu_util->standings[epoch]) >= threshold;
+    self = raw_smp_processor_id();
+    for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+        if (cpu == self || !waitqueue_active(&fanout[cpu].wq[epoch])) continue;
+        if (!offload || !cpu_online(cpu)) {
+            wake_up_all(&fanout[cpu].wq[epoch]);
+            continue;
+        }
+        fanout[cpu].epoch = epoch;
+        __sync_fetch_and_add(&rcu_util->fanout_pending, 1);
+        if (!queue_work_on((int) cpu, system_highpri_wq, &fanout[cpu].work)) {
+            __sync_fetch_and_sub(&rcu_util->fanout_pending, 1);
+        }
+    }
+    /* the local queue while the workers run */
+    if (self < nr_cpu_ids) wake_up_all(&fanout[self].wq[epoch]);
+}
+
+/**
+ * @description Sets (len != 0) or removes the receive filter of a descriptor on a level. Filters of a level are
+ * changed under the level mutex, so that no sender is walking the list. A filter in use by a receiver cannot be
+ * replaced or removed (-EBUSY).
+ */
+static int filter_register(tag_ptr_t my_tag, tag_handle_ptr handle, struct tag_filter *req) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[req->level];
+    struct filter_reg *reg = NULL, *old;
+
+    if (req->len != 0) {
+        reg = kzalloc(sizeof(struct filter_reg), GFP_KERNEL);
+        if (reg == NULL) return -ENOMEM;
+        reg->filter = *req;
+        reg->state = FILTER_IDLE;
+        init_waitqueue_head(&reg->wq);
+    }
+    if (mutex_lock_interruptible(&rcu_util->mtx) == -EINTR) {
+        kfree(reg);
+        return -EINTR;
+    }
+
+    old = rcu_dereference_protected(handle->filter[req->level], 1);
+    if (old == NULL && reg == NULL) {
+        mutex_unlock(&rcu_util->mtx);
+        return -ENOENT;
+    }
+    if (old != NULL && !__sync_bool_compare_and_swap(&old->state, FILTER_IDLE, FILTER_DEAD)) {
+        mutex_unlock(&rcu_util->mtx);
+        kfree(reg);
+        return -EBUSY;
+    }
+    if (old != NULL) list_del(&old->node);
+    if (reg != NULL) list_add(&reg->node, &rcu_util->filtered);
+    rcu_assign_pointer(handle->filter[req->level], reg);
+    mutex_unlock(&rcu_util->mtx);
+    if (old != NULL) {
+        /* receivers of other threads could be looking at it */
+        synchronize_rcu();
+        kfree(old);
+    }
+    return 0;
+}
+
+/* on close nobody can receive through the descriptor anymore */
+static void filter_release(tag_handle_ptr handle) {
+    struct filter_reg *reg;
+    int level;
+    for (level = 0; level < LEVELS; level++) {
+        reg = rcu_dereference_protected(handle->filter[level], 1);
+        if (reg == NULL) continue;
+        mutex_lock(&handle->tag->msg_rcu_util_list[level]->mtx);
+        list_del(&reg->node);
+        mutex_unlock(&handle->tag->msg_rcu_util_list[level]->mtx);
+        kfree(reg);
+    }
+}
+
+static bool filter_match(struct tag_filter *filter, struct tag_msg *msg) {
+    unsigned char *data = (unsigned char *) msg->data + filter->offset;
+    unsigned int i;
+    if (filter->offset + filter->len > msg->size) return false;
+    for (i = 0; i < filter->len; i++) {
+        if ((data[i] & filter->mask[i]) != filter->value[i]) return false;
+    }
+    return true;
+}
+
+/* some filtered reader is waiting, with the level mutex held */
+static bool filter_armed(rcu_util_ptr rcu_util) {
+    struct filter_reg *reg;
+    list_for_each_entry(reg, &rcu_util->filtered, node) {
+        if (READ_ONCE(reg->state) == FILTER_ARMED) return true;
+    }
+    return false;
+}
+
+/**
+ * @description Evaluates the filters of the waiting readers on the message of the epoch, with the level mutex held:
+ * the matching readers are counted in the epoch, so that the sender waits for them like for the other readers, and
+ * selected; the other ones keep sleeping and are not even woken up.
+ * @return the number of readers selected
+ */
+static int filter_select(tag_ptr_t my_tag, rcu_util_ptr rcu_util, struct tag_msg *msg, int epoch) {
+    struct filter_reg *reg;
+    int node, selected = 0;
+    list_for_each_entry(reg, &rcu_util->filtered, node) {
+        if (READ_ONCE(reg->state) != FILTER_ARMED) continue;
+        if (!filter_match(&reg->filter, msg)) {
+            __sync_fetch_and_add(&my_tag->delivery_stats.filtered, 1);
+            continue;
+        }
+        /* count the reader before it can see the selection, the owner could give up in the meanwhile */
+        node = READ_ONCE(reg->home);
+        __sync_fetch_and_add(&rcu_util->standings[epoch], 1);
+        __sync_fetch_and_add(&rcu_util->node_standings[node], 1);
+        reg->epoch = epoch;
+        reg->round = rcu_util->round[epoch];
+        reg->sel_node = node;
+        if (__sync_bool_compare_and_swap(&reg->state, FILTER_ARMED, FILTER_SELECTED)) {
+            selected++;
+        } else {
+            reader_leave(rcu_util, epoch, node);
+        }
+    }
+    return selected;
+}
+
+/* wake up the readers selected for the message of the epoch, with the level mutex held */
+static void filter_wake(rcu_util_ptr rcu_util, int epoch) {
+    struct filter_reg *reg;
+    list_for_each_entry(reg, &rcu_util->filtered, node) {
+        if (READ_ONCE(reg->state) == FILTER_SELECTED && reg->epoch == epoch) wake_up_all(&reg->wq);
+    }
+}
+
+/**
+ * @description Sets up the shared-memory ring of a level, or attaches to the existing one if the geometry matches
+ * (any geometry if slots is 0). The ring is created once under the level mutex and lives as long as the tag.
+ * @return the size of the ring to map on success, an error code on failure
+ */
+static int ring_setup(tag_ptr_t my_tag, struct tag_ring_req *req) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[req->level];
+    struct ring_util *ring;
+    size_t size = PAGE_ALIGN(sizeof(struct tag_ring_hdr) + (size_t) req->slots * TAG_RING_STRIDE(req->slot_size));
+
+    if (mutex_lock_interruptible(&rcu_util->mtx) == -EINTR) return -EINTR;
+    ring = rcu_util->ring;
+    if (ring != NULL) {
+        mutex_unlock(&rcu_util->mtx);
+        if (req->slots != 0 && (ring->slots != req->slots || ring->slot_size != req->slot_size)) return -EEXIST;
+        return (int) ring->size;
+    }
+    if (req->slots == 0) {
+        mutex_unlock(&rcu_util->mtx);
+        return -ENXIO;
+    }
+
+    ring = kzalloc_node(sizeof(struct ring_util), GFP_KERNEL, rcu_util->node);
+    if (ring != NULL) ring->hdr = vmalloc_user(size);
+    if (ring == NULL || ring->hdr == NULL) {
+        mutex_unlock(&rcu_util->mtx);
+        kfree(ring);
+        return -ENOMEM;
+    }
+    ring->size = size;
+    ring->slots = ring->hdr->slots = req->slots;
+    ring->slot_size = ring->hdr->slot_size = req->slot_size;
+    init_waitqueue_head(&ring->wq);
+    asm volatile ("mfence":: : "memory");
+    /* mmap and the waits look it up without the mutex */
+    WRITE_ONCE(rcu_util->ring, ring);
+    mutex_unlock(&rcu_util->mtx);
+    return (int) size;
+}
+
+/*
+ * mmap of a tag descriptor: the page offset selects the level, the whole ring is mapped.
+ * The mapping holds the file, the file holds the tag memory and so the ring.
+ */
+static int tag_handle_mmap(struct file *file, struct vm_area_struct *vma) {
+    tag_handle_ptr handle = file->private_data;
+    struct ring_util *ring;
+    rcu_util_ptr rcu_util;
+
+    if (!handle->allowed) return -EPERM;
+    if (vma->vm_pgoff >= LEVELS) return -EINVAL;
+    /* a level with a ring is never reclaimed, the ring lives as long as the tag */
+    rcu_read_lock();
+    rcu_util = READ_ONCE(handle->tag->msg_rcu_util_list[vma->vm_pgoff]);
+    ring = rcu_util == NULL ? NULL : READ_ONCE(rcu_util->ring);
+    rcu_read_unlock();
+    if (ring == NULL) return -ENXIO;
+    if (vma->vm_end - vma->vm_start != ring->size) return -EINVAL;
+    return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+static int tag_handle_release(struct inode *inode, struct file *file) {
+    tag_handle_ptr handle = file->private_data;
+    (void) inode;
+    /* the registrations keep the shrinker away from their levels until they are gone, see tag_reclaim */
+    down_read(&tag_list[handle->index].tag_node_rwsem);
+    direct_release(handle);
+    filter_release(handle);
+    up_read(&tag_list[handle->index].tag_node_rwsem);
+    tag_release(handle->tag);
+    kfree(handle);
+    return 0;
+}
+
+static const struct file_operations tag_fops = {
+        .owner = THIS_MODULE,
+        .release = tag_handle_release,
+        .mmap = tag_handle_mmap,
+};
+
+/**
+ * @description Opens a new tag descriptor on a tag_list entry: the tag is pinned and the permission check is done
+ * once for all the operations issued through the descriptor.
+ * @param tag tag_list entry
+ * @return the tag descriptor on success, an error code on failure
+ */
+static int tag_handle_open(int tag) {
+    tag_handle_ptr handle;
+    tag_ptr_t my_tag;
+    int fd;
+
+    handle = kzalloc(sizeof(struct tag_handle), GFP_KERNEL);
+    if (handle == NULL) return -ENOMEM;
+
+    rcu_read_lock();
+    my_tag = rcu_dereference(tag_list[tag].tag_ptr);
+    if (my_tag != NULL && !refcount_inc_not_zero(&my_tag->refs)) my_tag = NULL;
+    rcu_read_unlock();
+    if (my_tag == NULL) {
+        /* removed in the meanwhile */
+        kfree(handle);
+        return -EAGAIN;
+    }
+
+    handle->tag = my_tag;
+    handle->index = tag;
+    handle->allowed = GOT_PERMISSION(my_tag->uid.val, my_tag->perm);
+
+    fd = anon_inode_getfd("[tag]", &tag_fops, handle, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        tag_release(my_tag);
+        kfree(handle);
+    }
+    return fd;
+}
+
+/**
+ * @description Resolves a tag descriptor of the calling process.
+ * @return 0 on success, -EBADF if fd is not a tag descriptor. On success release the file with fdput.
+ */
+static int tag_fdget(int fd, struct fd *f, tag_handle_ptr *handle) {
+    *f = fdget(fd);
+    if (f->file == NULL) return -EBADF;
+    if (f->file->f_op != &tag_fops) {
+        fdput(*f);
+        return -EBADF;
+    }
+    *handle = f->file->private_data;
+    return 0;
+}
+
+/*
+ * Takes a users reference. The shrinker holds the tag at zero users for a moment while it releases the level state
+ * (see tag_reclaim): only a removed tag is also gone from its tag_list entry. Both wake up the threads waiting for
+ * the tag with wake_up_var on users once done.
+ */
+static bool tag_get_user(tag_handle_ptr handle) {
+    tag_ptr_t my_tag = handle->tag;
+
+    while (!refcount_inc_not_zero(&my_tag->users)) {
+        wait_var_event(&my_tag->users, refcount_read(&my_tag->users) != 0 ||
+                                       rcu_access_pointer(tag_list[handle->index].tag_ptr) != my_tag);
+        if (rcu_access_pointer(tag_list[handle->index].tag_ptr) != my_tag) return false;
+    }
+    return true;
+}
+
+/**
+ * @description Pins the tag of a descriptor for the duration of an operation, so that it cannot be removed until
+ * tag_put is called. The reference can be held while sleeping. Neither the tag_list nor the credentials are looked up.
+ * The level state released by the shrinker is rebuilt, so that the caller always finds it.
+ * @return 0 on success, an error code on failure.
+ */
+static int handle_pin(tag_handle_ptr handle, tag_ptr_t *my_tag) {
+    int ret = 0;
+
+    if (!handle->allowed) {
+        ret = -EPERM;
+    } else if (!tag_get_user(handle)) {
+        /* tag removed */
+        ret = -ENOENT;
+    } else if (READ_ONCE(handle->tag->dying)) {
+        /* tag being removed */
+        tag_put(handle->tag);
+        ret = -EIDRM;
+    } else if (READ_ONCE(handle->tag->reclaimed) && (ret = tag_rebuild(handle->tag)) < 0) {
+        tag_put(handle->tag);
+    } else {
+        if (READ_ONCE(handle->tag->last_use) != jiffies) WRITE_ONCE(handle->tag->last_use, jiffies);
+        *my_tag = handle->tag;
+    }
+    return ret;
+}
+
+/* handle_pin on the tag of a descriptor of the calling process */
+static int tag_pin(int fd, tag_ptr_t *my_tag) {
+    struct fd f;
+    tag_handle_ptr handle;
+    int ret = tag_fdget(fd, &f, &handle);
+    if (ret < 0) return ret;
+    ret = handle_pin(handle, my_tag);
+    fdput(f);
+    return ret;
+}
+
+/*
+ * Used only if a new IPC_PRIVATE tag cannot be returned to the creator: nobody else can reach it.
+ */
+static void discard_tag(int tag) {
+    down_write(&tag_list[tag].tag_node_rwsem);
+    remove_tag(tag, 0, 0);
+    up_write(&tag_list[tag].tag_node_rwsem);
+}
+
+/**
+ * @description Validates the arguments of tag_get and isolates the NUMA node hint from the command.
+ */
+static int tag_get_parse(int key, int *command, int *node) {
+    if (key > max_key || key < 0) {
+        //not valid key
+        return -EINVAL;
+    }
+
+    /* isolate the NUMA node hint from the command */
+    *node = ((*command & TAG_NODE_MASK) >> TAG_NODE_SHIFT) - 1;
+    *command &= ~TAG_NODE_MASK;
+    if (*node != NUMA_NO_NODE && (*node >= nr_node_ids || !node_online(*node))) {
+        return -EINVAL;
+    }
+
+    /* use xor funtions a xor (b xor a ) = a to isolate a command bit */
+    if (key != IPC_PRIVATE && (*command ^ IPC_EXCL) != IPC_CREAT && *command != IPC_CREAT && *command != TAG_OPEN) {
+        /*not valid command was specified */
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @description Opens or creates the tag of a key, with key_list_mtx held.
+ * A new tag uses *spare if it has been already allocated (then *spare is set to NULL) and is published in the first
+ * free entry of the tag_list after *from (see publish_tag).
+ */
+static int tag_get_key(int key, int command, int permissions, int node, tag_ptr_t *spare, int *from) {
+    int tag_descriptor, fd;
+
+    if (key_list[key] != -1) {
+        //corresponding tag already exists
+        tag_descriptor = key_list[key];
+
+        /*case of IPC_CREAT | IPC_EXCL */
+        if ((command ^ IPC_CREAT) == IPC_EXCL) {
+            //return error because was specified IPC_EXCL
+            return -EEXIST;
+        }
+
+        /* still under the key lock: the tag cannot be removed and its entry reused meanwhile */
+        return tag_handle_open(tag_descriptor);
+
+    }
+    /* open only */
+    if (command == TAG_OPEN) return -ENOENT;
+
+    if (*spare == NULL) *spare = alloc_tag(key, permissions, node);
+    tag_descriptor = *spare == NULL ? -ENOMEM : publish_tag(*spare, from);
+    if (tag_descriptor < 0) {
+        printk(KERN_INFO "%s : Unable to create a new tag.", MODNAME);
+        //tag creation failed
+        return -ENOMEM;
+    }
+    *spare = NULL;
+
+    //modify key-list: insert a new tag associated to the key
+    key_list[key] = tag_descriptor;
+    /* if the descriptor cannot be opened the tag is anyhow reachable by key */
+    fd = tag_handle_open(tag_descriptor);
+
+    return fd;
+}
 
 /**
  * @description Create a new instance associated with the key or opens an existing one by using the key.
@@ -42,99 +828,504 @@ static DEFINE_MUTEX(key_list_mtx);
  * @param key associated to a tag or IPC_PRIVATE
  * @param command Use IPC_CREAT to create a new tag instance associated to the corresponding key or to open an existing one.
  * If  IPC_CREAT | IPC_EXCL is specified and the tag instance associated to the key already exists an error is generated.
+ * Use TAG_OPEN to open only the existing tag of the key, without creating it.
+ * TAG_NODE(n) can be added to place the state of a newly created tag on the NUMA node n (EINVAL if n is not online).
  * @param permissions 0 to grant all user access, > 0 if the access is restricted to the creator
- * @return a tag descriptor on success or an appropriate error code.
+ * @return a tag descriptor on success or an appropriate error code. The descriptor is a file descriptor of the calling
+ * process (close-on-exec) that pins the tag and records the permission check: use close() to release it, it can be
+ * shared with fork or passed over a unix socket. Every call returns a new descriptor.
  * @errors
  * EINVAL: Invalid Arguments.\n
  * ENOMEM: Out of memory.\n
  * EEXIST: Tag already exists and IPC_EXCL is specified with IPC_CREAT.\n
+ * ENOENT: No tag for the key and TAG_OPEN is specified.\n
  * EEAGAIN: Operation failed, but if you retry may success.\n
+ * EMFILE: Too many open files.\n
  */
 int tag_get(int key, int command, int permissions) {
-    int tag_descriptor;
-    if (key > max_key || key < 0) {
-        //not valid key
-        return -EINVAL;
-    }
+    int tag_descriptor, node, fd, from = 0;
+    tag_ptr_t spare = NULL;
+
+    fd = tag_get_parse(key, &command, &node);
+    if (fd < 0) return fd;
 
     if (key == IPC_PRIVATE) {
 
-        tag_descriptor = create_tag(key, permissions);
+        tag_descriptor = create_tag(key, permissions, node);
         if (tag_descriptor < 0) {
             printk(KERN_INFO "%s : Unable to create a new tag.\n", MODNAME);
             //tag creation failed
             return -ENOMEM;
         }
         /*with IPC_PRIVATE the tag is not associate to a key*/
-        return tag_descriptor;
+        fd = tag_handle_open(tag_descriptor);
+        if (fd < 0) discard_tag(tag_descriptor);
+        return fd;
     }
-    /* use xor funtions a xor (b xor a ) = a to isolate a command bit */
-    if ((command ^ IPC_EXCL) == IPC_CREAT || command == IPC_CREAT) {
-        /*case of IPC_CREAT | IPC_EXCL  or just IPC_CREAT */
-        if (mutex_lock_interruptible(&key_list_mtx) == -EINTR) return -EINTR;
-
-        if (key_list[key] != -1) {
-            //corresponding tag already exists
-            tag_descriptor = key_list[key];
-            mutex_unlock(&key_list_mtx);
-
-            /*case of IPC_CREAT | IPC_EXCL */
-            if ((command ^ IPC_CREAT) == IPC_EXCL) {
-                //return error because was specified IPC_EXCL
-                return -EEXIST;
-            }
 
-            return tag_descriptor;
+    if (mutex_lock_interruptible(&key_list_mtx) == -EINTR) return -EINTR;
+    fd = tag_get_key(key, command, permissions, node, &spare, &from);
+    //release lock
+    mutex_unlock(&key_list_mtx);
+    return fd;
+
+}
+
+/**
+ * @description Opens or creates many tags at once, like nr calls of tag_get(reqs[i].key, reqs[i].command,
+ * reqs[i].permissions) but with one system call, one acquisition of the key lock and the state of the new tags
+ * allocated before taking it. The result of each request (tag descriptor or negative error code) is stored in
+ * reqs[i].ret; a failed request does not stop the others.
+ * @param reqs userspace array of requests
+ * @param nr number of requests, at most MAX_BULK_GET
+ * @return the number of tag descriptors opened, an error code if the array cannot be processed.
+ * @errors
+ * EINVAL: Invalid Arguments.\n
+ * ENOMEM: Out of memory.\n
+ * EFAULT: Invalid user address.\n
+ * EINTR: Stopped, interrupt occured.\n
+ */
+int tag_get_bulk(struct tag_get_req *reqs, unsigned int nr) {
+    struct tag_get_req *req;
+    tag_ptr_t *spares;
+    int *nodes;
+    unsigned int i;
+    int opened = 0, from = 0, tag_descriptor;
+
+    if (reqs == NULL || nr == 0 || nr > MAX_BULK_GET) {
+        /* Invalid Arguments error */
+        return -EINVAL;
+    }
+
+    req = kmalloc(sizeof(struct tag_get_req) * nr, GFP_KERNEL);
+    spares = kzalloc(sizeof(tag_ptr_t) * nr, GFP_KERNEL);
+    nodes = kmalloc(sizeof(int) * nr, GFP_KERNEL);
+    if (req == NULL || spares == NULL || nodes == NULL) {
+        opened = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(req, reqs, sizeof(struct tag_get_req) * nr) != 0) {
+        opened = -EFAULT;
+        goto out;
+    }
 
+    /* allocate the tags that will be likely created out of any lock, the key check is repeated under the lock */
+    for (i = 0; i < nr; i++) {
+        req[i].ret = tag_get_parse(req[i].key, &req[i].command, &nodes[i]);
+        if (req[i].ret < 0) continue;
+        if (req[i].key == IPC_PRIVATE || (req[i].command != TAG_OPEN && READ_ONCE(key_list[req[i].key]) == -1)) {
+            spares[i] = alloc_tag(req[i].key, req[i].permissions, nodes[i]);
         }
+    }
 
-        tag_descriptor = create_tag(key, permissions);
+    if (mutex_lock_interruptible(&key_list_mtx) == -EINTR) {
+        opened = -EINTR;
+        goto out;
+    }
+    for (i = 0; i < nr; i++) {
+        if (req[i].ret < 0) continue;
+        if (req[i].key != IPC_PRIVATE) {
+            req[i].ret = tag_get_key(req[i].key, req[i].command, req[i].permissions, nodes[i], &spares[i], &from);
+            continue;
+        }
+        if (spares[i] == NULL) spares[i] = alloc_tag(req[i].key, req[i].permissions, nodes[i]);
+        tag_descriptor = spares[i] == NULL ? -ENOMEM : publish_tag(spares[i], &from);
         if (tag_descriptor < 0) {
-            printk(KERN_INFO "%s : Unable to create a new tag.", MODNAME);
-            mutex_unlock(&key_list_mtx);
-            //tag creation failed
-            return -ENOMEM;
+            req[i].ret = -ENOMEM;
+            continue;
         }
+        spares[i] = NULL;
+        /*with IPC_PRIVATE the tag is not associate to a key*/
+        req[i].ret = tag_handle_open(tag_descriptor);
+        if (req[i].ret < 0) discard_tag(tag_descriptor);
+    }
+    mutex_unlock(&key_list_mtx);
 
-        //modify key-list: insert a new tag associated to the key
-        key_list[key] = tag_descriptor;
-        //release lock
-        mutex_unlock(&key_list_mtx);
+    for (i = 0; i < nr; i++) {
+        if (req[i].ret >= 0) opened++;
+    }
+    /* the descriptors already opened stay valid (and owned by the caller) even if the results cannot be copied */
+    if (copy_to_user(reqs, req, sizeof(struct tag_get_req) * nr) != 0) opened = -EFAULT;
 
-        return tag_descriptor;
+    out:
+    /* tags allocated for keys that meanwhile got one */
+    if (spares != NULL) {
+        for (i = 0; i < nr; i++) tag_cleanup_mem(spares[i]);
+    }
+    kfree(nodes);
+    kfree(spares);
+    kfree(req);
+    return opened;
+}
 
+/**
+ * @description Returns the NUMA node with most standing readers on a level, NUMA_NO_NODE if nobody is waiting.
+ */
+static int readers_node(rcu_util_ptr rcu_util) {
+    int node, best = NUMA_NO_NODE;
+    unsigned long max = 0;
+    for (node = 0; node < nr_node_ids; node++) {
+        if (READ_ONCE(rcu_util->node_standings[node]) > max) {
+            max = READ_ONCE(rcu_util->node_standings[node]);
+            best = node;
+        }
+    }
+    return best;
+}
+
+/**
+ * @description Copies the message on every other node with standing readers, so that they don't read it remotely.
+ * A failed allocation is not an error: readers of that node will use the main copy.
+ */
+static void make_replicas(struct tag_msg *msg, rcu_util_ptr rcu_util, int msg_node) {
+    int node;
+    char *replica;
+    msg->replicas = kzalloc(sizeof(char *) * nr_node_ids, GFP_KERNEL);
+    if (msg->replicas == NULL) return;
+    for (node = 0; node < nr_node_ids; node++) {
+        if (node == msg_node || READ_ONCE(rcu_util->node_standings[node]) == 0) continue;
+        replica = kmalloc_node(msg->size, GFP_KERNEL, node);
+        if (replica == NULL) continue;
+        memcpy(replica, msg->data, msg->size);
+        msg->replicas[node] = replica;
     }
+}
 
-    /*not valid command was specified */
+static void last_value_free_rcu(struct rcu_head *head) {
+    kfree(container_of(head, struct last_value, rcu));
+}
 
-    return -EINVAL;
+static void last_value_put(struct last_value *lv) {
+    if (refcount_dec_and_test(&lv->refs)) call_rcu(&lv->rcu, last_value_free_rcu);
+}
+
+/* metadata of a message sent by the current task but the sequence number */
+static void msg_origin_init(struct tag_msg_info *info, int level, size_t size) {
+    info->send_ns = ktime_get_ns();
+    info->tgid = task_tgid_nr(current);
+    info->uid = current_uid().val;
+    info->size = (unsigned int) size;
+    info->level = level;
+}
+
+/* metadata of a message sent by the current task, it takes the next sequence number of the level */
+static void msg_info_init(struct tag_msg_info *info, rcu_util_ptr rcu_util, int level, size_t size) {
+    info->seq = __sync_add_and_fetch(&rcu_util->seq, 1);
+    msg_origin_init(info, level, size);
+}
+
+/**
+ * @description Send on a conflating level: the message replaces the current value of the level and the readers
+ * waiting for a newer version are woken up. The sender never waits for readers nor for other senders.
+ */
+static int last_value_send(tag_ptr_t my_tag, int level, char *buffer, size_t size) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+    struct last_value *lv, *old;
+
+    lv = kmalloc_node(sizeof(struct last_value) + size, GFP_KERNEL, readers_node(rcu_util));
+    if (lv == NULL) return -ENOMEM;
+    if (copy_from_user(lv->data, buffer, size) != 0) {
+        kfree(lv);
+        return -EFAULT;
+    }
+    lv->size = size;
+    refcount_set(&lv->refs, 1);
+    msg_info_init(&lv->info, rcu_util, level, size);
+
+    /*
+     * concurrent senders are ordered by the swap, the old value is alive under rcu_read_lock;
+     * a value never replaces one with a higher sequence number, the skipped numbers count as conflated values
+     */
+    rcu_read_lock();
+    do {
+        old = rcu_dereference(rcu_util->last);
+        lv->version = old == NULL ? 1 : old->version + 1;
+        if (old != NULL && old->info.seq > lv->info.seq) lv->info.seq = __sync_add_and_fetch(&rcu_util->seq, 1);
+    } while (__sync_val_compare_and_swap(&rcu_util->last, old, lv) != old);
+    rcu_read_unlock();
+    __sync_fetch_and_add(&rcu_util->published, 1);
+
+    /* a reader registers in standings before checking published: nobody waiting means nobody to wake up */
+    if (READ_ONCE(rcu_util->standings[0]) + READ_ONCE(rcu_util->standings[1]) != 0) {
+        wake_epoch(rcu_util, 0);
+        wake_epoch(rcu_util, 1);
+    }
+
+    if (old != NULL) last_value_put(old);
+    return 0;
+}
+
+/**
+ * @description Copies the current value of a conflating level and records its version in the descriptor.
+ * The value is pinned with a reference because the copy to user space can sleep.
+ */
+static int last_value_copy(rcu_util_ptr rcu_util, tag_handle_ptr handle, int level, char *buffer, size_t size,
+                           struct tag_msg_info *info) {
+    struct last_value *lv;
+    int ret;
+
+    rcu_read_lock();
+    do {
+        /* a failed reference means that the value has just been replaced, look at the new one */
+        lv = rcu_dereference(rcu_util->last);
+    } while (lv != NULL && !refcount_inc_not_zero(&lv->refs));
+    rcu_read_unlock();
+    if (lv == NULL) return -EFAULT;
+
+    if (lv->size > size) {
+        // provided buffer is not large enough to copy the value
+        ret = -ENOBUFS;
+    } else if (copy_to_user(buffer, lv->data, lv->size) != 0) {
+        ret = -EFAULT;
+    } else {
+        ret = (int) lv->size;
+        if (info != NULL) *info = lv->info;
+        if (lv->version > READ_ONCE(handle->seen[level])) WRITE_ONCE(handle->seen[level], lv->version);
+    }
+    last_value_put(lv);
+    return ret;
+}
+
+/**
+ * @description Publishes a message in the current epoch of the level, wakes up its readers and waits for them, up
+ * to the delivery deadline of the tag, with the level mutex held and a reference on the message.
+ */
+static void publish_epoch(tag_ptr_t my_tag, int level, struct tag_msg *msg) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+    int grace_epoch, next_epoch, selected;
+    unsigned long late;
+    u64 deadline_ns, deadline = 0;
+
+    grace_epoch = next_epoch = rcu_util->current_epoch;
+    rcu_assign_pointer(my_tag->msg_store[level]->msg[grace_epoch], msg);
+    rcu_util->awake[grace_epoch] = MESSAGE;
+    /* filtered readers join the epoch only if the message matches */
+    selected = filter_select(my_tag, rcu_util, msg, grace_epoch);
+
+    // now change epoch still under write lock
+    next_epoch += 1;
+    next_epoch = next_epoch % 2;
+    /* a reader seeing the new epoch must read its new round, not the one of its previous use */
+    rcu_util->round[next_epoch]++;
+    rcu_util->awake[next_epoch] = NO;
+    asm volatile ("mfence":: : "memory");
+    WRITE_ONCE(rcu_util->current_epoch, next_epoch);
+    asm volatile ("mfence":: : "memory");
+    /* the single receives held back by a combined batch join the next epoch (see single_enter) */
+    WRITE_ONCE(rcu_util->combining, 0);
+
+    /* wake up all thread waiting on the queues corresponding to the grace_epoch */
+    fanout_wake(rcu_util, grace_epoch);
+    if (selected != 0) filter_wake(rcu_util, grace_epoch);
+
+    /*
+     * wait until all readers have taken a reference to the message (they copy it on their own), or up to the
+     * delivery deadline of the tag: a reader that is not even scheduled must not hold up the level
+     */
+    deadline_ns = READ_ONCE(my_tag->deadline_ns);
+    if (deadline_ns != 0) deadline = ktime_get_ns() + deadline_ns;
+    while (rcu_util->standings[grace_epoch] > 0) {
+        if (deadline != 0 && ktime_get_ns() > deadline) {
+            late = READ_ONCE(rcu_util->standings[grace_epoch]);
+            if (late == 0) break;
+            /* detach: the late readers find no message and return -ETIMEDOUT, recorded before the message goes */
+            WRITE_ONCE(rcu_util->detached[grace_epoch], rcu_util->round[grace_epoch]);
+            __sync_fetch_and_add(&my_tag->delivery_stats.detached, 1);
+            __sync_fetch_and_add(&my_tag->delivery_stats.late, late);
+            break;
+        }
+        schedule();
+    }
+    /* the work items of fanout_wake use the level state */
+    while (READ_ONCE(rcu_util->fanout_pending) != 0) schedule();
+
+    /* here all readers on the grace_epoch took the message or are late */
+    RCU_INIT_POINTER(my_tag->msg_store[level]->msg[grace_epoch], NULL);
+}
+
+/**
+ * @description A receive that returns a single message could not take the rest of a combined batch: it is counted
+ * in singles for the whole call, so that the combiners of the level publish one epoch per message (see combine).
+ * A combiner that is about to publish a batch is waited for, the receive then joins the epoch after the batch.
+ */
+static void single_enter(rcu_util_ptr rcu_util) {
+    for (;;) {
+        __sync_fetch_and_add(&rcu_util->singles, 1);
+        /* either the combiner sees me counted or I see it combining */
+        if (!READ_ONCE(rcu_util->combining)) return;
+        __sync_fetch_and_add(&rcu_util->singles, -1);
+        while (READ_ONCE(rcu_util->combining)) schedule();
+    }
+}
+
+static inline void single_leave(rcu_util_ptr rcu_util) {
+    __sync_fetch_and_add(&rcu_util->singles, -1);
+}
+
+/* publishes a message of the combiner, or a batch, if some reader waits for it (see tag_send) */
+static void combine_publish(tag_ptr_t my_tag, int level, struct tag_msg *msg) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+
+    if (READ_ONCE(rcu_util->standings[rcu_util->current_epoch]) == 0 && !filter_armed(rcu_util)) return;
+    asm volatile ("mfence":: : "memory");
+    publish_epoch(my_tag, level, msg);
+}
+
+/**
+ * @description Publishes the messages queued by the senders that found the level mutex busy (see combine_send), with
+ * the level mutex held: every message takes its sequence number in submission order. If no receive of a single
+ * message runs on the level (see single_enter), that is every reader is in tag_receive_batch, the messages are
+ * published as one batch: one epoch, one wake up and one drain serve all of them, the messages after the first one
+ * hang on the batch pointer and every reader copies the whole batch within its own call (see set_receive).
+ * Otherwise every message is published in an epoch of its own, as if its sender got the mutex.
+ * The outcome of the send is stored in every message before it is marked SUBMIT_DONE.
+ */
+static void combine(tag_ptr_t my_tag, int level) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+    struct tag_msg *msg, *next, *first = NULL;
+    bool batch = false;
+    int node, ret = 0;
+
+    /* take the whole list, newest first: reversing it gives the submission order */
+    for (msg = __sync_lock_test_and_set(&rcu_util->submitted, NULL); msg != NULL; msg = next) {
+        next = msg->submit_next;
+        if (!__sync_bool_compare_and_swap(&msg->submit_state, SUBMIT_PENDING, SUBMIT_CLAIMED)) {
+            /* canceled by its sender, only the reference of the list is left */
+            tag_msg_put(msg);
+            continue;
+        }
+        msg->submit_next = first;
+        first = msg;
+    }
+    if (first == NULL) return;
+
+    if (READ_ONCE(my_tag->dying)) {
+        /* removed while waiting for the other senders, readers are leaving */
+        ret = -EIDRM;
+    } else if (READ_ONCE(rcu_util->conflate)) {
+        /* switched to last-value mode while waiting for the other senders: each sender publishes its value */
+        ret = -EAGAIN;
+    } else {
+        for (msg = first; msg != NULL; msg = msg->submit_next) {
+            msg->info.seq = __sync_add_and_fetch(&rcu_util->seq, 1);
+        }
+        if (READ_ONCE(rcu_util->standings[rcu_util->current_epoch]) != 0 || filter_armed(rcu_util)) {
+            node = readers_node(rcu_util);
+            for (msg = first; msg != NULL; msg = msg->submit_next) {
+                if (numa_replica_size != 0 && msg->size >= numa_replica_size) {
+                    make_replicas(msg, rcu_util, node == NUMA_NO_NODE ? numa_node_id() : node);
+                }
+            }
+        }
+        if (first->submit_next != NULL) {
+            /* single receives wait from now on until the batch epoch is flipped, unless one is counted already */
+            WRITE_ONCE(rcu_util->combining, 1);
+            asm volatile ("mfence":: : "memory");
+            batch = READ_ONCE(rcu_util->singles) == 0;
+        }
+        if (batch) {
+            /* registered buffers and filters are only armed by single receives: nobody to deliver to apart */
+            for (msg = first; msg->submit_next != NULL; msg = msg->submit_next) {
+                refcount_inc(&msg->submit_next->refs);
+                msg->batch = msg->submit_next;
+            }
+            combine_publish(my_tag, level, first);
+        } else {
+            WRITE_ONCE(rcu_util->combining, 0);
+            for (msg = first; msg != NULL; msg = msg->submit_next) {
+                direct_deliver(rcu_util, msg->data, msg->size, &msg->info, true);
+                combine_publish(my_tag, level, msg);
+            }
+        }
+        /* nobody was waiting for the batch, publish_epoch did not run */
+        WRITE_ONCE(rcu_util->combining, 0);
+    }
+
+    for (msg = first; msg != NULL; msg = next) {
+        next = msg->submit_next;
+        msg->submit_ret = ret;
+        asm volatile ("mfence":: : "memory");
+        WRITE_ONCE(msg->submit_state, SUBMIT_DONE);
+        tag_msg_put(msg);
+    }
+}
 
+/**
+ * @description Send on a level whose mutex is busy: rather than waiting for the mutex to run a whole publish, wake
+ * and drain cycle of its own, the sender queues its message on the submission list of the level and the next holder
+ * of the mutex publishes all the queued messages at once (combine). The sender that gets the mutex while its
+ * message is still queued is the combiner.
+ * @return as tag_send
+ */
+static int combine_send(tag_ptr_t my_tag, int level, char *buffer, size_t size) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+    struct tag_msg *msg, *head;
+    int ret;
+
+    msg = kzalloc_node(sizeof(struct tag_msg) + size, GFP_KERNEL, readers_node(rcu_util));
+    if (msg == NULL) return -ENOMEM;
+    if (copy_from_user(msg->data, buffer, size) != 0) {
+        kfree(msg);
+        return -EFAULT;
+    }
+    /* one reference for me and one for the submission list, the combiner assigns the sequence number */
+    refcount_set(&msg->refs, 2);
+    msg->size = size;
+    msg_origin_init(&msg->info, level, size);
+    msg->submit_state = SUBMIT_PENDING;
+    do {
+        head = READ_ONCE(rcu_util->submitted);
+        msg->submit_next = head;
+    } while (!__sync_bool_compare_and_swap(&rcu_util->submitted, head, msg));
+
+    if (mutex_lock_interruptible(&rcu_util->mtx) == -EINTR) {
+        if (__sync_bool_compare_and_swap(&msg->submit_state, SUBMIT_PENDING, SUBMIT_CANCELED)) {
+            /* the next combiner drops it */
+            tag_msg_put(msg);
+            return -EINTR;
+        }
+        /* a combiner took it already: the send ends with its batch */
+        mutex_lock(&rcu_util->mtx);
+    }
+    /* with the mutex held the message is either still queued or done */
+    if (READ_ONCE(msg->submit_state) != SUBMIT_DONE) combine(my_tag, level);
+    mutex_unlock(&rcu_util->mtx);
+    ret = msg->submit_ret;
+    tag_msg_put(msg);
+
+    if (ret == -EAGAIN) ret = last_value_send(my_tag, level, buffer, size);
+    return ret;
 }
 
 /**
  * @description Send a message to the corresponding tag-level instance, awake all waiting threads then wait delivery ends up.
  * This function could be blocking and could be interrupted by a signal.
  * This service doesn't keep any message log; if nobody waits for the incoming message this is discarded.
- * @param tag tag descriptor
+ * On a conflating level (see TAG_CONFLATE) the message replaces the value of the level and the call never blocks.
+ * The message is allocated on the NUMA node where most of the readers are waiting.
+ * @param tag tag descriptor returned by tag_get
  * @param level message source level
  * @param buffer userspace buffer address
  * @param size buffer lenght, empty messages are anyhow allowed.
  * @return 0 on success, appropriate error code otherwise
  * @errors
  * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
  * ENOMEM: Out of memory.\n
- * ENOENT: Tag doesn't exist.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
  * EINTR: Stopped, interrupt occured.\n
  * EPERM: Operation not permitted.\n
  * EFAULT: Message delivery fault.\n
  */
 int tag_send(int tag, int level, char *buffer, size_t size) {
     tag_ptr_t my_tag;
-    char *msg;
-    int grace_epoch, next_epoch;
+    struct tag_msg *msg;
+    struct tag_msg_info info;
+    int node, ret;
     unsigned long res;
 
-    if (tag < 0 || tag >= max_tg || level >= LEVELS || level < 0 || buffer == NULL || size < 0 || size > msg_size) {
+    if (level >= LEVELS || level < 0 || buffer == NULL || size > msg_size) {
         /* Invalid Arguments error */
         return -EINVAL;
     }
@@ -145,249 +1336,1130 @@ int tag_send(int tag, int level, char *buffer, size_t size) {
         return 0;
     }
 
-    /* take read lock to avoid that someone deletes the tag entry during my job*/
-    if (down_read_killable(&tag_list[tag].tag_node_rwsem) == -EINTR) return -EINTR;
+    /* take a reference to avoid that someone deletes the tag during my job*/
+    ret = tag_pin(tag, &my_tag);
+    if (ret < 0) return ret;
+    if (READ_ONCE(my_tag->msg_rcu_util_list[level]->conflate)) {
+        ret = last_value_send(my_tag, level, buffer, size);
+        tag_put(my_tag);
+        return ret;
+    }
+    /* other senders on the same tag-level exclusion, a sender finding it busy is combined with the others */
+    if (!mutex_trylock(&(my_tag->msg_rcu_util_list[level]->mtx))) {
+        ret = combine_send(my_tag, level, buffer, size);
+        tag_put(my_tag);
+        return ret;
+    }
+    if (READ_ONCE(my_tag->dying)) {
+        /* removed while waiting for the other senders, readers are leaving */
+        mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
+        tag_put(my_tag);
+        return -EIDRM;
+    }
+    if (READ_ONCE(my_tag->msg_rcu_util_list[level]->conflate)) {
+        /* switched to last-value mode while waiting for the other senders */
+        mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
+        ret = last_value_send(my_tag, level, buffer, size);
+        tag_put(my_tag);
+        return ret;
+    }
 
-    my_tag = tag_list[tag].tag_ptr;
-    if (my_tag != NULL) {
-        /* permisson check */
-        if (GOT_PERMISSION(my_tag->uid.val, my_tag->perm)) {
-            /* other senders on the same tag-level exclusion */
-            if (mutex_lock_interruptible(&(my_tag->msg_rcu_util_list[level]->mtx)) == -EINTR) {
-                /*release r_lock on the tag_list i-th entry previously obtained*/
-                up_read(&tag_list[tag].tag_node_rwsem);
-                return -EINTR;
-            }
+    /* the sequence number is taken also when nobody is waiting: receivers see the messages they missed */
+    msg_info_init(&info, my_tag->msg_rcu_util_list[level], level, size);
+    /* registered buffers first: their readers are not counted in standings and nobody waits for them */
+    ret = direct_deliver(my_tag->msg_rcu_util_list[level], buffer, size, &info, false);
+    if (READ_ONCE(my_tag->msg_rcu_util_list[level]->standings[my_tag->msg_rcu_util_list[level]->current_epoch]) == 0 &&
+        !filter_armed(my_tag->msg_rcu_util_list[level])) {
+        /* no other reader is waiting: no copy and no epoch change, a reader arriving now waits for the next message */
+        mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
+        tag_put(my_tag);
+        return ret;
+    }
 
-            /*  alloc memory to copy the info */
-            msg = (char *) kzalloc(size, GFP_KERNEL);
-            if (msg == NULL) {
-                /* release write lock on the message buffer of the corresponding level */
-                mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
-                /*release r_lock on the tag_list i-th entry previously obtained*/
-                up_read(&tag_list[tag].tag_node_rwsem);
-                /* unable to allocate memory*/
-                return -ENOMEM;
-            }
+    /*  alloc memory to copy the info next to the readers */
+    node = readers_node(my_tag->msg_rcu_util_list[level]);
+    msg = kzalloc_node(sizeof(struct tag_msg) + size, GFP_KERNEL, node);
+    if (msg == NULL) {
+        /* release write lock on the message buffer of the corresponding level */
+        mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
+        /*release the reference on the tag previously obtained*/
+        tag_put(my_tag);
+        /* unable to allocate memory*/
+        return -ENOMEM;
+    }
 
 
-            /* start to copy the message */
-            res = copy_from_user(msg, buffer, size);
-            asm volatile ("mfence":: : "memory");
-            if (res != 0) {
-                /* release write lock on the message buffer of the corresponding level */
-                mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
-                /*release r_lock on the tag_list i-th entry previously obtained*/
-                up_read(&tag_list[tag].tag_node_rwsem);
-
-                kfree(msg);
-                return -EFAULT;
-            }
+    /* start to copy the message */
+    res = copy_from_user(msg->data, buffer, size);
+    asm volatile ("mfence":: : "memory");
+    if (res != 0) {
+        /* release write lock on the message buffer of the corresponding level */
+        mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
+        /*release the reference on the tag previously obtained*/
+        tag_put(my_tag);
 
-            my_tag->msg_store[level]->msg = msg;
-            my_tag->msg_store[level]->size = size;
+        kfree(msg);
+        return -EFAULT;
+    }
 
-            grace_epoch = next_epoch = my_tag->msg_rcu_util_list[level]->current_epoch;
-            my_tag->msg_rcu_util_list[level]->awake[grace_epoch] = MESSAGE;
+    refcount_set(&msg->refs, 1);
+    msg->size = size;
+    msg->info = info;
+    if (numa_replica_size != 0 && size >= numa_replica_size) {
+        make_replicas(msg, my_tag->msg_rcu_util_list[level], node == NUMA_NO_NODE ? numa_node_id() : node);
+    }
 
-            // now change epoch still under write lock
-            next_epoch += 1;
-            next_epoch = next_epoch % 2;
-            my_tag->msg_rcu_util_list[level]->current_epoch = next_epoch;
-            my_tag->msg_rcu_util_list[level]->awake[next_epoch] = NO;
-            asm volatile ("mfence":: : "memory");
+    publish_epoch(my_tag, level, msg);
 
-            /* wake up all thread waiting on the queue corresponding to the grace_epoch */
-            wake_up_all(&my_tag->the_queue_head[level][grace_epoch]);
+    /* release write lock on the message buffer of the corresponding level */
+    mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
+    /*release the reference on the tag previously obtained*/
+    tag_put(my_tag);
 
-            /*wait until all readers have been consumed the message  */
-            while (my_tag->msg_rcu_util_list[level]->standings[grace_epoch] > 0) schedule();
+    tag_msg_put(msg);
 
-            /* here all readerers on the grace_epoch consumed the message */
-            /* restore default values */
-            my_tag->msg_store[level]->msg = NULL;
-            my_tag->msg_store[level]->size = 0;
+    return 0;
 
-            /* release write lock on the message buffer of the corresponding level */
-            mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
-            /*release r_lock on the tag_list i-th entry previously obtained*/
-            up_read(&tag_list[tag].tag_node_rwsem);
+}
 
-            kfree(msg);
+/* the level has been switched to the other mode after the reader started, see set_conflate */
+static inline bool mode_changed(rcu_util_ptr rcu_util, unsigned long seen) {
+    return READ_ONCE(rcu_util->conflate) != (seen != ULONG_MAX);
+}
 
-            return 0;
+/*
+ * wake up condition of a reader of the round of the epoch: a message or an awake notification, the reuse of the
+ * epoch, the removal of the tag, a switch of the level mode or, on a conflating level, a value newer than seen
+ * (ULONG_MAX for the readers of a normal level)
+ */
+static inline bool receive_ready(tag_ptr_t my_tag, rcu_util_ptr rcu_util, int epoch, unsigned long round,
+                                 unsigned long seen) {
+    return READ_ONCE(rcu_util->awake[epoch]) != NO || READ_ONCE(rcu_util->round[epoch]) != round ||
+           READ_ONCE(my_tag->dying) ||
+           READ_ONCE(rcu_util->published) > seen || mode_changed(rcu_util, seen);
+}
 
+/**
+ * @description Spins up to poll_ns waiting for the awake condition of the epoch, then the caller goes to sleep on the
+ * wait queue as usual. A message arriving while spinning saves the sleep and the wake up of the receiver.
+ */
+static void busy_poll(tag_ptr_t my_tag, rcu_util_ptr rcu_util, int epoch, unsigned long round, unsigned long seen,
+                      u64 poll_ns) {
+    u64 deadline = ktime_get_ns() + poll_ns;
+    while (!receive_ready(my_tag, rcu_util, epoch, round, seen)) {
+        if (need_resched() || signal_pending(current) || ktime_get_ns() > deadline) {
+            __sync_fetch_and_add(&my_tag->poll_stats.misses, 1);
+            return;
+        }
+        cpu_relax();
+    }
+    __sync_fetch_and_add(&my_tag->poll_stats.hits, 1);
+}
 
-        } else {
-            /*release r_lock on the tag_list i-th entry previously obtained*/
-            up_read(&tag_list[tag].tag_node_rwsem);
-            /* denied permission */
-            return -EPERM;
+/*
+ * wait_event_interruptible bounded by the receive timeout of a descriptor (0 waits forever):
+ * 0 if the condition holds, -ERESTARTSYS on signal, -ETIMEDOUT on expiry
+ */
+#define receive_wait(wq, condition, timeout) ({                              \
+    long __ret = 0;                                                           \
+    if ((timeout) == 0) {                                                     \
+        __ret = wait_event_interruptible(wq, condition);                      \
+    } else {                                                                  \
+        __ret = wait_event_interruptible_timeout(wq, condition, timeout);     \
+        if (__ret == 0) __ret = -ETIMEDOUT;                                   \
+        else if (__ret > 0) __ret = 0;                                        \
+    }                                                                         \
+    __ret;                                                                    \
+})
+
+/**
+ * @description Receive in the buffer registered with TAG_DIRECT: the sender copies the message in the pinned pages
+ * and the reader only collects the outcome, it is neither counted in standings nor waited for by the sender.
+ * @return bytes delivered or an error code; -EAGAIN if buffer is not the registered buffer of the level or it is
+ * already in use, then the usual path is taken
+ */
+static long direct_receive(tag_ptr_t my_tag, tag_handle_ptr handle, rcu_util_ptr rcu_util, int level, char *buffer,
+                           struct tag_msg_info *info) {
+    struct direct_buf *reg;
+    unsigned long gen;
+    int event_wq_ret;
+    long ret;
+
+    rcu_read_lock();
+    reg = rcu_dereference(handle->direct[level]);
+    if (reg != NULL && (reg->ubuf != buffer || !__sync_bool_compare_and_swap(&reg->state, DIRECT_IDLE, DIRECT_ARMED))) {
+        reg = NULL;
+    }
+    rcu_read_unlock();
+    if (reg == NULL) return -EAGAIN;
+
+    /* armed from now on: an awake notification counted after this point cancels the receive */
+    gen = READ_ONCE(rcu_util->awake_gen);
+    event_wq_ret = receive_wait(rcu_util->the_queue_head[0],
+                                READ_ONCE(reg->state) == DIRECT_FULL ||
+                                READ_ONCE(rcu_util->awake_gen) != gen || READ_ONCE(my_tag->dying) ||
+                                mode_changed(rcu_util, ULONG_MAX), READ_ONCE(handle->timeout));
+
+    if (__sync_bool_compare_and_swap(&reg->state, DIRECT_ARMED, DIRECT_IDLE)) {
+        /* nothing delivered */
+        if (event_wq_ret == -ERESTARTSYS) return -EINTR;
+        if (event_wq_ret == -ETIMEDOUT) return -ETIMEDOUT;
+        if (READ_ONCE(my_tag->dying)) return -EIDRM;
+        return -ECANCELED;
+    }
+    /* a sender took the buffer, wait for the end of its copy */
+    while (READ_ONCE(reg->state) != DIRECT_FULL) schedule();
+    ret = reg->len;
+    if (info != NULL) *info = reg->info;
+    WRITE_ONCE(reg->state, DIRECT_IDLE);
+    return ret;
+}
+
+/**
+ * @description Copies a message taken by a reader in buffer, from the copy of the node we are running on if any.
+ * @return bytes copied or an error code
+ */
+static long msg_copy(struct tag_msg *msg, char *buffer, size_t size, struct tag_msg_info *info) {
+    char *data;
+
+    if (msg->size > size) {
+        // provided buffer is not large enough to copy the info of the message
+        return -ENOBUFS;
+    }
+    data = msg->replicas != NULL ? msg->replicas[numa_node_id()] : NULL;
+    if (data == NULL) data = msg->data;
+    if (copy_to_user(buffer, data, msg->size) != 0) {
+        /* error during the copy-- partial delivery of the message not supported */
+        return -EFAULT;
+    }
+    if (info != NULL) *info = msg->info;
+    return (long) msg->size;
+}
+
+/**
+ * @description Outcome of a reader that found the message of its round gone: it is late (-ETIMEDOUT, counted as
+ * expired) only if the sender of the round detached at the deadline. Otherwise it has been counted in the epoch after
+ * its sender had left (see reader_join) and has to wait again.
+ * @return -ETIMEDOUT or -EAGAIN
+ */
+static int reader_late(tag_ptr_t my_tag, rcu_util_ptr rcu_util, int epoch, unsigned long round) {
+    /* a later round of the epoch can only start once the sender of mine has left */
+    if (READ_ONCE(rcu_util->detached[epoch]) < round) return -EAGAIN;
+    __sync_fetch_and_add(&my_tag->delivery_stats.expired, 1);
+    return -ETIMEDOUT;
+}
+
+/**
+ * @description Outcome of a reader of the epoch woken up by receive_ready: copies the message or the newer value of
+ * the level in buffer, or tells why the reader has been woken up. The reader leaves the epoch in any case.
+ * The message of a combined batch is the first one: if rest is not NULL the messages after it are stored there with
+ * a reference, for the caller to copy them in its next slots (see tag_receive_batch). Only the callers that can take
+ * a whole batch get one (see combine).
+ * @return bytes copied or an error code; -EAGAIN if the message is gone but its sender did not detach at the deadline
+ * (see reader_late), then the caller waits again
+ */
+static int reader_collect(tag_ptr_t my_tag, tag_handle_ptr handle, int level, int epoch, unsigned long round, int node,
+                          unsigned long seen, char *buffer, size_t size, struct tag_msg_info *info,
+                          struct tag_msg **rest) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+    struct tag_msg *msg;
+    long res;
+    int awake;
+
+    if (READ_ONCE(rcu_util->round[epoch]) != round) {
+        /* the epoch has been reused in the meanwhile */
+        reader_leave(rcu_util, epoch, node);
+        return reader_late(my_tag, rcu_util, epoch, round);
+    }
+
+    awake = READ_ONCE(rcu_util->awake[epoch]);
+    if (awake == MESSAGE) {
+        /* take the message of my epoch, it is gone if the sender detached at the deadline */
+        rcu_read_lock();
+        msg = rcu_dereference(my_tag->msg_store[level]->msg[epoch]);
+        if (msg != NULL && !refcount_inc_not_zero(&msg->refs)) msg = NULL;
+        rcu_read_unlock();
+        /* a message of a later round: the round changes before the epoch gets a new message */
+        if (msg != NULL && READ_ONCE(rcu_util->round[epoch]) != round) {
+            tag_msg_put(msg);
+            msg = NULL;
         }
-    } else {
-        /*release r_lock on the tag_list i-th entry previously obtained*/
-        up_read(&tag_list[tag].tag_node_rwsem);
-        /* tag specified not exists */
-        return -ENOENT;
+        /* with a reference the sender doesn't need to wait for my copy */
+        reader_leave(rcu_util, epoch, node);
+        if (msg == NULL) return reader_late(my_tag, rcu_util, epoch, round);
+
+        res = msg_copy(msg, buffer, size, info);
+        if (rest != NULL && msg->batch != NULL) {
+            /* the rest of a combined batch */
+            refcount_inc(&msg->batch->refs);
+            *rest = msg->batch;
+        }
+        tag_msg_put(msg);
+        return (int) res;
+
+    } else if (awake == AWAKE) {
+        /* we have been awoken by AWAKEALL routine */
+        reader_leave(rcu_util, epoch, node);
+        return -ECANCELED;
+
+    } else if (READ_ONCE(my_tag->dying)) {
+        /* the tag is being removed with TAG_DRAIN */
+        reader_leave(rcu_util, epoch, node);
+        return -EIDRM;
+
+    } else if (READ_ONCE(rcu_util->published) > seen) {
+        /* a newer value of the conflating level */
+        res = last_value_copy(rcu_util, handle, level, buffer, size, info);
+        reader_leave(rcu_util, epoch, node);
+        return (int) res;
+
+    } else if (mode_changed(rcu_util, seen)) {
+        /* the level has been switched to the other mode by TAG_CONFLATE */
+        reader_leave(rcu_util, epoch, node);
+        return -ECANCELED;
+
+    }
+
+    /*redundant ... just to be secure ! */
+    reader_leave(rcu_util, epoch, node);
+    return -EFAULT;
+}
+
+/**
+ * @description Receive through the filter registered with TAG_FILTER: the reader sleeps on the queue of its filter
+ * and is neither counted in standings nor woken up until a sender finds a matching message, then the sender counts
+ * it in the epoch of the message and it collects the message like the other readers.
+ * @return bytes copied or an error code; -EAGAIN if no filter is registered on the level, then the usual path is taken
+ */
+static long filter_receive(tag_ptr_t my_tag, tag_handle_ptr handle, rcu_util_ptr rcu_util, int level, char *buffer,
+                           size_t size, struct tag_msg_info *info) {
+    struct filter_reg *reg;
+    wait_queue_entry_t own, ctl;
+    unsigned long gen;
+    long timeout, ret = 0;
+
+    rcu_read_lock();
+    reg = rcu_dereference(handle->filter[level]);
+    if (reg != NULL && !__sync_bool_compare_and_swap(&reg->state, FILTER_IDLE, FILTER_CLAIMED)) {
+        rcu_read_unlock();
+        /* another thread receives through the filter */
+        return -EBUSY;
+    }
+    rcu_read_unlock();
+    if (reg == NULL) return -EAGAIN;
+
+    /* armed from now on: an awake notification counted after this point cancels the receive */
+    WRITE_ONCE(reg->home, numa_node_id());
+    gen = READ_ONCE(rcu_util->awake_gen);
+    asm volatile ("mfence":: : "memory");
+    WRITE_ONCE(reg->state, FILTER_ARMED);
+
+    init_waitqueue_entry(&own, current);
+    add_wait_queue(&reg->wq, &own);
+    init_waitqueue_entry(&ctl, current);
+    add_wait_queue(&rcu_util->filter_wq, &ctl);
+    timeout = READ_ONCE(handle->timeout);
+    if (timeout == 0) timeout = MAX_SCHEDULE_TIMEOUT;
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (READ_ONCE(reg->state) == FILTER_SELECTED || READ_ONCE(rcu_util->awake_gen) != gen ||
+            READ_ONCE(my_tag->dying) || mode_changed(rcu_util, ULONG_MAX)) {
+            break;
+        }
+        if (signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+        if (timeout == 0) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        timeout = schedule_timeout(timeout);
+    }
+    __set_current_state(TASK_RUNNING);
+    remove_wait_queue(&rcu_util->filter_wq, &ctl);
+    remove_wait_queue(&reg->wq, &own);
+
+    if (__sync_bool_compare_and_swap(&reg->state, FILTER_ARMED, FILTER_IDLE)) {
+        /* not selected */
+        if (ret != 0) return ret;
+        if (READ_ONCE(my_tag->dying)) return -EIDRM;
+        return -ECANCELED;
+    }
+    /* a sender counted me in the epoch of a matching message, it waits for me: never -EAGAIN */
+    ret = reader_collect(my_tag, handle, level, reg->epoch, reg->round, reg->sel_node, ULONG_MAX, buffer, size, info,
+                         NULL);
+    WRITE_ONCE(reg->state, FILTER_IDLE);
+    return ret;
+}
+
+/**
+ * @description Body of tag_receive on a pinned tag, counted as a single receive of the level (see single_enter).
+ * The metadata of the message is stored in info, if not NULL.
+ */
+static int level_receive(tag_ptr_t my_tag, tag_handle_ptr handle, int level, int flags, char *buffer, size_t size,
+                         struct tag_msg_info *info) {
+    int my_epoch_msg, event_wq_ret, my_node, ret;
+    wait_queue_head_t *wq;
+    rcu_util_ptr rcu_util;
+    unsigned long seen, round;
+    long direct;
+    u64 poll_ns;
+
+    rcu_util = my_tag->msg_rcu_util_list[level];
+    if (!READ_ONCE(rcu_util->conflate)) {
+        direct = direct_receive(my_tag, handle, rcu_util, level, buffer, info);
+        if (direct == -EAGAIN) direct = filter_receive(my_tag, handle, rcu_util, level, buffer, size, info);
+        if (direct != -EAGAIN) return (int) direct;
+    }
+
+    join:
+    /*atomically add myself to the presence counter for standing readers of the current epoch  */
+    my_epoch_msg = reader_join(rcu_util, &round);
+    /* let senders know where readers are waiting */
+    my_node = numa_node_id();
+    __sync_fetch_and_add(&rcu_util->node_standings[my_node], 1);
+
+    /* on a conflating level wait for a value newer than the last one read, or for any value with TAG_LATEST */
+    seen = ULONG_MAX;
+    if (READ_ONCE(rcu_util->conflate)) seen = (flags & TAG_LATEST) ? 0 : READ_ONCE(handle->seen[level]);
+
+    poll_ns = READ_ONCE(my_tag->poll_ns);
+    if ((flags & TAG_POLL) && poll_ns == 0) poll_ns = (u64) READ_ONCE(busy_poll_usecs) * NSEC_PER_USEC;
+    if (poll_ns != 0) busy_poll(my_tag, rcu_util, my_epoch_msg, round, seen, poll_ns);
+
+    /* wait event queues are used to selectively awake threads on some conditions*/
+    wq = reader_queue(rcu_util, my_epoch_msg);
+    event_wq_ret = receive_wait(*wq,
+
+                                receive_ready(my_tag, rcu_util, my_epoch_msg, round, seen),
+                                READ_ONCE(handle->timeout));
+
+
+    if (event_wq_ret == -ERESTARTSYS) {
+        /*operation can fail also because of the delivery of a Posix signal*/
+        reader_leave(rcu_util, my_epoch_msg, my_node);
+        return -EINTR;
+
+    } else if (event_wq_ret == -ETIMEDOUT) {
+        /* nothing came within the timeout of the descriptor: leave like an interrupted reader */
+        reader_leave(rcu_util, my_epoch_msg, my_node);
+        return -ETIMEDOUT;
+
+    }
+
+    ret = reader_collect(my_tag, handle, level, my_epoch_msg, round, my_node, seen, buffer, size, info, NULL);
+    /* counted after the sender of the epoch had left: wait for the next message */
+    if (ret == -EAGAIN) goto join;
+    return ret;
+
+}
+
+/* tag_receive and tag_receive_info: the metadata of the message is stored in info, if not NULL */
+static int receive(int tag, int level, char *buffer, size_t size, struct tag_msg_info *info) {
+    struct fd f;
+    tag_handle_ptr handle;
+    rcu_util_ptr rcu_util;
+    tag_ptr_t my_tag;
+    int ret, flags;
+
+    /* isolate the busy poll and latest value flags from the level */
+    flags = level & (TAG_POLL | TAG_LATEST);
+    level &= ~(TAG_POLL | TAG_LATEST);
+
+    if (level >= LEVELS || level < 0 || buffer == NULL) {
+        /* Invalid Arguments error */
+        return -EINVAL;
     }
 
-
+    /* the descriptor is held for the whole receive: it records the versions read from the conflating levels */
+    ret = tag_fdget(tag, &f, &handle);
+    if (ret < 0) return ret;
+    /* take a reference to avoid that someone deletes the tag during my job*/
+    ret = handle_pin(handle, &my_tag);
+    if (ret == 0) {
+        rcu_util = my_tag->msg_rcu_util_list[level];
+        single_enter(rcu_util);
+        ret = level_receive(my_tag, handle, level, flags, buffer, size, info);
+        single_leave(rcu_util);
+        tag_put(my_tag);
+    }
+    fdput(f);
+    return ret;
 }
 
 /**
  * @description This operation blocks the caller untill an incoming message arrives from the corresponding tag-level instance.
  * The caller could be unlocked even if a signal arrives or another thread calls tag_clt with the AWAKE_ALL command.
- * @param tag tag descriptor
- * @param level message source level
+ * @param tag tag descriptor returned by tag_get
+ * @param level message source level, TAG_POLL can be added to busy poll before sleeping (see TAG_BUSY_POLL).
+ * On a conflating level (see TAG_CONFLATE) the call returns at once the current value if it is newer than the last one
+ * read through the descriptor, otherwise it waits for a newer one; with TAG_LATEST the current value is always read.
+ * With a filter set on the level through the descriptor (TAG_FILTER) only a matching message is received; a single
+ * receive at a time uses the filter.
+ * Concurrent senders of the level are not combined in one batch while the call waits (see Combined sends).
+ * If buffer is the buffer registered on the level with TAG_DIRECT the sender copies the message in it and the size of
+ * the registration applies.
  * @param buffer userspace buffer address
  * @param size buffer lenght
  * @return bytes copied on success, appropriate error code otherwise.
  * @errors
  * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
  * ENOBUFS: Not enough buffer space available.\n
- * ENOENT: Tag doesn't exist.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
  * EINTR: Stopped, interrupt occured.\n
  * EPERM: Operation not permitted.\n
  * EFAULT: Message recovery fault.\n
+ * EBUSY: Another thread receives through the filter of the descriptor on the level (TAG_FILTER).\n
  * ECANCELED: Operation canceled because of AWAKE notification.\n
+ * ETIMEDOUT: No message within the receive timeout of the descriptor (TAG_TIMEOUT), or the sender stopped waiting
+ * for the reader at the delivery deadline of the tag (TAG_DEADLINE) before it could take the message.\n
  */
 int tag_receive(int tag, int level, char *buffer, size_t size) {
-    int my_epoch_msg, event_wq_ret;
-    tag_ptr_t my_tag;
-    unsigned long res;
-
-    if (tag < 0 || tag >= max_tg || level >= LEVELS || level < 0 || buffer == NULL || size < 0) {
-        /* Invalid Arguments error */
-        return -EINVAL;
-    }
-
-    /* take read lock to avoid that someone deletes the tag entry during my job*/
-    if (down_read_killable(&tag_list[tag].tag_node_rwsem) == -EINTR) return -EINTR;
+    return receive(tag, level, buffer, size, NULL);
+}
 
-    my_tag = tag_list[tag].tag_ptr;
-    if (my_tag != NULL) {
-        /* permisson check */
-        if (GOT_PERMISSION(my_tag->uid.val, my_tag->perm)) {
+/**
+ * @description Like tag_receive, moreover stores the metadata of the message received in info: the sequence number
+ * of the message in its level, the sender process and user, the CLOCK_MONOTONIC time of the send, the size and the
+ * level. Sequence numbers grow with the sends of a level, also the ones that found no reader, so the difference with
+ * the previous message received tells how many were missed. On a conflating level (see TAG_CONFLATE) the current
+ * value carries the number of its send, the values replaced before being read are the missed ones.
+ * @param tag tag descriptor returned by tag_get
+ * @param level message source level, TAG_POLL and TAG_LATEST as in tag_receive
+ * @param buffer userspace buffer address
+ * @param size buffer lenght
+ * @param info userspace address of the struct tag_msg_info of the message, written only on success
+ * @return bytes copied on success, appropriate error code otherwise.
+ * @errors
+ * As tag_receive; EFAULT also if info can't be written, the message is consumed.\n
+ */
+int tag_receive_info(int tag, int level, char *buffer, size_t size, struct tag_msg_info *info) {
+    struct tag_msg_info kinfo;
+    int ret;
+
+    if (info == NULL) return -EINVAL;
+    ret = receive(tag, level, buffer, size, &kinfo);
+    if (ret >= 0 && copy_to_user(info, &kinfo, sizeof(kinfo)) != 0) return -EFAULT;
+    return ret;
+}
 
-            /*atomically add myself to the presence counter for standing readers of the current epoch  */
-            my_epoch_msg = my_tag->msg_rcu_util_list[level]->current_epoch;
-            __sync_fetch_and_add(&my_tag->msg_rcu_util_list[level]->standings[my_epoch_msg], 1);
+/* joins the current epoch of a level of a subscription set as a standing reader, see level_receive */
+static void set_join(struct sub_wait *w, tag_handle_ptr handle, tag_ptr_t my_tag, int index, int level) {
+    rcu_util_ptr rcu_util = my_tag->msg_rcu_util_list[level];
+
+    w->handle = handle;
+    w->tag = my_tag;
+    w->index = index;
+    w->level = level;
+    w->epoch = reader_join(rcu_util, &w->round);
+    w->node = numa_node_id();
+    __sync_fetch_and_add(&rcu_util->node_standings[w->node], 1);
+    w->seen = READ_ONCE(rcu_util->conflate) ? READ_ONCE(handle->seen[level]) : ULONG_MAX;
+}
 
-            /* wait event queues are used to selectively awake threads on some conditions*/
-            event_wq_ret = wait_event_interruptible(my_tag->the_queue_head[level][my_epoch_msg],
+/* leaves the levels still joined by set_receive for the caller of tag_receive_batch */
+static void set_leave(struct sub_wait *waits, int joined) {
+    int i;
+    for (i = 0; i < joined; i++) {
+        reader_leave(waits[i].tag->msg_rcu_util_list[waits[i].level], waits[i].epoch, waits[i].node);
+    }
+}
 
-                                                    my_tag->msg_rcu_util_list[level]->awake[my_epoch_msg] != NO);
+/**
+ * @description Waits on every level of the pinned subscriptions of a set and collects the first message, awake
+ * notification or removal among them (see tag_receive_set). The wait ends after timeout jiffies (MAX_SCHEDULE_TIMEOUT
+ * waits forever, 0 only looks at the levels) or, if until_ns is not 0, at that ktime_get_ns time.
+ * With joined the caller takes messages in a row (see tag_receive_batch): the first *joined waits are still joined
+ * from the previous call and all of them stay joined at the end, for the caller to leave them with set_leave. The
+ * level of the message joins its next epoch before leaving the one of the message, which its sender can't leave
+ * before me, so that no message of the caller's levels is missed in between; the rest of a combined batch is stored
+ * in rest (see reader_collect).
+ * @return bytes copied or an error code, the origin of the message or of the error is stored in from
+ */
+static int set_receive(struct tag_sub *sub, unsigned int nr, struct fd *files, tag_ptr_t *tags, struct sub_wait *waits,
+                       int *joined, char *buffer, size_t size, long timeout, u64 until_ns, struct tag_origin *from,
+                       struct tag_msg **rest) {
+    struct sub_wait *w;
+    rcu_util_ptr rcu_util;
+    unsigned long round, seen;
+    ktime_t expires;
+    int i, level, epoch, node, nwaits = 0, ready = -1, ret = 0;
+
+    /* enter every level as a standing reader of its current epoch, if not joined yet, and hook on its wait queue */
+    for (i = 0; i < (int) nr; i++) {
+        for (level = 0; level < LEVELS; level++) {
+            if (!(sub[i].levels & (1UL << level))) continue;
+            w = &waits[nwaits++];
+            if (joined == NULL || nwaits > *joined) set_join(w, files[i].file->private_data, tags[i], i, level);
+            init_waitqueue_entry(&w->wait, current);
+            add_wait_queue(&tags[i]->msg_rcu_util_list[level]->the_queue_head[w->epoch], &w->wait);
+        }
+    }
+    if (joined != NULL) *joined = nwaits;
 
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        for (i = 0; i < nwaits; i++) {
+            w = &waits[i];
+            if (receive_ready(w->tag, w->tag->msg_rcu_util_list[w->level], w->epoch, w->round, w->seen)) break;
+        }
+        if (i < nwaits) {
+            ready = i;
+            break;
+        }
+        if (signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+        if (timeout == 0 || (until_ns != 0 && ktime_get_ns() >= until_ns)) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        if (until_ns != 0) {
+            expires = ns_to_ktime(until_ns);
+            schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+        } else {
+            timeout = schedule_timeout(timeout);
+        }
+    }
+    __set_current_state(TASK_RUNNING);
+
+    /* leave the other levels first, their senders are waiting for me */
+    for (i = 0; i < nwaits; i++) {
+        w = &waits[i];
+        rcu_util = w->tag->msg_rcu_util_list[w->level];
+        remove_wait_queue(&rcu_util->the_queue_head[w->epoch], &w->wait);
+        if (i != ready && joined == NULL) reader_leave(rcu_util, w->epoch, w->node);
+    }
+    /* no message: ret is -EINTR or -ETIMEDOUT and from is left as it is */
+    if (ready < 0) return ret;
+
+    w = &waits[ready];
+    from->index = w->index;
+    from->tag = sub[w->index].tag;
+    from->level = w->level;
+    if (joined == NULL) {
+        return reader_collect(w->tag, w->handle, w->level, w->epoch, w->round, w->node, w->seen, buffer, size, NULL,
+                              NULL);
+    }
 
-            if (event_wq_ret == -ERESTARTSYS) {
-                /*operation can fail also because of the delivery of a Posix signal*/
-                __sync_fetch_and_add(&my_tag->msg_rcu_util_list[level]->standings[my_epoch_msg], -1);
-                up_read(&tag_list[tag].tag_node_rwsem);
-                return -EINTR;
+    epoch = w->epoch;
+    round = w->round;
+    node = w->node;
+    seen = w->seen;
+    rcu_util = w->tag->msg_rcu_util_list[w->level];
+    /* a message: its sender is about to flip the epoch, if it did not yet */
+    if (READ_ONCE(rcu_util->awake[epoch]) == MESSAGE && READ_ONCE(rcu_util->round[epoch]) == round) {
+        while (READ_ONCE(rcu_util->current_epoch) == epoch) schedule();
+    }
+    set_join(w, w->handle, w->tag, w->index, w->level);
+    ret = reader_collect(w->tag, w->handle, w->level, epoch, round, node, seen, buffer, size, NULL, rest);
+    /* on a conflating level wait for a value newer than the one just read */
+    if (w->seen != ULONG_MAX) w->seen = READ_ONCE(w->handle->seen[w->level]);
+    return ret;
+}
 
-            } else if (my_tag->msg_rcu_util_list[level]->awake[my_epoch_msg] == MESSAGE) {
-                /* let's read the incoming message */
-                if (my_tag->msg_store[level]->size > size) {
-                    // provided buffer is not large enough to copy the info of the message
-                    __sync_fetch_and_add(&my_tag->msg_rcu_util_list[level]->standings[my_epoch_msg], -1);
-                    up_read(&tag_list[tag].tag_node_rwsem);
+/**
+ * @description Receives the first message of a subscription set: the caller waits at once on every (tag, level) of
+ * the set, as a reader of the current epoch of each level, and returns the first message, awake notification or
+ * removal among them together with its origin. When more levels are ready at the same time the one that comes first
+ * in the set wins; the caller leaves the other levels, so their messages are not delivered to it, like to a reader
+ * that is not waiting. Registered buffers (TAG_DIRECT), filters (TAG_FILTER) and busy polling are not used,
+ * conflating levels behave as in tag_receive. The receive timeout (TAG_TIMEOUT) of the descriptor of the first
+ * subscription applies.
+ * @param subs userspace array of subscriptions
+ * @param nr number of subscriptions, at most MAX_SUBSCRIPTIONS (tag, level) pairs in all
+ * @param buffer userspace buffer address
+ * @param size buffer lenght
+ * @param origin userspace address where the subscription, the descriptor and the level of the message are stored,
+ * also on failures of a single subscription (level -1 if the failure concerns all its levels, index -1 for failures
+ * of the whole set such as EINTR or ETIMEDOUT by the timeout)
+ * @return bytes copied on success, appropriate error code otherwise.
+ * @errors
+ * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
+ * ENOMEM: Out of memory.\n
+ * ENOBUFS: Not enough buffer space available.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
+ * EINTR: Stopped, interrupt occured.\n
+ * EPERM: Operation not permitted.\n
+ * EFAULT: Message recovery fault.\n
+ * ECANCELED: Operation canceled because of AWAKE notification.\n
+ * ETIMEDOUT: No message within the receive timeout of the first descriptor (TAG_TIMEOUT), or the sender stopped
+ * waiting for the reader at the delivery deadline of the tag (TAG_DEADLINE) before it could take the message.\n
+ */
+int tag_receive_set(struct tag_sub *subs, unsigned int nr, char *buffer, size_t size, struct tag_origin *origin) {
+    struct tag_origin from = {-1, -1, -1};
+    struct tag_sub *sub;
+    struct fd *files = NULL;
+    tag_ptr_t *tags = NULL;
+    struct sub_wait *waits = NULL;
+    tag_handle_ptr handle;
+    int i, level, nwaits = 0, pinned = 0, ret = 0;
+    long timeout;
+
+    if (subs == NULL || nr == 0 || nr > MAX_SUBSCRIPTIONS || buffer == NULL || origin == NULL) {
+        /* Invalid Arguments error */
+        return -EINVAL;
+    }
 
-                    return -ENOBUFS;
-                }
+    sub = kmalloc(sizeof(struct tag_sub) * nr, GFP_KERNEL);
+    if (sub == NULL) return -ENOMEM;
+    if (copy_from_user(sub, subs, sizeof(struct tag_sub) * nr) != 0) {
+        ret = -EFAULT;
+        goto out;
+    }
+    for (i = 0; i < (int) nr; i++) {
+        if (sub[i].levels == 0 || (sub[i].levels & ~ALL_LEVELS) != 0) {
+            ret = -EINVAL;
+            goto out;
+        }
+        for (level = 0; level < LEVELS; level++) {
+            if (sub[i].levels & (1UL << level)) nwaits++;
+        }
+    }
+    if (nwaits > MAX_SUBSCRIPTIONS) {
+        ret = -EINVAL;
+        goto out;
+    }
 
-                res = copy_to_user(buffer, my_tag->msg_store[level]->msg, my_tag->msg_store[level]->size);
-                asm volatile ("mfence":: : "memory");
-                if (res != 0) {
-                    __sync_fetch_and_add(&my_tag->msg_rcu_util_list[level]->standings[my_epoch_msg], -1);
-                    up_read(&tag_list[tag].tag_node_rwsem);
-                    /* error during the copy-- partial delivery of the message not supported */
-                    return -EFAULT;
-                }
+    files = kmalloc(sizeof(struct fd) * nr, GFP_KERNEL);
+    tags = kmalloc(sizeof(tag_ptr_t) * nr, GFP_KERNEL);
+    waits = kmalloc(sizeof(struct sub_wait) * nwaits, GFP_KERNEL);
+    if (files == NULL || tags == NULL || waits == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
 
-                res = my_tag->msg_store[level]->size;
+    /* pin all the tags of the set first: a subscription that cannot be used fails the whole receive */
+    for (pinned = 0; pinned < (int) nr; pinned++) {
+        ret = tag_fdget(sub[pinned].tag, &files[pinned], &handle);
+        if (ret == 0) {
+            ret = handle_pin(handle, &tags[pinned]);
+            if (ret < 0) fdput(files[pinned]);
+        }
+        if (ret < 0) {
+            from.index = pinned;
+            from.tag = sub[pinned].tag;
+            goto out_pinned;
+        }
+    }
 
-                __sync_fetch_and_add(&my_tag->msg_rcu_util_list[level]->standings[my_epoch_msg], -1);
+    /* a single message is returned: no combined batch for the levels of the set meanwhile */
+    for (i = 0; i < (int) nr; i++) {
+        for (level = 0; level < LEVELS; level++) {
+            if (sub[i].levels & (1UL << level)) single_enter(tags[i]->msg_rcu_util_list[level]);
+        }
+    }
+    timeout = READ_ONCE(((tag_handle_ptr) files[0].file->private_data)->timeout);
+    do {
+        /* counted after the sender of the epoch had left: wait again on every level */
+        ret = set_receive(sub, nr, files, tags, waits, NULL, buffer, size,
+                          timeout == 0 ? MAX_SCHEDULE_TIMEOUT : timeout, 0, &from, NULL);
+    } while (ret == -EAGAIN);
+    for (i = 0; i < (int) nr; i++) {
+        for (level = 0; level < LEVELS; level++) {
+            if (sub[i].levels & (1UL << level)) single_leave(tags[i]->msg_rcu_util_list[level]);
+        }
+    }
 
-                up_read(&tag_list[tag].tag_node_rwsem);
+    out_pinned:
+    for (i = 0; i < pinned; i++) {
+        tag_put(tags[i]);
+        fdput(files[i]);
+    }
+    if (copy_to_user(origin, &from, sizeof(struct tag_origin)) != 0 && ret >= 0) ret = -EFAULT;
+    out:
+    kfree(waits);
+    kfree(tags);
+    kfree(files);
+    kfree(sub);
+    return ret;
+}
 
-                return (int) res;
+/**
+ * @description Receives up to nr messages of the levels of a tag in a single call, like recvmmsg: the first message
+ * is waited for as in tag_receive_set on a single subscription (tag, levels), then the call keeps collecting messages
+ * for a coalescing window of window_us microseconds from the arrival of the first one, or until window_msgs messages
+ * are collected, whichever comes first, so that a high-rate consumer pays one syscall and one wake up for many
+ * messages. The levels stay joined for the whole call, so that no message sent while the previous one is copied is
+ * missed, and every message of a combined batch of concurrent senders is returned (see Combined sends). Every message
+ * takes a slot of msgs: its buffer and size are read, the level of the message and the bytes copied (-ENOBUFS if it
+ * did not fit) are written. After the first message a failure (AWAKE notification, removal, signal) ends the batch
+ * and the messages collected are returned. The receive timeout (TAG_TIMEOUT) of the descriptor applies to the first
+ * message.
+ * @param tag tag descriptor returned by tag_get
+ * @param levels bit mask of the levels (bit n for level n)
+ * @param msgs userspace array of message slots (struct tag_mmsg)
+ * @param nr number of slots, at most MAX_BATCH_MSGS
+ * @param window_us coalescing window after the first message, at most MAX_BATCH_WINDOW_US; 0 only takes the messages
+ * ready at once
+ * @param window_msgs the call returns as soon as this many messages are collected, 0 for nr
+ * @return number of messages received on success, appropriate error code otherwise.
+ * @errors
+ * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
+ * ENOMEM: Out of memory.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
+ * EINTR: Stopped, interrupt occured.\n
+ * EPERM: Operation not permitted.\n
+ * EFAULT: Message recovery fault, or msgs can't be read or written.\n
+ * ECANCELED: Operation canceled because of AWAKE notification.\n
+ * ETIMEDOUT: No message within the receive timeout of the descriptor (TAG_TIMEOUT), or the sender stopped waiting for
+ * the reader at the delivery deadline of the tag (TAG_DEADLINE) before it could take the message.\n
+ */
+int tag_receive_batch(int tag, unsigned int levels, struct tag_mmsg *msgs, unsigned int nr, unsigned int window_us,
+                      unsigned int window_msgs) {
+    struct tag_origin from = {-1, -1, -1};
+    struct tag_sub sub = {tag, levels};
+    struct tag_mmsg *mmsg;
+    struct sub_wait *waits;
+    struct tag_msg *rest, *next;
+    struct fd f;
+    tag_handle_ptr handle;
+    tag_ptr_t my_tag;
+    unsigned int count = 0;
+    u64 until_ns = 0;
+    long timeout;
+    int ret, joined = 0;
 
-            } else if (my_tag->msg_rcu_util_list[level]->awake[my_epoch_msg] == AWAKE) {
-                /* we have been awoken by AWAKEALL routine */
-                __sync_fetch_and_add(&my_tag->msg_rcu_util_list[level]->standings[my_epoch_msg], -1);
+    if (msgs == NULL || nr == 0 || nr > MAX_BATCH_MSGS || levels == 0 || (levels & ~ALL_LEVELS) != 0 ||
+        window_us > MAX_BATCH_WINDOW_US) {
+        /* Invalid Arguments error */
+        return -EINVAL;
+    }
+    if (window_msgs == 0 || window_msgs > nr) window_msgs = nr;
 
-                up_read(&tag_list[tag].tag_node_rwsem);
-                return -ECANCELED;
+    mmsg = kmalloc(sizeof(struct tag_mmsg) * nr, GFP_KERNEL);
+    waits = kmalloc(sizeof(struct sub_wait) * LEVELS, GFP_KERNEL);
+    if (mmsg == NULL || waits == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(mmsg, msgs, sizeof(struct tag_mmsg) * nr) != 0) {
+        ret = -EFAULT;
+        goto out;
+    }
+    ret = tag_fdget(tag, &f, &handle);
+    if (ret < 0) goto out;
+    ret = handle_pin(handle, &my_tag);
+    if (ret < 0) {
+        fdput(f);
+        goto out;
+    }
 
+    timeout = READ_ONCE(handle->timeout);
+    if (timeout == 0) timeout = MAX_SCHEDULE_TIMEOUT;
+    while (count < window_msgs) {
+        rest = NULL;
+        ret = set_receive(&sub, 1, &f, &my_tag, waits, &joined, mmsg[count].buffer, mmsg[count].size, timeout,
+                          until_ns, &from, &rest);
+        /* counted after the sender of the epoch had left, the level already joined the next one */
+        if (ret == -EAGAIN) continue;
+        if (ret < 0 && ret != -ENOBUFS) {
+            tag_msg_put(rest);
+            break;
+        }
+        mmsg[count].level = from.level;
+        mmsg[count].len = ret;
+        if (++count == 1) {
+            /* the coalescing window opens with the first message */
+            if (window_us == 0) timeout = 0;
+            else until_ns = ktime_get_ns() + (u64) window_us * NSEC_PER_USEC;
+        }
+        /* the rest of a combined batch is mine, in the next slots; without room it is missed like a late send */
+        for (; rest != NULL; rest = next) {
+            if (count < window_msgs) {
+                mmsg[count].level = from.level;
+                mmsg[count].len = (int) msg_copy(rest, mmsg[count].buffer, mmsg[count].size, NULL);
+                count++;
             }
+            next = rest->batch;
+            if (next != NULL) refcount_inc(&next->refs);
+            tag_msg_put(rest);
+        }
+    }
+    /* the levels stay joined across the messages of the call, none is missed in between */
+    set_leave(waits, joined);
+    tag_put(my_tag);
+    fdput(f);
+
+    if (count > 0) {
+        /* the failure that ended the batch is reported by the next call, if it lasts */
+        ret = copy_to_user(msgs, mmsg, sizeof(struct tag_mmsg) * count) != 0 ? -EFAULT : (int) count;
+    }
+    out:
+    kfree(waits);
+    kfree(mmsg);
+    return ret;
+}
 
+/* receivers already spinning are not affected */
+static int set_busy_poll(tag_ptr_t my_tag, unsigned long usecs) {
+    if (usecs > MAX_BUSY_POLL_US) return -EINVAL;
+    WRITE_ONCE(my_tag->poll_ns, usecs * NSEC_PER_USEC);
+    return 0;
+}
 
-        } else {
-            /*release r_lock on the tag_list i-th entry previously obtained*/
-            up_read(&tag_list[tag].tag_node_rwsem);
-            /* denied permission */
-            return -EPERM;
-        }
-    } else {
-        /*release r_lock on the tag_list i-th entry previously obtained*/
-        up_read(&tag_list[tag].tag_node_rwsem);
-        /* tag specified not exists */
-        return -ENOENT;
+/**
+ * @description Switches the levels in the bit mask to last-value mode and the other ones back to normal mode.
+ * The mode is changed under the level mutex, so that no sender of the old mode is running, then the readers still
+ * waiting in the old mode are woken up and return -ECANCELED. The last value is kept across switches.
+ */
+static int set_conflate(tag_ptr_t my_tag, unsigned long levels) {
+    rcu_util_ptr rcu_util;
+    bool conflate;
+    int level;
+
+    for (level = 0; level < LEVELS; level++) {
+        rcu_util = my_tag->msg_rcu_util_list[level];
+        conflate = (levels & (1UL << level)) != 0;
+        if (READ_ONCE(rcu_util->conflate) == conflate) continue;
+        if (mutex_lock_interruptible(&rcu_util->mtx) == -EINTR) return -EINTR;
+        WRITE_ONCE(rcu_util->conflate, conflate);
+        mutex_unlock(&rcu_util->mtx);
+        asm volatile ("mfence":: : "memory");
+
+        wake_epoch(rcu_util, 0);
+        wake_epoch(rcu_util, 1);
+        wake_up_all(&rcu_util->filter_wq);
     }
+    return 0;
+}
 
-    /*redundant ... just to be secure ! */
-    up_read(&tag_list[tag].tag_node_rwsem);
-    return -EFAULT;
+/**
+ * @description Sleeps until a sender claims a sequence number after req->seq on the ring of the level, an AWAKE
+ * notification changes awake_gen or the tag is removed. Senders call TAG_RING_WAKE after publishing a message if
+ * they see waiters in the header: the receivers count themselves before checking the ring, so no wakeup is lost.
+ * @return 0 if the ring moved, -ECANCELED, -EIDRM or -EINTR otherwise
+ */
+static int ring_wait(tag_ptr_t my_tag, struct tag_ring_wait *req) {
+    struct ring_util *ring = READ_ONCE(my_tag->msg_rcu_util_list[req->level]->ring);
+    int event_wq_ret;
+
+    if (ring == NULL) return -ENXIO;
+    event_wq_ret = wait_event_interruptible(ring->wq, READ_ONCE(ring->hdr->head) > req->seq ||
+                                                      READ_ONCE(ring->hdr->awake_gen) != req->awake_gen ||
+                                                      READ_ONCE(my_tag->dying));
+    if (event_wq_ret == -ERESTARTSYS) return -EINTR;
+    if (READ_ONCE(my_tag->dying)) return -EIDRM;
+    if (READ_ONCE(ring->hdr->awake_gen) != req->awake_gen) return -ECANCELED;
+    return 0;
+}
 
+static int ring_wake(tag_ptr_t my_tag, int level) {
+    struct ring_util *ring = READ_ONCE(my_tag->msg_rcu_util_list[level]->ring);
+    if (ring == NULL) return -ENXIO;
+    wake_up_all(&ring->wq);
+    return 0;
 }
 
 /**
  * @description This operation control a tag instance by awakening operation or the by removing operation.
  * This function acts differently basing on the command and key combination.
- * @param tag tag descriptor
+ * @param tag tag descriptor returned by tag_get
  * @param command use IPC_RMID command to remove a tag instance, this will fail if there are readers waiting for a message on the corresponding tag.
  * IPC_RMID command can be combinating with IPC_NOWAIT command to have a nonblocking behavior.
- * Use the AWAKE_ALL command to wake up all thread waiting for a message on the corresponding tag indipendently of the level.
+ * IPC_RMID | TAG_DRAIN does not fail on waiting readers: the tag is marked removed, so that new operations fail with EIDRM,
+ * the waiting readers are woken up (they return EIDRM) and the call returns once every thread has left the tag.
+ * Use the AWAKE_ALL command to wake up all thread waiting for a message on the corresponding tag indipendently of the level,
+ * AWAKE_LEVELS to wake up only the threads waiting on the levels of the bit mask arg (bit n for level n).
+ * A level busy with a sender is awoken once its message is published, so that no reader parked meanwhile is missed.
+ * Use the TAG_BUSY_POLL command to make all the receivers of the tag spin up to arg microseconds (at most
+ * MAX_BUSY_POLL_US, 0 disables) before sleeping, TAG_POLL_STATS to copy the struct tag_poll_stats of the tag at arg.
+ * Use the TAG_CONFLATE command to switch the levels of the bit mask arg to last-value mode (the others back to normal
+ * mode): a send replaces the value of the level without waiting for the readers.
+ * Use the TAG_DIRECT command with the address of a struct tag_direct to register (or unregister, buffer NULL) a receive
+ * buffer of the descriptor on a level: senders copy the messages straight into it (see tag_receive).
+ * Use the TAG_FILTER command with the address of a struct tag_filter to set (or remove, len 0) the receive filter of the
+ * descriptor on a level: the receives get only the messages matching it, the senders wake up the matching readers only.
+ * Use the TAG_RING command with the address of a struct tag_ring_req to set up the shared-memory ring of a level and
+ * get the size to mmap on the descriptor (see tag_ring.h): senders and receivers exchange the messages in user space and
+ * enter the kernel only to sleep on an empty ring (TAG_RING_WAIT with a struct tag_ring_wait) and to wake the sleepers
+ * (TAG_RING_WAKE with the level as arg).
+ * Use the TAG_TIMEOUT command to make the receives through the descriptor fail with ETIMEDOUT if no message comes
+ * within arg microseconds (at most MAX_TIMEOUT_US, 0 waits forever).
+ * Use the TAG_DEADLINE command to bound the wait of the senders of the tag for the readers to arg microseconds (at
+ * most MAX_DEADLINE_US, 0 waits forever), TAG_DELIVERY_STATS to copy the struct tag_delivery_stats of the tag at arg.
+ * @param arg argument of the command, ignored by IPC_RMID and AWAKE_ALL
  * @return non-negative value on success, negative on failure and errno is set to the correct error code.
  * @errors
  * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
  * EBUSY: Resource busy.\n
- * ENOENT: Tag doesn't exist.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
  * EINTR: Stopped, interrupt occured.\n
  * EPERM: Operation not permitted.\n
+ * EFAULT: Invalid user address.\n
+ * ENOMEM: Out of memory.\n
+ * EEXIST: The ring of the level has another geometry (TAG_RING).\n
+ * ENXIO: No ring on the level (TAG_RING_WAIT, TAG_RING_WAKE, TAG_RING attaching).\n
+ * ECANCELED: Operation canceled because of AWAKE notification (TAG_RING_WAIT).\n
  */
-int tag_ctl(int tag, int command) {
+int tag_ctl(int tag, int command, unsigned long arg) {
     int ret_key;
-    if (tag < 0 || tag >= max_tg) {
+    struct tag_direct direct;
+    struct tag_filter filter;
+    struct tag_ring_req ring_req;
+    struct tag_ring_wait ring_wait_req;
+    struct fd f;
+    tag_handle_ptr handle;
+    tag_ptr_t my_tag;
+
+    if ((command == AWAKE_LEVELS && arg == 0) || ((command == AWAKE_LEVELS || command == TAG_CONFLATE) &&
+                                                  (arg & ~ALL_LEVELS) != 0)) {
         /* Invalid Arguments error */
         return -EINVAL;
     }
 
+    if (command == TAG_RING_WAKE && arg >= LEVELS) {
+        /* Invalid Arguments error */
+        return -EINVAL;
+    }
+    if (command == TAG_RING) {
+        if (copy_from_user(&ring_req, (void *) arg, sizeof(struct tag_ring_req)) != 0) return -EFAULT;
+        if (ring_req.level < 0 || ring_req.level >= LEVELS || (ring_req.slots != 0 &&
+            ((ring_req.slots & (ring_req.slots - 1)) != 0 || ring_req.slots > MAX_RING_SLOTS ||
+             ring_req.slot_size == 0 || ring_req.slot_size > msg_size ||
+             ring_req.slots * TAG_RING_STRIDE(ring_req.slot_size) > MAX_RING_BYTES))) {
+            /* Invalid Arguments error */
+            return -EINVAL;
+        }
+    }
+    if (command == TAG_RING_WAIT) {
+        if (copy_from_user(&ring_wait_req, (void *) arg, sizeof(struct tag_ring_wait)) != 0) return -EFAULT;
+        if (ring_wait_req.level < 0 || ring_wait_req.level >= LEVELS) {
+            /* Invalid Arguments error */
+            return -EINVAL;
+        }
+    }
+
+    if (command == TAG_DEADLINE && arg > MAX_DEADLINE_US) {
+        /* Invalid Arguments error */
+        return -EINVAL;
+    }
 
-    if (command == AWAKE_ALL) {
-        return awake_all(tag);
+    if (command == AWAKE_ALL || command == AWAKE_LEVELS || command == TAG_BUSY_POLL || command == TAG_POLL_STATS ||
+        command == TAG_CONFLATE || command == TAG_RING || command == TAG_RING_WAIT || command == TAG_RING_WAKE ||
+        command == TAG_DEADLINE || command == TAG_DELIVERY_STATS) {
+        ret_key = tag_pin(tag, &my_tag);
+        if (ret_key < 0) return ret_key;
+        if (command == AWAKE_ALL) {
+            ret_key = awake_all(my_tag, ALL_LEVELS);
+        } else if (command == AWAKE_LEVELS) {
+            ret_key = awake_all(my_tag, arg);
+        } else if (command == TAG_BUSY_POLL) {
+            ret_key = set_busy_poll(my_tag, arg);
+        } else if (command == TAG_CONFLATE) {
+            ret_key = set_conflate(my_tag, arg);
+        } else if (command == TAG_RING) {
+            ret_key = ring_setup(my_tag, &ring_req);
+        } else if (command == TAG_RING_WAIT) {
+            ret_key = ring_wait(my_tag, &ring_wait_req);
+        } else if (command == TAG_RING_WAKE) {
+            ret_key = ring_wake(my_tag, (int) arg);
+        } else if (command == TAG_DEADLINE) {
+            WRITE_ONCE(my_tag->deadline_ns, (u64) arg * NSEC_PER_USEC);
+            ret_key = 0;
+        } else if (command == TAG_DELIVERY_STATS) {
+            if (copy_to_user((void *) arg, &my_tag->delivery_stats, sizeof(struct tag_delivery_stats)) != 0) {
+                ret_key = -EFAULT;
+            }
+        } else if (copy_to_user((void *) arg, &my_tag->poll_stats, sizeof(struct tag_poll_stats)) != 0) {
+            ret_key = -EFAULT;
+        }
+        tag_put(my_tag);
+        return ret_key;
     }
-    /* use xor funtions a xor (b xor a ) = a to isolate a command bit */
-    if ((command ^ IPC_NOWAIT) == IPC_RMID || command == IPC_RMID) {
-        /*case of IPC_RMID | IPC_NOWAIT  or just REMOVE */
+    if (command == TAG_TIMEOUT) {
+        if (arg > MAX_TIMEOUT_US) return -EINVAL;
+        /* the timeout belongs to the descriptor */
+        ret_key = tag_fdget(tag, &f, &handle);
+        if (ret_key < 0) return ret_key;
+        if (!handle->allowed) {
+            fdput(f);
+            return -EPERM;
+        }
+        /* a non zero timeout is at least one jiffy */
+        WRITE_ONCE(handle->timeout, arg == 0 ? 0 : max(usecs_to_jiffies(arg), 1UL));
+        fdput(f);
+        return 0;
+    }
+    if (command == TAG_DIRECT) {
+        if (copy_from_user(&direct, (void *) arg, sizeof(struct tag_direct)) != 0) return -EFAULT;
+        if (direct.level < 0 || direct.level >= LEVELS ||
+            (direct.buffer != NULL && (direct.size == 0 || direct.size > msg_size))) {
+            /* Invalid Arguments error */
+            return -EINVAL;
+        }
+        /* the registration belongs to the descriptor */
+        ret_key = tag_fdget(tag, &f, &handle);
+        if (ret_key < 0) return ret_key;
+        ret_key = handle_pin(handle, &my_tag);
+        if (ret_key == 0) {
+            ret_key = direct_register(my_tag, handle, &direct);
+            tag_put(my_tag);
+        }
+        fdput(f);
+        return ret_key;
+    }
+    if (command == TAG_FILTER) {
+        if (copy_from_user(&filter, (void *) arg, sizeof(struct tag_filter)) != 0) return -EFAULT;
+        if (filter.level < 0 || filter.level >= LEVELS || filter.len > TAG_FILTER_LEN ||
+            filter.offset > msg_size || filter.len > msg_size - filter.offset) {
+            /* Invalid Arguments error */
+            return -EINVAL;
+        }
+        for (ret_key = 0; ret_key < (int) filter.len; ret_key++) {
+            /* a value bit outside the mask never matches */
+            if (filter.value[ret_key] & ~filter.mask[ret_key]) return -EINVAL;
+        }
+        /* the filter belongs to the descriptor */
+        ret_key = tag_fdget(tag, &f, &handle);
+        if (ret_key < 0) return ret_key;
+        ret_key = handle_pin(handle, &my_tag);
+        if (ret_key == 0) {
+            ret_key = filter_register(my_tag, handle, &filter);
+            tag_put(my_tag);
+        }
+        fdput(f);
+        return ret_key;
+    }
+
+    if ((command & ~(IPC_NOWAIT | TAG_DRAIN)) == IPC_RMID) {
+        /*case of IPC_RMID with any combination of IPC_NOWAIT and TAG_DRAIN */
+        ret_key = tag_fdget(tag, &f, &handle);
+        if (ret_key < 0) return ret_key;
+        if (!handle->allowed) {
+            fdput(f);
+            return -EPERM;
+        }
 
-        // every reader and every sender currently working with this tag takes a read lock
-        // we obtain the write lock when neither readers and writers are here anymore
-        if (down_write_trylock(&tag_list[tag].tag_node_rwsem)) {
+        // every reader and every sender currently working with this tag holds a reference (see remove_tag),
+        // the write lock only excludes concurrent creators and removers of the same entry
+        if (down_write_trylock(&tag_list[handle->index].tag_node_rwsem)) {
             // trylock is used to avoid deadlock, see documentation for detailed description.
-            if ((command ^ IPC_RMID) == IPC_NOWAIT) {
-                /* case of IPC_RMID | IPC_NOWAIT
-                 * let's remove the tag */
-                ret_key = remove_tag(tag, 1);
+            if (rcu_access_pointer(tag_list[handle->index].tag_ptr) != handle->tag) {
+                /* already removed, the entry could be used by another tag */
+                ret_key = -ENOENT;
             } else {
-                ret_key = remove_tag(tag, 0);
+                /* let's remove the tag */
+                ret_key = remove_tag(handle->index, command & IPC_NOWAIT, command & TAG_DRAIN);
             }
 
-            up_write(&tag_list[tag].tag_node_rwsem);
+            up_write(&tag_list[handle->index].tag_node_rwsem);
+            fdput(f);
             return ret_key;
 
         } else {
-            /*tag cannot be removed because other readers are still waiting for a message */
+            fdput(f);
+            /*another creator or remover is working on this entry */
             return -EBUSY;
         }
     }
@@ -400,148 +2472,386 @@ int tag_ctl(int tag, int command) {
 }
 
 
-void init_rcu_util(rcu_util_ptr rcu_util) {
+void init_rcu_util(rcu_util_ptr rcu_util, int node) {
     mutex_init(&rcu_util->mtx);
     rcu_util->standings[0] = 0;
     rcu_util->standings[1] = 0;
     rcu_util->awake[0] = NO;
     rcu_util->awake[1] = NO;
+    /* rounds count from 1, a detached round is never 0 */
+    rcu_util->round[0] = 1;
+    rcu_util->round[1] = 0;
+    rcu_util->detached[0] = 0;
+    rcu_util->detached[1] = 0;
     rcu_util->current_epoch = 0;
+    rcu_util->node = node == NUMA_NO_NODE ? numa_node_id() : node;
+    //wait event queues initialization
+    init_waitqueue_head(&rcu_util->the_queue_head[0]);
+    init_waitqueue_head(&rcu_util->the_queue_head[1]);
+    INIT_LIST_HEAD(&rcu_util->direct);
+    INIT_LIST_HEAD(&rcu_util->filtered);
+    init_waitqueue_head(&rcu_util->filter_wq);
+    rcu_util->seq = 0;
 }
 
 /**
  * @description Allows tag instance creation and correct initialization.
  * @param in_key associated to a tag or IPC_PRIVATE
  * @param permissions 0 to grant all user access, > 0 if the access is restricted to the creator
+ * @param node NUMA node for the tag state or NUMA_NO_NODE
  * @return tag descriptor on sussess, an error code on failure
  */
-int create_tag(int in_key, int permissions) {
-    rcu_util_ptr new_msg_rcu;
-    int i, j;
-    tag_ptr_t new_tag;
-    for (i = 0; i < max_tg; i++) {
-        if (down_write_trylock(&tag_list[i].tag_node_rwsem)) {
-            //succesfull , lock acquired
+int create_tag(int in_key, int permissions, int node) {
+    int from = 0, ret;
+    tag_ptr_t new_tag = alloc_tag(in_key, permissions, node);
+    if (new_tag == NULL) return -ENOMEM;
+    ret = publish_tag(new_tag, &from);
+    if (ret < 0) tag_cleanup_mem(new_tag);
+    return ret;
+}
 
-            if (tag_list[i].tag_ptr == NULL) {
-                new_tag = kzalloc(sizeof(struct tag_t), GFP_KERNEL);
-                if (new_tag == NULL) {
-                    //unable to allocate, release lock and return error
-                    up_write(&tag_list[i].tag_node_rwsem);
-                    return -ENOMEM;
-                }
+/**
+ * @description Allocates and initializes the state of a new tag, without publishing it in the tag_list.
+ * @return the new tag, NULL if out of memory
+ */
+tag_ptr_t alloc_tag(int in_key, int permissions, int node) {
+    tag_ptr_t new_tag;
 
+    new_tag = kzalloc_node(sizeof(struct tag_t), GFP_KERNEL, node);
+    if (new_tag == NULL) return NULL;
+
+    // references of the tag_list
+    refcount_set(&new_tag->users, 1);
+    refcount_set(&new_tag->refs, 1);
+    new_tag->key = in_key;
+    new_tag->uid.val = current_uid().val;
+    if (permissions > 0) new_tag->perm = true;
+    else new_tag->perm = false;
+    new_tag->node = node == NUMA_NO_NODE ? numa_node_id() : node;
+    mutex_init(&new_tag->rebuild_mtx);
+    new_tag->last_use = jiffies;
+
+    if (alloc_levels(new_tag->msg_store, new_tag->msg_rcu_util_list, new_tag->node) < 0) {
+        kfree(new_tag);
+        return NULL;
+    }
+    __sync_fetch_and_add(&resident_tags, 1);
+    return new_tag;
+}
 
-                new_tag->key = in_key;
-                new_tag->uid.val = current_uid().val;
-                if (permissions > 0) new_tag->perm = true;
-                else new_tag->perm = false;
-
-
-                for (j = 0; j < LEVELS; j++) {
-
-                    msg_ptr_t new_msg_str = kzalloc(sizeof(struct msg_t), GFP_KERNEL);
-                    if (new_msg_str == NULL) {
-                        tag_list[i].tag_ptr = NULL;
-                        up_write(&tag_list[i].tag_node_rwsem);
-                        tag_cleanup_mem(new_tag);
-                        return -ENOMEM;
-
-                    }
-                    //message buffer initialization
-                    new_msg_str->size = 0;
-                    new_msg_str->msg = NULL;
-                    new_tag->msg_store[j] = new_msg_str;
-
-                    new_msg_rcu = kzalloc(sizeof(struct rcu_util), GFP_KERNEL);
-                    if (new_msg_rcu == NULL) {
-                        tag_list[i].tag_ptr = NULL;
-                        up_write(&tag_list[i].tag_node_rwsem);
-                        tag_cleanup_mem(new_tag);
-                        return -ENOMEM;
-                    }
-                    //rcu util initialization
-                    init_rcu_util(new_msg_rcu);
-                    new_tag->msg_rcu_util_list[j] = new_msg_rcu;
-
-                    //wait event queues initialization
-                    init_waitqueue_head(&new_tag->the_queue_head[j][0]);
-                    init_waitqueue_head(&new_tag->the_queue_head[j][1]);
-                }
+/**
+ * @description Publishes a tag built by alloc_tag in the first free entry of the tag_list starting from *from,
+ * that is moved after the entry used: callers creating many tags don't scan again the entries already taken.
+ * @return tag descriptor on sussess, -EAGAIN if there aren't free entries
+ */
+int publish_tag(tag_ptr_t new_tag, int *from) {
+    int i;
+    for (i = *from; i < max_tg; i++) {
+        if (down_write_trylock(&tag_list[i].tag_node_rwsem)) {
+            //succesfull , lock acquired
 
-                tag_list[i].tag_ptr = new_tag;
-                asm volatile ("sfence":: : "memory");
+            if (rcu_access_pointer(tag_list[i].tag_ptr) == NULL) {
+                /* publish the tag: lookups see it only fully initialized */
+                rcu_assign_pointer(tag_list[i].tag_ptr, new_tag);
 
                 up_write(&tag_list[i].tag_node_rwsem);
+                *from = i + 1;
                 // return a tag descriptor
                 return i;
 
-
-            } else {
-
-                up_write(&tag_list[i].tag_node_rwsem);
-                continue;
-
             }
-
+            up_write(&tag_list[i].tag_node_rwsem);
         }
-
+        //if we can't get write lock on a tag it means that someone else is doing something with that tag
+        //so it isn't free and you cannot insert a new one.
     }
 
     //research failed ... there aren't free tags to use
-    //if we can't get write lock on a tag it means that someone else is doing something with that tag
-    //so it isn't free and you cannot insert a new one.
+    *from = max_tg;
     return -EAGAIN;
-
 }
 
-
 void tag_cleanup_mem(tag_ptr_t tag) {
+    struct tag_msg *msg, *next;
     int i;
     if (tag == NULL) return;
+    if (tag->reclaimed) __sync_fetch_and_sub(&reclaim_stats.released_bytes, tag->released);
+    else __sync_fetch_and_sub(&resident_tags, 1);
     for (i = 0; i < LEVELS; i++) {
-        if (tag->msg_store[i] != NULL) kfree(tag->msg_store[i]);
-        if (tag->msg_rcu_util_list[i] != NULL) kfree(tag->msg_rcu_util_list[i]);
+        if (tag->msg_rcu_util_list[i] != NULL) {
+            /* messages of the senders that gave up after the last combined send */
+            for (msg = tag->msg_rcu_util_list[i]->submitted; msg != NULL; msg = next) {
+                next = msg->submit_next;
+                tag_msg_put(msg);
+            }
+            /* nobody can copy the last value anymore */
+            kfree(rcu_dereference_protected(tag->msg_rcu_util_list[i]->last, 1));
+            if (tag->msg_rcu_util_list[i]->ring != NULL) {
+                /* the pages mapped by users are released by the last munmap */
+                vfree(tag->msg_rcu_util_list[i]->ring->hdr);
+                kfree(tag->msg_rcu_util_list[i]->ring);
+            }
+        }
+        level_free(tag->msg_store[i], tag->msg_rcu_util_list[i]);
     }
 
     kfree(tag);
 }
 
+/* wake up the readers of every level and epoch: they see the tag dying and leave */
+static void wake_up_dying(tag_ptr_t my_tag) {
+    int level;
+    for (level = 0; level < LEVELS; level++) {
+        /* nobody waits on a reclaimed tag */
+        if (my_tag->msg_rcu_util_list[level] == NULL) continue;
+        wake_epoch(my_tag->msg_rcu_util_list[level], 0);
+        wake_epoch(my_tag->msg_rcu_util_list[level], 1);
+        if (my_tag->msg_rcu_util_list[level]->ring != NULL) wake_up_all(&my_tag->msg_rcu_util_list[level]->ring->wq);
+        wake_up_all(&my_tag->msg_rcu_util_list[level]->filter_wq);
+    }
+}
+
+/**
+ * @description Snapshot of the tags with a key for the namespace device: entry, owner, permissions and configuration
+ * of the tag. Creations and removals of keyed tags are excluded while it is taken.
+ * @param recs array of at least max_tg records
+ * @return number of records written, an error code on failure
+ */
+int tag_ns_export(struct tag_ns_record *recs) {
+    tag_ptr_t my_tag;
+    rcu_util_ptr rcu_util;
+    int i, level, count = 0;
+
+    if (mutex_lock_interruptible(&key_list_mtx) == -EINTR) return -EINTR;
+    for (i = 0; i < max_tg; i++) {
+        rcu_read_lock();
+        my_tag = rcu_dereference(tag_list[i].tag_ptr);
+        if (my_tag != NULL && my_tag->key != IPC_PRIVATE && !READ_ONCE(my_tag->dying)) {
+            recs[count].key = my_tag->key;
+            recs[count].tag = i;
+            recs[count].uid = my_tag->uid.val;
+            recs[count].perm = my_tag->perm;
+            recs[count].node = my_tag->node;
+            recs[count].conflate = 0;
+            for (level = 0; level < LEVELS; level++) {
+                /* a conflating level is never reclaimed */
+                rcu_util = READ_ONCE(my_tag->msg_rcu_util_list[level]);
+                if (rcu_util != NULL && READ_ONCE(rcu_util->conflate)) recs[count].conflate |= 1U << level;
+            }
+            recs[count].poll_ns = READ_ONCE(my_tag->poll_ns);
+            recs[count].deadline_ns = READ_ONCE(my_tag->deadline_ns);
+            count++;
+        }
+        rcu_read_unlock();
+    }
+    mutex_unlock(&key_list_mtx);
+    return count;
+}
+
+/**
+ * @description Recreates a tag of a snapshot taken by tag_ns_export with the same key, entry, owner and configuration,
+ * so that the clients find it at once after a module reload.
+ * @return 0 on success, an error code on failure: EINVAL (malformed record), EEXIST (key already in use), EBUSY
+ * (entry already in use or locked by a concurrent operation), ENOMEM, EINTR
+ */
+int tag_ns_import(struct tag_ns_record *rec) {
+    tag_ptr_t new_tag;
+    int node = rec->node, level, ret = 0;
+
+    if (rec->key <= IPC_PRIVATE || rec->key >= max_key || rec->tag < 0 || rec->tag >= max_tg ||
+        (rec->conflate & ~ALL_LEVELS) != 0 || rec->poll_ns > (u64) MAX_BUSY_POLL_US * NSEC_PER_USEC ||
+        rec->deadline_ns > (u64) MAX_DEADLINE_US * NSEC_PER_USEC) {
+        /* Invalid Arguments error */
+        return -EINVAL;
+    }
+    /* the machine could have changed since the snapshot */
+    if (node < 0 || node >= nr_node_ids || !node_online(node)) node = NUMA_NO_NODE;
+
+    new_tag = alloc_tag(rec->key, rec->perm, node);
+    if (new_tag == NULL) return -ENOMEM;
+    new_tag->uid.val = rec->uid;
+    new_tag->poll_ns = rec->poll_ns;
+    new_tag->deadline_ns = rec->deadline_ns;
+    for (level = 0; level < LEVELS; level++) {
+        if (rec->conflate & (1U << level)) new_tag->msg_rcu_util_list[level]->conflate = true;
+    }
+
+    if (mutex_lock_interruptible(&key_list_mtx) == -EINTR) {
+        tag_cleanup_mem(new_tag);
+        return -EINTR;
+    }
+    if (key_list[rec->key] != -1) {
+        ret = -EEXIST;
+    } else if (!down_write_trylock(&tag_list[rec->tag].tag_node_rwsem)) {
+        /* IPC_RMID takes the entry before key_list_mtx: never wait for it here */
+        ret = -EBUSY;
+    } else {
+        if (rcu_access_pointer(tag_list[rec->tag].tag_ptr) != NULL) {
+            ret = -EBUSY;
+        } else {
+            /* publish the tag: lookups see it only fully initialized */
+            rcu_assign_pointer(tag_list[rec->tag].tag_ptr, new_tag);
+            key_list[rec->key] = rec->tag;
+        }
+        up_write(&tag_list[rec->tag].tag_node_rwsem);
+    }
+    mutex_unlock(&key_list_mtx);
+    if (ret < 0) tag_cleanup_mem(new_tag);
+    return ret;
+}
+
+/*
+ * the level keeps something that cannot be rebuilt: a last value, a ring, registrations of the descriptors or
+ * canceled submissions of combined senders
+ */
+static inline bool level_in_use(rcu_util_ptr rcu_util) {
+    return rcu_util->conflate || rcu_access_pointer(rcu_util->last) != NULL || rcu_util->ring != NULL ||
+           !list_empty(&rcu_util->direct) || !list_empty(&rcu_util->filtered) || rcu_util->submitted != NULL;
+}
+
+/**
+ * @description Releases the state of all the levels of a tag nobody has used for idle jiffies, if no thread works on
+ * it (no standing readers, no running senders) and no level is in use (see level_in_use). The tag is held at zero
+ * users meanwhile, so that handle_pin waits for the release and then rebuilds the state (tag_rebuild); the rcu_util
+ * are freed after a grace period because the status snapshots read them without pinning the tag.
+ * Be carefull : take write lock on tag_list[tag]->tag_node_rwsem OUTSIDE of this function, it excludes the removals
+ * and the release of the registrations of the descriptors.
+ * @return true if the state has been released
+ */
+static bool tag_reclaim(tag_ptr_t my_tag, unsigned long idle) {
+    rcu_util_ptr rcu_util;
+    bool busy = false;
+    unsigned long released = 0;
+    int level;
+
+    if (my_tag->reclaimed || READ_ONCE(my_tag->dying) || time_before(jiffies, READ_ONCE(my_tag->last_use) + idle)) {
+        return false;
+    }
+    /* the pinning threads wait for the tag: keep the time short */
+    preempt_disable();
+    if (!refcount_dec_if_one(&my_tag->users)) {
+        preempt_enable();
+        return false;
+    }
+    for (level = 0; level < LEVELS && !busy; level++) busy = level_in_use(my_tag->msg_rcu_util_list[level]);
+    if (!busy) {
+        for (level = 0; level < LEVELS; level++) {
+            rcu_util = my_tag->msg_rcu_util_list[level];
+            my_tag->idle_seq[level] = rcu_util->seq;
+            released += level_state_size(rcu_util);
+            WRITE_ONCE(my_tag->msg_rcu_util_list[level], NULL);
+            kfree(my_tag->msg_store[level]);
+            my_tag->msg_store[level] = NULL;
+            call_rcu(&rcu_util->rcu, level_free_rcu);
+        }
+        my_tag->released = released;
+        WRITE_ONCE(my_tag->reclaimed, true);
+    }
+    /* the threads pinning the tag see it reclaimed */
+    asm volatile ("mfence":: : "memory");
+    refcount_set(&my_tag->users, 1);
+    preempt_enable();
+    /* the pinning threads waiting for the release (see tag_get_user) */
+    asm volatile ("mfence":: : "memory");
+    wake_up_var(&my_tag->users);
+    if (busy) return false;
+
+    __sync_fetch_and_sub(&resident_tags, 1);
+    /* a pinning thread may already be rebuilding the tag, use my own count */
+    __sync_fetch_and_add(&reclaim_stats.reclaimed_bytes, released);
+    __sync_fetch_and_add(&reclaim_stats.released_bytes, released);
+    __sync_fetch_and_add(&reclaim_stats.reclaims, 1);
+    return true;
+}
+
+/**
+ * @description Number of tags whose level state could be released by tag_shrink_scan, for the shrinker.
+ */
+unsigned long tag_shrink_count(void) {
+    return reclaim_idle_ms == 0 ? 0 : READ_ONCE(resident_tags);
+}
+
+/**
+ * @description Releases the level state of the idle tags among the next nr entries of the tag_list, see tag_reclaim.
+ * Never sleeps: busy entries are skipped.
+ * @return number of tags reclaimed
+ */
+unsigned long tag_shrink_scan(unsigned long nr) {
+    unsigned long idle = msecs_to_jiffies(READ_ONCE(reclaim_idle_ms)), reclaimed = 0, i;
+    tag_ptr_t my_tag;
+
+    if (idle == 0) return 0;
+    if (nr > (unsigned long) max_tg) nr = max_tg;
+    for (; nr > 0; nr--) {
+        /* concurrent shrinkers may examine the same entries, it is harmless */
+        i = READ_ONCE(reclaim_cursor) % max_tg;
+        WRITE_ONCE(reclaim_cursor, i + 1);
+        if (!down_write_trylock(&tag_list[i].tag_node_rwsem)) continue;
+        my_tag = rcu_dereference_protected(tag_list[i].tag_ptr, 1);
+        if (my_tag != NULL && tag_reclaim(my_tag, idle)) reclaimed++;
+        up_write(&tag_list[i].tag_node_rwsem);
+    }
+    return reclaimed;
+}
+
+/**
+ * @description Snapshot of the activity of the shrinker.
+ */
+void tag_reclaim_stats(struct tag_reclaim_stats *stats) {
+    stats->reclaimed_bytes = READ_ONCE(reclaim_stats.reclaimed_bytes);
+    stats->released_bytes = READ_ONCE(reclaim_stats.released_bytes);
+    stats->reclaims = READ_ONCE(reclaim_stats.reclaims);
+    stats->rebuilds = READ_ONCE(reclaim_stats.rebuilds);
+}
+
 /**
  * @description Allows tag instance deletion.
  *
  * Be carefull : take write lock on tag_list[tag]->tag_node_rwsem OUTSIDE of this function and use nowait=1 to provide a nonblocking
- * behavior; if nowait is specified and the resource is not immediately available the operation abort and -EBUSY returned
+ * behavior; if nowait is specified and the resource is not immediately available the operation abort and -EBUSY returned.
+ * The operation fails with -EBUSY if some thread holds a reference on the tag (standing readers, running senders),
+ * unless drain is specified: then the tag is marked dying, so that new operations fail with -EIDRM and parked readers
+ * leave, and the operation waits for the threads still working on the tag.
  */
-int remove_tag(int tag, int nowait) {
+int remove_tag(int tag, int nowait, int drain) {
     int ret_key;
-    tag_ptr_t my_tag = tag_list[tag].tag_ptr;
+    tag_ptr_t my_tag = rcu_dereference_protected(tag_list[tag].tag_ptr, 1);
     if (my_tag != NULL) {
         ret_key = my_tag->key;
 
         if (GOT_PERMISSION(my_tag->uid.val, my_tag->perm)) {
-            /*first of all remove the key; this way the tag cannot be used anymore */
             if (ret_key != IPC_PRIVATE) {
                 /*use nowait is IPC_NOWAIT is specified*/
                 if (nowait) {
-                    if (mutex_trylock(&key_list_mtx)) {
-                        key_list[ret_key] = -1;
-                        mutex_unlock(&key_list_mtx);
-                    } else {
-                        return -EBUSY;
-                    }
-
+                    if (!mutex_trylock(&key_list_mtx)) return -EBUSY;
                 } else {
                     if (mutex_lock_interruptible(&key_list_mtx) == -EINTR) return -EINTR;
-                    key_list[ret_key] = -1;
-                    mutex_unlock(&key_list_mtx);
                 }
             }
-            /* delete the tag from the tag_list */
-            tag_list[tag].tag_ptr = NULL;
-            asm volatile ("mfence");
-            /*cleanup memory previously allocated*/
-            tag_cleanup_mem(my_tag);
+            if (drain) {
+                /* from now on the operations that pin the tag give up */
+                WRITE_ONCE(my_tag->dying, true);
+                asm volatile ("mfence":: : "memory");
+            } else if (!refcount_dec_if_one(&my_tag->users)) {
+                /* drop the reference of the tag_list only if it is the last one; this way the tag cannot be used anymore */
+                if (ret_key != IPC_PRIVATE) mutex_unlock(&key_list_mtx);
+                return -EBUSY;
+            }
+            if (ret_key != IPC_PRIVATE) {
+                key_list[ret_key] = -1;
+                mutex_unlock(&key_list_mtx);
+            }
+            if (drain) {
+                wake_up_dying(my_tag);
+                /* parked readers leave at once and running senders only wait for them: the wait is bounded */
+                while (!refcount_dec_if_one(&my_tag->users)) schedule();
+            }
+            /* delete the tag from the tag_list, the threads waiting to pin it give up (see tag_get_user) */
+            RCU_INIT_POINTER(tag_list[tag].tag_ptr, NULL);
+            asm volatile ("mfence":: : "memory");
+            wake_up_var(&my_tag->users);
+            /*cleanup memory previously allocated once concurrent lookups are over and all descriptors are closed*/
+            tag_release(my_tag);
 
             return ret_key;
 
@@ -556,67 +2866,68 @@ int remove_tag(int tag, int nowait) {
 }
 
 /**
- * @description Awakes all thread awaiting for a message on the corresponding tag indipendently of the level.
+ * @description Awakes all thread awaiting for a message on the corresponding tag on the selected levels.
  * Conceptually acts as a sender but an awake notification is sent instead of a message.
- * @param tag tag descriptor
- * @return 0 on success, error code on failure.
+ * The levels are taken in ascending order: a level busy with a sender, a combiner or another awaker is flipped once
+ * its holder is done, so that the readers parked after a message in progress are awoken too. Every level is awoken as
+ * soon as it is flipped, then the readers of every level are waited for: they drain in parallel, so the cost is the
+ * slowest drain instead of the sum of the drains.
+ * @param my_tag tag pinned by the caller
+ * @param levels bit mask of the levels
+ * @return 0 on success, -EINTR if a fatal signal stopped the wait for a busy level (the levels after it only get
+ * their direct, filtered and ring receivers awoken)
  */
-int awake_all(int tag) {
-    int grace_epoch, next_epoch, level;
-    tag_ptr_t my_tag;
-    /* take read lock to avoid that someone deletes the tag entry during my job*/
-    if (down_read_killable(&tag_list[tag].tag_node_rwsem) == -EINTR) return -EINTR;
-
-    my_tag = tag_list[tag].tag_ptr;
-    if (my_tag != NULL) {
-
-        if (GOT_PERMISSION(my_tag->uid.val, my_tag->perm)) {
-
-            for (level = 0; level < LEVELS; level++) {
-                /*
-                 * Use trylock because if it is not immediately acquired it means that a sender is currently there
-                 * to awake this level with a message or it means that another awaker is doing his job on the current epoch.
-                 * this lock is acquired to protect against concurrent threads executing awakers/writers.
-                 */
-                if (mutex_trylock(&my_tag->msg_rcu_util_list[level]->mtx)) {
-
-                    grace_epoch = next_epoch = my_tag->msg_rcu_util_list[level]->current_epoch;
-                    my_tag->msg_rcu_util_list[level]->awake[grace_epoch] = AWAKE;
-
-                    // now change epoch still under write lock
-                    next_epoch += 1;
-                    next_epoch = next_epoch % 2;
-                    my_tag->msg_rcu_util_list[level]->current_epoch = next_epoch;
-                    /* all the following threads belong to the new epoch and won't be awoken*/
-                    my_tag->msg_rcu_util_list[level]->awake[next_epoch] = NO;
-                    asm volatile ("mfence":: : "memory");
-                    /* wake up all thread waiting on the queue corresponding to the grace_epoch */
-                    wake_up_all(&my_tag->the_queue_head[level][grace_epoch]);
-                    /*wait until all readers have been consumed the awake notification */
-                    while (my_tag->msg_rcu_util_list[level]->standings[grace_epoch] > 0) schedule();
-
-                    /* release locks previously aquired */
-                    mutex_unlock(&(my_tag->msg_rcu_util_list[level]->mtx));
-
-                }
-
-
-            }
-            up_read(&tag_list[tag].tag_node_rwsem);
-            return 0;
+int awake_all(tag_ptr_t my_tag, unsigned long levels) {
+    int grace_epoch[LEVELS], next_epoch, level, ret = 0;
+    unsigned long locked = 0;
+    rcu_util_ptr rcu_util;
+
+    for (level = 0; level < LEVELS; level++) {
+        if (!(levels & (1UL << level))) continue;
+        rcu_util = my_tag->msg_rcu_util_list[level];
+        /* receivers of the ring never take the mutex: notify them even if the level is busy */
+        if (READ_ONCE(rcu_util->ring) != NULL) __sync_fetch_and_add(&rcu_util->ring->hdr->awake_gen, 1);
+        /* neither do direct and filtered readers, a sender holding the mutex could skip them */
+        __sync_fetch_and_add(&rcu_util->awake_gen, 1);
+        /*
+         * Wait for the sender or the awaker holding the level: a sender holds a single level and only waits for its
+         * readers, so the wait is bounded by the senders in progress. Only a fatal signal stops it.
+         */
+        if (ret == 0 && mutex_lock_killable(&rcu_util->mtx) != 0) ret = -EINTR;
+        if (ret == 0) {
+            locked |= 1UL << level;
+
+            grace_epoch[level] = next_epoch = rcu_util->current_epoch;
+            rcu_util->awake[grace_epoch[level]] = AWAKE;
 
-        } else {
-            /*permission denided case*/
-            /*release r_lock on the tag_list i-th entry previously obtained*/
-            up_read(&tag_list[tag].tag_node_rwsem);
-            return -EPERM;
+            // now change epoch still under write lock
+            next_epoch += 1;
+            next_epoch = next_epoch % 2;
+            /* the new round comes first, see publish_epoch */
+            rcu_util->round[next_epoch]++;
+            rcu_util->awake[next_epoch] = NO;
+            asm volatile ("mfence":: : "memory");
+            /* all the following threads belong to the new epoch and won't be awoken*/
+            WRITE_ONCE(rcu_util->current_epoch, next_epoch);
+            asm volatile ("mfence":: : "memory");
         }
-    } else {
-        /*release r_lock on the tag_list i-th entry previously obtained*/
-        up_read(&tag_list[tag].tag_node_rwsem);
-        /* tag specified not exists */
-        return -ENOENT;
+
+        /* wake up the threads of the grace epoch now, they don't wait for the mutex of the next levels */
+        if (READ_ONCE(rcu_util->ring) != NULL) wake_up_all(&rcu_util->ring->wq);
+        wake_up_all(&rcu_util->filter_wq);
+        /* readers of registered buffers wait on the queue of epoch 0 */
+        if ((locked & (1UL << level)) && grace_epoch[level] == 0) wake_epoch(rcu_util, 0);
+        else wake_up_all(&rcu_util->the_queue_head[0]);
+        if ((locked & (1UL << level)) && grace_epoch[level] != 0) wake_epoch(rcu_util, 1);
     }
 
+    /*wait until all readers have been consumed the awake notification, then release locks previously aquired */
+    for (level = 0; level < LEVELS; level++) {
+        if (!(locked & (1UL << level))) continue;
+        rcu_util = my_tag->msg_rcu_util_list[level];
+        while (rcu_util->standings[grace_epoch[level]] > 0) schedule();
+        mutex_unlock(&rcu_util->mtx);
+    }
+    return ret;
 
 }
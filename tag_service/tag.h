@@ -6,7 +6,7 @@
 #define SOA_PROJECT_TM_TAG_H
 
 
-#ifdef  __KERNEL__
+#if defined(__KERNEL__) || defined(TAG_USPACE)
 
 #define MODNAME "TAG-SERVICE"
 
@@ -19,5 +19,183 @@
 
 
 #define AWAKE_ALL  00006000   /* awake all threads waiting for a message*/
+#define TAG_BUSY_POLL  00010000   /* tag_ctl: receivers of the tag busy poll for arg microseconds before sleeping, 0 disables */
+#define TAG_POLL_STATS  00020000   /* tag_ctl: copy the struct tag_poll_stats of the tag at the user address arg */
+#define AWAKE_LEVELS  00040000   /* tag_ctl: like AWAKE_ALL only for the levels in the bit mask arg */
+#define TAG_DRAIN  00100000   /* tag_ctl IPC_RMID flag: wake up and wait for the threads on the tag instead of failing */
+#define TAG_CONFLATE  00200000   /* tag_ctl: the levels in the bit mask arg keep only the last value sent, see README */
+#define TAG_DIRECT  00400000   /* tag_ctl: register the receive buffer of struct tag_direct at arg for direct delivery */
+#define TAG_RING  01000000   /* tag_ctl: set up (or attach to) the shared-memory ring of struct tag_ring_req at arg */
+#define TAG_RING_WAIT  02000000   /* tag_ctl: sleep until the ring of struct tag_ring_wait at arg moves, see tag_ring.h */
+#define TAG_RING_WAKE  04000000   /* tag_ctl: wake up the receivers sleeping on the ring of level arg */
+#define TAG_TIMEOUT  010000000   /* tag_ctl: receives through the descriptor fail after arg microseconds, 0 waits forever */
+#define TAG_DEADLINE  020000000   /* tag_ctl: senders of the tag wait for the readers at most arg microseconds, 0 forever */
+#define TAG_DELIVERY_STATS  040000000   /* tag_ctl: copy the struct tag_delivery_stats of the tag at the user address arg */
+#define TAG_FILTER  0100000000   /* tag_ctl: set the receive filter (struct tag_filter at arg) of the descriptor */
+
+#define TAG_POLL 0x100 /* tag_receive level flag: busy poll even if not enabled on the tag, for busy_poll_usecs */
+#define TAG_LATEST 0x200 /* tag_receive level flag: on a conflating level read the current value even if already read */
+#define MAX_BUSY_POLL_US 1000000
+#define MAX_TIMEOUT_US 3600000000UL
+#define MAX_DEADLINE_US 1000000
+#define TAG_FILTER_LEN 16
+
+/* busy poll counters of a tag, see TAG_POLL_STATS */
+struct tag_poll_stats {
+    unsigned long hits; // message or awake notification arrived while spinning
+    unsigned long misses; // poll time elapsed (or rescheduling needed), the receiver went to sleep
+};
+
+/* delivery deadline counters of a tag, see TAG_DELIVERY_STATS */
+struct tag_delivery_stats {
+    unsigned long detached; // sends that stopped waiting for the readers at the deadline
+    unsigned long late; // readers still not scheduled when their sender detached
+    unsigned long expired; // late readers that found the message gone and returned ETIMEDOUT
+    unsigned long filtered; // waiting readers not woken by a send because their filter (TAG_FILTER) did not match
+};
+
+/*
+ * metadata of a message returned by tag_receive_info: seq counts every send of the level from 1, also the ones that
+ * found no reader, so a jump between two messages of a level tells how many were missed
+ */
+struct tag_msg_info {
+    unsigned long long seq;
+    unsigned long long send_ns; // CLOCK_MONOTONIC time of the send
+    int tgid; // sender process, in the initial pid namespace
+    unsigned int uid; // sender user, in the initial user namespace
+    unsigned int size;
+    int level;
+};
+
+/* argument of TAG_DIRECT: buffer NULL unregisters the buffer of the level */
+struct tag_direct {
+    int level;
+    char *buffer;
+    size_t size;
+};
+
+/*
+ * argument of TAG_FILTER: a message matches if its len bytes at offset, and-ed with mask, are equal to value
+ * (value must be within mask); len 0 removes the filter of the level
+ */
+struct tag_filter {
+    int level;
+    unsigned int offset;
+    unsigned int len; // at most TAG_FILTER_LEN
+    unsigned char mask[TAG_FILTER_LEN];
+    unsigned char value[TAG_FILTER_LEN];
+};
+
+/* argument of TAG_RING: slots 0 attaches to the ring of the level whatever its geometry */
+struct tag_ring_req {
+    int level;
+    unsigned int slots; // power of two, at most MAX_RING_SLOTS
+    unsigned int slot_size; // max message size of the ring
+};
+
+/* argument of TAG_RING_WAIT: the caller sleeps while head <= seq and awake_gen is unchanged */
+struct tag_ring_wait {
+    int level;
+    unsigned int awake_gen;
+    unsigned long long seq;
+};
+
+/*
+ * Shared-memory ring of a level, mapped with mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, td, level * page size).
+ * The header is followed by slots of TAG_RING_STRIDE(slot_size) bytes, see tag_ring.h for the protocol.
+ */
+struct tag_ring_hdr {
+    unsigned int slots;
+    unsigned int slot_size;
+    unsigned int waiters; // receivers sleeping (or going to sleep) in TAG_RING_WAIT
+    unsigned int awake_gen; // AWAKE notifications of the level
+    char pad0[48];
+    unsigned long long head; // next sequence number claimed by a sender
+    char pad1[56];
+};
+
+struct tag_ring_slot {
+    unsigned long long seq; // 2 * n + 1 while the message n is written, 2 * n + 2 once it is complete
+    unsigned int len;
+    unsigned int pad;
+    char data[];
+};
+
+#define TAG_RING_STRIDE(slot_size) ((sizeof(struct tag_ring_slot) + (slot_size) + 63) & ~63UL)
+#define MAX_RING_SLOTS 65536
+#define MAX_RING_BYTES (64UL << 20)
+
+/* request of tag_get_bulk: key, command and permissions as in tag_get, ret is set to the descriptor or error code */
+struct tag_get_req {
+    int key;
+    int command;
+    int permissions;
+    int ret;
+};
+
+#define MAX_BULK_GET 1024
+
+/* subscription of tag_receive_set: the levels of the bit mask (bit n for level n) of the tag descriptor tag */
+struct tag_sub {
+    int tag;
+    unsigned int levels;
+};
+
+/* where the message (or the failure) returned by tag_receive_set comes from */
+struct tag_origin {
+    int index; // subscription of the set, -1 if the failure concerns the whole set
+    int tag;
+    int level; // -1 if the failure concerns the whole subscription
+};
+
+#define MAX_SUBSCRIPTIONS 256 // (tag, level) pairs of a set
+
+/* message slot of tag_receive_batch: buffer and size are read, level and len are written */
+struct tag_mmsg {
+    char *buffer;
+    size_t size;
+    int level;
+    int len; // bytes copied, -ENOBUFS if the message did not fit in the buffer
+};
+
+#define MAX_BATCH_MSGS 1024
+#define MAX_BATCH_WINDOW_US 1000000
+
+/*
+ * Snapshot of the tag namespace read from the namespace device (minor TAG_NS_MINOR) before a module reload and written
+ * back to it after the reload: a header followed by count records, one for every tag with a key.
+ */
+#define TAG_NS_MINOR 1
+#define TAG_NS_MAGIC 0x54414753 // "TAGS"
+#define TAG_NS_VERSION 1
+
+struct tag_ns_hdr {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int count;
+    unsigned int record_size; // sizeof(struct tag_ns_record)
+};
+
+struct tag_ns_record {
+    int key;
+    int tag; // tag_list entry, kept by the import (descriptors are not: clients call tag_get again)
+    unsigned int uid; // owner
+    int perm; // access restricted to the owner
+    int node; // NUMA node of the tag state, NUMA_NO_NODE if it is offline after the reload
+    unsigned int conflate; // levels in last-value mode (TAG_CONFLATE)
+    unsigned long long poll_ns; // TAG_BUSY_POLL
+    unsigned long long deadline_ns; // TAG_DEADLINE
+};
+
+/*
+ * tag_get command hint: allocate the state of a new tag on NUMA node n, e.g. tag_get(key, IPC_CREAT | TAG_NODE(1), 0).
+ * The hint is ignored when an existing tag is opened.
+ */
+#define TAG_NODE_SHIFT 16
+#define TAG_NODE_MASK (0xff << TAG_NODE_SHIFT)
+#define TAG_NODE(n) ((((n) + 1) & 0xff) << TAG_NODE_SHIFT)
+
+/* tag_get command: open the existing tag of the key only, ENOENT if there is none, e.g. tag_get(key, TAG_OPEN, 0) */
+#define TAG_OPEN 0x1000000
 
 #endif //SOA_PROJECT_TM_TAG_H
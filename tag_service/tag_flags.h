@@ -7,6 +7,11 @@
 #include <stdbool.h>
 #include <linux/rwsem.h>
 #include <linux/uidgid.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
 #include "tag.h"
 
 #define SOA_PROJECT_TM_TAG_FLAGS_H
@@ -16,6 +21,8 @@
 #define MESSAGE (NO+1)
 #define AWAKE (MESSAGE + 1)
 
+#define ALL_LEVELS ((1UL << LEVELS) - 1) // level bit mask of AWAKE_ALL
+
 #define GOT_PERMISSION(permission, do_check)({ \
         /* only creator user can access to this tag and the current user correspond to him */ \
         (do_check && permission == current_uid().val)  ||                                      \
@@ -26,17 +33,120 @@
 })
 
 
-struct msg_t {
-    char *msg; // message
+/* message of a send, the readers that took a reference copy it after leaving the epoch */
+struct tag_msg {
+    refcount_t refs; // one for the sender while it is published plus one for every reader copying it
+    struct rcu_head rcu; // deferred release: readers look it up under rcu_read_lock
+    char **replicas; // per node copies of the message, NULL if not replicated
     size_t size; // message size
+    struct tag_msg_info info;
+    struct tag_msg *batch; // next message of a combined batch (see SUBMIT_PENDING), referenced by this one
+    struct tag_msg *submit_next; // in the submission list of the level, then in the batch being published
+    int submit_state;
+    int submit_ret; // outcome of the combined send, valid in SUBMIT_DONE
+    char data[];
+};
+
+struct msg_t {
+    struct tag_msg __rcu *msg[2]; // message of the readers of each epoch, NULL when no sender waits for them
 };
 typedef struct msg_t *msg_ptr_t;
 
+/* value of a conflating level (TAG_CONFLATE), replaced by every send */
+struct last_value {
+    unsigned long version; // 1 for the first value of the level, then +1 for every replacement
+    refcount_t refs; // one for the level while it is the current value plus one for every reader copying it
+    struct rcu_head rcu; // deferred release: lock-free readers could still see it
+    size_t size;
+    struct tag_msg_info info;
+    char data[];
+};
+
+/* state of a registered receive buffer (TAG_DIRECT) */
+#define DIRECT_IDLE 0 // the owner is not receiving
+#define DIRECT_ARMED 1 // the owner waits for a message in it
+#define DIRECT_FILLING 2 // a sender is copying the message
+#define DIRECT_FULL 3 // message delivered, len is valid
+#define DIRECT_DEAD 4 // being unregistered
+
+/* receive buffer of a descriptor registered on a level: senders copy the message straight into its pinned pages */
+struct direct_buf {
+    struct list_head node; // in the direct list of the level, under the level mutex
+    char *ubuf; // registered user address
+    size_t size;
+    char *kaddr; // kernel mapping of the registered buffer
+    struct page **pages;
+    int nr_pages;
+    int state;
+    long len; // bytes delivered or error code
+    struct tag_msg_info info; // metadata of the message delivered
+};
+
+#define SUBMIT_PENDING 0 // queued by a sender waiting for the level mutex
+#define SUBMIT_CLAIMED 1 // taken by the sender holding the mutex, the combiner, in the batch it publishes
+#define SUBMIT_CANCELED 2 // the sender gave up before a combiner took it
+#define SUBMIT_DONE 3 // published by the combiner, submit_ret is valid
+
+#define FILTER_IDLE 0 // no receive through the registration
+#define FILTER_CLAIMED 1 // a receiver is arming it
+#define FILTER_ARMED 2 // the owner waits for a matching message
+#define FILTER_SELECTED 3 // a sender counted the owner in the epoch of a matching message
+#define FILTER_DEAD 4 // being unregistered
+
+/* receive filter of a descriptor on a level: senders only count and wake the owner for the matching messages */
+struct filter_reg {
+    struct list_head node; // in the filtered list of the level, under the level mutex
+    struct tag_filter filter;
+    int state;
+    int home; // NUMA node of the waiting owner
+    int epoch; // epoch of the message, set by the sender that selects the owner
+    unsigned long round; // round of that epoch (rcu_util.round), set by the same sender
+    int sel_node; // node counted in node_standings by that sender
+    wait_queue_head_t wq; // the owner waits here, only the senders that select it wake it
+};
+
+/* shared-memory ring of a level (TAG_RING), the geometry is kept here because the header is writable by the users */
+struct ring_util {
+    struct tag_ring_hdr *hdr; // vmalloc_user area: header followed by the slots
+    size_t size; // bytes of the area, multiple of PAGE_SIZE
+    unsigned int slots;
+    unsigned int slot_size;
+    wait_queue_head_t wq; // receivers sleeping in TAG_RING_WAIT
+};
+
+/* wait queues of the standing readers running on a CPU, woken by a work item on that CPU (see fanout_wake) */
+struct fanout_shard {
+    wait_queue_head_t wq[2]; // one for each epoch, like the_queue_head
+    struct work_struct work;
+    struct rcu_util *owner;
+    int epoch; // epoch woken by the work, set before queueing it
+};
+
 struct rcu_util {
     unsigned long standings[2];
+    unsigned long round[2]; // times the epoch became current, a reader of an older round is late (see reader_collect)
+    unsigned long detached[2]; // last round of the epoch whose sender detached at the deadline (TAG_DEADLINE), 0 if none
     int current_epoch;
     int awake[2]; // used as awake condition for the wait event queue
     struct mutex mtx; // used to have mutual exclusion between senders
+    wait_queue_head_t the_queue_head[2]; //wait event queue head
+    unsigned long *node_standings; // standing readers of both epochs for every NUMA node
+    int node; // NUMA node of the level state
+    bool conflate; // last-value mode: senders replace last and never wait for readers
+    struct last_value __rcu *last; // current value of the conflating level, NULL before the first send
+    unsigned long published; // values published in last-value mode, readers wait for it to pass their version
+    struct list_head direct; // registered receive buffers, under mtx
+    unsigned long awake_gen; // AWAKE notifications, watched by the direct and filtered readers (not in standings)
+    struct ring_util *ring; // shared-memory ring, set once under mtx and freed with the tag
+    struct list_head filtered; // receive filters, under mtx
+    wait_queue_head_t filter_wq; // filtered readers also wait here for AWAKE notifications, removal and mode changes
+    unsigned long long seq; // sequence number of the last message sent on the level (struct tag_msg_info)
+    struct rcu_head rcu; // deferred release by the shrinker: the status snapshots read it under rcu_read_lock
+    struct tag_msg *submitted; // messages of the senders waiting for mtx, newest first (lock-free stack)
+    unsigned long singles; // receives of the level that return a single message, a batch is never published to them
+    int combining; // a combiner is choosing between one batch and one epoch per message (see single_enter)
+    struct fanout_shard *fanout; // nr_cpu_ids shards, allocated once fanout_threshold readers stand on the level
+    unsigned long fanout_pending; // work items queued by the sender of the level and not run yet
 };
 typedef struct rcu_util *rcu_util_ptr;
 
@@ -46,48 +156,119 @@ struct tag_t {
     kuid_t uid; // creator uid
     bool perm; // true if it is restricted to the creator user; false if it is public (all case)
     msg_ptr_t msg_store[LEVELS];
-    wait_queue_head_t the_queue_head[LEVELS][2]; //wait event queue head
-    rcu_util_ptr msg_rcu_util_list[LEVELS];
+    rcu_util_ptr msg_rcu_util_list[LEVELS]; // NULL while the level state is reclaimed, see tag_reclaim
+    int node; // NUMA node of the level state
+    bool reclaimed; // the level state has been released by the shrinker, rebuilt by the next operation
+    struct mutex rebuild_mtx; // exclusion between the threads rebuilding the level state
+    unsigned long last_use; // jiffies of the last operation, the shrinker only releases idle tags
+    unsigned long long idle_seq[LEVELS]; // sequence numbers of the levels while the state is reclaimed
+    unsigned long released; // bytes of level state released by the shrinker, 0 if not reclaimed
+    bool dying; // being removed with TAG_DRAIN: new operations fail and parked readers leave
+    unsigned long poll_ns; // busy poll time of the receivers, 0 if disabled
+    struct tag_poll_stats poll_stats;
+    unsigned long deadline_ns; // time senders wait for the readers (TAG_DEADLINE), 0 waits for all of them
+    struct tag_delivery_stats delivery_stats;
+    refcount_t users; // one for the tag_list plus one for every thread working on the tag
+    refcount_t refs; // memory references: one for the tag_list plus one for every open handle
+    struct rcu_head rcu; // deferred release after removal
 };
 typedef struct tag_t *tag_ptr_t;
 
+/* private data of a tag descriptor (file) returned by tag_get */
+struct tag_handle {
+    tag_ptr_t tag; // pinned with a memory reference
+    int index; // tag_list entry of the tag
+    bool allowed; // permission check done at open time
+    unsigned long seen[LEVELS]; // last version read from every conflating level through this descriptor
+    struct direct_buf __rcu *direct[LEVELS]; // registered receive buffers, see TAG_DIRECT
+    struct filter_reg __rcu *filter[LEVELS]; // receive filters, see TAG_FILTER
+    unsigned long timeout; // receive timeout in jiffies (TAG_TIMEOUT), 0 waits forever
+};
+typedef struct tag_handle *tag_handle_ptr;
+
+/* (tag, level) of a subscription set the caller of tag_receive_set is waiting on */
+struct sub_wait {
+    tag_handle_ptr handle;
+    tag_ptr_t tag; // pinned for the whole receive
+    int index; // subscription of the set
+    int level;
+    int epoch; // the caller is a standing reader of this epoch of the level
+    int node;
+    unsigned long seen; // see level_receive
+    unsigned long round; // round of the epoch at the entry
+    wait_queue_entry_t wait; // on the queue of the epoch
+};
+
 
 typedef struct tag_info_t {
-    tag_ptr_t tag_ptr;
-    struct rw_semaphore tag_node_rwsem;
+    struct tag_t __rcu *tag_ptr; // published with rcu_assign_pointer, looked up under rcu_read_lock
+    struct rw_semaphore tag_node_rwsem; // exclusion between creators and removers of the entry
 } tag_node;
 
 typedef tag_node *tag_node_ptr;
 
+/* activity of the shrinker of the level state of idle tags, shown by the tag device */
+struct tag_reclaim_stats {
+    unsigned long reclaimed_bytes; // level state released since the module was loaded
+    unsigned long released_bytes; // level state of the tags still reclaimed
+    unsigned long reclaims; // tags reclaimed
+    unsigned long rebuilds; // tags whose level state has been rebuilt
+};
+
 /**
  * @description Create a new instance associated with the key or opens an existing one by using the key.
  * This function acts differently basing on the command and key combination.
  * @param key associated to a tag or IPC_PRIVATE
  * @param command Use IPC_CREAT to create a new tag instance associated to the corresponding key or to open an existing one.
  * If  IPC_CREAT | IPC_EXCL is specified and the tag instance associated to the key already exists an error is generated.
+ * Use TAG_OPEN to open only the existing tag of the key, without creating it.
+ * TAG_NODE(n) can be added to place the state of a newly created tag on the NUMA node n (EINVAL if n is not online).
  * @param permissions 0 to grant all user access, > 0 if the access is restricted to the creator
- * @return a tag descriptor on success or an appropriate error code.
+ * @return a tag descriptor on success or an appropriate error code. The descriptor is a file descriptor of the calling
+ * process (close-on-exec) that pins the tag and records the permission check: use close() to release it, it can be
+ * shared with fork or passed over a unix socket. Every call returns a new descriptor.
  * @errors
  * EINVAL: Invalid Arguments.\n
  * ENOMEM: Out of memory.\n
  * EEXIST: Tag already exists and IPC_EXCL is specified with IPC_CREAT.\n
+ * ENOENT: No tag for the key and TAG_OPEN is specified.\n
  * EEAGAIN: Operation failed, but if you retry may success.\n
+ * EMFILE: Too many open files.\n
  */
 int tag_get(int key, int command, int permissions);
 
+/**
+ * @description Opens or creates many tags at once, like nr calls of tag_get(reqs[i].key, reqs[i].command,
+ * reqs[i].permissions) but with one system call, one acquisition of the key lock and the state of the new tags
+ * allocated before taking it. The result of each request (tag descriptor or negative error code) is stored in
+ * reqs[i].ret; a failed request does not stop the others.
+ * @param reqs userspace array of requests
+ * @param nr number of requests, at most MAX_BULK_GET
+ * @return the number of tag descriptors opened, an error code if the array cannot be processed.
+ * @errors
+ * EINVAL: Invalid Arguments.\n
+ * ENOMEM: Out of memory.\n
+ * EFAULT: Invalid user address.\n
+ * EINTR: Stopped, interrupt occured.\n
+ */
+int tag_get_bulk(struct tag_get_req *reqs, unsigned int nr);
+
 /**
  * @description Send a message to the corresponding tag-level instance, awake all waiting threads then wait delivery ends up.
  * This function could be blocking and could be interrupted by a signal.
  * This service doesn't keep any message log; if nobody waits for the incoming message this is discarded.
- * @param tag tag descriptor
+ * On a conflating level (see TAG_CONFLATE) the message replaces the value of the level and the call never blocks.
+ * @param tag tag descriptor returned by tag_get
  * @param level message source level
  * @param buffer userspace buffer address
  * @param size buffer lenght, empty messages are anyhow allowed.
  * @return 0 on success, appropriate error code otherwise
  * @errors
  * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
  * ENOMEM: Out of memory.\n
- * ENOENT: Tag doesn't exist.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
  * EINTR: Stopped, interrupt occured.\n
  * EPERM: Operation not permitted.\n
  * EFAULT: Message delivery fault.\n
@@ -97,57 +278,222 @@ int tag_send(int tag, int level, char *buffer, size_t size);
 /**
  * @description This operation blocks the caller untill an incoming message arrives from the corresponding tag-level instance.
  * The caller could be unlocked even if a signal arrives or another thread calls tag_clt with the AWAKE_ALL command.
- * @param tag tag descriptor
- * @param level message source level
+ * @param tag tag descriptor returned by tag_get
+ * @param level message source level, TAG_POLL can be added to busy poll before sleeping (see TAG_BUSY_POLL).
+ * On a conflating level (see TAG_CONFLATE) the call returns at once the current value if it is newer than the last one
+ * read through the descriptor, otherwise it waits for a newer one; with TAG_LATEST the current value is always read.
+ * With a filter set on the level through the descriptor (TAG_FILTER) only a matching message is received; a single
+ * receive at a time uses the filter.
+ * Concurrent senders of the level are not combined in one batch while the call waits (see Combined sends).
+ * If buffer is the buffer registered on the level with TAG_DIRECT the sender copies the message in it and the size of
+ * the registration applies.
  * @param buffer userspace buffer address
  * @param size buffer lenght
  * @return bytes copied on success, appropriate error code otherwise.
  * @errors
  * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
  * ENOBUFS: Not enough buffer space available.\n
- * ENOENT: Tag doesn't exist.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
  * EINTR: Stopped, interrupt occured.\n
  * EPERM: Operation not permitted.\n
  * EFAULT: Message recovery fault.\n
+ * EBUSY: Another thread receives through the filter of the descriptor on the level (TAG_FILTER).\n
  * ECANCELED: Operation canceled because of AWAKE notification.\n
+ * ETIMEDOUT: No message within the receive timeout of the descriptor (TAG_TIMEOUT), or the sender stopped waiting
+ * for the reader at the delivery deadline of the tag (TAG_DEADLINE) before it could take the message.\n
  */
 int tag_receive(int tag, int level, char *buffer, size_t size);
 
+/**
+ * @description Like tag_receive, moreover stores the metadata of the message received in info: the sequence number
+ * of the message in its level, the sender process and user, the CLOCK_MONOTONIC time of the send, the size and the
+ * level. Sequence numbers grow with the sends of a level, also the ones that found no reader, so the difference with
+ * the previous message received tells how many were missed. On a conflating level (see TAG_CONFLATE) the current
+ * value carries the number of its send, the values replaced before being read are the missed ones.
+ * @param tag tag descriptor returned by tag_get
+ * @param level message source level, TAG_POLL and TAG_LATEST as in tag_receive
+ * @param buffer userspace buffer address
+ * @param size buffer lenght
+ * @param info userspace address of the struct tag_msg_info of the message, written only on success
+ * @return bytes copied on success, appropriate error code otherwise.
+ * @errors
+ * As tag_receive; EFAULT also if info can't be written, the message is consumed.\n
+ */
+int tag_receive_info(int tag, int level, char *buffer, size_t size, struct tag_msg_info *info);
+
+/**
+ * @description Receives the first message of a subscription set: the caller waits at once on every (tag, level) of
+ * the set, as a reader of the current epoch of each level, and returns the first message, awake notification or
+ * removal among them together with its origin. When more levels are ready at the same time the one that comes first
+ * in the set wins; the caller leaves the other levels, so their messages are not delivered to it, like to a reader
+ * that is not waiting. Registered buffers (TAG_DIRECT), filters (TAG_FILTER) and busy polling are not used,
+ * conflating levels behave as in tag_receive. The receive timeout (TAG_TIMEOUT) of the descriptor of the first
+ * subscription applies.
+ * @param subs userspace array of subscriptions
+ * @param nr number of subscriptions, at most MAX_SUBSCRIPTIONS (tag, level) pairs in all
+ * @param buffer userspace buffer address
+ * @param size buffer lenght
+ * @param origin userspace address where the subscription, the descriptor and the level of the message are stored,
+ * also on failures of a single subscription (level -1 if the failure concerns all its levels, index -1 for failures
+ * of the whole set such as EINTR or ETIMEDOUT by the timeout)
+ * @return bytes copied on success, appropriate error code otherwise.
+ * @errors
+ * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
+ * ENOMEM: Out of memory.\n
+ * ENOBUFS: Not enough buffer space available.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
+ * EINTR: Stopped, interrupt occured.\n
+ * EPERM: Operation not permitted.\n
+ * EFAULT: Message recovery fault.\n
+ * ECANCELED: Operation canceled because of AWAKE notification.\n
+ * ETIMEDOUT: No message within the receive timeout of the first descriptor (TAG_TIMEOUT), or the sender stopped
+ * waiting for the reader at the delivery deadline of the tag (TAG_DEADLINE) before it could take the message.\n
+ */
+int tag_receive_set(struct tag_sub *subs, unsigned int nr, char *buffer, size_t size, struct tag_origin *origin);
+
+/**
+ * @description Receives up to nr messages of the levels of a tag in a single call, like recvmmsg: the first message
+ * is waited for as in tag_receive_set on a single subscription (tag, levels), then the call keeps collecting messages
+ * for a coalescing window of window_us microseconds from the arrival of the first one, or until window_msgs messages
+ * are collected, whichever comes first, so that a high-rate consumer pays one syscall and one wake up for many
+ * messages. The levels stay joined for the whole call, so that no message sent while the previous one is copied is
+ * missed, and every message of a combined batch of concurrent senders is returned (see Combined sends). Every message
+ * takes a slot of msgs: its buffer and size are read, the level of the message and the bytes copied (-ENOBUFS if it
+ * did not fit) are written. After the first message a failure (AWAKE notification, removal, signal) ends the batch
+ * and the messages collected are returned. The receive timeout (TAG_TIMEOUT) of the descriptor applies to the first
+ * message.
+ * @param tag tag descriptor returned by tag_get
+ * @param levels bit mask of the levels (bit n for level n)
+ * @param msgs userspace array of message slots (struct tag_mmsg)
+ * @param nr number of slots, at most MAX_BATCH_MSGS
+ * @param window_us coalescing window after the first message, at most MAX_BATCH_WINDOW_US; 0 only takes the messages
+ * ready at once
+ * @param window_msgs the call returns as soon as this many messages are collected, 0 for nr
+ * @return number of messages received on success, appropriate error code otherwise.
+ * @errors
+ * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
+ * ENOMEM: Out of memory.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
+ * EINTR: Stopped, interrupt occured.\n
+ * EPERM: Operation not permitted.\n
+ * EFAULT: Message recovery fault, or msgs can't be read or written.\n
+ * ECANCELED: Operation canceled because of AWAKE notification.\n
+ * ETIMEDOUT: No message within the receive timeout of the descriptor (TAG_TIMEOUT), or the sender stopped waiting for
+ * the reader at the delivery deadline of the tag (TAG_DEADLINE) before it could take the message.\n
+ */
+int tag_receive_batch(int tag, unsigned int levels, struct tag_mmsg *msgs, unsigned int nr, unsigned int window_us,
+                      unsigned int window_msgs);
+
 /**
  * @description This operation control a tag instance by awakening operation or the by removing operation.
  * This function acts differently basing on the command and key combination.
- * @param tag tag descriptor
+ * @param tag tag descriptor returned by tag_get
  * @param command use IPC_RMID command to remove a tag instance, this will fail if there are readers waiting for a message on the corresponding tag.
  * IPC_RMID command can be combinating with IPC_NOWAIT command to have a nonblocking behavior.
- * Use the AWAKE_ALL command to wake up all thread waiting for a message on the corresponding tag indipendently of the level.
+ * IPC_RMID | TAG_DRAIN does not fail on waiting readers: the tag is marked removed, so that new operations fail with EIDRM,
+ * the waiting readers are woken up (they return EIDRM) and the call returns once every thread has left the tag.
+ * Use the AWAKE_ALL command to wake up all thread waiting for a message on the corresponding tag indipendently of the level,
+ * AWAKE_LEVELS to wake up only the threads waiting on the levels of the bit mask arg (bit n for level n).
+ * A level busy with a sender is awoken once its message is published, so that no reader parked meanwhile is missed.
+ * Use the TAG_BUSY_POLL command to make all the receivers of the tag spin up to arg microseconds (at most
+ * MAX_BUSY_POLL_US, 0 disables) before sleeping, TAG_POLL_STATS to copy the struct tag_poll_stats of the tag at arg.
+ * Use the TAG_CONFLATE command to switch the levels of the bit mask arg to last-value mode (the others back to normal
+ * mode): a send replaces the value of the level without waiting for the readers.
+ * Use the TAG_DIRECT command with the address of a struct tag_direct to register (or unregister, buffer NULL) a receive
+ * buffer of the descriptor on a level: senders copy the messages straight into it (see tag_receive).
+ * Use the TAG_FILTER command with the address of a struct tag_filter to set (or remove, len 0) the receive filter of the
+ * descriptor on a level: the receives get only the messages matching it, the senders wake up the matching readers only.
+ * Use the TAG_RING command with the address of a struct tag_ring_req to set up the shared-memory ring of a level and
+ * get the size to mmap on the descriptor (see tag_ring.h): senders and receivers exchange the messages in user space and
+ * enter the kernel only to sleep on an empty ring (TAG_RING_WAIT with a struct tag_ring_wait) and to wake the sleepers
+ * (TAG_RING_WAKE with the level as arg).
+ * Use the TAG_TIMEOUT command to make the receives through the descriptor fail with ETIMEDOUT if no message comes
+ * within arg microseconds (at most MAX_TIMEOUT_US, 0 waits forever).
+ * Use the TAG_DEADLINE command to bound the wait of the senders of the tag for the readers to arg microseconds (at
+ * most MAX_DEADLINE_US, 0 waits forever), TAG_DELIVERY_STATS to copy the struct tag_delivery_stats of the tag at arg.
+ * @param arg argument of the command, ignored by IPC_RMID and AWAKE_ALL
  * @return non-negative value on success, negative on failure and errno is set to the correct error code.
  * @errors
  * EINVAL: Invalid Arguments.\n
+ * EBADF: Not a tag descriptor.\n
  * EBUSY: Resource busy.\n
- * ENOENT: Tag doesn't exist.\n
+ * ENOENT: Tag has been removed.\n
+ * EIDRM: Tag is being removed (TAG_DRAIN).\n
  * EINTR: Stopped, interrupt occured.\n
  * EPERM: Operation not permitted.\n
+ * EFAULT: Invalid user address.\n
+ * ENOMEM: Out of memory.\n
+ * EEXIST: The ring of the level has another geometry (TAG_RING).\n
+ * ENXIO: No ring on the level (TAG_RING_WAIT, TAG_RING_WAKE, TAG_RING attaching).\n
+ * ECANCELED: Operation canceled because of AWAKE notification (TAG_RING_WAIT).\n
  */
-int tag_ctl(int tag, int command);
+int tag_ctl(int tag, int command, unsigned long arg);
 
 void tag_cleanup_mem(tag_ptr_t tag);
 
-int awake_all(int tag);
+void init_rcu_util(rcu_util_ptr rcu_util, int node);
+
+int awake_all(tag_ptr_t my_tag, unsigned long levels);
 
 /**
  * @description Allows tag instance creation and correct initialization.
  * @param in_key associated to a tag or IPC_PRIVATE
  * @param permissions 0 to grant all user access, > 0 if the access is restricted to the creator
+ * @param node NUMA node for the tag state or NUMA_NO_NODE
  * @return tag descriptor on sussess, an error code on failure
  */
-int create_tag(int in_key, int permissions);
+int create_tag(int in_key, int permissions, int node);
+
+tag_ptr_t alloc_tag(int in_key, int permissions, int node);
+
+int publish_tag(tag_ptr_t new_tag, int *from);
 
 /**
  * @description Allows tag instance deletion.
  *
  * Be carefull : take write lock on tag_list[tag]->tag_node_rwsem OUTSIDE of this function and use nowait=1 to provide a nonblocking
- * behavior; if nowait is specified and the resource is not immediately available the operation abort and -EBUSY returned
+ * behavior; if nowait is specified and the resource is not immediately available the operation abort and -EBUSY returned.
+ * Use drain=1 to wake up and wait for the threads working on the tag instead of failing with -EBUSY.
+ */
+int remove_tag(int tag, int nowait, int drain);
+
+/**
+ * @description Snapshot of the tags with a key for the namespace device: entry, owner, permissions and configuration
+ * of the tag. Creations and removals of keyed tags are excluded while it is taken.
+ * @param recs array of at least max_tg records
+ * @return number of records written, an error code on failure
+ */
+int tag_ns_export(struct tag_ns_record *recs);
+
+/**
+ * @description Recreates a tag of a snapshot taken by tag_ns_export with the same key, entry, owner and configuration,
+ * so that the clients find it at once after a module reload.
+ * @return 0 on success, an error code on failure: EINVAL (malformed record), EEXIST (key already in use), EBUSY
+ * (entry already in use), ENOMEM, EINTR
+ */
+int tag_ns_import(struct tag_ns_record *rec);
+
+/**
+ * @description Number of tags whose level state could be released by tag_shrink_scan, for the shrinker.
+ */
+unsigned long tag_shrink_count(void);
+
+/**
+ * @description Releases the level state of the idle tags among the next nr entries of the tag_list, see tag_reclaim.
+ * Never sleeps: busy entries are skipped.
+ * @return number of tags reclaimed
+ */
+unsigned long tag_shrink_scan(unsigned long nr);
+
+/**
+ * @description Snapshot of the activity of the shrinker.
  */
-int remove_tag(int tag, int nowait);
+void tag_reclaim_stats(struct tag_reclaim_stats *stats);
 
 #endif //SOA_PROJECT_TM_TAG_FLAGS_H
@@ -22,8 +22,10 @@
 #include <linux/syscalls.h>
 #include <linux/cdev.h>
 #include <linux/rwsem.h>
+#include <linux/rcupdate.h>
 #include <linux/errno.h>
 #include <linux/compiler.h>
+#include <linux/shrinker.h>
 
 
 #include "systbl_hack/systbl_hack.h"
@@ -69,16 +71,108 @@ unsigned int msg_size = MSG_LEN;
 module_param(msg_size, uint, S_IRUGO);
 MODULE_PARM_DESC(msg_size, "Max message size.");
 
+/* Min message size replicated on every NUMA node with standing readers. */
+unsigned int numa_replica_size = 0;
+
+module_param(numa_replica_size, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(numa_replica_size, "Min message size replicated on the readers NUMA nodes (0 = disabled).");
+
+/* Default busy poll time of TAG_POLL receives. */
+unsigned int busy_poll_usecs = 50;
+
+module_param(busy_poll_usecs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(busy_poll_usecs, "Busy poll time in microseconds of the receives with TAG_POLL on tags without TAG_BUSY_POLL.");
+
+/* Standing readers of a level from which the senders offload the wake ups to per-CPU work items. */
+unsigned int fanout_threshold = 256;
+
+module_param(fanout_threshold, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fanout_threshold, "Standing readers of a level from which the wake ups are split across per-CPU workers (0 = disabled).");
+
+/* Idle time after which the shrinker can release the level state of a tag. */
+unsigned int reclaim_idle_ms = 60000;
+
+module_param(reclaim_idle_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(reclaim_idle_ms, "Idle milliseconds after which the shrinker can release the level state of a tag (0 = never).");
+
 tag_node_ptr tag_list = NULL;
 int *key_list = NULL;
 
 
-int tag_get_nr; // tag_get syscall number
-int tag_send_nr; //tag_send syscall number
-int tag_receive_nr;// tag_receive syscall number
-int tag_ctl_nr;// tag_ctl syscall number
+/* syscall numbers, published read-only so that user space libraries can discover them */
+int tag_get_nr = -1; // tag_get syscall number
+int tag_send_nr = -1; //tag_send syscall number
+int tag_receive_nr = -1;// tag_receive syscall number
+int tag_ctl_nr = -1;// tag_ctl syscall number
+int tag_get_bulk_nr = -1;// tag_get_bulk syscall number
+int tag_receive_set_nr = -1;// tag_receive_set syscall number
+int tag_receive_info_nr = -1;// tag_receive_info syscall number
+int tag_receive_batch_nr = -1;// tag_receive_batch syscall number
+
+module_param(tag_get_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_get_nr, "Syscall number of tag_get.");
+module_param(tag_send_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_send_nr, "Syscall number of tag_send.");
+module_param(tag_receive_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_receive_nr, "Syscall number of tag_receive.");
+module_param(tag_ctl_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_ctl_nr, "Syscall number of tag_ctl.");
+module_param(tag_get_bulk_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_get_bulk_nr, "Syscall number of tag_get_bulk.");
+module_param(tag_receive_set_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_receive_set_nr, "Syscall number of tag_receive_set.");
+module_param(tag_receive_info_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_receive_info_nr, "Syscall number of tag_receive_info.");
+module_param(tag_receive_batch_nr, int, S_IRUGO);
+MODULE_PARM_DESC(tag_receive_batch_nr, "Syscall number of tag_receive_batch.");
 extern struct file_operations fops;
 
+static unsigned long tag_shrinker_count(struct shrinker *shrinker, struct shrink_control *sc) {
+    unsigned long count = tag_shrink_count();
+    return count == 0 ? SHRINK_EMPTY : count;
+}
+
+static unsigned long tag_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc) {
+    unsigned long reclaimed = tag_shrink_scan(sc->nr_to_scan);
+    return reclaimed == 0 ? SHRINK_STOP : reclaimed;
+}
+
+/* releases the level state of the idle tags under memory pressure, see tag_shrink_scan */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *tag_shrinker;
+
+static int tag_shrinker_register(void) {
+    tag_shrinker = shrinker_alloc(0, "tag_service");
+    if (tag_shrinker == NULL) return -ENOMEM;
+    tag_shrinker->count_objects = tag_shrinker_count;
+    tag_shrinker->scan_objects = tag_shrinker_scan;
+    shrinker_register(tag_shrinker);
+    return 0;
+}
+
+static void tag_shrinker_unregister(void) {
+    shrinker_free(tag_shrinker);
+}
+#else
+static struct shrinker tag_shrinker = {
+        .count_objects = tag_shrinker_count,
+        .scan_objects = tag_shrinker_scan,
+        .seeks = DEFAULT_SEEKS,
+};
+
+static int tag_shrinker_register(void) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    return register_shrinker(&tag_shrinker, "tag_service");
+#else
+    return register_shrinker(&tag_shrinker);
+#endif
+}
+
+static void tag_shrinker_unregister(void) {
+    unregister_shrinker(&tag_shrinker);
+}
+#endif
+
 __SYSCALL_DEFINEx(3, _tag_get, int, key, int, command, int, permissions) {
     int res;
     if (!try_module_get(THIS_MODULE)) return -ENOSYS;
@@ -104,10 +198,45 @@ __SYSCALL_DEFINEx(4, _tag_receive, int, tag, int, level, char *, buffer, size_t,
 
 }
 
-__SYSCALL_DEFINEx(2, _tag_ctl, int, tag, int, command) {
+__SYSCALL_DEFINEx(3, _tag_ctl, int, tag, int, command, unsigned long, arg) {
     int res;
     if (!try_module_get(THIS_MODULE)) return -ENOSYS;
-    res = tag_ctl(tag, command);
+    res = tag_ctl(tag, command, arg);
+    module_put(THIS_MODULE);
+    return res;
+}
+
+__SYSCALL_DEFINEx(2, _tag_get_bulk, struct tag_get_req *, reqs, unsigned int, nr) {
+    int res;
+    if (!try_module_get(THIS_MODULE)) return -ENOSYS;
+    res = tag_get_bulk(reqs, nr);
+    module_put(THIS_MODULE);
+    return res;
+}
+
+__SYSCALL_DEFINEx(5, _tag_receive_set, struct tag_sub *, subs, unsigned int, nr, char *, buffer, size_t, size,
+                  struct tag_origin *, origin) {
+    int res;
+    if (!try_module_get(THIS_MODULE)) return -ENOSYS;
+    res = tag_receive_set(subs, nr, buffer, size, origin);
+    module_put(THIS_MODULE);
+    return res;
+}
+
+__SYSCALL_DEFINEx(5, _tag_receive_info, int, tag, int, level, char *, buffer, size_t, size,
+                  struct tag_msg_info *, info) {
+    int res;
+    if (!try_module_get(THIS_MODULE)) return -ENOSYS;
+    res = tag_receive_info(tag, level, buffer, size, info);
+    module_put(THIS_MODULE);
+    return res;
+}
+
+__SYSCALL_DEFINEx(6, _tag_receive_batch, int, tag, unsigned int, levels, struct tag_mmsg *, msgs, unsigned int, nr,
+                  unsigned int, window_us, unsigned int, window_msgs) {
+    int res;
+    if (!try_module_get(THIS_MODULE)) return -ENOSYS;
+    res = tag_receive_batch(tag, levels, msgs, nr, window_us, window_msgs);
     module_put(THIS_MODULE);
     return res;
 }
@@ -171,11 +300,11 @@ int tag_service_init(void) {
 
     for (i = 0; i < max_tg; i++) {
         init_rwsem(&tag_list[i].tag_node_rwsem);
-        tag_list[i].tag_ptr = NULL;
+        RCU_INIT_POINTER(tag_list[i].tag_ptr, NULL);
     }
 
 
-    /*insert the 4 system calls in the table */
+    /*insert the 8 system calls in the table */
     tag_get_nr = systbl_hack(__x64_sys_tag_get);
     if (tag_get_nr < 0) goto error_exit_point;
 
@@ -188,10 +317,28 @@ int tag_service_init(void) {
     tag_ctl_nr = systbl_hack(__x64_sys_tag_ctl);
     if (tag_ctl_nr < 0) goto error_exit_point;
 
+    tag_get_bulk_nr = systbl_hack(__x64_sys_tag_get_bulk);
+    if (tag_get_bulk_nr < 0) goto error_exit_point;
+    tag_receive_set_nr = systbl_hack(__x64_sys_tag_receive_set);
+    if (tag_receive_set_nr < 0) goto error_exit_point;
+    tag_receive_info_nr = systbl_hack(__x64_sys_tag_receive_info);
+    if (tag_receive_info_nr < 0) goto error_exit_point;
+    tag_receive_batch_nr = systbl_hack(__x64_sys_tag_receive_batch);
+    if (tag_receive_batch_nr < 0) goto error_exit_point;
+
     printk(KERN_INFO "%s : tag_get at %d\n", MODNAME, tag_get_nr);
     printk(KERN_INFO "%s : tag_send at %d\n", MODNAME, tag_send_nr);
     printk(KERN_INFO "%s : tag_receive at %d\n", MODNAME, tag_receive_nr);
     printk(KERN_INFO "%s : tag_ctl at %d\n", MODNAME, tag_ctl_nr);
+    printk(KERN_INFO "%s : tag_get_bulk at %d\n", MODNAME, tag_get_bulk_nr);
+    printk(KERN_INFO "%s : tag_receive_set at %d\n", MODNAME, tag_receive_set_nr);
+    printk(KERN_INFO "%s : tag_receive_info at %d\n", MODNAME, tag_receive_info_nr);
+    printk(KERN_INFO "%s : tag_receive_batch at %d\n", MODNAME, tag_receive_batch_nr);
+
+    if (tag_shrinker_register() < 0) {
+        printk(KERN_INFO "%s : Unable to register the shrinker.\n", MODNAME);
+        goto error_exit_point;
+    }
 
     printk(KERN_INFO "%s : module correctly mounted\n", MODNAME);
     return 0;
@@ -202,6 +349,10 @@ int tag_service_init(void) {
     systbl_entry_restore(tag_receive_nr, 1);
     systbl_entry_restore(tag_send_nr, 1);
     systbl_entry_restore(tag_ctl_nr, 1);
+    systbl_entry_restore(tag_get_bulk_nr, 1);
+    systbl_entry_restore(tag_receive_set_nr, 1);
+    systbl_entry_restore(tag_receive_info_nr, 1);
+    systbl_entry_restore(tag_receive_batch_nr, 1);
     printk(KERN_INFO "%s : Failed initialization\n", MODNAME);
     kfree(tag_list);
     kfree(key_list);
@@ -230,16 +381,33 @@ void tag_service_clean(void) {
     if (systbl_entry_restore(tag_ctl_nr, 1) == 0) {
         printk(KERN_INFO "%s : deleted tag_ctl at %d\n", MODNAME, tag_ctl_nr);
     }
+    if (systbl_entry_restore(tag_get_bulk_nr, 1) == 0) {
+        printk(KERN_INFO "%s : deleted tag_get_bulk at %d\n", MODNAME, tag_get_bulk_nr);
+    }
+    if (systbl_entry_restore(tag_receive_set_nr, 1) == 0) {
+        printk(KERN_INFO "%s : deleted tag_receive_set at %d\n", MODNAME, tag_receive_set_nr);
+    }
+    if (systbl_entry_restore(tag_receive_info_nr, 1) == 0) {
+        printk(KERN_INFO "%s : deleted tag_receive_info at %d\n", MODNAME, tag_receive_info_nr);
+    }
+    if (systbl_entry_restore(tag_receive_batch_nr, 1) == 0) {
+        printk(KERN_INFO "%s : deleted tag_receive_batch at %d\n", MODNAME, tag_receive_batch_nr);
+    }
 
     if (major_number != 0) {
         printk(KERN_INFO "%s : unregister %s.\n", MODNAME, DEVICE_NAME);
         unregister_chrdev(major_number, DEVICE_NAME);
     }
 
+    tag_shrinker_unregister();
     kfree(key_list);
+    /* wait for the tags removed and the level state reclaimed but not yet released */
+    rcu_barrier();
     for (i = 0; i < max_tg; i++) {
-        tag_cleanup_mem(tag_list[i].tag_ptr);
+        tag_cleanup_mem(rcu_dereference_protected(tag_list[i].tag_ptr, 1));
     }
+    /* the messages left by the senders of a combined send are released after a grace period too */
+    rcu_barrier();
     kfree(tag_list);
     module_put(systbl_hack_mod_ptr);
     printk(KERN_INFO "%s : clean system calls for tag-service ... exit.\n", MODNAME);
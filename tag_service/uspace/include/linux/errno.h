@@ -0,0 +1,3 @@
+/* user space shim of <linux/errno.h>, see uspace_shim.h */
+#include_next <linux/errno.h>
+#include "../../uspace_shim.h"
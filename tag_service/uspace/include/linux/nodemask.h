@@ -0,0 +1,2 @@
+/* user space shim of <linux/nodemask.h>, see uspace_shim.h */
+#include "../../uspace_shim.h"
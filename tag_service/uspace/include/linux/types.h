@@ -0,0 +1,3 @@
+/* user space shim of <linux/types.h>, see uspace_shim.h */
+#include_next <linux/types.h>
+#include "../../uspace_shim.h"
@@ -0,0 +1,593 @@
+/**
+ * @file tag_core_bench.c
+ *
+ * @description Microbenchmark suite for the tag core compiled in user space (see tag_uspace.c).
+ * Every benchmark reports the number of operations, the elapsed time and the cost of a single operation,
+ * one line per benchmark so that results of different builds can be easily compared.
+ */
+
+#include <getopt.h>
+#include <time.h>
+
+#include "tag_flags.h"
+#include "tag.h"
+#include "tag_uspace.h"
+
+#define BENCH_KEY 1
+#define STARTUP_KEYS 128
+
+struct bench_cfg {
+    int threads;
+    int receivers;
+    int size;
+    unsigned long iterations;
+    unsigned long poll_us;
+};
+
+struct bench_arg {
+    struct bench_cfg *cfg;
+    int tag;
+    int level;
+    struct tag_sub *subs; // subscription set of the receivers of tag_receive_set
+    unsigned int nsubs;
+    unsigned char class_id; // first byte of the messages wanted by a class receiver
+    int filtered; // the class receiver sets a TAG_FILTER instead of discarding the other messages
+    unsigned long ops;
+    unsigned long discarded;
+};
+
+static atomic_int stop;
+static atomic_int exited;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void report(const char *name, struct bench_cfg *cfg, unsigned long ops, double elapsed_ns) {
+    printf("%-12s threads=%-3d receivers=%-3d size=%-5d ops=%-9lu elapsed_ms=%-9.2f ops/s=%-11.0f ns/op=%.1f\n",
+           name, cfg->threads, cfg->receivers, cfg->size, ops, elapsed_ns / 1e6,
+           ops / (elapsed_ns / 1e9), ops ? elapsed_ns / ops : 0.0);
+}
+
+/* standing readers of the current epoch of a tag-level */
+static unsigned long standing(int tag, int level) {
+    tag_ptr_t my_tag = tag_uspace_peek(tag);
+    rcu_util_ptr rcu;
+    if (my_tag == NULL) return 0;
+    rcu = my_tag->msg_rcu_util_list[level];
+    return __atomic_load_n(&rcu->standings[__atomic_load_n(&rcu->current_epoch, __ATOMIC_ACQUIRE)],
+                           __ATOMIC_ACQUIRE);
+}
+
+/* receivers parked on their registered buffer of a tag-level (they are not counted in standings) */
+static unsigned long armed(int tag, int level) {
+    tag_ptr_t my_tag = tag_uspace_peek(tag);
+    struct direct_buf *reg;
+    unsigned long total = 0;
+    if (my_tag == NULL) return 0;
+    list_for_each_entry(reg, &my_tag->msg_rcu_util_list[level]->direct, node) {
+        if (__atomic_load_n(&reg->state, __ATOMIC_ACQUIRE) == DIRECT_ARMED) total++;
+    }
+    return total;
+}
+
+/* receivers parked on their filter of a tag-level (they are not counted in standings either) */
+static unsigned long filtering(int tag, int level) {
+    tag_ptr_t my_tag = tag_uspace_peek(tag);
+    struct filter_reg *reg;
+    unsigned long total = 0;
+    if (my_tag == NULL) return 0;
+    list_for_each_entry(reg, &my_tag->msg_rcu_util_list[level]->filtered, node) {
+        if (__atomic_load_n(&reg->state, __ATOMIC_ACQUIRE) == FILTER_ARMED) total++;
+    }
+    return total;
+}
+
+static unsigned long standing_all(int tag) {
+    unsigned long total = 0;
+    int level;
+    for (level = 0; level < LEVELS; level++) total += standing(tag, level);
+    return total;
+}
+
+/* run nthreads copies of fn and return the elapsed time */
+static double run_threads(void *(*fn)(void *), struct bench_arg *args, int nthreads) {
+    pthread_t tids[nthreads];
+    double start;
+    int i;
+    start = now_ns();
+    for (i = 0; i < nthreads; i++) pthread_create(&tids[i], NULL, fn, &args[i]);
+    for (i = 0; i < nthreads; i++) pthread_join(tids[i], NULL);
+    return now_ns() - start;
+}
+
+static void *get_rmid_worker(void *data) {
+    struct bench_arg *arg = data;
+    unsigned long i;
+    int td;
+    for (i = 0; i < arg->cfg->iterations; i++) {
+        td = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+        if (td < 0) continue;
+        tag_ctl(td, IPC_RMID, 0);
+        tag_uspace_close(td);
+        arg->ops++;
+    }
+    return NULL;
+}
+
+static void *open_key_worker(void *data) {
+    struct bench_arg *arg = data;
+    unsigned long i;
+    int td;
+    for (i = 0; i < arg->cfg->iterations; i++) {
+        td = tag_get(BENCH_KEY, IPC_CREAT, 0);
+        if (td < 0) continue;
+        tag_uspace_close(td);
+        arg->ops++;
+    }
+    return NULL;
+}
+
+static void *send_worker(void *data) {
+    struct bench_arg *arg = data;
+    char *buffer = calloc(1, arg->cfg->size);
+    unsigned long i;
+    for (i = 0; i < arg->cfg->iterations; i++) {
+        if (tag_send(arg->tag, arg->level, buffer, arg->cfg->size) == 0) arg->ops++;
+    }
+    free(buffer);
+    return NULL;
+}
+
+static void *receive_worker(void *data) {
+    struct bench_arg *arg = data;
+    char *buffer = calloc(1, arg->cfg->size);
+    while (!atomic_load(&stop)) {
+        if (tag_receive(arg->tag, arg->level, buffer, arg->cfg->size) >= 0) arg->ops++;
+    }
+    free(buffer);
+    atomic_fetch_add(&exited, 1);
+    return NULL;
+}
+
+/* receiver of the first message of a subscription set */
+static void *receive_set_worker(void *data) {
+    struct bench_arg *arg = data;
+    char *buffer = calloc(1, arg->cfg->size);
+    struct tag_origin origin;
+    while (!atomic_load(&stop)) {
+        if (tag_receive_set(arg->subs, arg->nsubs, buffer, arg->cfg->size, &origin) >= 0) arg->ops++;
+    }
+    free(buffer);
+    atomic_fetch_add(&exited, 1);
+    return NULL;
+}
+
+/* receiver with its own descriptor and a registered buffer, the sender copies the messages straight into it */
+static void *direct_receive_worker(void *data) {
+    struct bench_arg *arg = data;
+    char *buffer = calloc(1, arg->cfg->size);
+    struct tag_direct req = {.level = arg->level, .buffer = buffer, .size = arg->cfg->size};
+    tag_ctl(arg->tag, TAG_DIRECT, (unsigned long) &req);
+    while (!atomic_load(&stop)) {
+        if (tag_receive(arg->tag, arg->level, buffer, arg->cfg->size) >= 0) arg->ops++;
+    }
+    req.buffer = NULL;
+    tag_ctl(arg->tag, TAG_DIRECT, (unsigned long) &req);
+    free(buffer);
+    atomic_fetch_add(&exited, 1);
+    return NULL;
+}
+
+/* receiver of the messages of its class, filtered by the senders or discarded after the wake up and the copy */
+static void *class_receive_worker(void *data) {
+    struct bench_arg *arg = data;
+    char *buffer = calloc(1, arg->cfg->size);
+    struct tag_filter filter = {.level = arg->level, .len = 1, .mask = {0xff}, .value = {arg->class_id}};
+    if (arg->filtered) tag_ctl(arg->tag, TAG_FILTER, (unsigned long) &filter);
+    while (!atomic_load(&stop)) {
+        if (tag_receive(arg->tag, arg->level, buffer, arg->cfg->size) < 1) continue;
+        if ((unsigned char) buffer[0] == arg->class_id) arg->ops++;
+        else arg->discarded++;
+    }
+    free(buffer);
+    atomic_fetch_add(&exited, 1);
+    return NULL;
+}
+
+/* stop all the receivers parked on a tag, AWAKE_ALL is repeated because a receiver could not be parked yet */
+static void stop_receivers(int tag, pthread_t *tids, int nreceivers) {
+    int i;
+    atomic_store(&stop, 1);
+    while (atomic_load(&exited) < nreceivers) {
+        tag_ctl(tag, AWAKE_ALL, 0);
+        usleep(100);
+    }
+    for (i = 0; i < nreceivers; i++) pthread_join(tids[i], NULL);
+    atomic_store(&stop, 0);
+    atomic_store(&exited, 0);
+}
+
+static void start_receivers(struct bench_arg *args, pthread_t *tids, int nreceivers) {
+    int i;
+    for (i = 0; i < nreceivers; i++) pthread_create(&tids[i], NULL, receive_worker, &args[i]);
+}
+
+/* tag creation and removal */
+static void bench_get_rmid(struct bench_cfg *cfg) {
+    struct bench_arg args[cfg->threads];
+    unsigned long ops = 0;
+    double elapsed;
+    int i;
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < cfg->threads; i++) args[i].cfg = cfg;
+    elapsed = run_threads(get_rmid_worker, args, cfg->threads);
+    for (i = 0; i < cfg->threads; i++) ops += args[i].ops;
+    report("get_rmid", cfg, ops, elapsed);
+}
+
+/* open of an already existing key */
+static void bench_open_key(struct bench_cfg *cfg) {
+    struct bench_arg args[cfg->threads];
+    unsigned long ops = 0;
+    double elapsed;
+    int i, td;
+    td = tag_get(BENCH_KEY, IPC_CREAT, 0);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < cfg->threads; i++) args[i].cfg = cfg;
+    elapsed = run_threads(open_key_worker, args, cfg->threads);
+    for (i = 0; i < cfg->threads; i++) ops += args[i].ops;
+    report("open_key", cfg, ops, elapsed);
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+}
+
+/* senders on the same tag-level without readers: publish, epoch flip and sender exclusion cost */
+static void bench_send_empty(struct bench_cfg *cfg) {
+    struct bench_arg args[cfg->threads];
+    unsigned long ops = 0;
+    double elapsed;
+    int i, td;
+    td = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < cfg->threads; i++) {
+        args[i].cfg = cfg;
+        args[i].tag = td;
+    }
+    elapsed = run_threads(send_worker, args, cfg->threads);
+    for (i = 0; i < cfg->threads; i++) ops += args[i].ops;
+    report("send_empty", cfg, ops, elapsed);
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+}
+
+/* one sender, every message is delivered to all the receivers: full publish/wake/drain round trip */
+static void fanout(struct bench_cfg *cfg, const char *name, unsigned long poll_us) {
+    struct bench_arg args[cfg->receivers];
+    pthread_t tids[cfg->receivers];
+    char *buffer = calloc(1, cfg->size);
+    unsigned long i, iterations = cfg->iterations / 10 + 1;
+    double elapsed = 0, start;
+    struct tag_poll_stats stats;
+    int td;
+    td = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+    tag_ctl(td, TAG_BUSY_POLL, poll_us);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < (unsigned long) cfg->receivers; i++) {
+        args[i].cfg = cfg;
+        args[i].tag = td;
+    }
+    start_receivers(args, tids, cfg->receivers);
+    for (i = 0; i < iterations; i++) {
+        while (standing(td, 0) < (unsigned long) cfg->receivers) sched_yield();
+        start = now_ns();
+        tag_send(td, 0, buffer, cfg->size);
+        elapsed += now_ns() - start;
+    }
+    stop_receivers(td, tids, cfg->receivers);
+    report(name, cfg, iterations, elapsed);
+    if (poll_us != 0) {
+        tag_ctl(td, TAG_POLL_STATS, (unsigned long) &stats);
+        printf("%-12s poll_us=%lu hits=%lu misses=%lu\n", name, poll_us, stats.hits, stats.misses);
+    }
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+    free(buffer);
+}
+
+static void bench_fanout(struct bench_cfg *cfg) {
+    fanout(cfg, "fanout", 0);
+}
+
+/* the same round trip with receivers spinning before sleeping */
+static void bench_fanout_poll(struct bench_cfg *cfg) {
+    fanout(cfg, "fanout_poll", cfg->poll_us);
+}
+
+/* senders on a conflating level with receivers reading the new values: senders never wait for the readers */
+static void bench_conflate(struct bench_cfg *cfg) {
+    struct bench_arg args[cfg->threads], rargs[cfg->receivers];
+    pthread_t tids[cfg->receivers];
+    unsigned long ops = 0, received = 0;
+    double elapsed;
+    int i, td;
+    td = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+    tag_ctl(td, TAG_CONFLATE, 1UL);
+    memset(args, 0, sizeof(args));
+    memset(rargs, 0, sizeof(rargs));
+    for (i = 0; i < cfg->threads; i++) {
+        args[i].cfg = cfg;
+        args[i].tag = td;
+    }
+    for (i = 0; i < cfg->receivers; i++) {
+        rargs[i].cfg = cfg;
+        rargs[i].tag = td;
+    }
+    start_receivers(rargs, tids, cfg->receivers);
+    elapsed = run_threads(send_worker, args, cfg->threads);
+    stop_receivers(td, tids, cfg->receivers);
+    for (i = 0; i < cfg->threads; i++) ops += args[i].ops;
+    for (i = 0; i < cfg->receivers; i++) received += rargs[i].ops;
+    report("conflate", cfg, ops, elapsed);
+    printf("%-12s values_read=%lu\n", "conflate", received);
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+}
+
+/* the fanout round trip with every receiver on a registered buffer: no kernel copy and no wait for the readers */
+static void bench_fanout_direct(struct bench_cfg *cfg) {
+    struct bench_arg args[cfg->receivers];
+    pthread_t tids[cfg->receivers];
+    char *buffer = calloc(1, cfg->size);
+    unsigned long i, iterations = cfg->iterations / 10 + 1;
+    double elapsed = 0, start;
+    int td;
+    td = tag_get(BENCH_KEY, IPC_CREAT, 0);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < (unsigned long) cfg->receivers; i++) {
+        args[i].cfg = cfg;
+        args[i].tag = tag_get(BENCH_KEY, IPC_CREAT, 0);
+        pthread_create(&tids[i], NULL, direct_receive_worker, &args[i]);
+    }
+    for (i = 0; i < iterations; i++) {
+        while (armed(td, 0) < (unsigned long) cfg->receivers) sched_yield();
+        start = now_ns();
+        tag_send(td, 0, buffer, cfg->size);
+        elapsed += now_ns() - start;
+    }
+    stop_receivers(td, tids, cfg->receivers);
+    report("fanout_direct", cfg, iterations, elapsed);
+    for (i = 0; i < (unsigned long) cfg->receivers; i++) tag_uspace_close(args[i].tag);
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+    free(buffer);
+}
+
+/* one sender cycling over the classes of the receivers, every message is wanted by a single receiver */
+static void classes(struct bench_cfg *cfg, const char *name, int filtered) {
+    struct bench_arg args[cfg->receivers];
+    pthread_t tids[cfg->receivers];
+    char *buffer = calloc(1, cfg->size);
+    unsigned long i, delivered = 0, discarded = 0, iterations = cfg->iterations / 10 + 1;
+    struct tag_delivery_stats stats;
+    double elapsed = 0, start;
+    int td;
+    td = tag_get(BENCH_KEY, IPC_CREAT, 0);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < (unsigned long) cfg->receivers; i++) {
+        args[i].cfg = cfg;
+        args[i].tag = tag_get(BENCH_KEY, IPC_CREAT, 0);
+        args[i].class_id = (unsigned char) i;
+        args[i].filtered = filtered;
+        pthread_create(&tids[i], NULL, class_receive_worker, &args[i]);
+    }
+    for (i = 0; i < iterations; i++) {
+        buffer[0] = (char) (i % cfg->receivers);
+        while ((filtered ? filtering(td, 0) : standing(td, 0)) < (unsigned long) cfg->receivers) sched_yield();
+        start = now_ns();
+        tag_send(td, 0, buffer, cfg->size);
+        elapsed += now_ns() - start;
+    }
+    stop_receivers(td, tids, cfg->receivers);
+    report(name, cfg, iterations, elapsed);
+    for (i = 0; i < (unsigned long) cfg->receivers; i++) {
+        delivered += args[i].ops;
+        discarded += args[i].discarded;
+        tag_uspace_close(args[i].tag);
+    }
+    tag_ctl(td, TAG_DELIVERY_STATS, (unsigned long) &stats);
+    printf("%-12s delivered=%lu discarded=%lu not_woken=%lu\n", name, delivered, discarded, stats.filtered);
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+    free(buffer);
+}
+
+static void bench_filter(struct bench_cfg *cfg) {
+    classes(cfg, "filter_discard", 0);
+    classes(cfg, "filter_kernel", 1);
+}
+
+/* AWAKE_ALL with the receivers spread over all the levels */
+static void bench_awake(struct bench_cfg *cfg) {
+    struct bench_arg args[cfg->receivers];
+    pthread_t tids[cfg->receivers];
+    unsigned long i, iterations = cfg->iterations / 100 + 1;
+    double elapsed = 0, start;
+    int td;
+    td = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < (unsigned long) cfg->receivers; i++) {
+        args[i].cfg = cfg;
+        args[i].tag = td;
+        args[i].level = (int) (i % LEVELS);
+    }
+    start_receivers(args, tids, cfg->receivers);
+    for (i = 0; i < iterations; i++) {
+        while (standing_all(td) < (unsigned long) cfg->receivers) sched_yield();
+        start = now_ns();
+        tag_ctl(td, AWAKE_ALL, 0);
+        elapsed += now_ns() - start;
+    }
+    stop_receivers(td, tids, cfg->receivers);
+    report("awake_all", cfg, iterations, elapsed);
+    tag_ctl(td, IPC_RMID, 0);
+    tag_uspace_close(td);
+}
+
+/* fan-in: a sender on each of threads tags, received by a thread per tag or by one thread on a set of all the tags */
+static void fanin(struct bench_cfg *cfg, const char *name, int use_set) {
+    struct bench_arg args[cfg->threads], rargs[cfg->threads];
+    struct tag_sub subs[cfg->threads];
+    pthread_t tids[cfg->threads];
+    unsigned long received = 0;
+    double elapsed;
+    int i, nreceivers = use_set ? 1 : cfg->threads;
+    memset(args, 0, sizeof(args));
+    memset(rargs, 0, sizeof(rargs));
+    for (i = 0; i < cfg->threads; i++) {
+        args[i].cfg = rargs[i].cfg = cfg;
+        args[i].tag = rargs[i].tag = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+        subs[i].tag = args[i].tag;
+        subs[i].levels = 1;
+    }
+    rargs[0].subs = subs;
+    rargs[0].nsubs = cfg->threads;
+    for (i = 0; i < nreceivers; i++) {
+        pthread_create(&tids[i], NULL, use_set ? receive_set_worker : receive_worker, &rargs[i]);
+    }
+    elapsed = run_threads(send_worker, args, cfg->threads);
+    atomic_store(&stop, 1);
+    while (atomic_load(&exited) < nreceivers) {
+        for (i = 0; i < cfg->threads; i++) tag_ctl(args[i].tag, AWAKE_ALL, 0);
+        usleep(100);
+    }
+    for (i = 0; i < nreceivers; i++) pthread_join(tids[i], NULL);
+    atomic_store(&stop, 0);
+    atomic_store(&exited, 0);
+    for (i = 0; i < nreceivers; i++) received += rargs[i].ops;
+    report(name, cfg, received, elapsed);
+    for (i = 0; i < cfg->threads; i++) {
+        tag_ctl(args[i].tag, IPC_RMID, 0);
+        tag_uspace_close(args[i].tag);
+    }
+}
+
+static void bench_fanin(struct bench_cfg *cfg) {
+    fanin(cfg, "fanin_threads", 0);
+    fanin(cfg, "fanin_set", 1);
+}
+
+/* remove the tags opened by a startup round */
+static void startup_teardown(struct tag_get_req *reqs) {
+    int i;
+    for (i = 0; i < STARTUP_KEYS; i++) {
+        if (reqs[i].ret < 0) continue;
+        tag_ctl(reqs[i].ret, IPC_RMID, 0);
+        tag_uspace_close(reqs[i].ret);
+    }
+}
+
+/* process startup: creation of STARTUP_KEYS keyed tags with a tag_get each and with a single tag_get_bulk */
+static void bench_startup(struct bench_cfg *cfg) {
+    struct tag_get_req reqs[STARTUP_KEYS];
+    unsigned long round, rounds = cfg->iterations / 1000 + 1;
+    double elapsed_get = 0, elapsed_bulk = 0, start;
+    int i;
+    for (i = 0; i < STARTUP_KEYS; i++) {
+        reqs[i].key = BENCH_KEY + 1 + i;
+        reqs[i].command = IPC_CREAT;
+        reqs[i].permissions = 0;
+    }
+    for (round = 0; round < rounds; round++) {
+        start = now_ns();
+        for (i = 0; i < STARTUP_KEYS; i++) reqs[i].ret = tag_get(reqs[i].key, reqs[i].command, reqs[i].permissions);
+        elapsed_get += now_ns() - start;
+        startup_teardown(reqs);
+
+        start = now_ns();
+        tag_get_bulk(reqs, STARTUP_KEYS);
+        elapsed_bulk += now_ns() - start;
+        startup_teardown(reqs);
+    }
+    report("startup_get", cfg, rounds * STARTUP_KEYS, elapsed_get);
+    report("startup_bulk", cfg, rounds * STARTUP_KEYS, elapsed_bulk);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(struct bench_cfg *cfg);
+} benches[] = {
+        {"get_rmid",   bench_get_rmid},
+        {"open_key",   bench_open_key},
+        {"send_empty", bench_send_empty},
+        {"fanout",     bench_fanout},
+        {"fanout_poll", bench_fanout_poll},
+        {"fanout_direct", bench_fanout_direct},
+        {"awake_all",  bench_awake},
+        {"conflate",   bench_conflate},
+        {"startup",    bench_startup},
+        {"fanin",      bench_fanin},
+        {"filter",     bench_filter},
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t threads] [-r receivers] [-s msg size] [-n iterations] [-p poll us] [-b bench]\n",
+            prog);
+    fprintf(stderr, "benchmarks: get_rmid open_key send_empty fanout fanout_poll fanout_direct awake_all conflate startup fanin filter (default all)\n");
+}
+
+int main(int argc, char **argv) {
+    struct bench_cfg cfg = {.threads = 4, .receivers = 4, .size = 64, .iterations = 100000, .poll_us = 20};
+    const char *only = NULL;
+    int opt, i, done = 0;
+
+    while ((opt = getopt(argc, argv, "t:r:s:n:p:b:h")) != -1) {
+        switch (opt) {
+            case 't':
+                cfg.threads = atoi(optarg);
+                break;
+            case 'r':
+                cfg.receivers = atoi(optarg);
+                break;
+            case 's':
+                cfg.size = atoi(optarg);
+                break;
+            case 'n':
+                cfg.iterations = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                cfg.poll_us = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                only = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cfg.threads <= 0 || cfg.receivers <= 0 || cfg.size <= 0 || cfg.size > MSG_LEN || cfg.iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (tag_uspace_init(MAX_KEY, MAX_TAG, MSG_LEN) < 0) {
+        fprintf(stderr, "unable to initialize the tag core\n");
+        return 1;
+    }
+
+    for (i = 0; i < (int) (sizeof(benches) / sizeof(benches[0])); i++) {
+        if (only != NULL && strcmp(only, benches[i].name) != 0) continue;
+        benches[i].run(&cfg);
+        done++;
+    }
+
+    tag_uspace_cleanup();
+    if (done == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file tag_uspace.c
+ *
+ * @description User space replacement of tag_main.c: owns the global structures shared with tag.c so that the
+ * tag core can be linked as a library and exercised without the syscall table hacking.
+ */
+
+#include <linux/slab.h>
+#include <linux/rwsem.h>
+#include <linux/rcupdate.h>
+
+#include "tag_flags.h"
+#include "tag.h"
+#include "tag_uspace.h"
+
+int max_key = MAX_KEY;
+int max_tg = MAX_TAG;
+unsigned int msg_size = MSG_LEN;
+unsigned int numa_replica_size = 0;
+unsigned int busy_poll_usecs = 50;
+unsigned int reclaim_idle_ms = 60000;
+unsigned int fanout_threshold = 256;
+
+tag_node_ptr tag_list = NULL;
+int *key_list = NULL;
+
+/* registered RCU readers of the shim, see uspace_shim.h */
+_Atomic(struct shim_rcu_reader *) shim_rcu_readers = NULL;
+_Thread_local struct shim_rcu_reader *shim_rcu_self = NULL;
+
+/* file table of the shim, see uspace_shim.h */
+_Atomic(struct file *) shim_files[SHIM_MAX_FILES];
+
+int anon_inode_getfd(const char *name, const struct file_operations *fops, void *priv, int flags) {
+    struct file *file, *empty;
+    int fd;
+    (void) name;
+    (void) flags;
+    file = kzalloc(sizeof(struct file), GFP_KERNEL);
+    if (file == NULL) return -ENOMEM;
+    file->f_op = fops;
+    file->private_data = priv;
+    for (fd = 0; fd < SHIM_MAX_FILES; fd++) {
+        empty = NULL;
+        if (atomic_compare_exchange_strong(&shim_files[fd], &empty, file)) return fd;
+    }
+    kfree(file);
+    return -EMFILE;
+}
+
+int tag_uspace_close(int fd) {
+    struct file *file;
+    if (fd < 0 || fd >= SHIM_MAX_FILES) return -EBADF;
+    file = atomic_exchange(&shim_files[fd], NULL);
+    if (file == NULL) return -EBADF;
+    file->f_op->release(NULL, file);
+    kfree(file);
+    return 0;
+}
+
+int tag_uspace_mmap(int fd, size_t size, int level, void **addr) {
+    struct vm_area_struct vma = {0, size, level};
+    struct fd f = fdget(fd);
+    int ret;
+    if (f.file == NULL || f.file->f_op->mmap == NULL) return -EBADF;
+    ret = f.file->f_op->mmap(f.file, &vma);
+    if (ret == 0) *addr = (void *) vma.vm_start;
+    return ret;
+}
+
+/**
+ * @description Allocates the global structures of the tag core like tag_service_init does for the module.
+ * @param keys total number of keys provided
+ * @param tags total number of tags provided
+ * @param msg_len max message size
+ * @return 0 on success, -ENOMEM on failure
+ */
+int tag_uspace_init(unsigned int keys, unsigned int tags, unsigned int msg_len) {
+    int i;
+    max_key = keys;
+    max_tg = tags;
+    msg_size = msg_len;
+
+    key_list = kzalloc(sizeof(int) * max_key, GFP_KERNEL);
+    if (key_list == NULL) return -ENOMEM;
+    /*setup key_list like an empty list*/
+    for (i = 0; i < max_key; i++) {
+        key_list[i] = -1;
+    }
+
+    tag_list = (tag_node_ptr) kzalloc(sizeof(tag_node) * max_tg, GFP_KERNEL);
+    if (tag_list == NULL) {
+        kfree(key_list);
+        key_list = NULL;
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < max_tg; i++) {
+        init_rwsem(&tag_list[i].tag_node_rwsem);
+        RCU_INIT_POINTER(tag_list[i].tag_ptr, NULL);
+    }
+
+    return 0;
+}
+
+/**
+ * @description Releases all the tags still alive and the global structures.
+ */
+void tag_uspace_cleanup(void) {
+    int i;
+    if (tag_list != NULL) {
+        /* wait for the tags removed but not yet released */
+        rcu_barrier();
+        for (i = 0; i < max_tg; i++) {
+            tag_cleanup_mem(rcu_dereference_protected(tag_list[i].tag_ptr, 1));
+        }
+    }
+    kfree(tag_list);
+    kfree(key_list);
+    tag_list = NULL;
+    key_list = NULL;
+}
+
+tag_ptr_t tag_uspace_peek(int tag) {
+    struct fd f = fdget(tag);
+    if (f.file == NULL) return NULL;
+    return ((tag_handle_ptr) f.file->private_data)->tag;
+}
@@ -0,0 +1,39 @@
+#ifndef SOA_PROJECT_TM_TAG_USPACE_H
+#define SOA_PROJECT_TM_TAG_USPACE_H
+
+#include "tag_flags.h"
+
+/**
+ * @description Allocates the global structures of the tag core like tag_service_init does for the module.
+ * @param keys total number of keys provided
+ * @param tags total number of tags provided
+ * @param msg_len max message size
+ * @return 0 on success, -ENOMEM on failure
+ */
+int tag_uspace_init(unsigned int keys, unsigned int tags, unsigned int msg_len);
+
+/**
+ * @description Releases all the tags still alive and the global structures.
+ */
+void tag_uspace_cleanup(void);
+
+/**
+ * @description Closes a tag descriptor returned by tag_get, replaces close() of the module interface.
+ * @return 0 on success, -EBADF if the descriptor is not open
+ */
+int tag_uspace_close(int fd);
+
+/**
+ * @description Maps the shared-memory ring of a level set up with TAG_RING, replaces mmap() of the module interface:
+ * the ring is handed out as it is, the caller must not unmap it.
+ * @return 0 on success and *addr set, an error code on failure
+ */
+int tag_uspace_mmap(int fd, size_t size, int level, void **addr);
+
+/**
+ * @description Returns the tag instance currently associated to a descriptor, used by benchmarks to observe the
+ * standing readers without changing the state of the tag.
+ */
+tag_ptr_t tag_uspace_peek(int tag);
+
+#endif //SOA_PROJECT_TM_TAG_USPACE_H
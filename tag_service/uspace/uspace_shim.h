@@ -0,0 +1,653 @@
+/**
+ * @file uspace_shim.h
+ *
+ * @description Thin user space emulation of the kernel primitives used by tag.c.
+ * It allows to compile the core of the tag_service as a plain library (see tag_uspace.c) and to benchmark it
+ * without loading any module. Only the subset of the kernel API really used by the tag core is provided:
+ * rw_semaphore and mutex are mapped on pthreads, wait queues are mapped on a futex, the user copy is a memcpy,
+ * RCU is a minimal per-thread counter scheme where call_rcu waits for the grace period synchronously, the tag
+ * descriptors are indexes of a private file table (see tag_uspace_close), pinned user pages are mapped on the user
+ * buffer itself.
+ */
+
+#ifndef SOA_PROJECT_TM_USPACE_SHIM_H
+#define SOA_PROJECT_TM_USPACE_SHIM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/ipc.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+/* kernel internal error code, never visible to user space */
+#define ERESTARTSYS 512
+
+/* printk */
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+/* memory allocation */
+typedef unsigned int gfp_t;
+#define GFP_KERNEL 0U
+
+static inline void *kzalloc(size_t size, gfp_t flags) {
+    (void) flags;
+    return calloc(1, size);
+}
+
+static inline void *kmalloc(size_t size, gfp_t flags) {
+    (void) flags;
+    return malloc(size);
+}
+
+static inline void kfree(const void *ptr) {
+    free((void *) ptr);
+}
+
+/* NUMA: user space sees a single node, allocations ignore the node */
+#define NUMA_NO_NODE (-1)
+#define nr_node_ids 1
+#define node_online(node) ((node) == 0)
+#define numa_node_id() 0
+#define kzalloc_node(size, flags, node) kzalloc(size, flags)
+#define kmalloc_node(size, flags, node) kmalloc(size, flags)
+
+/* compiler */
+#define READ_ONCE(x) (*(volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *) &(x) = (val))
+
+/* user memory access: the caller and the "kernel" share the same address space */
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* credentials */
+typedef struct {
+    uid_t val;
+} kuid_t;
+
+static inline kuid_t current_uid(void) {
+    kuid_t uid = {getuid()};
+    return uid;
+}
+
+/* scheduling: the external call also acts as a compiler barrier for the busy waiting loops */
+static inline void schedule(void) {
+    sched_yield();
+}
+
+/*
+ * a user space spinner can't observe signals and rescheduling requests: on a single cpu somebody else surely needs
+ * the cpu, otherwise keep spinning
+ */
+#define current NULL
+#define signal_pending(task) 0
+#define task_tgid_nr(task) ((int) getpid())
+
+static inline int need_resched(void) {
+    static int ncpus;
+    if (ncpus == 0) ncpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpus == 1;
+}
+
+/* the tag core never runs in interrupt context, preemption only matters to the kernel */
+#define preempt_disable() ((void) 0)
+#define preempt_enable() ((void) 0)
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* time */
+typedef uint64_t u64;
+#define NSEC_PER_USEC 1000UL
+
+static inline u64 ktime_get_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ULL + (u64) ts.tv_nsec;
+}
+
+/* read-write semaphore */
+struct rw_semaphore {
+    pthread_rwlock_t lock;
+};
+
+static inline void init_rwsem(struct rw_semaphore *sem) {
+    pthread_rwlock_init(&sem->lock, NULL);
+}
+
+static inline int down_read_killable(struct rw_semaphore *sem) {
+    pthread_rwlock_rdlock(&sem->lock);
+    return 0;
+}
+
+static inline void down_read(struct rw_semaphore *sem) {
+    pthread_rwlock_rdlock(&sem->lock);
+}
+
+static inline int down_read_trylock(struct rw_semaphore *sem) {
+    return pthread_rwlock_tryrdlock(&sem->lock) == 0;
+}
+
+static inline void up_read(struct rw_semaphore *sem) {
+    pthread_rwlock_unlock(&sem->lock);
+}
+
+static inline void down_write(struct rw_semaphore *sem) {
+    pthread_rwlock_wrlock(&sem->lock);
+}
+
+static inline int down_write_trylock(struct rw_semaphore *sem) {
+    return pthread_rwlock_trywrlock(&sem->lock) == 0;
+}
+
+static inline void up_write(struct rw_semaphore *sem) {
+    pthread_rwlock_unlock(&sem->lock);
+}
+
+/* mutex */
+struct mutex {
+    pthread_mutex_t lock;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = {PTHREAD_MUTEX_INITIALIZER}
+
+static inline void mutex_init(struct mutex *mtx) {
+    pthread_mutex_init(&mtx->lock, NULL);
+}
+
+static inline void mutex_lock(struct mutex *mtx) {
+    pthread_mutex_lock(&mtx->lock);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *mtx) {
+    pthread_mutex_lock(&mtx->lock);
+    return 0;
+}
+
+static inline int mutex_lock_killable(struct mutex *mtx) {
+    pthread_mutex_lock(&mtx->lock);
+    return 0;
+}
+
+static inline int mutex_trylock(struct mutex *mtx) {
+    return pthread_mutex_trylock(&mtx->lock) == 0;
+}
+
+static inline void mutex_unlock(struct mutex *mtx) {
+    pthread_mutex_unlock(&mtx->lock);
+}
+
+/*
+ * wait event queue: every wake_up_all bumps the sequence number, a waiter sleeps on the futex only if the
+ * sequence is still the one observed before evaluating the condition, so no wake up can be lost.
+ * Threads waiting on many queues at once (add_wait_queue) sleep on a futex of their own instead, bumped by
+ * wake_up_all through the entries linked in the queue.
+ */
+typedef struct wait_queue_entry {
+    struct wait_queue_entry *next;
+    struct wait_queue_entry *prev;
+    atomic_uint *wake; // futex of the waiting thread
+} wait_queue_entry_t;
+
+typedef struct wait_queue_head {
+    atomic_uint seq;
+    atomic_uint waiters;
+    atomic_uint entries;
+    pthread_mutex_t lock; // protects the list of entries
+    wait_queue_entry_t head;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq) {
+    atomic_init(&wq->seq, 0);
+    atomic_init(&wq->waiters, 0);
+    atomic_init(&wq->entries, 0);
+    pthread_mutex_init(&wq->lock, NULL);
+    wq->head.next = wq->head.prev = &wq->head;
+}
+
+static inline void shim_futex_wait(atomic_uint *addr, unsigned int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void wake_up_all(wait_queue_head_t *wq) {
+    wait_queue_entry_t *entry;
+    atomic_fetch_add(&wq->seq, 1);
+    if (atomic_load(&wq->waiters) != 0) {
+        syscall(SYS_futex, &wq->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+    if (atomic_load(&wq->entries) != 0) {
+        pthread_mutex_lock(&wq->lock);
+        for (entry = wq->head.next; entry != &wq->head; entry = entry->next) {
+            atomic_fetch_add(entry->wake, 1);
+            syscall(SYS_futex, entry->wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+        pthread_mutex_unlock(&wq->lock);
+    }
+}
+
+/* the task state is the value of the futex of the thread observed before evaluating the wake up conditions */
+static __thread atomic_uint shim_task_wake;
+static __thread unsigned int shim_task_seq;
+
+#define TASK_RUNNING 0
+#define TASK_INTERRUPTIBLE 1
+#define MAX_SCHEDULE_TIMEOUT LONG_MAX
+#define set_current_state(state) (shim_task_seq = atomic_load(&shim_task_wake))
+#define __set_current_state(state) ((void) 0)
+#define init_waitqueue_entry(entry, task) ((entry)->wake = &shim_task_wake)
+
+static inline void add_wait_queue(wait_queue_head_t *wq, wait_queue_entry_t *entry) {
+    pthread_mutex_lock(&wq->lock);
+    entry->next = &wq->head;
+    entry->prev = wq->head.prev;
+    wq->head.prev->next = entry;
+    wq->head.prev = entry;
+    atomic_fetch_add(&wq->entries, 1);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+static inline void remove_wait_queue(wait_queue_head_t *wq, wait_queue_entry_t *entry) {
+    pthread_mutex_lock(&wq->lock);
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    atomic_fetch_sub(&wq->entries, 1);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+#define wait_event_interruptible(wq, condition) ({ \
+    unsigned int __seq;                            \
+    for (;;) {                                     \
+        __seq = atomic_load(&(wq).seq);            \
+        if (condition) break;                      \
+        atomic_fetch_add(&(wq).waiters, 1);        \
+        shim_futex_wait(&(wq).seq, __seq);         \
+        atomic_fetch_sub(&(wq).waiters, 1);        \
+    }                                              \
+    0;                                             \
+})
+
+/* jiffies are microseconds in user space */
+#define HZ 1000000UL
+#define usecs_to_jiffies(usecs) ((unsigned long) (usecs))
+#define msecs_to_jiffies(msecs) ((unsigned long) (msecs) * 1000UL)
+#define time_before(a, b) ((long) ((a) - (b)) < 0)
+
+/* a coarse clock is enough for the idle times of the tags */
+static inline unsigned long shim_jiffies(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (unsigned long) ts.tv_sec * 1000000UL + (unsigned long) ts.tv_nsec / 1000UL;
+}
+
+#define jiffies shim_jiffies()
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+static inline void shim_futex_wait_timeout(atomic_uint *addr, unsigned int val, long usecs) {
+    struct timespec ts = {usecs / 1000000, (usecs % 1000000) * 1000};
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+/* sleeps unless a queue of the thread was woken after set_current_state, returns the jiffies left (0 on expiry) */
+static inline long schedule_timeout(long timeout) {
+    long end;
+    if (timeout == MAX_SCHEDULE_TIMEOUT) {
+        shim_futex_wait(&shim_task_wake, shim_task_seq);
+        return timeout;
+    }
+    end = (long) (ktime_get_ns() / NSEC_PER_USEC) + timeout;
+    shim_futex_wait_timeout(&shim_task_wake, shim_task_seq, timeout);
+    timeout = end - (long) (ktime_get_ns() / NSEC_PER_USEC);
+    return timeout > 0 ? timeout : 0;
+}
+
+typedef int64_t ktime_t;
+#define ns_to_ktime(ns) ((ktime_t) (ns))
+#define HRTIMER_MODE_ABS 0
+
+/* like schedule_timeout up to the ktime_get_ns time *expires, returns 0 on expiry */
+static inline int schedule_hrtimeout(ktime_t *expires, int mode) {
+    ktime_t left = *expires - (ktime_t) ktime_get_ns();
+    (void) mode;
+    if (left > 0) shim_futex_wait_timeout(&shim_task_wake, shim_task_seq, (long) ((left + 999) / 1000));
+    return (ktime_t) ktime_get_ns() >= *expires ? 0 : -EINTR;
+}
+
+/* remaining jiffies (at least 1) if the condition holds, 0 on expiry */
+#define wait_event_interruptible_timeout(wq, condition, timeout) ({    \
+    unsigned int __seq;                                                  \
+    long __left = (long) (timeout);                                      \
+    long __end = (long) (ktime_get_ns() / NSEC_PER_USEC) + __left;       \
+    for (;;) {                                                           \
+        __seq = atomic_load(&(wq).seq);                                  \
+        if (condition) {                                                 \
+            if (__left <= 0) __left = 1;                                 \
+            break;                                                       \
+        }                                                                \
+        __left = __end - (long) (ktime_get_ns() / NSEC_PER_USEC);        \
+        if (__left <= 0) {                                               \
+            __left = 0;                                                  \
+            break;                                                       \
+        }                                                                \
+        atomic_fetch_add(&(wq).waiters, 1);                              \
+        shim_futex_wait_timeout(&(wq).seq, __seq, __left);               \
+        atomic_fetch_sub(&(wq).waiters, 1);                              \
+    }                                                                    \
+    __left;                                                              \
+})
+
+/* variable waits share one sequence, like the hashed queues of the kernel: any wake up re-evaluates every condition */
+static atomic_uint shim_var_seq;
+static atomic_uint shim_var_waiters;
+
+#define wait_var_event(var, condition) do { \
+    unsigned int __seq;                     \
+    (void) (var);                           \
+    for (;;) {                              \
+        __seq = atomic_load(&shim_var_seq); \
+        if (condition) break;               \
+        atomic_fetch_add(&shim_var_waiters, 1); \
+        shim_futex_wait(&shim_var_seq, __seq);  \
+        atomic_fetch_sub(&shim_var_waiters, 1); \
+    }                                       \
+} while (0)
+
+static inline void wake_up_var(void *var) {
+    (void) var;
+    atomic_fetch_add(&shim_var_seq, 1);
+    if (atomic_load(&shim_var_waiters) != 0) {
+        syscall(SYS_futex, &shim_var_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+/* reference counter */
+typedef struct {
+    atomic_uint refs;
+} refcount_t;
+
+static inline void refcount_set(refcount_t *r, unsigned int n) {
+    atomic_store(&r->refs, n);
+}
+
+static inline bool refcount_inc_not_zero(refcount_t *r) {
+    unsigned int old = atomic_load(&r->refs);
+    do {
+        if (old == 0) return false;
+    } while (!atomic_compare_exchange_weak(&r->refs, &old, old + 1));
+    return true;
+}
+
+static inline void refcount_inc(refcount_t *r) {
+    atomic_fetch_add(&r->refs, 1);
+}
+
+static inline void refcount_dec(refcount_t *r) {
+    atomic_fetch_sub(&r->refs, 1);
+}
+
+static inline bool refcount_dec_and_test(refcount_t *r) {
+    return atomic_fetch_sub(&r->refs, 1) == 1;
+}
+
+static inline bool refcount_dec_if_one(refcount_t *r) {
+    unsigned int one = 1;
+    return atomic_compare_exchange_strong(&r->refs, &one, 0);
+}
+
+static inline unsigned int refcount_read(refcount_t *r) {
+    return atomic_load(&r->refs);
+}
+
+/*
+ * RCU: every thread registers a counter that is odd while it is inside a read side critical section; a grace period
+ * ends when every counter has been seen even or changed. Nesting is not supported (not used by the tag core).
+ */
+#define __rcu
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+struct shim_rcu_reader {
+    atomic_ulong ctr;
+    struct shim_rcu_reader *next;
+};
+
+extern _Atomic(struct shim_rcu_reader *) shim_rcu_readers;
+extern _Thread_local struct shim_rcu_reader *shim_rcu_self;
+
+static inline void rcu_read_lock(void) {
+    struct shim_rcu_reader *self = shim_rcu_self;
+    if (self == NULL) {
+        /* first critical section of the thread: register the counter, never released */
+        self = calloc(1, sizeof(*self));
+        self->next = atomic_load(&shim_rcu_readers);
+        while (!atomic_compare_exchange_weak(&shim_rcu_readers, &self->next, self));
+        shim_rcu_self = self;
+    }
+    atomic_fetch_add(&self->ctr, 1);
+}
+
+static inline void rcu_read_unlock(void) {
+    atomic_fetch_add(&shim_rcu_self->ctr, 1);
+}
+
+static inline void synchronize_rcu(void) {
+    struct shim_rcu_reader *reader;
+    unsigned long snap;
+    atomic_thread_fence(memory_order_seq_cst);
+    for (reader = atomic_load(&shim_rcu_readers); reader != NULL; reader = reader->next) {
+        snap = atomic_load(&reader->ctr);
+        if ((snap & 1) == 0) continue;
+        while (atomic_load(&reader->ctr) == snap) sched_yield();
+    }
+}
+
+static inline void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head)) {
+    synchronize_rcu();
+    func(head);
+}
+
+/* call_rcu callbacks are executed synchronously */
+static inline void rcu_barrier(void) {
+}
+
+/* CPUs and work items: user space sees a single CPU, queued work items are executed synchronously */
+#define nr_cpu_ids 1U
+#define raw_smp_processor_id() 0
+#define cpu_online(cpu) ((cpu) == 0)
+
+struct work_struct {
+    void (*func)(struct work_struct *work);
+};
+
+struct workqueue_struct;
+#define system_highpri_wq ((struct workqueue_struct *) NULL)
+#define INIT_WORK(w, f) ((w)->func = (f))
+
+static inline bool queue_work_on(int cpu, struct workqueue_struct *wq, struct work_struct *work) {
+    (void) cpu;
+    (void) wq;
+    work->func(work);
+    return true;
+}
+
+/* wait_event sleepers announce themselves after evaluating the condition: every queue may have sleepers */
+#define waitqueue_active(wq) ((void) (wq), 1)
+
+#define rcu_dereference(p) atomic_load_explicit((_Atomic(__typeof__(p)) *) &(p), memory_order_acquire)
+#define rcu_access_pointer(p) rcu_dereference(p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v) atomic_store_explicit((_Atomic(__typeof__(p)) *) &(p), (v), memory_order_release)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+
+/*
+ * files: anon_inode_getfd installs the file in a private table of the library, the returned descriptors are not
+ * kernel file descriptors and must be closed with tag_uspace_close. There is no reference counting of the files,
+ * closing a descriptor while another thread uses it is not supported.
+ */
+#define SHIM_MAX_FILES 65536
+#define THIS_MODULE NULL
+
+struct module;
+struct inode;
+struct file;
+
+/* user space mapping: the "kernel" area is handed to the caller as it is, see tag_uspace_mmap */
+struct vm_area_struct {
+    unsigned long vm_start;
+    unsigned long vm_end;
+    unsigned long vm_pgoff;
+};
+
+struct file_operations {
+    struct module *owner;
+    int (*release)(struct inode *inode, struct file *file);
+    int (*mmap)(struct file *file, struct vm_area_struct *vma);
+};
+
+struct file {
+    const struct file_operations *f_op;
+    void *private_data;
+};
+
+struct fd {
+    struct file *file;
+};
+
+extern _Atomic(struct file *) shim_files[SHIM_MAX_FILES];
+
+int anon_inode_getfd(const char *name, const struct file_operations *fops, void *priv, int flags);
+
+static inline struct fd fdget(int fd) {
+    struct fd f = {NULL};
+    if (fd >= 0 && fd < SHIM_MAX_FILES) f.file = atomic_load(&shim_files[fd]);
+    return f;
+}
+
+static inline void fdput(struct fd f) {
+    (void) f;
+}
+
+/* list */
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void list_add(struct list_head *entry, struct list_head *head) {
+    entry->next = head->next;
+    entry->prev = head;
+    head->next->prev = entry;
+    head->next = entry;
+}
+
+static inline void list_del(struct list_head *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+#define list_for_each_entry(pos, head, member) \
+    for (pos = container_of((head)->next, __typeof__(*pos), member); &pos->member != (head); \
+         pos = container_of(pos->member.next, __typeof__(*pos), member))
+
+/*
+ * pinned user pages: user and kernel share the address space, so a "page" is the user address of the page and the
+ * kernel mapping of contiguous pages is the user buffer itself
+ */
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 0, 0)
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096UL
+#endif
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+#define offset_in_page(p) ((unsigned long) (p) & ~PAGE_MASK)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define FOLL_WRITE 0x01
+#define FOLL_LONGTERM 0x100
+#define VM_MAP 0x04
+#define PAGE_KERNEL 0
+
+struct page;
+
+static inline int pin_user_pages_fast(unsigned long start, int nr_pages, unsigned int gup_flags, struct page **pages) {
+    int i;
+    (void) gup_flags;
+    for (i = 0; i < nr_pages; i++) pages[i] = (struct page *) (start + i * PAGE_SIZE);
+    return nr_pages;
+}
+
+static inline void unpin_user_pages(struct page **pages, unsigned long npages) {
+    (void) pages;
+    (void) npages;
+}
+
+static inline void unpin_user_pages_dirty_lock(struct page **pages, unsigned long npages, bool make_dirty) {
+    (void) pages;
+    (void) npages;
+    (void) make_dirty;
+}
+
+static inline void *vmap(struct page **pages, unsigned int count, unsigned long flags, int prot) {
+    (void) count;
+    (void) flags;
+    (void) prot;
+    return pages[0];
+}
+
+static inline void vunmap(const void *addr) {
+    (void) addr;
+}
+
+#define PAGE_ALIGN(n) (((n) + PAGE_SIZE - 1) & PAGE_MASK)
+
+static inline void *vmalloc_user(unsigned long size) {
+    void *area = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+    if (area != NULL) memset(area, 0, PAGE_ALIGN(size));
+    return area;
+}
+
+static inline void vfree(const void *addr) {
+    free((void *) addr);
+}
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff) {
+    vma->vm_start = (unsigned long) addr + pgoff * PAGE_SIZE;
+    return 0;
+}
+
+#endif //SOA_PROJECT_TM_USPACE_SHIM_H
@@ -1,6 +1,12 @@
 #!/bin/bash
 
+# save the tag namespace for the next install.sh, the tags are freed with the module
+cat /dev/mydev_ns > /var/tmp/tag_service.ns || rm -f /var/tmp/tag_service.ns
 cd ./tag_service && make unload
+rm -f /dev/mydev /dev/mydev_ns
+# cache the syscall table address for the next install.sh, valid until reboot (KASLR)
+echo "$(cat /proc/sys/kernel/random/boot_id) $(cat /sys/module/systbl_hack/parameters/sys_call_table)" \
+  > /var/tmp/systbl_hack.cache
 cd ./systbl_hack && make unload
 cd ../  && make clean
 
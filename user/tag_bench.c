@@ -0,0 +1,608 @@
+/**
+ * @file tag_bench.c
+ *
+ * @description Throughput and latency load generator for the tag-service.
+ * Every run spawns senders and receivers spread over tags and levels, senders embed a CLOCK_MONOTONIC timestamp
+ * in each payload and receivers collect the send -> receive latency in a log-linear histogram.
+ * Every parameter accepts a comma separated list and the cartesian product of all the lists is executed,
+ * one CSV row (or JSON object) per run.
+ * With --ring 1 the messages go through the shared-memory rings of the levels (tag_ring.h) instead of the syscalls,
+ * so that the two paths can be compared on the same load.
+ * With --deadline the senders stop waiting for slow receivers after that many microseconds (TAG_DEADLINE), the
+ * detached sends and the receivers they left behind are reported next to the latency.
+ * With --info the receivers use tag_receive_info: the latency is taken from the send time recorded by the kernel and
+ * the jumps of the sequence numbers of the level are reported as lost messages.
+ * With --batch N the receivers use tag_receive_batch with N slots and a coalescing window of --window microseconds,
+ * the receive calls are reported so that the messages per call can be compared.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/ipc.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "../tag_lib.h"
+#include "../tag_ring.h"
+#include "../tag_service/tag.h"
+
+#define MAX_VALUES 16
+#define MAX_CPUS 1024
+#define HIST_SUB_BITS 4 // 16 linear sub-buckets for every power of two: ~6% precision
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+#define BENCH_LEVELS 32
+#define RING_SLOTS 1024
+
+/* header embedded at the beginning of every payload */
+struct bench_msg_hdr {
+    uint64_t send_ns;
+    uint32_t sender;
+    uint32_t seq;
+};
+
+struct value_list {
+    int values[MAX_VALUES];
+    int count;
+};
+
+struct bench_params {
+    int senders;
+    int receivers;
+    int tags;
+    int levels;
+    int size;
+    int awake_every; // AWAKE_ALL issued every awake_every sends of the first sender, 0 to disable
+    int busy_poll; // TAG_BUSY_POLL microseconds of every tag, 0 to disable
+    int ring; // 1 to use the shared-memory rings (TAG_RING) instead of tag_send/tag_receive
+    int deadline; // TAG_DEADLINE microseconds of every tag, 0 to disable
+    int batch; // slots of tag_receive_batch, 0 or 1 for tag_receive
+    int window; // coalescing window of tag_receive_batch in microseconds
+};
+
+struct bench_result {
+    unsigned long sent;
+    unsigned long received;
+    unsigned long awakes;
+    unsigned long errors;
+    unsigned long lost; // ring messages overwritten before being read, or missed by the receivers with --info
+    unsigned long poll_hits;
+    unsigned long poll_misses;
+    unsigned long detached; // sends that stopped waiting for the receivers at the deadline
+    unsigned long late; // receivers left behind by the detached sends
+    unsigned long calls; // receive calls of the receivers
+    double elapsed_s;
+    uint64_t p50, p90, p99, p999, max;
+};
+
+struct worker {
+    pthread_t tid;
+    int id;
+    int cpu;
+    int tag;
+    int level;
+    struct bench_params *params;
+    int *tags;
+    unsigned long ops;
+    unsigned long awakes;
+    unsigned long errors;
+    unsigned long lost;
+    unsigned long calls;
+    uint64_t max_ns;
+    uint64_t *hist;
+};
+
+static volatile int stop;
+static int cpu_list[MAX_CPUS];
+static int cpu_count;
+static int duration_s = 5;
+static int use_json;
+static int use_info;
+static int json_rows;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static inline int hist_index(uint64_t ns) {
+    int msb;
+    if (ns < HIST_SUB) return (int) ns;
+    msb = 63 - __builtin_clzll(ns);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + (int) ((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* lower bound of the values collected by a bucket */
+static uint64_t hist_value(int index) {
+    int shift;
+    if (index < HIST_SUB) return (uint64_t) index;
+    shift = index / HIST_SUB - 1;
+    return ((uint64_t) (HIST_SUB + index % HIST_SUB)) << shift;
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, unsigned long total, double p) {
+    unsigned long target = (unsigned long) (total * p), seen = 0;
+    int i;
+    if (total == 0) return 0;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > target) return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+static void pin(struct worker *w) {
+    cpu_set_t set;
+    if (w->cpu < 0) return;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "unable to pin thread %d on cpu %d\n", w->id, w->cpu);
+    }
+}
+
+static void *sender(void *data) {
+    struct worker *w = data;
+    struct bench_params *p = w->params;
+    struct bench_msg_hdr *hdr;
+    struct tag_ring *rings = NULL;
+    char *buffer;
+    uint32_t seq = 0;
+    int tag_index, level, res, i;
+
+    pin(w);
+    buffer = calloc(1, p->size);
+    if (buffer == NULL) return NULL;
+    hdr = (struct bench_msg_hdr *) buffer;
+    if (p->ring) {
+        rings = calloc(p->tags * p->levels, sizeof(struct tag_ring));
+        for (i = 0; rings != NULL && i < p->tags * p->levels; i++) {
+            if (tag_ring_open(&rings[i], w->tags[i / p->levels], i % p->levels, RING_SLOTS, p->size) < 0) {
+                fprintf(stderr, "TAG_RING failed: %s\n", strerror(errno));
+                stop = 1;
+                break;
+            }
+        }
+    }
+
+    while (!stop) {
+        tag_index = (int) (seq % p->tags);
+        level = (int) ((seq / p->tags) % p->levels);
+        hdr->sender = w->id;
+        hdr->seq = seq++;
+        hdr->send_ns = now_ns();
+        if (rings != NULL) res = tag_ring_send(&rings[tag_index * p->levels + level], buffer, p->size);
+        else res = tag_send(w->tags[tag_index], level, buffer, p->size);
+        if (res < 0) {
+            w->errors++;
+            continue;
+        }
+        w->ops++;
+        if (p->awake_every > 0 && w->id == 0 && w->ops % p->awake_every == 0) {
+            tag_ctl(w->tags[tag_index], AWAKE_ALL);
+        }
+    }
+
+    for (i = 0; rings != NULL && i < p->tags * p->levels; i++) {
+        if (rings[i].hdr != NULL) tag_ring_close(&rings[i]);
+    }
+    free(rings);
+    free(buffer);
+    return NULL;
+}
+
+/* latency of a message received with a bench_msg_hdr */
+static void record(struct worker *w, uint64_t latency) {
+    w->hist[hist_index(latency)]++;
+    if (latency > w->max_ns) w->max_ns = latency;
+    w->ops++;
+}
+
+/* receiver with tag_receive_batch: one call returns up to batch messages of its level */
+static void receive_batches(struct worker *w) {
+    struct bench_params *p = w->params;
+    struct tag_mmsg *msgs = calloc(p->batch, sizeof(struct tag_mmsg));
+    char *buffers = calloc(p->batch, p->size);
+    uint64_t now;
+    int res, i;
+
+    for (i = 0; msgs != NULL && buffers != NULL && i < p->batch; i++) {
+        msgs[i].buffer = buffers + (size_t) i * p->size;
+        msgs[i].size = p->size;
+    }
+    while (msgs != NULL && buffers != NULL && !stop) {
+        res = tag_receive_batch(w->tag, 1U << w->level, msgs, p->batch, p->window, 0);
+        w->calls++;
+        if (res < 0) {
+            if (errno == ECANCELED) w->awakes++;
+            else if (errno != ETIMEDOUT || p->deadline == 0) w->errors++;
+            continue;
+        }
+        now = now_ns();
+        for (i = 0; i < res; i++) {
+            if (msgs[i].len < (int) sizeof(struct bench_msg_hdr)) continue;
+            record(w, now - ((struct bench_msg_hdr *) msgs[i].buffer)->send_ns);
+        }
+    }
+    free(buffers);
+    free(msgs);
+}
+
+static void *receiver(void *data) {
+    struct worker *w = data;
+    struct bench_params *p = w->params;
+    struct bench_msg_hdr *hdr;
+    struct tag_ring ring = {0};
+    struct tag_msg_info info;
+    uint64_t latency, last_seq = 0;
+    char *buffer;
+    int res;
+
+    pin(w);
+    if (p->batch > 1 && !p->ring) {
+        receive_batches(w);
+        return NULL;
+    }
+    buffer = calloc(1, p->size);
+    if (buffer == NULL) return NULL;
+    hdr = (struct bench_msg_hdr *) buffer;
+    if (p->ring && tag_ring_open(&ring, w->tag, w->level, RING_SLOTS, p->size) < 0) {
+        fprintf(stderr, "TAG_RING failed: %s\n", strerror(errno));
+        free(buffer);
+        return NULL;
+    }
+
+    while (!stop) {
+        if (p->ring) res = tag_ring_receive(&ring, buffer, p->size);
+        else if (use_info) res = tag_receive_info(w->tag, w->level, buffer, p->size, &info);
+        else res = tag_receive(w->tag, w->level, buffer, p->size);
+        w->calls++;
+        if (res < 0) {
+            if (errno == ECANCELED) w->awakes++;
+            else if (errno != ETIMEDOUT || p->deadline == 0) w->errors++;
+            continue;
+        }
+        if (use_info && !p->ring) {
+            /* the metadata of the kernel, the payload is not looked at */
+            if (last_seq != 0 && info.seq > last_seq + 1) w->lost += info.seq - last_seq - 1;
+            last_seq = info.seq;
+            latency = now_ns() - info.send_ns;
+        } else {
+            if (res < (int) sizeof(struct bench_msg_hdr)) continue;
+            latency = now_ns() - hdr->send_ns;
+        }
+        record(w, latency);
+    }
+
+    if (p->ring) {
+        w->lost = ring.lost;
+        tag_ring_close(&ring);
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int run(struct bench_params *p, struct bench_result *res) {
+    struct worker *workers;
+    uint64_t *hist, start;
+    struct tag_poll_stats stats;
+    struct tag_delivery_stats delivery;
+    int *tags;
+    int i, j, nworkers = p->senders + p->receivers, created = 0, ret = -1;
+
+    memset(res, 0, sizeof(*res));
+    workers = calloc(nworkers, sizeof(struct worker));
+    tags = calloc(p->tags, sizeof(int));
+    hist = calloc(HIST_BUCKETS, sizeof(uint64_t));
+    if (workers == NULL || tags == NULL || hist == NULL) goto out;
+
+    for (i = 0; i < p->tags; i++) {
+        tags[i] = tag_get(IPC_PRIVATE, IPC_CREAT, 0);
+        if (tags[i] < 0) {
+            fprintf(stderr, "tag_get failed: %s\n", strerror(errno));
+            goto out_tags;
+        }
+        created++;
+        if (p->busy_poll > 0 && tag_ctl_arg(tags[i], TAG_BUSY_POLL, p->busy_poll) < 0) {
+            fprintf(stderr, "TAG_BUSY_POLL failed: %s\n", strerror(errno));
+            goto out_tags;
+        }
+        if (p->deadline > 0 && tag_ctl_arg(tags[i], TAG_DEADLINE, p->deadline) < 0) {
+            fprintf(stderr, "TAG_DEADLINE failed: %s\n", strerror(errno));
+            goto out_tags;
+        }
+    }
+
+    stop = 0;
+    /* receivers first, so that the first messages find someone waiting */
+    for (i = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+        int r = i - p->senders;
+        w->id = i;
+        w->params = p;
+        w->tags = tags;
+        w->cpu = cpu_count > 0 ? cpu_list[i % cpu_count] : -1;
+        if (r >= 0) {
+            w->tag = tags[r % p->tags];
+            w->level = (r / p->tags) % p->levels;
+            w->hist = calloc(HIST_BUCKETS, sizeof(uint64_t));
+            if (w->hist == NULL) goto out_workers;
+        }
+    }
+    for (i = p->senders; i < nworkers; i++) pthread_create(&workers[i].tid, NULL, receiver, &workers[i]);
+    usleep(100000);
+
+    start = now_ns();
+    for (i = 0; i < p->senders; i++) pthread_create(&workers[i].tid, NULL, sender, &workers[i]);
+    sleep(duration_s);
+    stop = 1;
+    for (i = 0; i < p->senders; i++) pthread_join(workers[i].tid, NULL);
+    res->elapsed_s = (double) (now_ns() - start) / 1e9;
+
+    /* unlock the receivers still parked on a tag */
+    for (i = p->senders; i < nworkers; i++) {
+        while (pthread_tryjoin_np(workers[i].tid, NULL) != 0) {
+            for (j = 0; j < p->tags; j++) tag_ctl(tags[j], AWAKE_ALL);
+            usleep(1000);
+        }
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        if (i < p->senders) {
+            res->sent += workers[i].ops;
+        } else {
+            res->received += workers[i].ops;
+            res->awakes += workers[i].awakes;
+            res->lost += workers[i].lost;
+            res->calls += workers[i].calls;
+            if (workers[i].max_ns > res->max) res->max = workers[i].max_ns;
+            for (j = 0; j < HIST_BUCKETS; j++) hist[j] += workers[i].hist[j];
+        }
+        res->errors += workers[i].errors;
+    }
+    for (j = 0; j < p->tags; j++) {
+        if (tag_ctl_arg(tags[j], TAG_POLL_STATS, (unsigned long) &stats) < 0) continue;
+        res->poll_hits += stats.hits;
+        res->poll_misses += stats.misses;
+    }
+    for (j = 0; j < p->tags; j++) {
+        if (tag_ctl_arg(tags[j], TAG_DELIVERY_STATS, (unsigned long) &delivery) < 0) continue;
+        res->detached += delivery.detached;
+        res->late += delivery.late;
+    }
+    res->p50 = hist_percentile(hist, res->received, 0.50);
+    res->p90 = hist_percentile(hist, res->received, 0.90);
+    res->p99 = hist_percentile(hist, res->received, 0.99);
+    res->p999 = hist_percentile(hist, res->received, 0.999);
+    ret = 0;
+
+    out_workers:
+    for (i = 0; i < nworkers; i++) free(workers[i].hist);
+    out_tags:
+    for (i = 0; i < created; i++) {
+        tag_ctl(tags[i], IPC_RMID);
+        close(tags[i]);
+    }
+    out:
+    free(hist);
+    free(tags);
+    free(workers);
+    return ret;
+}
+
+static void print_header(void) {
+    if (use_json) {
+        printf("[\n");
+        return;
+    }
+    printf("senders,receivers,tags,levels,size,awake_every,busy_poll_us,ring,deadline_us,batch,window_us,elapsed_s,"
+           "sent,received,awakes,errors,lost,msgs_per_s,bytes_per_s,lat_p50_ns,lat_p90_ns,lat_p99_ns,lat_p999_ns,"
+           "lat_max_ns,poll_hits,poll_misses,detached,late,receive_calls,msgs_per_call\n");
+}
+
+static void print_row(struct bench_params *p, struct bench_result *r) {
+    double msgs = r->received / r->elapsed_s, per_call = r->calls ? (double) r->received / r->calls : 0;
+    if (use_json) {
+        printf("%s  {\"senders\": %d, \"receivers\": %d, \"tags\": %d, \"levels\": %d, \"size\": %d, "
+               "\"awake_every\": %d, \"busy_poll_us\": %d, \"ring\": %d, \"deadline_us\": %d, \"batch\": %d, "
+               "\"window_us\": %d, \"elapsed_s\": %.3f, "
+               "\"sent\": %lu, "
+               "\"received\": %lu, \"awakes\": %lu, \"errors\": %lu, \"lost\": %lu, \"msgs_per_s\": %.0f, \"bytes_per_s\": %.0f, \"lat_p50_ns\": %lu, "
+               "\"lat_p90_ns\": %lu, \"lat_p99_ns\": %lu, \"lat_p999_ns\": %lu, \"lat_max_ns\": %lu, "
+               "\"poll_hits\": %lu, \"poll_misses\": %lu, \"detached\": %lu, \"late\": %lu, \"receive_calls\": %lu, "
+               "\"msgs_per_call\": %.2f}",
+               json_rows++ ? ",\n" : "", p->senders, p->receivers, p->tags, p->levels, p->size, p->awake_every,
+               p->busy_poll, p->ring, p->deadline, p->batch, p->window, r->elapsed_s, r->sent, r->received, r->awakes,
+               r->errors, r->lost,
+               msgs,
+               msgs * p->size,
+               r->p50, r->p90, r->p99, r->p999, r->max, r->poll_hits, r->poll_misses, r->detached, r->late, r->calls,
+               per_call);
+        fflush(stdout);
+        return;
+    }
+    printf("%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.3f,%lu,%lu,%lu,%lu,%lu,%.0f,%.0f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,"
+           "%lu,%.2f\n",
+           p->senders, p->receivers, p->tags, p->levels, p->size, p->awake_every, p->busy_poll, p->ring, p->deadline,
+           p->batch, p->window, r->elapsed_s, r->sent, r->received, r->awakes, r->errors, r->lost, msgs, msgs * p->size,
+           r->p50, r->p90, r->p99, r->p999, r->max, r->poll_hits, r->poll_misses, r->detached, r->late, r->calls,
+           per_call);
+    fflush(stdout);
+}
+
+/* runs a combination of the parameters and prints its row */
+static void run_one(struct bench_params *p) {
+    struct bench_result r;
+    if (p->senders < 0 || p->receivers < 0 || p->tags <= 0 || p->levels <= 0 || p->levels > BENCH_LEVELS ||
+        p->size < (int) sizeof(struct bench_msg_hdr) || p->awake_every < 0 || p->busy_poll < 0 || p->ring < 0 ||
+        p->ring > 1 || p->deadline < 0 || p->deadline > MAX_DEADLINE_US || p->batch < 0 || p->batch > MAX_BATCH_MSGS ||
+        p->window < 0 || p->window > MAX_BATCH_WINDOW_US) {
+        fprintf(stderr, "skipping invalid combination\n");
+        return;
+    }
+    if (run(p, &r) < 0) {
+        fprintf(stderr, "run failed\n");
+        return;
+    }
+    print_row(p, &r);
+}
+
+static int parse_list(const char *arg, struct value_list *list) {
+    char *copy = strdup(arg), *token, *save;
+    list->count = 0;
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        if (list->count == MAX_VALUES) break;
+        list->values[list->count++] = atoi(token);
+    }
+    free(copy);
+    return list->count;
+}
+
+/* cpu list in the "0-3,8,10-11" format */
+static int parse_cpus(const char *arg) {
+    char *copy = strdup(arg), *token, *save;
+    int first, last;
+    cpu_count = 0;
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        if (sscanf(token, "%d-%d", &first, &last) != 2) last = first = atoi(token);
+        for (; first <= last && cpu_count < MAX_CPUS; first++) cpu_list[cpu_count++] = first;
+    }
+    free(copy);
+    return cpu_count;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --senders LIST       sender threads (default 1)\n"
+            "  -r, --receivers LIST     receiver threads (default 1)\n"
+            "  -t, --tags LIST          tags the threads are spread over (default 1)\n"
+            "  -l, --levels LIST        levels of every tag the threads are spread over (default 1)\n"
+            "  -m, --size LIST          message size in bytes, at least %zu (default 64)\n"
+            "  -a, --awake-every LIST   AWAKE_ALL every N sends, 0 disables (default 0)\n"
+            "  -p, --busy-poll LIST     receivers busy poll microseconds (TAG_BUSY_POLL), 0 disables (default 0)\n"
+            "  -R, --ring LIST          1 to send and receive through the shared-memory rings (default 0)\n"
+            "  -D, --deadline LIST      senders wait at most N microseconds for the receivers (TAG_DEADLINE), 0 forever\n"
+            "  -b, --batch LIST         receive up to N messages per call with tag_receive_batch, 0 or 1 disables\n"
+            "  -w, --window LIST        coalescing window of tag_receive_batch in microseconds (default 0)\n"
+            "  -d, --duration SEC       duration of every run (default 5)\n"
+            "  -c, --cpus LIST          pin threads round robin on these cpus, e.g. 0-3,8\n"
+            "  -i, --info               receive with tag_receive_info, latency and lost messages from the metadata\n"
+            "  -j, --json               JSON output instead of CSV\n"
+            "LIST is a comma separated list of values, all the combinations are executed.\n",
+            prog, sizeof(struct bench_msg_hdr));
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+            {"senders",     required_argument, NULL, 's'},
+            {"receivers",   required_argument, NULL, 'r'},
+            {"tags",        required_argument, NULL, 't'},
+            {"levels",      required_argument, NULL, 'l'},
+            {"size",        required_argument, NULL, 'm'},
+            {"awake-every", required_argument, NULL, 'a'},
+            {"busy-poll",   required_argument, NULL, 'p'},
+            {"ring",        required_argument, NULL, 'R'},
+            {"deadline",    required_argument, NULL, 'D'},
+            {"batch",       required_argument, NULL, 'b'},
+            {"window",      required_argument, NULL, 'w'},
+            {"duration",    required_argument, NULL, 'd'},
+            {"cpus",        required_argument, NULL, 'c'},
+            {"info",        no_argument,       NULL, 'i'},
+            {"json",        no_argument,       NULL, 'j'},
+            {"help",        no_argument,       NULL, 'h'},
+            {NULL, 0,                          NULL, 0}
+    };
+    struct value_list senders = {{1}, 1}, receivers = {{1}, 1}, tags = {{1}, 1}, levels = {{1}, 1};
+    struct value_list sizes = {{64}, 1}, awakes = {{0}, 1}, polls = {{0}, 1}, rings = {{0}, 1};
+    struct value_list deadlines = {{0}, 1}, batches = {{0}, 1}, windows = {{0}, 1};
+    struct bench_params p;
+    int opt, is, ir, it, il, im, ia, ip, ig, id, ib, iw;
+
+    while ((opt = getopt_long(argc, argv, "s:r:t:l:m:a:p:R:D:b:w:d:c:ijh", options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                parse_list(optarg, &senders);
+                break;
+            case 'r':
+                parse_list(optarg, &receivers);
+                break;
+            case 't':
+                parse_list(optarg, &tags);
+                break;
+            case 'l':
+                parse_list(optarg, &levels);
+                break;
+            case 'm':
+                parse_list(optarg, &sizes);
+                break;
+            case 'a':
+                parse_list(optarg, &awakes);
+                break;
+            case 'p':
+                parse_list(optarg, &polls);
+                break;
+            case 'R':
+                parse_list(optarg, &rings);
+                break;
+            case 'D':
+                parse_list(optarg, &deadlines);
+                break;
+            case 'b':
+                parse_list(optarg, &batches);
+                break;
+            case 'w':
+                parse_list(optarg, &windows);
+                break;
+            case 'd':
+                duration_s = atoi(optarg);
+                break;
+            case 'c':
+                parse_cpus(optarg);
+                break;
+            case 'i':
+                use_info = 1;
+                break;
+            case 'j':
+                use_json = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    print_header();
+    for (is = 0; is < senders.count; is++)
+        for (ir = 0; ir < receivers.count; ir++)
+            for (it = 0; it < tags.count; it++)
+                for (il = 0; il < levels.count; il++)
+                    for (im = 0; im < sizes.count; im++)
+                        for (ia = 0; ia < awakes.count; ia++)
+                            for (ip = 0; ip < polls.count; ip++)
+                                for (ig = 0; ig < rings.count; ig++)
+                                    for (id = 0; id < deadlines.count; id++)
+                                        for (ib = 0; ib < batches.count; ib++)
+                                            for (iw = 0; iw < windows.count; iw++) {
+                                                p.senders = senders.values[is];
+                                                p.receivers = receivers.values[ir];
+                                                p.tags = tags.values[it];
+                                                p.levels = levels.values[il];
+                                                p.size = sizes.values[im];
+                                                p.awake_every = awakes.values[ia];
+                                                p.busy_poll = polls.values[ip];
+                                                p.ring = rings.values[ig];
+                                                p.deadline = deadlines.values[id];
+                                                p.batch = batches.values[ib];
+                                                p.window = windows.values[iw];
+                                                run_one(&p);
+                                            }
+    if (use_json) printf("\n]\n");
+    return 0;
+}
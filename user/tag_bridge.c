@@ -0,0 +1,171 @@
+/**
+ * @file tag_bridge.c
+ *
+ * @description Cross-host bridge daemon of the tag-service (see tag_bridge.h). It forwards the messages of the
+ * routed (key, level) pairs of this host to the peer bridges over UDP or TCP and republishes with tag_send the
+ * messages the peers forward to it. Routes go one way: a host that also receives a key must not route it back, the
+ * messages republished by the bridge itself are anyhow never forwarded again. A listening bridge takes frames only
+ * from the addresses of its peers and republishes only the levels of the keys it accepts, on existing tags.
+ *
+ * build: gcc -O2 -pthread user/tag_bridge.c -o tag_bridge
+ *
+ * e.g. host A (192.168.1.1) forwards the levels 0 and 1 of the key 10, host B republishes them on the key 10:
+ *   A: ./tag_bridge -p 192.168.1.2:7000 -f 10:0x3
+ *   B: ./tag_bridge -l 7000 -p 192.168.1.1:7000 -a 10:0x3
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include "tag_bridge.h"
+
+#define DEFAULT_MSG_SIZE 4096
+#define DEFAULT_FLUSH_US 200
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+static void print_stats(struct bridge *b, double elapsed_s) {
+    struct bridge_stats s = b->stats;
+    printf("elapsed_s=%.3f forwarded=%lu missed=%lu frames_out=%lu bytes_out=%lu send_errors=%lu frames_in=%lu "
+           "republished=%lu republish_errors=%lu bad_frames=%lu lost_frames=%lu rejected=%lu\n", elapsed_s, s.forwarded,
+           s.missed, s.frames_out, s.bytes_out, s.send_errors, s.frames_in, s.republished, s.republish_errors,
+           s.bad_frames, s.lost_frames, s.rejected);
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t, --tcp                 use TCP instead of UDP\n"
+            "  -l, --listen [HOST:]PORT  republish the frames of the peers received on this address\n"
+            "  -p, --peer HOST:PORT      forward to this peer bridge and take its frames (repeatable, at most %d)\n"
+            "  -f, --forward KEY:LEVELS[@REMOTE_KEY]\n"
+            "                            forward the levels (bit mask) of the key, republished on REMOTE_KEY\n"
+            "                            (default the same key); repeatable, at most %d\n"
+            "  -a, --accept KEY:LEVELS   republish the frames of the peers on these levels (bit mask) of the key,\n"
+            "                            which must exist; repeatable, at most %d, needed by --listen\n"
+            "  -b, --batch BYTES         frame size limit (default %d for UDP, %d for TCP)\n"
+            "  -w, --flush USECS         longest wait of a message for a batch to fill (default %d)\n"
+            "  -m, --msg-size BYTES      largest message forwarded (default %d, or what fits in a UDP batch)\n"
+            "  -s, --stats SEC           print the counters every SEC seconds, 0 only at exit (default 0)\n",
+            prog, BRIDGE_MAX_PEERS, BRIDGE_MAX_ROUTES, BRIDGE_MAX_ROUTES, BRIDGE_UDP_BATCH, BRIDGE_TCP_BATCH, DEFAULT_FLUSH_US,
+            DEFAULT_MSG_SIZE);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+            {"tcp",      no_argument,       NULL, 't'},
+            {"listen",   required_argument, NULL, 'l'},
+            {"peer",     required_argument, NULL, 'p'},
+            {"forward",  required_argument, NULL, 'f'},
+            {"accept",   required_argument, NULL, 'a'},
+            {"batch",    required_argument, NULL, 'b'},
+            {"flush",    required_argument, NULL, 'w'},
+            {"msg-size", required_argument, NULL, 'm'},
+            {"stats",    required_argument, NULL, 's'},
+            {"help",     no_argument,       NULL, 'h'},
+            {NULL, 0,                       NULL, 0}
+    };
+    static struct bridge_config cfg = {.flush_us = DEFAULT_FLUSH_US, .skip_own = 1};
+    static struct bridge bridge;
+    struct sigaction sa;
+    uint64_t start, last;
+    int opt, stats_s = 0;
+
+    while ((opt = getopt_long(argc, argv, "tl:p:f:a:b:w:m:s:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                cfg.tcp = 1;
+                break;
+            case 'l':
+                if (bridge_parse_addr(optarg, &cfg.listen_addr) < 0) {
+                    fprintf(stderr, "invalid listen address %s\n", optarg);
+                    return 1;
+                }
+                cfg.listen = 1;
+                break;
+            case 'p':
+                if (cfg.npeers == BRIDGE_MAX_PEERS || bridge_parse_addr(optarg, &cfg.peers[cfg.npeers]) < 0 ||
+                    cfg.peers[cfg.npeers].sin_addr.s_addr == htonl(INADDR_ANY)) {
+                    fprintf(stderr, "invalid peer %s\n", optarg);
+                    return 1;
+                }
+                cfg.npeers++;
+                break;
+            case 'f':
+                if (cfg.nroutes == BRIDGE_MAX_ROUTES || bridge_parse_route(optarg, &cfg.routes[cfg.nroutes]) < 0) {
+                    fprintf(stderr, "invalid route %s\n", optarg);
+                    return 1;
+                }
+                cfg.nroutes++;
+                break;
+            case 'a':
+                if (cfg.naccepts == BRIDGE_MAX_ROUTES || bridge_parse_route(optarg, &cfg.accepts[cfg.naccepts]) < 0 ||
+                    cfg.accepts[cfg.naccepts].remote_key != cfg.accepts[cfg.naccepts].key) {
+                    fprintf(stderr, "invalid accepted key %s\n", optarg);
+                    return 1;
+                }
+                cfg.naccepts++;
+                break;
+            case 'b':
+                cfg.batch_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                cfg.flush_us = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                cfg.msg_size = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                stats_s = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cfg.nroutes > 0 && cfg.npeers == 0) {
+        fprintf(stderr, "routes need at least a peer\n");
+        return 1;
+    }
+    if (cfg.listen && (cfg.npeers == 0 || cfg.naccepts == 0)) {
+        fprintf(stderr, "listening needs the peers and the accepted keys\n");
+        return 1;
+    }
+    if (cfg.nroutes == 0 && !cfg.listen) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.batch_bytes == 0) cfg.batch_bytes = cfg.tcp ? BRIDGE_TCP_BATCH : BRIDGE_UDP_BATCH;
+    if (cfg.msg_size == 0) {
+        cfg.msg_size = cfg.batch_bytes - sizeof(struct bridge_frame) - sizeof(struct bridge_rec);
+        if (cfg.msg_size > DEFAULT_MSG_SIZE) cfg.msg_size = DEFAULT_MSG_SIZE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (bridge_start(&bridge, &cfg) < 0) {
+        fprintf(stderr, "bridge start failed: %s%s\n", strerror(errno),
+                errno == EINVAL ? " (the message size must fit in a batch)" : "");
+        return 1;
+    }
+    start = last = bridge_now_ns();
+    while (!stop) {
+        sleep(1);
+        if (stats_s > 0 && bridge_now_ns() - last >= (uint64_t) stats_s * 1000000000ULL) {
+            last = bridge_now_ns();
+            print_stats(&bridge, (double) (last - start) / 1e9);
+        }
+    }
+    bridge_stop(&bridge);
+    print_stats(&bridge, (double) (bridge_now_ns() - start) / 1e9);
+    return 0;
+}
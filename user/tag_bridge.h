@@ -0,0 +1,673 @@
+/*
+ * Cross-host bridge of the tag service, used by the tag_bridge daemon and by tag_bridge_bench.
+ *
+ * A bridge forwards the messages of the configured (key, level) pairs of the local host to its peers, which
+ * republish them with tag_send on their host. One thread per forwarded level waits in tag_receive_info and appends
+ * the message to the current batch; the network thread sends the batch to every peer when it is full or flush_us
+ * after its first message, while the next batch is being filled. A batch travels as a frame: a struct bridge_frame
+ * followed by count records, each a struct bridge_rec and len payload bytes, all the fields in network byte order.
+ * Over UDP a frame is a datagram (keep batch_bytes within the path MTU), over TCP frames follow each other on the
+ * stream of every peer.
+ * The tag service keeps no backlog: a message sent while the forwarding thread of its level is not waiting is missed
+ * like by any other reader; the sequence numbers of tag_receive_info count those messages in missed.
+ * The receiving side only takes the frames coming from the addresses of its peers and only republishes the records
+ * of the (key, level) pairs it accepts, on tags that already exist: it never creates a tag.
+ */
+
+#ifndef SOA_PROJECT_TM_TAG_BRIDGE_H
+#define SOA_PROJECT_TM_TAG_BRIDGE_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "../tag_lib.h"
+#include "../tag_service/tag.h"
+
+#define BRIDGE_MAGIC 0x5442 // "TB"
+#define BRIDGE_VERSION 1
+#define BRIDGE_MAX_FRAME 65507 // largest UDP payload
+#define BRIDGE_UDP_BATCH 1472 // one Ethernet frame: 1500 bytes minus the IPv4 and UDP headers
+#define BRIDGE_TCP_BATCH 65536
+#define BRIDGE_LEVELS 32 // levels of a tag
+#define BRIDGE_MAX_PEERS 16
+#define BRIDGE_MAX_ROUTES 64
+#define BRIDGE_MAX_KEYS 64 // descriptors cached by a republishing thread
+#define BRIDGE_MAX_CONNS 64 // inbound TCP connections
+#define BRIDGE_POLL_MS 100 // blocked threads check for the stop request this often
+#define BRIDGE_RETRY_NS 1000000000ULL // reconnection interval of a TCP peer
+
+struct bridge_frame {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint16_t count; // records
+    uint16_t pad;
+    uint32_t len; // bytes of the frame, this header included
+    uint32_t seq; // frames sent by the bridge, to count the UDP frames lost
+};
+
+struct bridge_rec {
+    int32_t key; // key the peer republishes on
+    uint16_t level;
+    uint16_t len; // payload bytes following
+};
+
+/* levels of a local key forwarded to the peers, republished there on remote_key */
+struct bridge_route {
+    int key;
+    unsigned int levels; // bit n for level n
+    int remote_key;
+};
+
+struct bridge_config {
+    int tcp; // 1 for TCP, 0 for UDP
+    int listen; // 1 to accept the frames of the peers on listen_addr
+    struct sockaddr_in listen_addr;
+    struct sockaddr_in peers[BRIDGE_MAX_PEERS]; // frames are sent to them and only taken from their addresses
+    int npeers;
+    struct bridge_route routes[BRIDGE_MAX_ROUTES];
+    int nroutes;
+    struct bridge_route accepts[BRIDGE_MAX_ROUTES]; // levels of the local keys the peers may republish on
+    int naccepts;
+    size_t batch_bytes; // frame size limit
+    unsigned int flush_us; // longest wait of a message in a batch that is not full
+    size_t msg_size; // largest message forwarded
+    int skip_own; // don't forward the messages sent by this process, i.e. the republished ones
+};
+
+struct bridge_stats {
+    unsigned long forwarded; // messages put in frames
+    unsigned long missed; // messages of the forwarded levels sent while their thread was not waiting
+    unsigned long frames_out;
+    unsigned long bytes_out;
+    unsigned long send_errors; // frames not delivered to a peer
+    unsigned long frames_in;
+    unsigned long republished;
+    unsigned long republish_errors;
+    unsigned long bad_frames;
+    unsigned long lost_frames; // UDP frames of the peers never received
+    unsigned long rejected; // frames from unknown addresses and records of keys or levels not accepted
+};
+
+struct bridge_batch {
+    char *buf; // frame being built, starts with the struct bridge_frame
+    size_t used;
+    unsigned int count;
+    uint64_t first_ns; // arrival of the first record
+};
+
+struct bridge;
+
+struct bridge_level {
+    struct bridge *bridge;
+    const struct bridge_route *route;
+    int level;
+    pthread_t tid;
+};
+
+struct bridge_conn {
+    struct bridge *bridge;
+    int fd;
+    pthread_t tid;
+};
+
+struct bridge {
+    struct bridge_config cfg;
+    struct bridge_stats stats; // updated with atomic builtins
+    volatile int stop;
+    pthread_mutex_t mtx;
+    pthread_cond_t filled; // first record of a batch or batch full, for the network thread
+    pthread_cond_t swapped; // a new batch can be filled, for the forwarding threads
+    struct bridge_batch batch[2];
+    int fill; // batch being filled, the other one is in flight or empty
+    int full;
+    uint32_t frame_seq;
+    int out_fd; // UDP socket of the frames sent
+    int peer_fds[BRIDGE_MAX_PEERS]; // TCP connections, -1 if down
+    uint64_t peer_retry_ns[BRIDGE_MAX_PEERS];
+    int in_fd; // UDP socket or TCP listening socket, -1 if not listening
+    struct bridge_level *levels;
+    int nlevels;
+    struct bridge_conn conns[BRIDGE_MAX_CONNS];
+    pthread_t out_tid, in_tid;
+};
+
+/* descriptors of the keys a thread republishes on */
+struct bridge_keys {
+    int key[BRIDGE_MAX_KEYS];
+    int td[BRIDGE_MAX_KEYS];
+    int n;
+};
+
+static inline uint64_t bridge_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+#define BRIDGE_COUNT(b, field, n) __atomic_fetch_add(&(b)->stats.field, (n), __ATOMIC_RELAXED)
+
+/* the descriptor receives fail with ETIMEDOUT every BRIDGE_POLL_MS, so that the threads see the stop request */
+static inline int bridge_open(int key) {
+    int td = tag_get(key, IPC_CREAT, 0);
+    if (td >= 0 && tag_ctl_arg(td, TAG_TIMEOUT, BRIDGE_POLL_MS * 1000UL) < 0) {
+        close(td);
+        return -1;
+    }
+    return td;
+}
+
+/**
+ * @description Appends a message to the batch being filled, waiting for the network thread to take the batch if the
+ * message doesn't fit.
+ */
+static inline void bridge_append(struct bridge *b, int key, int level, const char *data, size_t len) {
+    struct bridge_batch *batch;
+    struct bridge_rec rec = {(int32_t) htonl((uint32_t) key), htons((uint16_t) level), htons((uint16_t) len)};
+
+    pthread_mutex_lock(&b->mtx);
+    while (!b->stop && b->batch[b->fill].used + sizeof(rec) + len > b->cfg.batch_bytes) {
+        b->full = 1;
+        pthread_cond_signal(&b->filled);
+        pthread_cond_wait(&b->swapped, &b->mtx);
+    }
+    batch = &b->batch[b->fill];
+    if (!b->stop) {
+        memcpy(batch->buf + batch->used, &rec, sizeof(rec));
+        memcpy(batch->buf + batch->used + sizeof(rec), data, len);
+        batch->used += sizeof(rec) + len;
+        if (batch->count++ == 0) {
+            batch->first_ns = bridge_now_ns();
+            pthread_cond_signal(&b->filled);
+        }
+    }
+    pthread_mutex_unlock(&b->mtx);
+}
+
+/* forwarding thread of a level */
+static inline void *bridge_forward(void *arg) {
+    struct bridge_level *l = arg;
+    struct bridge *b = l->bridge;
+    struct tag_msg_info info;
+    unsigned long long last_seq = 0;
+    char *buffer = malloc(b->cfg.msg_size);
+    int td = -1, res;
+
+    while (buffer != NULL && !b->stop) {
+        if (td < 0 && (td = bridge_open(l->route->key)) < 0) {
+            usleep(BRIDGE_POLL_MS * 1000);
+            continue;
+        }
+        res = tag_receive_info(td, l->level, buffer, b->cfg.msg_size, &info);
+        if (res < 0) {
+            if (errno == ENOENT || errno == EIDRM) {
+                /* the tag has been removed, follow the key */
+                close(td);
+                td = -1;
+                last_seq = 0;
+            }
+            continue;
+        }
+        if (last_seq != 0 && info.seq > last_seq + 1) BRIDGE_COUNT(b, missed, info.seq - last_seq - 1);
+        last_seq = info.seq;
+        if (b->cfg.skip_own && info.tgid == getpid()) continue;
+        bridge_append(b, l->route->remote_key, l->level, buffer, (size_t) res);
+        BRIDGE_COUNT(b, forwarded, 1);
+    }
+    if (td >= 0) close(td);
+    free(buffer);
+    return NULL;
+}
+
+static inline int bridge_write_all(int fd, const char *buf, size_t len) {
+    ssize_t res;
+    while (len > 0) {
+        res = send(fd, buf, len, MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return -1;
+        buf += res;
+        len -= (size_t) res;
+    }
+    return 0;
+}
+
+static inline int bridge_connect(struct bridge *b, int peer) {
+    int fd, one = 1;
+    uint64_t now = bridge_now_ns();
+
+    if (b->peer_fds[peer] >= 0) return b->peer_fds[peer];
+    if (now < b->peer_retry_ns[peer]) return -1;
+    b->peer_retry_ns[peer] = now + BRIDGE_RETRY_NS;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *) &b->cfg.peers[peer], sizeof(b->cfg.peers[peer])) < 0) {
+        close(fd);
+        return -1;
+    }
+    b->peer_fds[peer] = fd;
+    return fd;
+}
+
+/* sends a frame to every peer, a TCP peer that fails is reconnected at the next frame */
+static inline void bridge_send_frame(struct bridge *b, struct bridge_batch *batch) {
+    struct bridge_frame *frame = (struct bridge_frame *) batch->buf;
+    int i, fd;
+
+    frame->magic = htons(BRIDGE_MAGIC);
+    frame->version = BRIDGE_VERSION;
+    frame->flags = 0;
+    frame->count = htons((uint16_t) batch->count);
+    frame->pad = 0;
+    frame->len = htonl((uint32_t) batch->used);
+    frame->seq = htonl(b->frame_seq++);
+    for (i = 0; i < b->cfg.npeers; i++) {
+        if (b->cfg.tcp) {
+            fd = bridge_connect(b, i);
+            if (fd >= 0 && bridge_write_all(fd, batch->buf, batch->used) == 0) continue;
+            if (fd >= 0) {
+                close(fd);
+                b->peer_fds[i] = -1;
+            }
+        } else if (sendto(b->out_fd, batch->buf, batch->used, 0, (struct sockaddr *) &b->cfg.peers[i],
+                          sizeof(b->cfg.peers[i])) == (ssize_t) batch->used) {
+            continue;
+        }
+        BRIDGE_COUNT(b, send_errors, 1);
+    }
+    BRIDGE_COUNT(b, frames_out, 1);
+    BRIDGE_COUNT(b, bytes_out, batch->used);
+}
+
+/* network thread: takes the batch when it is full or flush_us after its first record and sends it */
+static inline void *bridge_output(void *arg) {
+    struct bridge *b = arg;
+    struct bridge_batch *batch;
+    struct timespec ts;
+    uint64_t deadline;
+
+    pthread_mutex_lock(&b->mtx);
+    for (;;) {
+        batch = &b->batch[b->fill];
+        if (batch->count == 0) {
+            if (b->stop) break;
+            pthread_cond_wait(&b->filled, &b->mtx);
+            continue;
+        }
+        deadline = batch->first_ns + (uint64_t) b->cfg.flush_us * 1000;
+        if (!b->full && !b->stop && bridge_now_ns() < deadline) {
+            /* filled uses CLOCK_MONOTONIC, like first_ns */
+            ts.tv_sec = (time_t) (deadline / 1000000000ULL);
+            ts.tv_nsec = (long) (deadline % 1000000000ULL);
+            pthread_cond_timedwait(&b->filled, &b->mtx, &ts);
+            continue;
+        }
+        /* the other batch is empty: the forwarding threads go on with it while this one is sent */
+        b->fill ^= 1;
+        b->full = 0;
+        pthread_cond_broadcast(&b->swapped);
+        pthread_mutex_unlock(&b->mtx);
+
+        bridge_send_frame(b, batch);
+
+        pthread_mutex_lock(&b->mtx);
+        batch->used = sizeof(struct bridge_frame);
+        batch->count = 0;
+    }
+    pthread_mutex_unlock(&b->mtx);
+    return NULL;
+}
+
+static inline void bridge_key_drop(struct bridge_keys *keys, int key) {
+    int i;
+    for (i = 0; i < keys->n; i++) {
+        if (keys->key[i] != key) continue;
+        close(keys->td[i]);
+        keys->key[i] = keys->key[--keys->n];
+        keys->td[i] = keys->td[keys->n];
+        return;
+    }
+}
+
+/* open only: a peer never creates a tag on this host */
+static inline int bridge_key_td(struct bridge_keys *keys, int key) {
+    int i, td;
+    for (i = 0; i < keys->n; i++) {
+        if (keys->key[i] == key) return keys->td[i];
+    }
+    td = tag_get(key, TAG_OPEN, 0);
+    if (td < 0) return td;
+    if (keys->n == BRIDGE_MAX_KEYS) bridge_key_drop(keys, keys->key[0]);
+    keys->key[keys->n] = key;
+    keys->td[keys->n++] = td;
+    return td;
+}
+
+static inline void bridge_keys_close(struct bridge_keys *keys) {
+    while (keys->n > 0) close(keys->td[--keys->n]);
+}
+
+static inline int bridge_accepted(const struct bridge *b, int key, int level) {
+    int i;
+    for (i = 0; i < b->cfg.naccepts; i++) {
+        if (b->cfg.accepts[i].key == key && level < BRIDGE_LEVELS && (b->cfg.accepts[i].levels & (1U << level))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* frames come from an ephemeral port of the peers: only the address is checked */
+static inline int bridge_known_peer(const struct bridge *b, const struct sockaddr_in *from) {
+    int i;
+    for (i = 0; i < b->cfg.npeers; i++) {
+        if (b->cfg.peers[i].sin_addr.s_addr == from->sin_addr.s_addr) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @description Checks a received frame and republishes its records with tag_send.
+ * @return the frame sequence number, -1 if the frame is malformed
+ */
+static inline long bridge_republish(struct bridge *b, struct bridge_keys *keys, char *frame, size_t len) {
+    struct bridge_frame *hdr = (struct bridge_frame *) frame;
+    struct bridge_rec rec;
+    size_t pos = sizeof(*hdr);
+    unsigned int i, count;
+    int key, level, td;
+
+    if (len < sizeof(*hdr) || ntohs(hdr->magic) != BRIDGE_MAGIC || hdr->version != BRIDGE_VERSION ||
+        ntohl(hdr->len) != len) {
+        BRIDGE_COUNT(b, bad_frames, 1);
+        return -1;
+    }
+    count = ntohs(hdr->count);
+    BRIDGE_COUNT(b, frames_in, 1);
+    for (i = 0; i < count; i++) {
+        if (pos + sizeof(rec) > len) break;
+        memcpy(&rec, frame + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (pos + ntohs(rec.len) > len) break;
+        key = (int) ntohl((uint32_t) rec.key);
+        level = ntohs(rec.level);
+        if (!bridge_accepted(b, key, level)) {
+            BRIDGE_COUNT(b, rejected, 1);
+            pos += ntohs(rec.len);
+            continue;
+        }
+        td = bridge_key_td(keys, key);
+        if (td < 0 || tag_send(td, level, frame + pos, ntohs(rec.len)) < 0) {
+            if (td >= 0 && (errno == ENOENT || errno == EIDRM)) bridge_key_drop(keys, key);
+            BRIDGE_COUNT(b, republish_errors, 1);
+        } else {
+            BRIDGE_COUNT(b, republished, 1);
+        }
+        pos += ntohs(rec.len);
+    }
+    if (i < count) BRIDGE_COUNT(b, bad_frames, 1);
+    return (long) ntohl(hdr->seq);
+}
+
+/* UDP input: frames are datagrams, the frame sequence numbers of every peer tell the lost ones */
+static inline void *bridge_input_udp(void *arg) {
+    struct bridge *b = arg;
+    struct bridge_keys keys = {.n = 0};
+    struct sockaddr_in from, seen[BRIDGE_MAX_PEERS];
+    uint32_t next[BRIDGE_MAX_PEERS];
+    socklen_t from_len;
+    char *frame = malloc(BRIDGE_MAX_FRAME);
+    int i, nseen = 0;
+    ssize_t len;
+    long seq;
+
+    while (frame != NULL && !b->stop) {
+        from_len = sizeof(from);
+        len = recvfrom(b->in_fd, frame, BRIDGE_MAX_FRAME, 0, (struct sockaddr *) &from, &from_len);
+        if (len < 0) continue;
+        if (!bridge_known_peer(b, &from)) {
+            BRIDGE_COUNT(b, rejected, 1);
+            continue;
+        }
+        seq = bridge_republish(b, &keys, frame, (size_t) len);
+        if (seq < 0) continue;
+        for (i = 0; i < nseen; i++) {
+            if (seen[i].sin_addr.s_addr == from.sin_addr.s_addr && seen[i].sin_port == from.sin_port) break;
+        }
+        if (i == nseen) {
+            if (nseen == BRIDGE_MAX_PEERS) continue;
+            seen[nseen++] = from;
+        } else if ((uint32_t) seq - next[i] >= 0x80000000U) {
+            /* late duplicate or reordered frame */
+            continue;
+        } else {
+            BRIDGE_COUNT(b, lost_frames, (uint32_t) seq - next[i]);
+        }
+        next[i] = (uint32_t) seq + 1;
+    }
+    bridge_keys_close(&keys);
+    free(frame);
+    return NULL;
+}
+
+static inline int bridge_read_all(struct bridge *b, int fd, char *buf, size_t len) {
+    ssize_t res;
+    while (len > 0) {
+        res = recv(fd, buf, len, 0);
+        if (res < 0 && (errno == EINTR || errno == EAGAIN) && !b->stop) continue;
+        if (res <= 0) return -1;
+        buf += res;
+        len -= (size_t) res;
+    }
+    return 0;
+}
+
+/* TCP input of a peer: the frame header tells the length of the rest of the frame */
+static inline void *bridge_input_conn(void *arg) {
+    struct bridge_conn *conn = arg;
+    struct bridge *b = conn->bridge;
+    struct bridge_keys keys = {.n = 0};
+    struct bridge_frame *hdr;
+    char *frame = malloc(BRIDGE_TCP_BATCH);
+    size_t len;
+
+    while (frame != NULL && !b->stop) {
+        if (bridge_read_all(b, conn->fd, frame, sizeof(*hdr)) < 0) break;
+        hdr = (struct bridge_frame *) frame;
+        len = ntohl(hdr->len);
+        if (ntohs(hdr->magic) != BRIDGE_MAGIC || len < sizeof(*hdr) || len > BRIDGE_TCP_BATCH) {
+            /* the stream can't be resynchronized */
+            BRIDGE_COUNT(b, bad_frames, 1);
+            break;
+        }
+        if (bridge_read_all(b, conn->fd, frame + sizeof(*hdr), len - sizeof(*hdr)) < 0) break;
+        bridge_republish(b, &keys, frame, len);
+    }
+    bridge_keys_close(&keys);
+    free(frame);
+    close(conn->fd);
+    __atomic_store_n(&conn->fd, -1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static inline void *bridge_accept(void *arg) {
+    struct bridge *b = arg;
+    struct pollfd pfd = {b->in_fd, POLLIN, 0};
+    struct timeval tv = {0, BRIDGE_POLL_MS * 1000};
+    struct bridge_conn *conn;
+    struct sockaddr_in from;
+    socklen_t from_len;
+    int fd, i, one = 1;
+
+    while (!b->stop) {
+        if (poll(&pfd, 1, BRIDGE_POLL_MS) <= 0) continue;
+        from_len = sizeof(from);
+        fd = accept(b->in_fd, (struct sockaddr *) &from, &from_len);
+        if (fd < 0) continue;
+        if (!bridge_known_peer(b, &from)) {
+            BRIDGE_COUNT(b, rejected, 1);
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        /* a free slot: a connection that is closed and joined */
+        conn = NULL;
+        for (i = 0; i < BRIDGE_MAX_CONNS && conn == NULL; i++) {
+            if (b->conns[i].bridge == NULL) {
+                conn = &b->conns[i];
+            } else if (__atomic_load_n(&b->conns[i].fd, __ATOMIC_ACQUIRE) < 0) {
+                pthread_join(b->conns[i].tid, NULL);
+                conn = &b->conns[i];
+            }
+        }
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->bridge = b;
+        conn->fd = fd;
+        if (pthread_create(&conn->tid, NULL, bridge_input_conn, conn) != 0) {
+            close(fd);
+            conn->bridge = NULL;
+        }
+    }
+    for (i = 0; i < BRIDGE_MAX_CONNS; i++) {
+        if (b->conns[i].bridge != NULL) pthread_join(b->conns[i].tid, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * @description Starts the threads of a bridge: one forwarding thread per routed level, the network thread and, if
+ * the bridge listens, the input thread.
+ * @return 0 on success, -1 on failure and errno is set (EINVAL if msg_size doesn't fit in a batch)
+ */
+static inline int bridge_start(struct bridge *b, const struct bridge_config *cfg) {
+    struct timeval tv = {0, BRIDGE_POLL_MS * 1000};
+    pthread_condattr_t attr;
+    int i, level, one = 1;
+
+    memset(b, 0, sizeof(*b));
+    b->cfg = *cfg;
+    b->out_fd = b->in_fd = -1;
+    if (cfg->batch_bytes > (cfg->tcp ? BRIDGE_TCP_BATCH : BRIDGE_MAX_FRAME) || cfg->msg_size > UINT16_MAX ||
+        sizeof(struct bridge_frame) + sizeof(struct bridge_rec) + cfg->msg_size > cfg->batch_bytes) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_init(&b->mtx, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&b->filled, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&b->swapped, NULL);
+    for (i = 0; i < 2; i++) {
+        b->batch[i].buf = malloc(cfg->batch_bytes);
+        b->batch[i].used = sizeof(struct bridge_frame);
+        if (b->batch[i].buf == NULL) goto fail;
+    }
+    for (i = 0; i < BRIDGE_MAX_PEERS; i++) b->peer_fds[i] = -1;
+
+    if (!cfg->tcp && (b->out_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) goto fail;
+    if (cfg->listen) {
+        b->in_fd = socket(AF_INET, cfg->tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+        if (b->in_fd < 0) goto fail;
+        setsockopt(b->in_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(b->in_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (bind(b->in_fd, (const struct sockaddr *) &cfg->listen_addr, sizeof(cfg->listen_addr)) < 0) goto fail;
+        if (cfg->tcp && listen(b->in_fd, BRIDGE_MAX_CONNS) < 0) goto fail;
+    }
+
+    for (i = 0; i < cfg->nroutes; i++) b->nlevels += __builtin_popcount(cfg->routes[i].levels);
+    b->levels = calloc(b->nlevels + 1, sizeof(struct bridge_level));
+    if (b->levels == NULL) goto fail;
+    b->nlevels = 0;
+    for (i = 0; i < cfg->nroutes; i++) {
+        for (level = 0; level < BRIDGE_LEVELS; level++) {
+            if (!(cfg->routes[i].levels & (1U << level))) continue;
+            b->levels[b->nlevels].bridge = b;
+            b->levels[b->nlevels].route = &b->cfg.routes[i];
+            b->levels[b->nlevels].level = level;
+            b->nlevels++;
+        }
+    }
+    if (pthread_create(&b->out_tid, NULL, bridge_output, b) != 0) goto fail;
+    for (i = 0; i < b->nlevels; i++) pthread_create(&b->levels[i].tid, NULL, bridge_forward, &b->levels[i]);
+    if (cfg->listen) pthread_create(&b->in_tid, NULL, cfg->tcp ? bridge_accept : bridge_input_udp, b);
+    return 0;
+
+    fail:
+    if (b->in_fd >= 0) close(b->in_fd);
+    if (b->out_fd >= 0) close(b->out_fd);
+    free(b->batch[0].buf);
+    free(b->batch[1].buf);
+    free(b->levels);
+    return -1;
+}
+
+/**
+ * @description Stops the threads of a bridge, the batch being filled is sent, and releases it.
+ */
+static inline void bridge_stop(struct bridge *b) {
+    int i;
+
+    pthread_mutex_lock(&b->mtx);
+    b->stop = 1;
+    pthread_cond_broadcast(&b->filled);
+    pthread_cond_broadcast(&b->swapped);
+    pthread_mutex_unlock(&b->mtx);
+    for (i = 0; i < b->nlevels; i++) pthread_join(b->levels[i].tid, NULL);
+    pthread_join(b->out_tid, NULL);
+    if (b->cfg.listen) pthread_join(b->in_tid, NULL);
+
+    for (i = 0; i < BRIDGE_MAX_PEERS; i++) {
+        if (b->peer_fds[i] >= 0) close(b->peer_fds[i]);
+    }
+    if (b->in_fd >= 0) close(b->in_fd);
+    if (b->out_fd >= 0) close(b->out_fd);
+    free(b->batch[0].buf);
+    free(b->batch[1].buf);
+    free(b->levels);
+}
+
+/* "host:port" or "port" (any address) */
+static inline int bridge_parse_addr(const char *arg, struct sockaddr_in *addr) {
+    const char *colon = strrchr(arg, ':');
+    char host[64];
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_ANY);
+    if (colon != NULL) {
+        if ((size_t) (colon - arg) >= sizeof(host)) return -1;
+        memcpy(host, arg, colon - arg);
+        host[colon - arg] = '\0';
+        if (inet_pton(AF_INET, host, &addr->sin_addr) != 1) return -1;
+        arg = colon + 1;
+    }
+    addr->sin_port = htons((uint16_t) atoi(arg));
+    return addr->sin_port == 0 ? -1 : 0;
+}
+
+/* "key:levels[@remote_key]", levels is a bit mask (e.g. 0x3 for the levels 0 and 1); also "key:levels" accepted */
+static inline int bridge_parse_route(const char *arg, struct bridge_route *route) {
+    char *end;
+
+    route->key = (int) strtol(arg, &end, 10);
+    if (*end != ':') return -1;
+    route->levels = (unsigned int) strtoul(end + 1, &end, 0);
+    route->remote_key = route->key;
+    if (*end == '@') route->remote_key = (int) strtol(end + 1, &end, 10);
+    return *end != '\0' || route->levels == 0 || route->key <= 0 || route->remote_key <= 0 ? -1 : 0;
+}
+
+#endif //SOA_PROJECT_TM_TAG_BRIDGE_H
@@ -0,0 +1,271 @@
+/**
+ * @file tag_bridge_bench.c
+ *
+ * @description Throughput and latency of the bridged path: a producer sends on a source key, the bridges carry the
+ * messages to a destination key and a consumer receives them there, the latency is taken from the CLOCK_MONOTONIC
+ * timestamp in the payload. With --inproc the two bridges (tag_bridge.h) run in this process over 127.0.0.1, the
+ * source key routed on the destination key; otherwise tag_bridge daemons must already route them, e.g. from two
+ * network namespaces of this host (see bridge_netns.sh), so that the clock is the same at both ends.
+ * Every list parameter accepts comma separated values and the cartesian product is executed, one CSV row per run.
+ *
+ * build: gcc -O2 -pthread user/tag_bridge_bench.c -o tag_bridge_bench
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include "tag_bridge.h"
+
+#define MAX_VALUES 16
+#define MAX_SAMPLES (1 << 22)
+#define BENCH_PORT 7411
+
+/* header embedded at the beginning of every payload */
+struct bench_msg_hdr {
+    uint64_t send_ns;
+    uint64_t seq;
+};
+
+struct value_list {
+    int values[MAX_VALUES];
+    int count;
+};
+
+struct bench_params {
+    int size;
+    int rate; // messages per second of the producer, 0 as fast as possible
+    int flush_us; // of the in-process bridges
+    unsigned long sent; // set by the producer
+};
+
+static volatile int stop;
+static int src_key = 100, dst_key = 200, duration_s = 5, inproc, use_tcp, batch_bytes;
+static uint64_t *samples;
+static unsigned long nsamples;
+
+static void *producer(void *arg) {
+    struct bench_params *p = arg;
+    struct bench_msg_hdr *hdr;
+    struct timespec next;
+    uint64_t period = p->rate > 0 ? 1000000000ULL / (uint64_t) p->rate : 0, seq = 0;
+    char *buffer = calloc(1, p->size);
+    int td = tag_get(src_key, IPC_CREAT, 0);
+
+    if (buffer == NULL || td < 0) {
+        fprintf(stderr, "producer setup failed: %s\n", strerror(errno));
+        stop = 1;
+        free(buffer);
+        return NULL;
+    }
+    hdr = (struct bench_msg_hdr *) buffer;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stop) {
+        if (period != 0) {
+            next.tv_nsec += (long) period;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        hdr->seq = ++seq;
+        hdr->send_ns = bridge_now_ns();
+        tag_send(td, 0, buffer, p->size);
+    }
+    p->sent = seq;
+    close(td);
+    free(buffer);
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    struct bench_params *p = arg;
+    struct bench_msg_hdr *hdr;
+    char *buffer = calloc(1, p->size);
+    int td = bridge_open(dst_key), res;
+
+    if (buffer == NULL || td < 0) {
+        fprintf(stderr, "consumer setup failed: %s\n", strerror(errno));
+        stop = 1;
+        free(buffer);
+        return NULL;
+    }
+    hdr = (struct bench_msg_hdr *) buffer;
+    while (!stop) {
+        res = tag_receive(td, 0, buffer, p->size);
+        if (res < (int) sizeof(*hdr)) continue;
+        if (nsamples < MAX_SAMPLES) samples[nsamples++] = bridge_now_ns() - hdr->send_ns;
+    }
+    close(td);
+    free(buffer);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(double q) {
+    return nsamples == 0 ? 0 : samples[(unsigned long) (q * (double) (nsamples - 1))];
+}
+
+static int run(struct bench_params *p) {
+    static struct bridge out, in;
+    struct bridge_config cfg = {.tcp = use_tcp, .msg_size = (size_t) p->size, .flush_us = (unsigned int) p->flush_us};
+    pthread_t prod_tid, cons_tid;
+    uint64_t start;
+    double elapsed_s;
+
+    cfg.batch_bytes = batch_bytes > 0 ? (size_t) batch_bytes : use_tcp ? BRIDGE_TCP_BATCH : BRIDGE_UDP_BATCH;
+    if (inproc) {
+        /* the receiving side first, so that the first frames find it */
+        cfg.listen = 1;
+        cfg.listen_addr.sin_family = AF_INET;
+        cfg.listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        cfg.listen_addr.sin_port = htons(BENCH_PORT);
+        /* the frames of the other bridge come from 127.0.0.1 */
+        cfg.peers[0] = cfg.listen_addr;
+        cfg.npeers = 1;
+        cfg.accepts[0] = (struct bridge_route) {dst_key, 1, dst_key};
+        cfg.naccepts = 1;
+        if (bridge_start(&in, &cfg) < 0) return -1;
+        cfg.listen = 0;
+        cfg.naccepts = 0;
+        cfg.routes[0] = (struct bridge_route) {src_key, 1, dst_key};
+        cfg.nroutes = 1;
+        /* the producer runs in this process too */
+        cfg.skip_own = 0;
+        if (bridge_start(&out, &cfg) < 0) {
+            bridge_stop(&in);
+            return -1;
+        }
+    }
+
+    nsamples = 0;
+    stop = 0;
+    p->sent = 0;
+    pthread_create(&cons_tid, NULL, consumer, p);
+    usleep(200000);
+    start = bridge_now_ns();
+    pthread_create(&prod_tid, NULL, producer, p);
+    sleep(duration_s);
+    stop = 1;
+    pthread_join(prod_tid, NULL);
+    elapsed_s = (double) (bridge_now_ns() - start) / 1e9;
+    pthread_join(cons_tid, NULL);
+
+    if (inproc) {
+        bridge_stop(&out);
+        bridge_stop(&in);
+    }
+    qsort(samples, nsamples, sizeof(uint64_t), cmp_u64);
+    printf("%s,%d,%d,%zu,%d,%.3f,%lu,%lu,%lu,%.0f,%lu,%lu,%lu,%lu,%lu,%lu\n", use_tcp ? "tcp" : "udp", p->size,
+           p->rate, cfg.batch_bytes, p->flush_us, elapsed_s, p->sent, nsamples, p->sent - nsamples,
+           (double) nsamples / elapsed_s, percentile(0.5), percentile(0.99),
+           nsamples ? samples[nsamples - 1] : 0, out.stats.frames_out, out.stats.missed, in.stats.lost_frames);
+    fflush(stdout);
+    return 0;
+}
+
+static int parse_list(const char *arg, struct value_list *list) {
+    char *copy = strdup(arg), *token, *save;
+    list->count = 0;
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        if (list->count == MAX_VALUES) break;
+        list->values[list->count++] = atoi(token);
+    }
+    free(copy);
+    return list->count;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i, --inproc           run the two bridges in this process over 127.0.0.1\n"
+            "  -t, --tcp              bridges over TCP instead of UDP (--inproc)\n"
+            "  -b, --batch BYTES      frame size limit of the bridges (--inproc)\n"
+            "  -w, --flush LIST       flush interval of the bridges in microseconds (--inproc, default 200)\n"
+            "  -m, --size LIST        message size, at least %zu (default 64)\n"
+            "  -r, --rate LIST        messages per second of the producer, 0 as fast as possible (default 10000)\n"
+            "  -k, --src-key KEY      key of the producer (default 100)\n"
+            "  -K, --dst-key KEY      key of the consumer (default 200)\n"
+            "  -d, --duration SEC     duration of every run (default 5)\n"
+            "The in-process counters (frames_out, bridge_missed, lost_frames) are 0 with external bridges.\n",
+            prog, sizeof(struct bench_msg_hdr));
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+            {"inproc",   no_argument,       NULL, 'i'},
+            {"tcp",      no_argument,       NULL, 't'},
+            {"batch",    required_argument, NULL, 'b'},
+            {"flush",    required_argument, NULL, 'w'},
+            {"size",     required_argument, NULL, 'm'},
+            {"rate",     required_argument, NULL, 'r'},
+            {"src-key",  required_argument, NULL, 'k'},
+            {"dst-key",  required_argument, NULL, 'K'},
+            {"duration", required_argument, NULL, 'd'},
+            {"help",     no_argument,       NULL, 'h'},
+            {NULL, 0,                       NULL, 0}
+    };
+    struct value_list sizes = {{64}, 1}, rates = {{10000}, 1}, flushes = {{200}, 1};
+    struct bench_params p;
+    int opt, im, ir, iw;
+
+    while ((opt = getopt_long(argc, argv, "itb:w:m:r:k:K:d:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                inproc = 1;
+                break;
+            case 't':
+                use_tcp = 1;
+                break;
+            case 'b':
+                batch_bytes = atoi(optarg);
+                break;
+            case 'w':
+                parse_list(optarg, &flushes);
+                break;
+            case 'm':
+                parse_list(optarg, &sizes);
+                break;
+            case 'r':
+                parse_list(optarg, &rates);
+                break;
+            case 'k':
+                src_key = atoi(optarg);
+                break;
+            case 'K':
+                dst_key = atoi(optarg);
+                break;
+            case 'd':
+                duration_s = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    if (samples == NULL || src_key == dst_key) {
+        fprintf(stderr, "%s\n", samples == NULL ? "out of memory" : "source and destination keys must differ");
+        return 1;
+    }
+
+    printf("transport,size,rate,batch_bytes,flush_us,elapsed_s,sent,received,lost,msgs_per_s,lat_p50_ns,lat_p99_ns,"
+           "lat_max_ns,frames_out,bridge_missed,lost_frames\n");
+    for (im = 0; im < sizes.count; im++)
+        for (ir = 0; ir < rates.count; ir++)
+            for (iw = 0; iw < flushes.count; iw++) {
+                p.size = sizes.values[im];
+                p.rate = rates.values[ir];
+                p.flush_us = flushes.values[iw];
+                if (p.size < (int) sizeof(struct bench_msg_hdr) || p.rate < 0 || p.flush_us < 0) {
+                    fprintf(stderr, "skipping invalid combination\n");
+                    continue;
+                }
+                if (run(&p) < 0) fprintf(stderr, "run failed: %s\n", strerror(errno));
+            }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file tag_lib_bench.cpp
+ *
+ * @description Microbenchmark of the C++ client (tag_lib.hpp). The global operator new is replaced with a counting
+ * one, so every row reports the heap allocations made by the measured loop next to the cost of an operation:
+ * the hot path (send, receive, timed receive, error_code failures) is expected to report 0.
+ *
+ * build: g++ -std=c++20 -O2 -pthread user/tag_lib_bench.cpp -o tag_lib_bench
+ */
+
+#include <getopt.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+#include "../tag_lib.hpp"
+
+static std::atomic<unsigned long> allocations{0};
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr std::size_t MSG_BUFFER = 4096;
+
+static unsigned long iterations = 200000;
+static std::size_t msg_size = 64;
+
+static void print_row(const char *name, unsigned long ops, bench_clock::duration elapsed, unsigned long allocs) {
+    double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    std::printf("%s,%lu,%.1f,%.0f,%lu\n", name, ops, ops ? ns / static_cast<double>(ops) : 0.0,
+                ns > 0 ? static_cast<double>(ops) * 1e9 / ns : 0.0, allocs);
+    std::fflush(stdout);
+}
+
+/* sends on a level without readers: the cost of the call itself */
+static void bench_send(tag::handle &td, std::span<const std::byte> msg) {
+    unsigned long i, allocs = allocations.load();
+    auto start = bench_clock::now();
+    for (i = 0; i < iterations; i++) td.send(0, msg);
+    print_row("send", iterations, bench_clock::now() - start, allocations.load() - allocs);
+}
+
+/* a sender streams to a receiver looping on a timed receive */
+static void bench_send_receive(tag::handle &td, std::span<const std::byte> msg) {
+    std::atomic<bool> stop{false}, ready{false};
+    std::atomic<unsigned long> received{0};
+    unsigned long allocs;
+    bench_clock::time_point start;
+
+    std::thread receiver([&] {
+        std::array<std::byte, MSG_BUFFER> buffer{};
+        std::error_code ec;
+        ready = true;
+        while (!stop.load(std::memory_order_relaxed)) {
+            td.receive_for(1, buffer, std::chrono::milliseconds(10), ec);
+            if (!ec) received++;
+        }
+    });
+    while (!ready) std::this_thread::yield();
+
+    allocs = allocations.load();
+    start = bench_clock::now();
+    for (unsigned long i = 0; i < iterations; i++) td.send(1, msg);
+    stop = true;
+    auto elapsed = bench_clock::now() - start;
+    receiver.join();
+    print_row("send_receive", received.load(), elapsed, allocations.load() - allocs);
+}
+
+/* timed receives that expire, reported through error_code */
+static void bench_timeout(tag::handle &td) {
+    std::array<std::byte, MSG_BUFFER> buffer{};
+    std::error_code ec;
+    unsigned long i, ops = iterations / 100 + 1, allocs = allocations.load();
+    auto start = bench_clock::now();
+    for (i = 0; i < ops; i++) td.receive_for(2, buffer, std::chrono::microseconds(1), ec);
+    print_row("timed_out", ops, bench_clock::now() - start, allocations.load() - allocs);
+    if (ec != std::errc::timed_out) std::fprintf(stderr, "unexpected result: %s\n", ec.message().c_str());
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'm':
+                msg_size = std::strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                std::fprintf(stderr, "usage: %s [-n iterations] [-m message size]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    try {
+        const tag::service &service = tag::discover();
+        if (msg_size == 0 || msg_size > service.msg_size || msg_size > MSG_BUFFER) {
+            std::fprintf(stderr, "message size must be in 1..%zu\n", std::min<std::size_t>(service.msg_size, MSG_BUFFER));
+            return 1;
+        }
+        tag::handle td = tag::handle::open(IPC_PRIVATE, IPC_CREAT);
+        std::vector<std::byte> msg(msg_size, std::byte{0x5a});
+
+        std::printf("bench,ops,ns_per_op,ops_per_s,allocations\n");
+        bench_send(td, msg);
+        bench_send_receive(td, msg);
+        bench_timeout(td);
+        td.remove();
+    } catch (const tag::error &e) {
+        std::fprintf(stderr, "%s: %s\n", e.what(), e.code().message().c_str());
+        return 1;
+    }
+    return 0;
+}
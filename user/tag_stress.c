@@ -0,0 +1,886 @@
+/**
+ * @file tag_stress.c
+ *
+ * @description Randomized stress test of the tag-service concurrency protocol.
+ * Senders, receivers, awakers and removers run a random mix of operations over a small set of keys and levels
+ * so that epoch flipping, standings accounting, remove-vs-receive and AWAKE_ALL-vs-send races are continuously hit.
+ * The following invariants are checked:
+ * - every delivered message is intact (header checksum, size and level match);
+ * - no lost wakeup: a receiver parked before a send on its tag-level completed must be woken by it (by a matching
+ *   send if it has a filter), and a filtered receiver only gets the matching messages;
+ * - no stuck reader: at the end of the run every parked receiver must be released by AWAKE_ALL;
+ * - after the run, two threads receiving with tag_receive_batch through one shared descriptor must each get every
+ *   message of rounds of concurrent sends, combined in one batch or not;
+ * - after the run, AWAKE_LEVELS must release a tag_receive_batch receiver even if a sender holds the level meanwhile;
+ * - only the error codes documented for every operation are returned;
+ * - before the run, tag_get creates a tag only with IPC_CREAT, TAG_OPEN only opens the existing one.
+ * The exit status is 0 only if no violation was found, a summary with the throughput of every operation is printed.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/ipc.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "../tag_lib.h"
+#include "../tag_ring.h"
+#include "../tag_service/tag.h"
+
+#define STRESS_MAGIC 0x7a6753u
+#define MAX_KEYS 256
+#define STRESS_LEVELS 32
+#define NS_PER_MS 1000000ULL
+#define RING_SLOTS 16
+#define BATCH_SLOTS 4
+#define SHARED_SENDERS 4
+#define SHARED_MARGIN_NS (20 * NS_PER_MS)
+
+enum role {
+    SENDER, RECEIVER, AWAKER, REMOVER, ROLES
+};
+
+static const char *role_name[ROLES] = {"send", "receive", "awake", "remove"};
+
+struct stress_msg_hdr {
+    uint32_t magic;
+    uint32_t key;
+    uint32_t level;
+    uint32_t len;
+    uint64_t seq;
+    uint64_t checksum;
+};
+
+struct worker {
+    pthread_t tid;
+    int id;
+    enum role role;
+    unsigned int seed;
+    /* receiver state observed by the watchdog */
+    _Atomic uint64_t parked_ns;
+    _Atomic int parked_key;
+    _Atomic int parked_level;
+    _Atomic int parked_parity; // parity of seq let through by the filter of the receiver, -1 without filter
+};
+
+static struct {
+    int duration_s;
+    int workers[ROLES];
+    int keys;
+    int levels;
+    int max_size;
+    unsigned int seed;
+    uint64_t wake_margin_ns; // a send must start this later than the park to be considered for the receiver
+    uint64_t stall_ns; // a receiver not woken this long after such a send is a lost wakeup
+    int shared_rounds; // rounds of the shared descriptor check
+    int busy_rounds; // rounds of the busy level awake check
+} cfg = {
+        .duration_s = 30,
+        .workers = {4, 8, 1, 1},
+        .keys = 4,
+        .levels = 4,
+        .max_size = 512,
+        .wake_margin_ns = 1000 * NS_PER_MS,
+        .stall_ns = 10000 * NS_PER_MS,
+        .shared_rounds = 100,
+        .busy_rounds = 100,
+};
+
+static atomic_int stop;
+static atomic_ulong ops[ROLES];
+static atomic_ulong errors[ROLES][256];
+static atomic_ulong violations;
+static atomic_ulong delivered_bytes;
+static atomic_ulong seq_counter;
+/* start time of the last completed send for every key and level */
+static _Atomic uint64_t last_send_ns[MAX_KEYS + 1][STRESS_LEVELS][2]; // by parity of seq
+/* last-value mode of the levels of a key as set by the awakers, conflate_gen is odd while it changes */
+static atomic_ulong conflated[MAX_KEYS + 1];
+static atomic_ulong conflate_gen[MAX_KEYS + 1];
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+#define VIOLATION(fmt, ...) do { \
+        atomic_fetch_add(&violations, 1); \
+        fprintf(stderr, "VIOLATION: " fmt "\n", ##__VA_ARGS__); \
+    } while (0)
+
+static uint64_t checksum(const struct stress_msg_hdr *hdr, const unsigned char *body, size_t len) {
+    uint64_t hash = 1469598103934665603ULL;
+    size_t i;
+    hash = (hash ^ hdr->key) * 1099511628211ULL;
+    hash = (hash ^ hdr->level) * 1099511628211ULL;
+    hash = (hash ^ hdr->len) * 1099511628211ULL;
+    hash = (hash ^ hdr->seq) * 1099511628211ULL;
+    for (i = 0; i < len; i++) hash = (hash ^ body[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static void count_error(enum role role, int err) {
+    atomic_fetch_add(&errors[role][err & 0xff], 1);
+}
+
+static int random_key(struct worker *w) {
+    return 1 + (int) (rand_r(&w->seed) % cfg.keys);
+}
+
+static int random_level(struct worker *w) {
+    return (int) (rand_r(&w->seed) % cfg.levels);
+}
+
+static void do_send(struct worker *w, unsigned char *buffer) {
+    struct stress_msg_hdr *hdr = (struct stress_msg_hdr *) buffer;
+    int key = random_key(w), level = random_level(w), td;
+    size_t len = sizeof(*hdr) + rand_r(&w->seed) % (cfg.max_size - sizeof(*hdr) + 1), i;
+    uint64_t start;
+
+    td = tag_get(key, IPC_CREAT, 0);
+    if (td < 0) {
+        count_error(SENDER, errno);
+        return;
+    }
+    hdr->magic = STRESS_MAGIC;
+    hdr->key = key;
+    hdr->level = level;
+    hdr->len = (uint32_t) len;
+    hdr->seq = atomic_fetch_add(&seq_counter, 1);
+    for (i = sizeof(*hdr); i < len; i++) buffer[i] = (unsigned char) (hdr->seq + i * 31);
+    hdr->checksum = checksum(hdr, buffer + sizeof(*hdr), len - sizeof(*hdr));
+
+    start = now_ns();
+    if (rand_r(&w->seed) % 8 == 0) {
+        /* sometimes publish on the shared-memory ring of the level */
+        struct tag_ring ring = {0};
+        if (tag_ring_open(&ring, td, level, RING_SLOTS, cfg.max_size) < 0 || tag_ring_send(&ring, buffer, len) < 0) {
+            if (errno != ENOENT && errno != EIDRM) VIOLATION("tag_ring_send(%d, %d) unexpected error %s", key, level, strerror(errno));
+            count_error(SENDER, errno);
+        } else {
+            atomic_fetch_add(&ops[SENDER], 1);
+        }
+        if (ring.hdr != NULL) tag_ring_close(&ring);
+        close(td);
+        return;
+    }
+    if (tag_send(td, level, (char *) buffer, len) < 0) {
+        if (errno != ENOENT && errno != EIDRM) VIOLATION("tag_send(%d, %d) unexpected error %s", key, level, strerror(errno));
+        count_error(SENDER, errno);
+        close(td);
+        return;
+    }
+    close(td);
+    if (last_send_ns[key][level][hdr->seq & 1] < start) last_send_ns[key][level][hdr->seq & 1] = start;
+    atomic_fetch_add(&ops[SENDER], 1);
+}
+
+/* checks a message of res bytes received on (key, level) by a receiver filtered on parity (-1 without filter) */
+static int check_received(int key, int level, const unsigned char *buffer, int res, int parity,
+                          unsigned long conflate_seen, const struct tag_msg_info *info) {
+    const struct stress_msg_hdr *hdr = (const struct stress_msg_hdr *) buffer;
+
+    if (res < (int) sizeof(*hdr) || hdr->magic != STRESS_MAGIC || hdr->len != (uint32_t) res) {
+        VIOLATION("tag_receive(%d, %d) malformed message of %d bytes", key, level, res);
+        return -1;
+    }
+    if (hdr->level != (uint32_t) level) {
+        VIOLATION("tag_receive(%d, %d) got message for level %u", key, level, hdr->level);
+        return -1;
+    }
+    if (hdr->checksum != checksum(hdr, buffer + sizeof(*hdr), res - sizeof(*hdr))) {
+        VIOLATION("tag_receive(%d, %d) corrupted message seq=%lu", key, level, (unsigned long) hdr->seq);
+        return -1;
+    }
+    /* conflating levels ignore the filters: check only if the level stayed in normal mode */
+    if (parity >= 0 && (hdr->seq & 1) != (uint64_t) parity && conflate_seen % 2 == 0 &&
+        atomic_load(&conflate_gen[key]) == conflate_seen && !(atomic_load(&conflated[key]) & (1UL << level))) {
+        VIOLATION("tag_receive(%d, %d) filtered on parity %d got seq=%lu", key, level, parity, (unsigned long) hdr->seq);
+        return -1;
+    }
+    if (info != NULL && (info->seq == 0 || info->level != level || info->size != (unsigned int) res ||
+                         info->tgid != getpid() || info->send_ns > now_ns())) {
+        VIOLATION("tag_receive_info(%d, %d) bad metadata seq=%llu level=%d size=%u tgid=%d", key, level, info->seq,
+                  info->level, info->size, info->tgid);
+        return -1;
+    }
+    return 0;
+}
+
+static void do_receive(struct worker *w, unsigned char *buffer) {
+    int key = random_key(w), level = random_level(w), td, td2 = -1, res, level_flags = 0, timed = 0, expired = 0;
+    int key2 = random_key(w), direct = 0, parity = -1, with_info = 0, batch = 0, i;
+    unsigned long conflate_seen = 0;
+    struct tag_msg_info info;
+    struct tag_delivery_stats delivery;
+    struct tag_filter filter = {.offset = offsetof(struct stress_msg_hdr, seq), .len = 1, .mask = {1}};
+    struct tag_origin origin = {-1, -1, -1};
+    struct tag_sub subs[2];
+    struct tag_mmsg msgs[BATCH_SLOTS];
+    /* sometimes use a short buffer to exercise ENOBUFS */
+    size_t size = rand_r(&w->seed) % 16 == 0 ? sizeof(struct stress_msg_hdr) : (size_t) cfg.max_size;
+
+    td = tag_get(key, IPC_CREAT, 0);
+    if (td < 0) {
+        count_error(RECEIVER, errno);
+        return;
+    }
+    if (rand_r(&w->seed) % 4 == 0) {
+        /* sometimes let the senders copy straight into the buffer, the registration is dropped by close */
+        struct tag_direct req = {.level = level, .buffer = (char *) buffer, .size = size};
+        direct = tag_ctl_arg(td, TAG_DIRECT, (unsigned long) &req) == 0;
+        if (!direct && errno != ENOENT && errno != EIDRM) {
+            VIOLATION("tag_ctl(%d, TAG_DIRECT) unexpected error %s", key, strerror(errno));
+        }
+    } else if (rand_r(&w->seed) % 4 == 0) {
+        /* sometimes take only the messages with one parity of seq, the other ones must not even wake us up */
+        filter.level = level;
+        filter.value[0] = (unsigned char) (rand_r(&w->seed) % 2);
+        conflate_seen = atomic_load(&conflate_gen[key]);
+        if (tag_ctl_arg(td, TAG_FILTER, (unsigned long) &filter) == 0) {
+            parity = filter.value[0];
+        } else if (errno != ENOENT && errno != EIDRM) {
+            VIOLATION("tag_ctl(%d, TAG_FILTER) unexpected error %s", key, strerror(errno));
+        }
+    }
+    if (rand_r(&w->seed) % 8 == 0) {
+        /* sometimes give up after a few milliseconds */
+        timed = tag_ctl_arg(td, TAG_TIMEOUT, 1 + rand_r(&w->seed) % 5000) == 0;
+    }
+    if (rand_r(&w->seed) % 8 == 0) {
+        /* sometimes follow the shared-memory ring of the level: tag_send doesn't wake it, so it is not parked */
+        struct tag_ring ring = {0};
+        res = tag_ring_open(&ring, td, level, RING_SLOTS, cfg.max_size);
+        if (res == 0) res = tag_ring_receive(&ring, buffer, size);
+        if (ring.hdr != NULL) tag_ring_close(&ring);
+        /* rings don't use the filters */
+        parity = -1;
+    } else {
+        w->parked_key = key;
+        w->parked_level = level;
+        w->parked_parity = parity;
+        w->parked_ns = now_ns();
+        if (rand_r(&w->seed) % 8 == 0 && (td2 = tag_get(key2, IPC_CREAT, 0)) >= 0) {
+            /* sometimes wait on a set of this level and a random level of another key */
+            subs[0].tag = td;
+            subs[0].levels = 1U << level;
+            subs[1].tag = td2;
+            subs[1].levels = 1U << random_level(w);
+            res = tag_receive_set(subs, 2, (char *) buffer, size, &origin);
+            /* sets don't use the filters either */
+            parity = -1;
+            if (origin.index == 1) {
+                key = key2;
+                level = origin.level;
+            } else if (origin.index == 0 && origin.level != level && origin.level != -1) {
+                VIOLATION("tag_receive_set(%d, %d) returned level %d", key, level, origin.level);
+            }
+        } else if (rand_r(&w->seed) % 8 == 0) {
+            /* sometimes take the messages of the level for a short window, combined sends come in whole batches */
+            for (i = 0; i < BATCH_SLOTS; i++) {
+                msgs[i].buffer = (char *) buffer + (size_t) i * cfg.max_size;
+                msgs[i].size = size;
+            }
+            res = tag_receive_batch(td, 1U << level, msgs, BATCH_SLOTS, rand_r(&w->seed) % 1000, 0);
+            batch = res >= 0;
+            /* batches don't use the filters either */
+            parity = -1;
+        } else {
+            /* sometimes busy poll before sleeping, sometimes read the current value of a conflating level */
+            if (rand_r(&w->seed) % 4 == 0) level_flags |= TAG_POLL;
+            if (rand_r(&w->seed) % 8 == 0) level_flags |= TAG_LATEST;
+            /* sometimes ask for the metadata of the message too */
+            if (rand_r(&w->seed) % 4 == 0) {
+                res = tag_receive_info(td, level | level_flags, (char *) buffer, size, &info);
+                with_info = res >= 0;
+            } else {
+                res = tag_receive(td, level | level_flags, (char *) buffer, size);
+            }
+        }
+        w->parked_ns = 0;
+        if (res < 0 && errno == ETIMEDOUT) {
+            /* without a timeout only a sender that detached at the deadline explains it */
+            expired = tag_ctl_arg(origin.index == 1 ? td2 : td, TAG_DELIVERY_STATS, (unsigned long) &delivery) == 0 &&
+                      delivery.expired > 0;
+            errno = ETIMEDOUT;
+        }
+    }
+    if (td2 >= 0) close(td2);
+    close(td);
+
+    if (res < 0) {
+        if (errno != ENOENT && errno != EIDRM && errno != ECANCELED && !(errno == ENOBUFS && size < (size_t) cfg.max_size) &&
+            !(errno == ETIMEDOUT && (timed || expired))) {
+            VIOLATION("tag_receive(%d, %d) unexpected error %s", key, level, strerror(errno));
+        }
+        count_error(RECEIVER, errno);
+        return;
+    }
+
+    if (batch) {
+        for (i = 0; i < res; i++) {
+            if (msgs[i].level != level) {
+                VIOLATION("tag_receive_batch(%d, %d) returned level %d", key, level, msgs[i].level);
+            } else if (msgs[i].len < 0) {
+                if (msgs[i].len != -ENOBUFS || size == (size_t) cfg.max_size) {
+                    VIOLATION("tag_receive_batch(%d, %d) slot %d unexpected error %s", key, level, i,
+                              strerror(-msgs[i].len));
+                }
+                count_error(RECEIVER, -msgs[i].len);
+            } else if (check_received(key, level, (unsigned char *) msgs[i].buffer, msgs[i].len, -1, 0, NULL) == 0) {
+                atomic_fetch_add(&delivered_bytes, msgs[i].len);
+                atomic_fetch_add(&ops[RECEIVER], 1);
+            }
+        }
+        return;
+    }
+    if (check_received(key, level, buffer, res, parity, conflate_seen, with_info ? &info : NULL) < 0) return;
+    atomic_fetch_add(&delivered_bytes, res);
+    atomic_fetch_add(&ops[RECEIVER], 1);
+}
+
+static void do_awake(struct worker *w) {
+    int key = random_key(w), td = tag_get(key, IPC_CREAT, 0), res;
+    unsigned long mask;
+    if (td < 0) {
+        count_error(AWAKER, errno);
+        return;
+    }
+    /* half of the times only a random subset of the levels */
+    mask = ((unsigned long) rand_r(&w->seed) << 1 | 1) & ((1UL << cfg.levels) - 1);
+    if (rand_r(&w->seed) % 8 == 0) {
+        /* sometimes switch a level to last-value mode, or all the levels back to normal */
+        mask = rand_r(&w->seed) % 2 ? 1UL << random_level(w) : 0;
+        atomic_fetch_add(&conflate_gen[key], 1);
+        res = tag_ctl_arg(td, TAG_CONFLATE, mask);
+        if (res == 0) atomic_store(&conflated[key], mask);
+        atomic_fetch_add(&conflate_gen[key], 1);
+    } else if (rand_r(&w->seed) % 8 == 0) {
+        /* sometimes bound the wait of the senders for slow readers, or wait for all of them again */
+        res = tag_ctl_arg(td, TAG_DEADLINE, rand_r(&w->seed) % 2 ? 1 + rand_r(&w->seed) % 1000 : 0);
+    } else {
+        res = rand_r(&w->seed) % 2 ? tag_ctl(td, AWAKE_ALL) : tag_ctl_arg(td, AWAKE_LEVELS, mask);
+    }
+    if (res < 0) {
+        if (errno != ENOENT && errno != EIDRM) VIOLATION("tag_ctl(%d, AWAKE) unexpected error %s", key, strerror(errno));
+        count_error(AWAKER, errno);
+    }
+    close(td);
+    if (res < 0) return;
+    atomic_fetch_add(&ops[AWAKER], 1);
+    usleep(rand_r(&w->seed) % 2000);
+}
+
+/* open the same key twice with tag_get_bulk, both descriptors must refer to the same tag */
+static int bulk_get(int key) {
+    struct tag_get_req reqs[2] = {{key, IPC_CREAT, 0, 0}, {key, IPC_CREAT, 0, 0}};
+    int res = tag_get_bulk(reqs, 2);
+    if (res < 0) return -1;
+    if (res != (reqs[0].ret >= 0) + (reqs[1].ret >= 0)) {
+        VIOLATION("tag_get_bulk(%d) returned %d with results %d %d", key, res, reqs[0].ret, reqs[1].ret);
+    }
+    if (reqs[1].ret >= 0) close(reqs[1].ret);
+    if (reqs[0].ret < 0) errno = -reqs[0].ret;
+    return reqs[0].ret < 0 ? -1 : reqs[0].ret;
+}
+
+static void do_remove(struct worker *w) {
+    int key = random_key(w), td = rand_r(&w->seed) % 2 ? tag_get(key, IPC_CREAT, 0) : bulk_get(key);
+    int command = rand_r(&w->seed) % 2 ? IPC_RMID : IPC_RMID | IPC_NOWAIT;
+    /* a third of the times drain the waiting readers instead of failing */
+    if (rand_r(&w->seed) % 3 == 0) command |= TAG_DRAIN;
+    if (td < 0) {
+        count_error(REMOVER, errno);
+        return;
+    }
+    if (tag_ctl(td, command) < 0) {
+        if (errno != ENOENT && errno != EBUSY) {
+            VIOLATION("tag_ctl(%d, IPC_RMID) unexpected error %s", key, strerror(errno));
+        }
+        count_error(REMOVER, errno);
+    } else {
+        atomic_fetch_add(&ops[REMOVER], 1);
+    }
+    close(td);
+    usleep(rand_r(&w->seed) % 5000);
+}
+
+static void *worker_main(void *data) {
+    struct worker *w = data;
+    /* room for the slots of tag_receive_batch */
+    unsigned char *buffer = calloc(BATCH_SLOTS, cfg.max_size);
+    if (buffer == NULL) return NULL;
+
+    while (!atomic_load(&stop)) {
+        switch (w->role) {
+            case SENDER:
+                do_send(w, buffer);
+                break;
+            case RECEIVER:
+                do_receive(w, buffer);
+                break;
+            case AWAKER:
+                do_awake(w);
+                break;
+            case REMOVER:
+                do_remove(w);
+                break;
+            default:
+                break;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/* a receiver parked before a send on its tag-level started must have been woken by that send */
+static void check_lost_wakeups(struct worker *workers, int nworkers, uint64_t now) {
+    uint64_t parked, sent;
+    int i, key, level, parity;
+    for (i = 0; i < nworkers; i++) {
+        if (workers[i].role != RECEIVER) continue;
+        parked = workers[i].parked_ns;
+        key = workers[i].parked_key;
+        level = workers[i].parked_level;
+        parity = workers[i].parked_parity;
+        if (parked == 0 || key < 0) continue;
+        /* a filtered receiver must have been woken by a matching send */
+        sent = last_send_ns[key][level][parity == 1];
+        if (parity < 0 && last_send_ns[key][level][1] > sent) sent = last_send_ns[key][level][1];
+        if (sent > parked + cfg.wake_margin_ns && now > sent + cfg.stall_ns && workers[i].parked_ns == parked) {
+            VIOLATION("lost wakeup: receiver %d parked on (%d, %d) since %.3fs, send completed at %.3fs",
+                      workers[i].id, key, level, (double) (now - parked) / 1e9, (double) (now - sent) / 1e9);
+            workers[i].parked_ns = 0; // report once
+        }
+    }
+}
+
+/* at the end of the run AWAKE_ALL must release every parked receiver */
+static void drain_receivers(struct worker *workers, int nworkers) {
+    uint64_t deadline;
+    int i, key, td;
+    for (i = 0; i < nworkers; i++) {
+        if (workers[i].role != RECEIVER) {
+            pthread_join(workers[i].tid, NULL);
+            continue;
+        }
+        deadline = now_ns() + cfg.stall_ns;
+        while (pthread_tryjoin_np(workers[i].tid, NULL) != 0) {
+            if (now_ns() > deadline) {
+                VIOLATION("stuck reader: receiver %d not released by AWAKE_ALL", workers[i].id);
+                pthread_cancel(workers[i].tid);
+                pthread_join(workers[i].tid, NULL);
+                break;
+            }
+            for (key = 1; key <= cfg.keys; key++) {
+                td = tag_get(key, IPC_CREAT, 0);
+                if (td < 0) continue;
+                tag_ctl(td, AWAKE_ALL);
+                close(td);
+            }
+            usleep(1000);
+        }
+    }
+}
+
+static void remove_all(void) {
+    int key, td;
+    for (key = 1; key <= cfg.keys; key++) {
+        td = tag_get(key, IPC_CREAT, 0);
+        if (td < 0) continue;
+        if (tag_ctl(td, IPC_RMID) < 0) VIOLATION("final removal of key %d failed: %s", key, strerror(errno));
+        close(td);
+    }
+}
+
+/* two receivers on one descriptor and SHARED_SENDERS senders on the key after the ones of the random run */
+static struct {
+    int td;
+    int key;
+    pthread_barrier_t go; // the senders start and end a round together with the coordinator
+    pthread_barrier_t end; // the receivers end a round together with the coordinator
+    _Atomic int armed[2]; // last round a receiver is about to wait for, from 1
+} shared;
+
+static void *shared_sender(void *data) {
+    unsigned char buffer[sizeof(struct stress_msg_hdr) + 32];
+    struct stress_msg_hdr *hdr = (struct stress_msg_hdr *) buffer;
+    int id = (int) (intptr_t) data, round;
+    size_t i;
+
+    for (round = 0; round < cfg.shared_rounds; round++) {
+        pthread_barrier_wait(&shared.go);
+        hdr->magic = STRESS_MAGIC;
+        hdr->key = shared.key;
+        hdr->level = 0;
+        hdr->len = sizeof(buffer);
+        hdr->seq = (uint64_t) round * SHARED_SENDERS + id;
+        for (i = sizeof(*hdr); i < sizeof(buffer); i++) buffer[i] = (unsigned char) (hdr->seq + i * 31);
+        hdr->checksum = checksum(hdr, buffer + sizeof(*hdr), sizeof(buffer) - sizeof(*hdr));
+        if (tag_send(shared.td, 0, (char *) buffer, sizeof(buffer)) < 0) {
+            VIOLATION("shared descriptor: tag_send(%d, 0) failed: %s", shared.key, strerror(errno));
+        }
+        pthread_barrier_wait(&shared.go);
+    }
+    return NULL;
+}
+
+static void *shared_receiver(void *data) {
+    unsigned char buffers[SHARED_SENDERS][sizeof(struct stress_msg_hdr) + 32];
+    struct tag_mmsg msgs[SHARED_SENDERS];
+    struct stress_msg_hdr *hdr;
+    int id = (int) (intptr_t) data, round, res, i, seen;
+
+    for (round = 0; round < cfg.shared_rounds; round++) {
+        for (i = 0; i < SHARED_SENDERS; i++) {
+            msgs[i].buffer = (char *) buffers[i];
+            msgs[i].size = sizeof(buffers[i]);
+        }
+        shared.armed[id] = round + 1;
+        /* the messages of the round, whatever batches they were combined in */
+        res = tag_receive_batch(shared.td, 1U, msgs, SHARED_SENDERS, MAX_BATCH_WINDOW_US, 0);
+        if (res < 0) {
+            VIOLATION("shared descriptor: receiver %d round %d: tag_receive_batch failed: %s", id, round,
+                      strerror(errno));
+            res = 0;
+        }
+        seen = 0;
+        for (i = 0; i < res; i++) {
+            hdr = (struct stress_msg_hdr *) buffers[i];
+            if (msgs[i].len != (int) sizeof(buffers[i]) || hdr->magic != STRESS_MAGIC || msgs[i].level != 0 ||
+                hdr->checksum != checksum(hdr, buffers[i] + sizeof(*hdr), sizeof(buffers[i]) - sizeof(*hdr)) ||
+                hdr->seq / SHARED_SENDERS != (uint64_t) round || (seen & (1 << hdr->seq % SHARED_SENDERS))) {
+                VIOLATION("shared descriptor: receiver %d round %d: bad or repeated message, len=%d seq=%lu", id,
+                          round, msgs[i].len, (unsigned long) hdr->seq);
+                continue;
+            }
+            seen |= 1 << hdr->seq % SHARED_SENDERS;
+        }
+        for (i = 0; i < SHARED_SENDERS; i++) {
+            if (!(seen & (1 << i))) {
+                VIOLATION("shared descriptor: receiver %d missed seq=%lu of round %d", id,
+                          (unsigned long) round * SHARED_SENDERS + i, round);
+            }
+        }
+        pthread_barrier_wait(&shared.end);
+    }
+    return NULL;
+}
+
+/*
+ * Every round starts once both receivers have been waiting for SHARED_MARGIN_NS, then all the senders send at once:
+ * the ones finding the level busy are combined, and each receiver must get every message of the round.
+ */
+static void check_shared_descriptor(void) {
+    pthread_t senders[SHARED_SENDERS], receivers[2];
+    int round, i;
+
+    shared.key = cfg.keys + 1;
+    shared.td = tag_get(shared.key, IPC_CREAT, 0);
+    if (shared.td < 0) {
+        VIOLATION("shared descriptor: tag_get(%d) failed: %s", shared.key, strerror(errno));
+        return;
+    }
+    /* a receiver must never wait forever, even for a lost round */
+    tag_ctl_arg(shared.td, TAG_TIMEOUT, 5000000);
+    pthread_barrier_init(&shared.go, NULL, SHARED_SENDERS + 1);
+    pthread_barrier_init(&shared.end, NULL, 3);
+    for (i = 0; i < SHARED_SENDERS; i++) pthread_create(&senders[i], NULL, shared_sender, (void *) (intptr_t) i);
+    for (i = 0; i < 2; i++) pthread_create(&receivers[i], NULL, shared_receiver, (void *) (intptr_t) i);
+
+    for (round = 0; round < cfg.shared_rounds; round++) {
+        while (shared.armed[0] != round + 1 || shared.armed[1] != round + 1) usleep(100);
+        usleep(SHARED_MARGIN_NS / 1000);
+        pthread_barrier_wait(&shared.go);
+        pthread_barrier_wait(&shared.go);
+        pthread_barrier_wait(&shared.end);
+    }
+
+    for (i = 0; i < SHARED_SENDERS; i++) pthread_join(senders[i], NULL);
+    for (i = 0; i < 2; i++) pthread_join(receivers[i], NULL);
+    pthread_barrier_destroy(&shared.go);
+    pthread_barrier_destroy(&shared.end);
+    if (tag_ctl(shared.td, IPC_RMID) < 0) VIOLATION("removal of key %d failed: %s", shared.key, strerror(errno));
+    close(shared.td);
+}
+
+/* a batch receiver, a sender and the coordinator awaking the level on the key after the one of the shared check */
+static struct {
+    int td;
+    int key;
+    pthread_barrier_t go; // the sender starts and ends a round together with the coordinator
+    pthread_barrier_t end; // the receiver ends a round together with the coordinator
+    _Atomic int armed; // last round the receiver is about to wait for, from 1
+    _Atomic uint64_t returned_ns; // end of the last tag_receive_batch of the receiver
+} busy;
+
+static void *busy_sender(void *data) {
+    unsigned char buffer[sizeof(struct stress_msg_hdr) + 32];
+    struct stress_msg_hdr *hdr = (struct stress_msg_hdr *) buffer;
+    int round;
+    size_t i;
+
+    (void) data;
+    for (round = 0; round < cfg.busy_rounds; round++) {
+        pthread_barrier_wait(&busy.go);
+        hdr->magic = STRESS_MAGIC;
+        hdr->key = busy.key;
+        hdr->level = 0;
+        hdr->len = sizeof(buffer);
+        hdr->seq = (uint64_t) round;
+        for (i = sizeof(*hdr); i < sizeof(buffer); i++) buffer[i] = (unsigned char) (hdr->seq + i * 31);
+        hdr->checksum = checksum(hdr, buffer + sizeof(*hdr), sizeof(buffer) - sizeof(*hdr));
+        if (tag_send(busy.td, 0, (char *) buffer, sizeof(buffer)) < 0) {
+            VIOLATION("busy level: tag_send(%d, 0) failed: %s", busy.key, strerror(errno));
+        }
+        pthread_barrier_wait(&busy.go);
+    }
+    return NULL;
+}
+
+static void *busy_receiver(void *data) {
+    unsigned char buffers[2][sizeof(struct stress_msg_hdr) + 32];
+    struct tag_mmsg msgs[2];
+    struct stress_msg_hdr *hdr = (struct stress_msg_hdr *) buffers[0];
+    int round, res;
+
+    (void) data;
+    for (round = 0; round < cfg.busy_rounds; round++) {
+        msgs[0].buffer = (char *) buffers[0];
+        msgs[0].size = sizeof(buffers[0]);
+        msgs[1].buffer = (char *) buffers[1];
+        msgs[1].size = sizeof(buffers[1]);
+        busy.armed = round + 1;
+        /* the message of the round, if it comes first, then the awake ends the window */
+        res = tag_receive_batch(busy.td, 1U, msgs, 2, MAX_BATCH_WINDOW_US, 0);
+        busy.returned_ns = now_ns();
+        if (res < 0 && errno != ECANCELED) {
+            VIOLATION("busy level: round %d: tag_receive_batch failed: %s", round, strerror(errno));
+        } else if (res > 1 || (res == 1 && (msgs[0].len != (int) sizeof(buffers[0]) || hdr->magic != STRESS_MAGIC ||
+                                            hdr->seq != (uint64_t) round ||
+                                            hdr->checksum != checksum(hdr, buffers[0] + sizeof(*hdr),
+                                                                      sizeof(buffers[0]) - sizeof(*hdr))))) {
+            VIOLATION("busy level: round %d: tag_receive_batch returned %d, len=%d seq=%lu", round, res, msgs[0].len,
+                      (unsigned long) hdr->seq);
+        }
+        pthread_barrier_wait(&busy.end);
+    }
+    return NULL;
+}
+
+/*
+ * Every round the level is awoken right after a send started: the sender holds the level until the receiver leaves
+ * the epoch of the message, and the receiver joins the next epoch before leaving, so the awake must wait for the
+ * sender instead of skipping the level. The receiver must be back long before its coalescing window ends.
+ */
+static void check_busy_awake(void) {
+    pthread_t sender, receiver;
+    uint64_t awoken;
+    unsigned int seed = cfg.seed;
+    int round;
+
+    busy.key = cfg.keys + 2;
+    busy.td = tag_get(busy.key, IPC_CREAT, 0);
+    if (busy.td < 0) {
+        VIOLATION("busy level: tag_get(%d) failed: %s", busy.key, strerror(errno));
+        return;
+    }
+    /* a receiver must never wait forever, even for a lost awake */
+    tag_ctl_arg(busy.td, TAG_TIMEOUT, 5000000);
+    pthread_barrier_init(&busy.go, NULL, 2);
+    pthread_barrier_init(&busy.end, NULL, 2);
+    pthread_create(&sender, NULL, busy_sender, NULL);
+    pthread_create(&receiver, NULL, busy_receiver, NULL);
+
+    for (round = 0; round < cfg.busy_rounds; round++) {
+        while (busy.armed != round + 1) usleep(100);
+        usleep(SHARED_MARGIN_NS / 1000);
+        pthread_barrier_wait(&busy.go);
+        /* sometimes before the sender takes the level, mostly while it holds it */
+        usleep(rand_r(&seed) % 50);
+        if (tag_ctl_arg(busy.td, AWAKE_LEVELS, 1UL) < 0) {
+            VIOLATION("busy level: tag_ctl(%d, AWAKE_LEVELS) failed: %s", busy.key, strerror(errno));
+        }
+        awoken = now_ns();
+        pthread_barrier_wait(&busy.go);
+        pthread_barrier_wait(&busy.end);
+        if (busy.returned_ns > awoken + MAX_BATCH_WINDOW_US * 1000ULL / 2) {
+            VIOLATION("busy level: round %d: receiver released %.3fs after AWAKE_LEVELS", round,
+                      (double) (busy.returned_ns - awoken) / 1e9);
+        }
+    }
+
+    pthread_join(sender, NULL);
+    pthread_join(receiver, NULL);
+    pthread_barrier_destroy(&busy.go);
+    pthread_barrier_destroy(&busy.end);
+    if (tag_ctl(busy.td, IPC_RMID) < 0) VIOLATION("removal of key %d failed: %s", busy.key, strerror(errno));
+    close(busy.td);
+}
+
+/* the commands of tag_get on the key after the one of the busy level check, before the run */
+static void check_tag_get(void) {
+    int key = cfg.keys + 3, td, td2;
+
+    /* left by an interrupted run */
+    td = tag_get(key, TAG_OPEN, 0);
+    if (td >= 0) {
+        tag_ctl(td, IPC_RMID | TAG_DRAIN);
+        close(td);
+    }
+    if (tag_get(key, 0, 0) >= 0 || errno != EINVAL) {
+        VIOLATION("tag_get(%d, 0) did not fail with EINVAL: %s", key, strerror(errno));
+    }
+    if (tag_get(key, TAG_OPEN, 0) >= 0 || errno != ENOENT) {
+        VIOLATION("tag_get(%d, TAG_OPEN) created a tag or did not fail with ENOENT: %s", key, strerror(errno));
+    }
+    td = tag_get(key, IPC_CREAT, 0);
+    if (td < 0) {
+        VIOLATION("tag_get(%d, IPC_CREAT) failed: %s", key, strerror(errno));
+        return;
+    }
+    if (tag_get(key, IPC_CREAT | IPC_EXCL, 0) >= 0 || errno != EEXIST) {
+        VIOLATION("tag_get(%d, IPC_CREAT | IPC_EXCL) on an existing key did not fail with EEXIST", key);
+    }
+    /* both open the tag just created */
+    td2 = tag_get(key, IPC_CREAT, 0);
+    if (td2 < 0) VIOLATION("tag_get(%d, IPC_CREAT) on an existing key failed: %s", key, strerror(errno));
+    else close(td2);
+    td2 = tag_get(key, TAG_OPEN, 0);
+    if (td2 < 0) VIOLATION("tag_get(%d, TAG_OPEN) on an existing key failed: %s", key, strerror(errno));
+    else close(td2);
+    if (tag_ctl(td, IPC_RMID) < 0) VIOLATION("removal of key %d failed: %s", key, strerror(errno));
+    close(td);
+}
+
+static void report(double elapsed) {
+    int role, err;
+    printf("duration_s=%.3f", elapsed);
+    for (role = 0; role < ROLES; role++) {
+        printf(" %s_ops=%lu %s_per_s=%.0f", role_name[role], ops[role], role_name[role], ops[role] / elapsed);
+    }
+    printf(" delivered_bytes_per_s=%.0f violations=%lu\n", delivered_bytes / elapsed, violations);
+    for (role = 0; role < ROLES; role++) {
+        for (err = 1; err < 256; err++) {
+            if (errors[role][err] != 0) printf("  %s %s: %lu\n", role_name[role], strerror(err), errors[role][err]);
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -d SEC    duration (default %d)\n"
+            "  -s N      senders (default %d)\n"
+            "  -r N      receivers (default %d)\n"
+            "  -a N      awakers (default %d)\n"
+            "  -x N      removers (default %d)\n"
+            "  -k N      keys (default %d)\n"
+            "  -l N      levels, max %d (default %d)\n"
+            "  -m BYTES  max message size (default %d)\n"
+            "  -S SEED   random seed (default: time)\n"
+            "  -t MS     lost wakeup threshold (default %lu)\n"
+            "  -b N      rounds of the shared descriptor check after the run, 0 skips it (default %d)\n"
+            "  -w N      rounds of the busy level awake check after the run, 0 skips it (default %d)\n",
+            prog, cfg.duration_s, cfg.workers[SENDER], cfg.workers[RECEIVER], cfg.workers[AWAKER],
+            cfg.workers[REMOVER], cfg.keys, STRESS_LEVELS, cfg.levels, cfg.max_size,
+            (unsigned long) (cfg.stall_ns / NS_PER_MS), cfg.shared_rounds, cfg.busy_rounds);
+}
+
+int main(int argc, char **argv) {
+    struct worker *workers;
+    uint64_t start, end;
+    int opt, role, i, n, nworkers = 0;
+
+    cfg.seed = (unsigned int) time(NULL);
+    while ((opt = getopt(argc, argv, "d:s:r:a:x:k:l:m:S:t:b:w:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                cfg.duration_s = atoi(optarg);
+                break;
+            case 's':
+                cfg.workers[SENDER] = atoi(optarg);
+                break;
+            case 'r':
+                cfg.workers[RECEIVER] = atoi(optarg);
+                break;
+            case 'a':
+                cfg.workers[AWAKER] = atoi(optarg);
+                break;
+            case 'x':
+                cfg.workers[REMOVER] = atoi(optarg);
+                break;
+            case 'k':
+                cfg.keys = atoi(optarg);
+                break;
+            case 'l':
+                cfg.levels = atoi(optarg);
+                break;
+            case 'm':
+                cfg.max_size = atoi(optarg);
+                break;
+            case 'S':
+                cfg.seed = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                cfg.stall_ns = strtoull(optarg, NULL, 10) * NS_PER_MS;
+                break;
+            case 'b':
+                cfg.shared_rounds = atoi(optarg);
+                break;
+            case 'w':
+                cfg.busy_rounds = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+    /* the shared descriptor, busy level and tag_get checks use the three keys after the ones of the run */
+    if (cfg.keys <= 0 || cfg.keys >= MAX_KEYS - 3 || cfg.shared_rounds < 0 || cfg.busy_rounds < 0 ||
+        cfg.levels <= 0 || cfg.levels > STRESS_LEVELS || cfg.max_size < (int) sizeof(struct stress_msg_hdr)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for (role = 0; role < ROLES; role++) nworkers += cfg.workers[role];
+    workers = calloc(nworkers, sizeof(struct worker));
+    if (workers == NULL) return 2;
+    printf("seed=%u\n", cfg.seed);
+    check_tag_get();
+
+    start = now_ns();
+    for (role = 0, n = 0; role < ROLES; role++) {
+        for (i = 0; i < cfg.workers[role]; i++, n++) {
+            workers[n].id = n;
+            workers[n].role = role;
+            workers[n].seed = cfg.seed + n;
+            workers[n].parked_key = -1;
+            pthread_create(&workers[n].tid, NULL, worker_main, &workers[n]);
+        }
+    }
+
+    end = start + (uint64_t) cfg.duration_s * 1000000000ULL;
+    while (now_ns() < end) {
+        usleep(100000);
+        check_lost_wakeups(workers, nworkers, now_ns());
+    }
+    atomic_store(&stop, 1);
+    end = now_ns();
+
+    drain_receivers(workers, nworkers);
+    if (cfg.shared_rounds > 0) check_shared_descriptor();
+    if (cfg.busy_rounds > 0) check_busy_awake();
+    remove_all();
+    report((double) (end - start) / 1e9);
+
+    free(workers);
+    return violations == 0 ? 0 : 1;
+}
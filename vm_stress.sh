@@ -0,0 +1,116 @@
+#!/bin/bash
+#
+# Boots a kernel in a local VM (virtme-ng), builds and loads the modules and runs the randomized stress suite
+# (user/tag_stress.c). The run fails if tag_stress finds a violation, if standing readers are left on the
+# tag device, if the modules cannot be unloaded or if the kernel log reports KASAN/kmemleak/lockdep/BUG splats.
+# Use a kernel built with KASAN (and optionally KMEMLEAK, PROVE_LOCKING) to catch use-after-free and leaks.
+#
+# usage: ./vm_stress.sh [-k kernel] [-c cpus] [-m memory] [-o results] [-- tag_stress options]
+#   -k kernel   kernel source/build tree or image to boot (default: the running kernel)
+#   -c cpus     virtual cpus (default 4)
+#   -m memory   VM memory (default 2G)
+#   -o results  file where the throughput summary of every run is appended (default stress_results.log)
+#
+# Example: ./vm_stress.sh -k ~/linux-kasan -c 8 -- -d 300 -s 8 -r 32 -a 2 -x 2
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+KERNEL=""
+CPUS=4
+MEMORY=2G
+RESULTS="$ROOT/stress_results.log"
+
+guest() {
+    local kdir nr_get nr_snd nr_rcv nr_ctl nr_blk status=0 out
+    cd "$ROOT" || exit 1
+    kdir="/lib/modules/$(uname -r)/build"
+    [ -n "$KERNEL" ] && [ -d "$KERNEL" ] && kdir="$KERNEL"
+
+    dmesg -C
+    if [ -w /sys/kernel/debug/kmemleak ]; then echo clear > /sys/kernel/debug/kmemleak; fi
+
+    make -C tag_service KDIR="$kdir" > /dev/null || exit 1
+    insmod tag_service/systbl_hack/systbl_hack.ko || exit 1
+    insmod tag_service/tag_service.ko || exit 1
+    mknod /dev/mydev c "$(cat /sys/module/tag_service/parameters/major_number)" 0 2> /dev/null
+
+    nr_get=$(cat /sys/module/tag_service/parameters/tag_get_nr)
+    nr_snd=$(cat /sys/module/tag_service/parameters/tag_send_nr)
+    nr_rcv=$(cat /sys/module/tag_service/parameters/tag_receive_nr)
+    nr_ctl=$(cat /sys/module/tag_service/parameters/tag_ctl_nr)
+    nr_blk=$(cat /sys/module/tag_service/parameters/tag_get_bulk_nr)
+    nr_set=$(cat /sys/module/tag_service/parameters/tag_receive_set_nr)
+    nr_info=$(cat /sys/module/tag_service/parameters/tag_receive_info_nr)
+    nr_batch=$(cat /sys/module/tag_service/parameters/tag_receive_batch_nr)
+    gcc -O2 -pthread -DGET_NR="$nr_get" -DSND_NR="$nr_snd" -DRCV_NR="$nr_rcv" -DCTL_NR="$nr_ctl" -DBLK_NR="$nr_blk" \
+        -DSET_NR="$nr_set" -DINFO_NR="$nr_info" -DBATCH_NR="$nr_batch" \
+        user/tag_stress.c -o /tmp/tag_stress || exit 1
+
+    out=$(/tmp/tag_stress "$@")
+    [ $? -ne 0 ] && status=1
+    echo "$out"
+    echo "$(date -Is) kernel=$(uname -r) cpus=$(nproc) args=\"$*\" $(echo "$out" | grep '^duration_s=')" \
+        >> "$RESULTS"
+
+    # the first line of the device holds the reclaim counters, only the per-level lines report standing readers
+    if grep -q '^key=' /dev/mydev; then
+        echo "FAIL: standing readers left on the tag device"
+        cat /dev/mydev
+        status=1
+    fi
+
+    rmmod tag_service || status=1
+    rmmod systbl_hack || status=1
+
+    if [ -w /sys/kernel/debug/kmemleak ]; then
+        echo scan > /sys/kernel/debug/kmemleak
+        if grep -q . /sys/kernel/debug/kmemleak; then
+            echo "FAIL: kmemleak reports leaks"
+            cat /sys/kernel/debug/kmemleak
+            status=1
+        fi
+    fi
+    if dmesg | grep -E "BUG:|KASAN|WARNING:|general protection|possible circular locking|kmemleak"; then
+        echo "FAIL: kernel splat"
+        status=1
+    fi
+
+    [ $status -eq 0 ] && echo "stress PASSED" || echo "stress FAILED"
+    exit $status
+}
+
+if [ "$1" = "--guest" ]; then
+    shift
+    KERNEL="$1"
+    RESULTS="$2"
+    shift 2
+    guest "$@"
+fi
+
+while getopts "k:c:m:o:h" opt; do
+    case $opt in
+    k) KERNEL="$(realpath "$OPTARG")" ;;
+    c) CPUS="$OPTARG" ;;
+    m) MEMORY="$OPTARG" ;;
+    o) RESULTS="$(realpath "$OPTARG")" ;;
+    *)
+        sed -n '8,15p' "$0"
+        exit 2
+        ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+# shellcheck disable=SC2145
+CMD="$ROOT/vm_stress.sh --guest '$KERNEL' '$RESULTS' $@"
+if command -v vng > /dev/null; then
+    exec vng --run ${KERNEL:+"$KERNEL"} --cpus "$CPUS" --memory "$MEMORY" --rwdir "$ROOT" --user root \
+        --exec "$CMD"
+elif command -v virtme-run > /dev/null; then
+    if [ -n "$KERNEL" ]; then
+        exec virtme-run --kdir "$KERNEL" --cpus "$CPUS" --memory "$MEMORY" --rwdir "$ROOT" --script-sh "$CMD"
+    fi
+    exec virtme-run --installed-kernel --cpus "$CPUS" --memory "$MEMORY" --rwdir "$ROOT" --script-sh "$CMD"
+fi
+
+echo "virtme-ng (vng) or virtme-run is required to boot the test VM"
+exit 2